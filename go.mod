@@ -41,8 +41,8 @@ require (
 )
 
 require (
-	github.com/oschwald/maxminddb-golang v1.13.0 // indirect
+	github.com/oschwald/maxminddb-golang v1.13.0
 	github.com/robfig/cron/v3 v3.0.1
 	golang.org/x/exp v0.0.0-20231108232855-2478ac86f678
-	golang.org/x/sys v0.26.0 // indirect
+	golang.org/x/sys v0.26.0
 )
@@ -3,6 +3,7 @@ package config
 import (
 	"fmt"
 	"log"
+	"math"
 	"os"
 
 	"github.com/danger-dream/ebpf-firewall/internal/utils"
@@ -23,6 +24,113 @@ type RateLimitConfig struct {
 	RateLimitInterval int `mapstructure:"interval"`
 }
 
+const (
+	// one perf event per packet, every packet is processed in user space
+	ExportModeEvent = "event"
+	// per-CPU flow counters are kept in the kernel and polled by user space
+	ExportModeAggregate = "aggregate"
+
+	// use the ring buffer when the kernel supports it, perf event array otherwise
+	TransportAuto = "auto"
+	// BPF_MAP_TYPE_RINGBUF, requires kernel 5.8+
+	TransportRingBuf = "ringbuf"
+	// BPF_MAP_TYPE_PERF_EVENT_ARRAY, works on older kernels
+	TransportPerf = "perf"
+
+	// one reader goroutine drains all CPUs and feeds the worker pool
+	ReaderModeShared = "shared"
+	// one ring buffer shard per CPU, each drained and processed by its own
+	// locked thread, requires the ringbuf transport
+	ReaderModePerCPU = "per-cpu"
+
+	// try the offload, driver and generic attach modes in that order
+	AttachModeAuto    = "auto"
+	AttachModeOffload = "offload"
+	AttachModeDriver  = "driver"
+	AttachModeGeneric = "generic"
+	// interfaces sharing one program, see MAX_XSK_IFACES in xdp.c
+	MaxInterfaces = 16
+
+	// upper bound of the sample rate, see MAX_SAMPLE_RATE in xdp.c
+	MaxSampleRate = 65536
+
+	// default blocklist map sizes, the maps are not preallocated so unused
+	// entries cost no kernel memory
+	DefaultIPv4MapSize = 2 << 20
+	DefaultIPv6MapSize = 1 << 20
+	DefaultCIDRMapSize = 1 << 20
+	DefaultMACMapSize  = 1 << 16
+	// threat intel tries hold the aggregated feed indicators
+	DefaultIntelMapSize = 1 << 20
+	// a large country collapses to some ten thousand prefixes
+	DefaultGeoMapSize = 1 << 18
+	// tuple tries hold one entry per distinct source prefix and protocol
+	DefaultTupleMapSize = 1 << 16
+	// port sets are preallocated, every set takes 8 KiB of kernel memory
+	DefaultPortSets = 256
+
+	// about 100 bytes per cached address
+	DefaultGeoIPCacheSize = 1 << 16
+)
+
+type EBPFConfig struct {
+	// how packet statistics leave the kernel: event or aggregate
+	ExportMode string `mapstructure:"export-mode"`
+	// interval to poll the in-kernel flow counters (in milliseconds), only used in aggregate mode
+	PollInterval int `mapstructure:"poll-interval"`
+	// event transport used in event mode: auto, ringbuf or perf
+	Transport string `mapstructure:"transport"`
+	// size of the shared ring buffer (in bytes), must be a power of two multiple of the page size
+	RingBufSize int `mapstructure:"ringbuf-size"`
+	// size of each per-CPU perf buffer (in pages)
+	PerfBufferPages int `mapstructure:"perf-buffer-pages"`
+	// number of pending events before user space is woken up, 1 wakes up on every event
+	WakeupBatch int `mapstructure:"wakeup-batch"`
+	// how events are read in event mode: shared or per-cpu
+	ReaderMode string `mapstructure:"reader-mode"`
+	// pin each per-cpu reader thread to the CPU of its shard
+	CPUAffinity bool `mapstructure:"cpu-affinity"`
+	// export 1 in N passed packets in event mode, matched packets are always exported, 1 exports all
+	SampleRate int `mapstructure:"sample-rate"`
+	// what happens to events while the workers fall behind: block, drop-newest, drop-oldest or sample.
+	// block stalls the reader until the kernel buffers overflow, the others shed load in user space
+	OverloadPolicy string `mapstructure:"overload-policy"`
+	// maximum number of entries of each blocklist map
+	MapSize MapSizeConfig `mapstructure:"map-size"`
+	// bpffs directory for the blocklist maps and the XDP links, a restart reuses them
+	// and the program stays attached while the daemon is down. empty disables pinning
+	PinPath string `mapstructure:"pin-path"`
+	// redirect passed packets of threat intel sources to the AF_XDP socket an analyzer
+	// bound to their receive queue in xsks_map under the pin path, packets of queues
+	// without a socket pass as usual
+	XSKRedirect bool `mapstructure:"xsk-redirect"`
+}
+
+// InterfaceConfig is one interface the XDP program is attached to
+type InterfaceConfig struct {
+	Name string `mapstructure:"name"`
+	// attach mode: auto, offload, driver or generic
+	Mode string `mapstructure:"mode"`
+}
+
+// MapSizeConfig sets the blocklist map sizes applied when the eBPF program is loaded
+type MapSizeConfig struct {
+	IPv4     int `mapstructure:"ipv4"`
+	IPv4CIDR int `mapstructure:"ipv4-cidr"`
+	IPv6     int `mapstructure:"ipv6"`
+	IPv6CIDR int `mapstructure:"ipv6-cidr"`
+	MAC      int `mapstructure:"mac"`
+	// threat intelligence tries, see kernel_drop in processor.json
+	IntelIPv4 int `mapstructure:"intel-ipv4"`
+	IntelIPv6 int `mapstructure:"intel-ipv6"`
+	// geo tries, the collapsed networks of the blocked countries and autonomous systems
+	GeoIPv4 int `mapstructure:"geo-ipv4"`
+	GeoIPv6 int `mapstructure:"geo-ipv6"`
+	// tuple rule tries and the distinct denied port sets they point to
+	Tuple    int `mapstructure:"tuple"`
+	PortSets int `mapstructure:"port-sets"`
+}
+
 // Config holds all application configuration parameters
 type Config struct {
 	Version string `mapstructure:"version"`
@@ -30,6 +138,8 @@ type Config struct {
 	Auth string `mapstructure:"auth"`
 	// network interface name to monitor (e.g., eth0, ens33)
 	Interface string `mapstructure:"interface"`
+	// interfaces to monitor with one shared set of maps, replaces interface when set
+	Interfaces []InterfaceConfig `mapstructure:"interfaces"`
 	// HTTP server listening address and port (e.g., :5678, 127.0.0.1:5678)
 	Addr string `mapstructure:"addr"`
 
@@ -38,6 +148,10 @@ type Config struct {
 
 	// file path to the MaxMind GeoLite2 City database
 	GeoIPPath string `mapstructure:"geoip-path"`
+	// file path to the MaxMind GeoLite2 ASN database, only needed to block autonomous systems
+	GeoIPASNPath string `mapstructure:"geoip-asn-path"`
+	// addresses whose GeoIP location is cached, 0 disables the cache
+	GeoIPCacheSize int `mapstructure:"geoip-cache-size"`
 
 	// interval to persist metrics data (in minutes), 0 means disable persistence
 	MetricsPersistInterval int `mapstructure:"metrics-persist-interval"`
@@ -45,9 +159,15 @@ type Config struct {
 	// RetentionHours defines how long to keep packet data in storage (in hours)
 	RetentionHours int `mapstructure:"retention-hours"`
 
+	// memory budget for per source metrics (in MB), 0 keeps every source.
+	// when set only the heaviest sources are tracked, totals and dimensions stay exact
+	MetricsMemoryBudget int `mapstructure:"metrics-memory-budget"`
+
 	Security SecurityConfig `mapstructure:"security"`
 
 	RateLimit RateLimitConfig `mapstructure:"rate-limit"`
+
+	EBPF EBPFConfig `mapstructure:"ebpf"`
 }
 
 var (
@@ -61,12 +181,38 @@ func Init() error {
 	viper.SetDefault("addr", ":5678")
 	viper.SetDefault("data-dir", "./data")
 	viper.SetDefault("geoip-path", "GeoLite2-City.mmdb")
+	viper.SetDefault("geoip-asn-path", "")
+	viper.SetDefault("geoip-cache-size", DefaultGeoIPCacheSize)
 	viper.SetDefault("metrics-persist-interval", 10)
 	viper.SetDefault("retention-hours", 720)
+	viper.SetDefault("metrics-memory-budget", 0)
 	viper.SetDefault("security.ip-error-threshold", 10)
 	viper.SetDefault("security.error-window", 86400)
 	viper.SetDefault("rate-limit.request", 120)
 	viper.SetDefault("rate-limit.interval", 60)
+	viper.SetDefault("ebpf.export-mode", ExportModeEvent)
+	viper.SetDefault("ebpf.poll-interval", 1000)
+	viper.SetDefault("ebpf.transport", TransportAuto)
+	viper.SetDefault("ebpf.ringbuf-size", 1<<24)
+	viper.SetDefault("ebpf.perf-buffer-pages", 64)
+	viper.SetDefault("ebpf.reader-mode", ReaderModeShared)
+	viper.SetDefault("ebpf.cpu-affinity", false)
+	viper.SetDefault("ebpf.wakeup-batch", 64)
+	viper.SetDefault("ebpf.sample-rate", 1)
+	viper.SetDefault("ebpf.overload-policy", string(utils.OverloadBlock))
+	viper.SetDefault("ebpf.map-size.ipv4", DefaultIPv4MapSize)
+	viper.SetDefault("ebpf.map-size.ipv4-cidr", DefaultCIDRMapSize)
+	viper.SetDefault("ebpf.map-size.ipv6", DefaultIPv6MapSize)
+	viper.SetDefault("ebpf.map-size.ipv6-cidr", DefaultCIDRMapSize)
+	viper.SetDefault("ebpf.map-size.mac", DefaultMACMapSize)
+	viper.SetDefault("ebpf.map-size.intel-ipv4", DefaultIntelMapSize)
+	viper.SetDefault("ebpf.map-size.intel-ipv6", DefaultIntelMapSize)
+	viper.SetDefault("ebpf.map-size.geo-ipv4", DefaultGeoMapSize)
+	viper.SetDefault("ebpf.map-size.geo-ipv6", DefaultGeoMapSize)
+	viper.SetDefault("ebpf.map-size.tuple", DefaultTupleMapSize)
+	viper.SetDefault("ebpf.map-size.port-sets", DefaultPortSets)
+	viper.SetDefault("ebpf.pin-path", "/sys/fs/bpf/ebpf-firewall")
+	viper.SetDefault("ebpf.xsk-redirect", false)
 
 	viper.SetConfigName("config")
 	viper.AddConfigPath(".")
@@ -101,18 +247,114 @@ func validateConfig(config *Config) error {
 		config.Auth = utils.GenerateRandomString(18)
 		log.Printf("No auth token provided, generated random auth token: %s", config.Auth)
 	}
-	if config.Interface == "" {
-		config.Interface = utils.GetDefaultInterface()
-		log.Printf("No interface provided, using default interface: %s", config.Interface)
-	} else if !utils.ValidateInterface(config.Interface) {
-		return fmt.Errorf("invalid interface: %s", config.Interface)
+	if len(config.Interfaces) == 0 {
+		if config.Interface == "" {
+			config.Interface = utils.GetDefaultInterface()
+			log.Printf("No interface provided, using default interface: %s", config.Interface)
+		}
+		config.Interfaces = []InterfaceConfig{{Name: config.Interface}}
+	}
+	if len(config.Interfaces) > MaxInterfaces {
+		return fmt.Errorf("too many interfaces: %d", len(config.Interfaces))
 	}
+	seen := make(map[string]bool, len(config.Interfaces))
+	for i := range config.Interfaces {
+		iface := &config.Interfaces[i]
+		if !utils.ValidateInterface(iface.Name) {
+			return fmt.Errorf("invalid interface: %s", iface.Name)
+		}
+		if seen[iface.Name] {
+			return fmt.Errorf("duplicate interface: %s", iface.Name)
+		}
+		seen[iface.Name] = true
+		switch iface.Mode {
+		case AttachModeAuto, AttachModeOffload, AttachModeDriver, AttachModeGeneric:
+		case "":
+			iface.Mode = AttachModeAuto
+		default:
+			return fmt.Errorf("invalid attach mode of interface %s: %s", iface.Name, iface.Mode)
+		}
+	}
+	config.Interface = config.Interfaces[0].Name
 
 	if config.DataDir == "" {
 		config.DataDir = "./data"
 		log.Printf("No data directory provided, using default data directory: %s", config.DataDir)
 	}
 
+	if config.GeoIPCacheSize < 0 {
+		return fmt.Errorf("invalid geoip cache size: %d", config.GeoIPCacheSize)
+	}
+
+	if config.MetricsMemoryBudget < 0 {
+		return fmt.Errorf("invalid metrics memory budget: %d", config.MetricsMemoryBudget)
+	}
+
+	switch config.EBPF.ExportMode {
+	case ExportModeEvent, ExportModeAggregate:
+	case "":
+		config.EBPF.ExportMode = ExportModeEvent
+	default:
+		return fmt.Errorf("invalid ebpf export mode: %s", config.EBPF.ExportMode)
+	}
+	if config.EBPF.PollInterval <= 0 {
+		config.EBPF.PollInterval = 1000
+	}
+	switch config.EBPF.Transport {
+	case TransportAuto, TransportRingBuf, TransportPerf:
+	case "":
+		config.EBPF.Transport = TransportAuto
+	default:
+		return fmt.Errorf("invalid ebpf transport: %s", config.EBPF.Transport)
+	}
+	switch config.EBPF.ReaderMode {
+	case ReaderModeShared, ReaderModePerCPU:
+	case "":
+		config.EBPF.ReaderMode = ReaderModeShared
+	default:
+		return fmt.Errorf("invalid ebpf reader mode: %s", config.EBPF.ReaderMode)
+	}
+	pageSize := os.Getpagesize()
+	if size := config.EBPF.RingBufSize; size < pageSize || size%pageSize != 0 || size&(size-1) != 0 {
+		return fmt.Errorf("invalid ebpf ringbuf size: %d", size)
+	}
+	if config.EBPF.PerfBufferPages <= 0 {
+		config.EBPF.PerfBufferPages = 64
+	}
+	if config.EBPF.WakeupBatch <= 0 {
+		config.EBPF.WakeupBatch = 1
+	}
+	if config.EBPF.SampleRate < 1 || config.EBPF.SampleRate > MaxSampleRate {
+		return fmt.Errorf("invalid ebpf sample rate: %d", config.EBPF.SampleRate)
+	}
+	switch utils.OverloadPolicy(config.EBPF.OverloadPolicy) {
+	case utils.OverloadBlock, utils.OverloadDropNewest, utils.OverloadDropOldest, utils.OverloadSample:
+	case "":
+		config.EBPF.OverloadPolicy = string(utils.OverloadBlock)
+	default:
+		return fmt.Errorf("invalid ebpf overload policy: %s", config.EBPF.OverloadPolicy)
+	}
+	for name, size := range map[string]int{
+		"ipv4":       config.EBPF.MapSize.IPv4,
+		"ipv4-cidr":  config.EBPF.MapSize.IPv4CIDR,
+		"ipv6":       config.EBPF.MapSize.IPv6,
+		"ipv6-cidr":  config.EBPF.MapSize.IPv6CIDR,
+		"mac":        config.EBPF.MapSize.MAC,
+		"intel-ipv4": config.EBPF.MapSize.IntelIPv4,
+		"intel-ipv6": config.EBPF.MapSize.IntelIPv6,
+		"geo-ipv4":   config.EBPF.MapSize.GeoIPv4,
+		"geo-ipv6":   config.EBPF.MapSize.GeoIPv6,
+		"tuple":      config.EBPF.MapSize.Tuple,
+	} {
+		if size < 1 || int64(size) > math.MaxUint32 {
+			return fmt.Errorf("invalid ebpf map size %s: %d", name, size)
+		}
+	}
+	// set 0 is kept for prefixes that deny no port
+	if config.EBPF.MapSize.PortSets < 2 || config.EBPF.MapSize.PortSets > 1<<16 {
+		return fmt.Errorf("invalid ebpf map size port-sets: %d", config.EBPF.MapSize.PortSets)
+	}
+
 	if _, err := os.Stat(config.DataDir); os.IsNotExist(err) {
 		if err := os.MkdirAll(config.DataDir, 0755); err != nil {
 			return fmt.Errorf("failed to create data directory: %w", err)
@@ -0,0 +1,17 @@
+package ebpf
+
+import (
+	"syscall"
+	"unsafe"
+)
+
+// setCPUAffinity pins the calling thread to cpu, the goroutine must be locked to its thread
+func setCPUAffinity(cpu int) error {
+	var mask [maxReaderShards / 64]uint64
+	mask[cpu/64] |= 1 << (cpu % 64)
+	_, _, errno := syscall.RawSyscall(syscall.SYS_SCHED_SETAFFINITY, 0, uintptr(len(mask)*8), uintptr(unsafe.Pointer(&mask[0])))
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
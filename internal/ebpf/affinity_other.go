@@ -0,0 +1,9 @@
+//go:build !linux
+
+package ebpf
+
+import "errors"
+
+func setCPUAffinity(cpu int) error {
+	return errors.New("cpu affinity is only supported on linux")
+}
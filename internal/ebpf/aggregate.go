@@ -0,0 +1,81 @@
+package ebpf
+
+import (
+	"log"
+	"math"
+	"time"
+
+	"github.com/danger-dream/ebpf-firewall/internal/config"
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// pollFlows is the producer used in aggregate export mode. Instead of one record per packet,
+// it periodically merges the per-CPU flow_stats counters and submits one record per flow that
+// saw traffic since the previous poll, with PktCount/PktSize holding the deltas.
+func (em *EBPFManager) pollFlows(submit func(*types.PacketInfo)) {
+	ticker := time.NewTicker(time.Millisecond * time.Duration(config.GetConfig().EBPF.PollInterval))
+	defer ticker.Stop()
+
+	last := make(map[types.PacketInfo]xdpFlowCounters)
+	for {
+		select {
+		case <-em.done:
+			return
+		case <-ticker.C:
+			last = em.collectFlows(last, submit)
+		}
+	}
+}
+
+// collectFlows walks flow_stats once and submits the deltas against the totals seen by the
+// previous walk. The returned map holds the current totals and becomes the next baseline.
+func (em *EBPFManager) collectFlows(last map[types.PacketInfo]xdpFlowCounters, submit func(*types.PacketInfo)) map[types.PacketInfo]xdpFlowCounters {
+	current := make(map[types.PacketInfo]xdpFlowCounters, len(last))
+	var (
+		key    types.PacketInfo
+		perCPU []xdpFlowCounters
+	)
+	iter := em.objects.FlowStats.Iterate()
+	for iter.Next(&key, &perCPU) {
+		var total xdpFlowCounters
+		for _, counters := range perCPU {
+			total.Packets += counters.Packets
+			total.Bytes += counters.Bytes
+		}
+		current[key] = total
+
+		prev := last[key]
+		// the LRU map may have evicted and re-created the flow, its counters start over
+		if total.Packets < prev.Packets || total.Bytes < prev.Bytes {
+			prev = xdpFlowCounters{}
+		}
+		splitFlowDelta(&key, total.Packets-prev.Packets, total.Bytes-prev.Bytes, submit)
+	}
+	if err := iter.Err(); err != nil {
+		log.Printf("failed to iterate flow stats: %s", err.Error())
+		return last
+	}
+	return current
+}
+
+// splitFlowDelta submits the delta of one flow. PacketInfo carries 32-bit
+// counters, so an oversized delta is split into several records, each with
+// at least one packet and an even share of the packets and the bytes.
+func splitFlowDelta(key *types.PacketInfo, packets, bytes uint64, submit func(*types.PacketInfo)) {
+	if packets == 0 {
+		return
+	}
+	chunks := max((packets+math.MaxUint32-1)/math.MaxUint32, (bytes+math.MaxUint32-1)/math.MaxUint32)
+	// a packet is far below 4 GiB, so this never leaves a share of the bytes over the limit
+	chunks = min(chunks, packets)
+	for i := chunks; i > 0; i-- {
+		count, size := packets/i, bytes/i
+		pi := types.AcquirePacketInfo()
+		*pi = *key
+		pi.PktCount = uint32(count)
+		pi.PktSize = uint32(min(size, math.MaxUint32))
+		packets -= count
+		bytes -= size
+		submit(pi)
+	}
+}
@@ -0,0 +1,40 @@
+package ebpf
+
+import (
+	"math"
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func TestSplitFlowDelta(t *testing.T) {
+	key := types.PacketInfo{IPProto: 6}
+	tests := []struct {
+		name           string
+		packets, bytes uint64
+		want           int
+	}{
+		{"fits", 10, 15000, 1},
+		{"none", 0, 0, 0},
+		{"bytes over 4 GiB", 3, 2*math.MaxUint32 + 5, 3},
+		{"packets over 4 G", math.MaxUint32 + 1, 64 * math.MaxUint32, 64},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			var records int
+			var packets, bytes uint64
+			splitFlowDelta(&key, tt.packets, tt.bytes, func(pi *types.PacketInfo) {
+				records++
+				if pi.PktCount == 0 || pi.IPProto != 6 {
+					t.Errorf("record %+v", pi)
+				}
+				packets += uint64(pi.PktCount)
+				bytes += uint64(pi.PktSize)
+			})
+			if records != tt.want || packets != tt.packets || bytes != tt.bytes {
+				t.Errorf("%d records with %d packets and %d bytes, want %d records with %d and %d",
+					records, packets, bytes, tt.want, tt.packets, tt.bytes)
+			}
+		})
+	}
+}
@@ -0,0 +1,37 @@
+package ebpf
+
+import (
+	"encoding/binary"
+	"errors"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// packetInfoSize is the size of the packed struct packet_info in xdp.c
+const packetInfoSize = 72
+
+var errShortRecord = errors.New("packet info record too short")
+
+// decodePacketInfo fills pi from a raw packet_info record. It follows the fixed
+// layout of the C struct, so unlike binary.Read it needs no reflection and does
+// not allocate. Fields are in host byte order, as written by the kernel.
+func decodePacketInfo(raw []byte, pi *types.PacketInfo) error {
+	if len(raw) < packetInfoSize {
+		return errShortRecord
+	}
+	raw = raw[:packetInfoSize]
+	copy(pi.SrcIP[:], raw[0:4])
+	copy(pi.DstIP[:], raw[4:8])
+	copy(pi.SrcIPv6[:], raw[8:24])
+	copy(pi.DstIPv6[:], raw[24:40])
+	pi.SrcPort = binary.NativeEndian.Uint16(raw[40:42])
+	pi.DstPort = binary.NativeEndian.Uint16(raw[42:44])
+	copy(pi.SrcMAC[:], raw[44:50])
+	copy(pi.DstMAC[:], raw[50:56])
+	pi.EthProto = types.EthernetType(binary.NativeEndian.Uint16(raw[56:58]))
+	pi.IPProto = types.IPProtocol(binary.NativeEndian.Uint16(raw[58:60]))
+	pi.PktSize = binary.NativeEndian.Uint32(raw[60:64])
+	pi.MatchType = types.MatchType(binary.NativeEndian.Uint32(raw[64:68]))
+	pi.PktCount = binary.NativeEndian.Uint32(raw[68:72])
+	return nil
+}
@@ -0,0 +1,90 @@
+package ebpf
+
+import (
+	"bytes"
+	"encoding/binary"
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func newTestRecord() []byte {
+	pi := types.PacketInfo{
+		SrcIP:     [4]byte{192, 168, 1, 10},
+		DstIP:     [4]byte{10, 0, 0, 1},
+		SrcIPv6:   [16]byte{0x20, 0x01, 0x0d, 0xb8, 15: 1},
+		DstIPv6:   [16]byte{0x20, 0x01, 0x0d, 0xb8, 15: 2},
+		SrcPort:   51234,
+		DstPort:   443,
+		SrcMAC:    [6]byte{0x00, 0x11, 0x22, 0x33, 0x44, 0x55},
+		DstMAC:    [6]byte{0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb},
+		EthProto:  0x0800,
+		IPProto:   6,
+		PktSize:   1500,
+		MatchType: types.MatchByIP4CIDR,
+		PktCount:  3,
+	}
+	var buf bytes.Buffer
+	binary.Write(&buf, binary.NativeEndian, &pi)
+	return buf.Bytes()
+}
+
+func TestDecodePacketInfo(t *testing.T) {
+	raw := newTestRecord()
+	if len(raw) != packetInfoSize {
+		t.Fatalf("packet info size = %d, want %d", len(raw), packetInfoSize)
+	}
+
+	var want types.PacketInfo
+	if err := binary.Read(bytes.NewReader(raw), binary.NativeEndian, &want); err != nil {
+		t.Fatalf("binary.Read() error = %v", err)
+	}
+	var got types.PacketInfo
+	if err := decodePacketInfo(raw, &got); err != nil {
+		t.Fatalf("decodePacketInfo() error = %v", err)
+	}
+	if got != want {
+		t.Errorf("decodePacketInfo() = %+v, want %+v", got, want)
+	}
+
+	if err := decodePacketInfo(raw[:packetInfoSize-1], &got); err == nil {
+		t.Errorf("decodePacketInfo() expected error for short record")
+	}
+}
+
+func TestDecodePacketInfo_NoAllocation(t *testing.T) {
+	raw := newTestRecord()
+	allocs := testing.AllocsPerRun(1000, func() {
+		pi := types.AcquirePacketInfo()
+		decodePacketInfo(raw, pi)
+		types.ReleasePacketInfo(pi)
+	})
+	if allocs > 0 {
+		t.Errorf("decode allocated %.1f times per record, want 0", allocs)
+	}
+}
+
+func BenchmarkDecodePacketInfo_BinaryRead(b *testing.B) {
+	raw := newTestRecord()
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		var pi types.PacketInfo
+		if err := binary.Read(bytes.NewReader(raw), binary.LittleEndian, &pi); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkDecodePacketInfo_Pooled(b *testing.B) {
+	raw := newTestRecord()
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		pi := types.AcquirePacketInfo()
+		if err := decodePacketInfo(raw, pi); err != nil {
+			b.Fatal(err)
+		}
+		types.ReleasePacketInfo(pi)
+	}
+}
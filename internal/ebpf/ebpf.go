@@ -1,33 +1,57 @@
 package ebpf
 
 import (
-	"bytes"
 	"errors"
-	"strings"
 
-	"encoding/binary"
 	"fmt"
 	"log"
-	"net"
 	"os"
+	"sync"
 
-	"github.com/danger-dream/ebpf-firewall/internal/config"
+	cfg "github.com/danger-dream/ebpf-firewall/internal/config"
 	"github.com/danger-dream/ebpf-firewall/internal/types"
 	"github.com/danger-dream/ebpf-firewall/internal/utils"
 
-	"github.com/cilium/ebpf/link"
+	"github.com/cilium/ebpf"
 	"github.com/cilium/ebpf/perf"
+	"github.com/cilium/ebpf/ringbuf"
 	"github.com/cilium/ebpf/rlimit"
 )
 
+// export modes understood by xdp_prog, see EXPORT_MODE_* in xdp.c
+const (
+	exportModeEvent     uint32 = 0
+	exportModeAggregate uint32 = 1
+)
+
 type EBPFManager struct {
-	interfaceName string
-	objects       *xdpObjects
-	link          *link.Link
-	reader        *perf.Reader
-	pool          *utils.ElasticPool[*types.PacketInfo]
-	done          chan struct{}
-	linkType      string
+	objects    *xdpObjects
+	ruleMaps   map[utils.IPType]*ruleMap
+	intel      prefixTries
+	geo        prefixTries
+	tuples     tupleTables
+	links      []xdpLink
+	reader     *perf.Reader
+	ringReader *ringbuf.Reader
+	// records reused across reads, only touched by the reader goroutine
+	perfRecord perf.Record
+	ringRecord ringbuf.Record
+	transport  string
+	stats      eventStats
+	settings   xdpSettings
+	settingsMu sync.Mutex
+	pool       *utils.ElasticPool[*types.PacketInfo]
+	done       chan struct{}
+	// returns the blocklist rules written at start, see SetRuleSource
+	ruleSource func() []Rule
+	// bpffs directory of the pinned maps and link, empty disables pinning
+	pinPath string
+	// ring buffer shards of the per-cpu reader mode, empty with a shared reader
+	shards      []*readerShard
+	cpuAffinity bool
+
+	// rate limit of intel matches, see SetIntelThreshold
+	intelLimit xdpRateLimit
 }
 
 func NewEBPFManager(pool *utils.ElasticPool[*types.PacketInfo]) *EBPFManager {
@@ -35,55 +59,131 @@ func NewEBPFManager(pool *utils.ElasticPool[*types.PacketInfo]) *EBPFManager {
 }
 
 func (em *EBPFManager) Start() error {
-	config := config.GetConfig()
-	iface, err := net.InterfaceByName(config.Interface)
-	if err != nil {
-		return fmt.Errorf("failed to get interface %s: %s", config.Interface, err)
-	}
-	em.interfaceName = config.Interface
+	config := cfg.GetConfig()
+	em.pinPath = config.EBPF.PinPath
 
 	if err := rlimit.RemoveMemlock(); err != nil {
 		log.Printf("failed to remove memlock: %s", err.Error())
 	}
-	var ebpfObj xdpObjects
-	if err := loadXdpObjects(&ebpfObj, nil); err != nil {
+	spec, err := loadXdp()
+	if err != nil {
+		return fmt.Errorf("failed to load eBPF spec: %s", err.Error())
+	}
+	exportMode := exportModeEvent
+	if config.EBPF.ExportMode == cfg.ExportModeAggregate {
+		exportMode = exportModeAggregate
+	}
+	em.transport = selectTransport(config.EBPF.Transport)
+	shards := 0
+	if config.EBPF.ReaderMode == cfg.ReaderModePerCPU && exportMode == exportModeEvent {
+		if em.transport == cfg.TransportRingBuf {
+			shards = readerShardCount()
+		} else {
+			log.Printf("per-cpu reader mode requires the ring buffer transport, using a shared reader")
+		}
+	}
+	if err := configureTransport(spec, em.transport, config.EBPF.RingBufSize, shards); err != nil {
+		return err
+	}
+	if err := configureMapSizes(spec, config.EBPF.MapSize); err != nil {
+		return err
+	}
+	if em.objects, err = em.loadObjects(spec); err != nil {
+		em.objects = nil
 		return fmt.Errorf("failed to load eBPF objects: %s", err.Error())
 	}
-	em.objects = &ebpfObj
-	err = em.attachXDP(iface.Index)
-	if err != nil {
+	if em.ruleMaps, err = newRuleMaps(spec, em.objects); err != nil {
+		em.Close()
+		return fmt.Errorf("failed to create blocklist maps: %s", err.Error())
+	}
+	if err := em.tuples.attach(spec, em.objects); err != nil {
+		em.Close()
+		return fmt.Errorf("failed to create tuple rule maps: %s", err.Error())
+	}
+	if em.ruleSource != nil {
+		if err := em.ReplaceRules(em.ruleSource()); err != nil {
+			log.Printf("failed to load blocklist rules: %s", err.Error())
+		}
+	}
+	intelNames := [2]string{intelMapSizes[0].name, intelMapSizes[1].name}
+	intelMaps := [2]*ebpf.Map{em.objects.IntelIpv4Trie, em.objects.IntelIpv6Trie}
+	if err := em.intel.attach(spec, intelNames, intelMaps, em.objects.PinState, [2]uint32{intelStateSlot(0), intelStateSlot(1)}); err != nil {
+		log.Printf("failed to load threat intel indicators: %s", err.Error())
+	}
+	geoNames := [2]string{geoMapSizes[0].name, geoMapSizes[1].name}
+	geoMaps := [2]*ebpf.Map{em.objects.GeoIpv4Trie, em.objects.GeoIpv6Trie}
+	if err := em.geo.attach(spec, geoNames, geoMaps, em.objects.PinState, [2]uint32{geoStateSlot(0), geoStateSlot(1)}); err != nil {
+		log.Printf("failed to load geo block networks: %s", err.Error())
+	}
+	em.settings = xdpSettings{
+		ExportMode:  exportMode,
+		WakeupBytes: uint32(config.EBPF.WakeupBatch * eventRecordSize),
+		SampleRate:  uint32(config.EBPF.SampleRate),
+		// kept across restarts, see SetIntelDrop
+		IntelAction: em.settings.IntelAction,
+	}
+	if config.EBPF.XSKRedirect {
+		em.settings.XskRedirect = 1
+		if em.pinPath == "" {
+			log.Printf("AF_XDP redirect is enabled without a pin path, analyzers can not find xsks_map")
+		}
+	}
+	if err := em.objects.Settings.Put(uint32(0), em.settings); err != nil {
+		em.Close()
+		return fmt.Errorf("failed to write eBPF settings: %s", err.Error())
+	}
+	if err := em.objects.RateLimits.Put(uint32(types.MatchByIntel), em.intelLimit); err != nil {
+		em.Close()
+		return fmt.Errorf("failed to write eBPF rate limits: %s", err.Error())
+	}
+	// the shards must be in place before packets arrive, events of a missing shard are dropped
+	if err := em.openShards(spec, shards); err != nil {
 		em.Close()
 		return err
 	}
-	em.reader, err = perf.NewReader(em.objects.Events, os.Getpagesize())
-	if err != nil {
+	em.cpuAffinity = config.EBPF.CPUAffinity
+	if err := em.attachInterfaces(config.Interfaces); err != nil {
 		em.Close()
-		return fmt.Errorf("failed to create perf event reader: %s", err.Error())
+		return err
 	}
 	em.done = make(chan struct{})
+	go em.sweepRoutine(em.done)
+	if exportMode == exportModeAggregate {
+		em.pool.SetProducer(em.pollFlows)
+		return nil
+	}
+	if shards > 0 {
+		log.Printf("eBPF event transport: %s, %d reader shards", em.transport, shards)
+		em.pool.SetShardProducer(shards, em.monitorShard)
+		return nil
+	}
+	if err := em.openReader(); err != nil {
+		em.Close()
+		return err
+	}
+	log.Printf("eBPF event transport: %s", em.transport)
 	em.pool.SetProducer(em.monitorEvents)
 	return nil
 }
 
-func (em *EBPFManager) attachXDP(index int) error {
-	flagNames := []string{"offload", "driver", "generic"}
-	errs := []string{}
-	for i, mode := range []link.XDPAttachFlags{link.XDPOffloadMode, link.XDPDriverMode, link.XDPGenericMode} {
-		flagName := flagNames[i]
-		l, err := link.AttachXDP(link.XDPOptions{
-			Program:   em.objects.XdpProg,
-			Interface: index,
-			Flags:     mode,
-		})
-		if err == nil {
-			em.linkType = flagName
-			em.link = &l
-			log.Printf("XDP program attached successfully, current mode: %s", flagName)
-			return nil
+// openReader creates the user space end of the event transport
+func (em *EBPFManager) openReader() error {
+	var err error
+	if em.transport == cfg.TransportRingBuf {
+		em.ringReader, err = ringbuf.NewReader(em.objects.RbEvents)
+		if err != nil {
+			return fmt.Errorf("failed to create ring buffer reader: %s", err.Error())
 		}
-		errs = append(errs, fmt.Sprintf("failed to attach XDP program with %s mode: %s", flagName, err.Error()))
+		return nil
+	}
+	perCPUBuffer := cfg.GetConfig().EBPF.PerfBufferPages * os.Getpagesize()
+	em.reader, err = perf.NewReaderWithOptions(em.objects.Events, perCPUBuffer, perf.ReaderOptions{
+		Watermark: min(int(em.settings.WakeupBytes), perCPUBuffer/2),
+	})
+	if err != nil {
+		return fmt.Errorf("failed to create perf event reader: %s", err.Error())
 	}
-	return errors.New(strings.Join(errs, "\n"))
+	return nil
 }
 
 func (em *EBPFManager) monitorEvents(submit func(*types.PacketInfo)) {
@@ -92,93 +192,169 @@ func (em *EBPFManager) monitorEvents(submit func(*types.PacketInfo)) {
 		case <-em.done:
 			return
 		default:
-			record, err := em.reader.Read()
+			sample, err := em.readSample()
 			if err != nil {
-				if err == perf.ErrClosed {
-					log.Printf("perf event reader closed, trying to restart eBPF")
-					em.Close()
-					if err := em.Start(); err != nil {
-						log.Fatalf("failed to restart eBPF: %s", err.Error())
-					} else {
-						log.Printf("eBPF restarted successfully")
+				if errors.Is(err, perf.ErrClosed) || errors.Is(err, ringbuf.ErrClosed) {
+					select {
+					case <-em.done:
+						// closed by Close
+						return
+					default:
+					}
+					// the program and maps are still in place, only the reader is recreated
+					log.Printf("event reader closed, reopening it")
+					if err := em.openReader(); err != nil {
+						log.Fatalf("failed to reopen event reader: %s", err.Error())
 					}
-					return
+					continue
 				}
 				continue
 			}
-			var pi types.PacketInfo
-			if err := binary.Read(bytes.NewReader(record.RawSample), binary.LittleEndian, &pi); err != nil {
+			if sample == nil {
 				continue
 			}
-			submit(&pi)
+			em.stats.received.Add(1)
+			pi := types.AcquirePacketInfo()
+			if err := decodePacketInfo(sample, pi); err != nil {
+				types.ReleasePacketInfo(pi)
+				em.stats.decodeErrors.Add(1)
+				continue
+			}
+			submit(pi)
 		}
 	}
 }
 
+// Close releases the program and maps. With a pin path the pinned links and
+// maps stay in bpffs, so the interfaces keep filtering until the next start;
+// remove the pin path to detach the program.
 func (em *EBPFManager) Close() error {
 	if em.done != nil {
-		close(em.done)
+		select {
+		case <-em.done:
+		default:
+			close(em.done)
+		}
 	}
 	if em.reader != nil {
 		em.reader.Close()
 	}
-	if em.link != nil {
-		(*em.link).Close()
+	if em.ringReader != nil {
+		em.ringReader.Close()
 	}
+	em.closeLinks()
+	em.closeShards()
+	for _, rm := range em.ruleMaps {
+		rm.close()
+	}
+	em.intel.detach()
+	em.geo.detach()
+	em.tuples.detach()
 	if em.objects != nil {
 		em.objects.Close()
 	}
 	return nil
 }
 
-func (em *EBPFManager) GetLinkType() string {
-	return em.linkType
+func (em *EBPFManager) GetSampleRate() uint32 {
+	em.settingsMu.Lock()
+	defer em.settingsMu.Unlock()
+	return em.settings.SampleRate
 }
 
-func (em *EBPFManager) updateMap(iptype utils.IPType, value []byte, add bool) (err error) {
-	switch iptype {
-	case utils.IPTypeIPv4:
-		if add {
-			err = em.objects.Ipv4List.Put(value, 1)
-		} else {
-			err = em.objects.Ipv4List.Delete(value)
+// SetSampleRate changes the passed packet sample rate of the running program, 1 exports every packet
+func (em *EBPFManager) SetSampleRate(rate uint32) error {
+	if rate < 1 || rate > cfg.MaxSampleRate {
+		return fmt.Errorf("invalid sample rate: %d", rate)
+	}
+	em.settingsMu.Lock()
+	defer em.settingsMu.Unlock()
+	settings := em.settings
+	settings.SampleRate = rate
+	if err := em.objects.Settings.Put(uint32(0), settings); err != nil {
+		return err
+	}
+	em.settings = settings
+	return nil
+}
+
+func (em *EBPFManager) updateMap(iptype utils.IPType, value []byte, add bool, expires uint64) error {
+	rm, ok := em.ruleMaps[iptype]
+	if !ok {
+		return fmt.Errorf("unsupported match type: %v", iptype)
+	}
+	if add {
+		return rm.add(value, expires)
+	}
+	return rm.delete(value)
+}
+
+// SetRuleSource registers the provider of the full blocklist, it is loaded
+// every time the program starts so rules survive restarts
+func (em *EBPFManager) SetRuleSource(source func() []Rule) {
+	em.ruleSource = source
+}
+
+// ReplaceRules swaps every blocklist map for a new instance holding exactly
+// rules. Each map is switched in one update, so packets never match against
+// a partially written list. A value given twice expires with the later rule.
+// Tuple rules do not expire in the kernel, they stay until deleted.
+func (em *EBPFManager) ReplaceRules(rules []Rule) error {
+	keys := make(map[utils.IPType][][]byte, len(em.ruleMaps))
+	expires := make(map[utils.IPType][]uint64, len(em.ruleMaps))
+	// position of every key in keys and expires
+	seen := make(map[string]int, len(rules))
+	var errs []error
+	var tuples []utils.TupleRule
+	for _, r := range rules {
+		value := r.Value
+		bytes, iptype, err := utils.ParseValueToBytes(value)
+		if err != nil {
+			errs = append(errs, err)
+			continue
 		}
-	case utils.IPTypeIPV4CIDR:
-		if add {
-			err = em.objects.Ipv4CidrTrie.Put(value, 1)
-		} else {
-			err = em.objects.Ipv4CidrTrie.Delete(value)
+		if iptype == utils.IPTypeTuple {
+			rule, _ := utils.ParseTupleRule(value)
+			tuples = append(tuples, rule)
+			continue
 		}
-	case utils.IPTypeIPv6:
-		if add {
-			err = em.objects.Ipv6List.Put(value, 1)
-		} else {
-			err = em.objects.Ipv6List.Delete(value)
+		if _, ok := em.ruleMaps[iptype]; !ok {
+			errs = append(errs, fmt.Errorf("unsupported match type: %v", iptype))
+			continue
 		}
-	case utils.IPTypeIPv6CIDR:
-		if add {
-			err = em.objects.Ipv6CidrTrie.Put(value, 1)
-		} else {
-			err = em.objects.Ipv6CidrTrie.Delete(value)
+		at := ktimeAt(r.ExpireTime)
+		if i, ok := seen[string(bytes)]; ok {
+			expires[iptype][i] = laterExpiry(expires[iptype][i], at)
+			continue
 		}
-	case utils.IPTypeMAC:
-		if add {
-			err = em.objects.MacList.Put(value, 1)
-		} else {
-			err = em.objects.MacList.Delete(value)
+		seen[string(bytes)] = len(keys[iptype])
+		keys[iptype] = append(keys[iptype], bytes)
+		expires[iptype] = append(expires[iptype], at)
+	}
+	for iptype, rm := range em.ruleMaps {
+		if err := rm.replace(keys[iptype], expires[iptype]); err != nil {
+			errs = append(errs, err)
 		}
-	default:
-		return fmt.Errorf("unsupported match type: %v", iptype)
 	}
-	return err
+	if err := em.tuples.replace(tuples); err != nil {
+		errs = append(errs, err)
+	}
+	return errors.Join(errs...)
 }
 
-func (em *EBPFManager) AddRule(value string) error {
+// AddRule blocks value until the unix time expireTime in seconds, zero never
+// expires. Adding a present value sets its expiry. Tuple rules ignore the
+// expiry, they stay until deleted.
+func (em *EBPFManager) AddRule(value string, expireTime int64) error {
 	bytes, iptype, err := utils.ParseValueToBytes(value)
 	if err != nil {
 		return err
 	}
-	return em.updateMap(iptype, bytes, true)
+	if iptype == utils.IPTypeTuple {
+		rule, _ := utils.ParseTupleRule(value)
+		return em.tuples.update(rule, true)
+	}
+	return em.updateMap(iptype, bytes, true, ktimeAt(expireTime))
 }
 
 func (em *EBPFManager) DeleteRule(value string) error {
@@ -186,5 +362,9 @@ func (em *EBPFManager) DeleteRule(value string) error {
 	if err != nil {
 		return err
 	}
-	return em.updateMap(iptype, bytes, false)
+	if iptype == utils.IPTypeTuple {
+		rule, _ := utils.ParseTupleRule(value)
+		return em.tuples.update(rule, false)
+	}
+	return em.updateMap(iptype, bytes, false, 0)
 }
@@ -0,0 +1,149 @@
+package ebpf
+
+import (
+	"container/heap"
+	"errors"
+	"log"
+	"time"
+
+	"github.com/cilium/ebpf"
+	"golang.org/x/sys/unix"
+)
+
+// how often expired blocklist entries are deleted, the kernel ignores them
+// as soon as they expire
+const expirySweepInterval = 5 * time.Second
+
+// Rule is a blocklist value, see utils.ParseValueToBytes, with the unix time
+// in seconds it expires at. Zero never expires.
+type Rule struct {
+	Value      string
+	ExpireTime int64
+}
+
+// ktimeNow returns the clock of bpf_ktime_get_coarse_ns
+func ktimeNow() uint64 {
+	var ts unix.Timespec
+	if err := unix.ClockGettime(unix.CLOCK_MONOTONIC_COARSE, &ts); err != nil {
+		return 0
+	}
+	return uint64(ts.Nano())
+}
+
+// ktimeAt converts a unix expire time in seconds to the clock of
+// bpf_ktime_get_coarse_ns, zero stays zero. A time in the past maps to now,
+// the entry is a miss right away.
+func ktimeAt(expireTime int64) uint64 {
+	if expireTime <= 0 {
+		return 0
+	}
+	now := ktimeNow()
+	ttl := time.Until(time.Unix(expireTime, 0))
+	if ttl <= 0 {
+		return max(now, 1)
+	}
+	return now + uint64(ttl)
+}
+
+// laterExpiry returns the expiry of a value blocked by two rules, zero wins
+func laterExpiry(a, b uint64) uint64 {
+	if a == 0 || b == 0 {
+		return 0
+	}
+	return max(a, b)
+}
+
+// pendingExpiry is an entry of a rule map that expires at, the entry may
+// have been deleted or given a new expiry since it was queued
+type pendingExpiry struct {
+	at  uint64
+	key string
+}
+
+type expiryQueue []pendingExpiry
+
+func (q expiryQueue) Len() int           { return len(q) }
+func (q expiryQueue) Less(i, j int) bool { return q[i].at < q[j].at }
+func (q expiryQueue) Swap(i, j int)      { q[i], q[j] = q[j], q[i] }
+func (q *expiryQueue) Push(x any)        { *q = append(*q, x.(pendingExpiry)) }
+func (q *expiryQueue) Pop() any {
+	old := *q
+	e := old[len(old)-1]
+	*q = old[:len(old)-1]
+	return e
+}
+
+// schedule queues the expiry of key, expiryMu must be held
+func (rm *ruleMap) schedule(key []byte, expires uint64) {
+	if expires != 0 {
+		heap.Push(&rm.expiring, pendingExpiry{at: expires, key: string(key)})
+	}
+}
+
+// sweep deletes the entries that expired by now. The kernel value decides,
+// an entry given a later expiry since it was queued is queued again.
+func (rm *ruleMap) sweep(now uint64) int {
+	rm.mu.Lock()
+	defer rm.mu.Unlock()
+	rm.expiryMu.Lock()
+	defer rm.expiryMu.Unlock()
+	if rm.m == nil {
+		return 0
+	}
+	var due [][]byte
+	for len(rm.expiring) > 0 && rm.expiring[0].at <= now {
+		e := heap.Pop(&rm.expiring).(pendingExpiry)
+		var expires uint64
+		if err := rm.m.Lookup([]byte(e.key), &expires); err != nil || expires == 0 {
+			continue
+		}
+		if expires > now {
+			heap.Push(&rm.expiring, pendingExpiry{at: expires, key: e.key})
+			continue
+		}
+		due = append(due, []byte(e.key))
+	}
+	if len(due) == 0 {
+		return 0
+	}
+	// lookups of a trie take the longest prefix, a key only found through a
+	// shorter one is gone already, so tries are deleted one key at a time
+	batched := 0
+	if rm.spec.Type != ebpf.LPMTrie {
+		// the kernel deletes in order and stops at the first failure
+		n, err := rm.m.BatchDelete(batchKeys(due), nil)
+		if err == nil {
+			n = len(due)
+		}
+		batched = max(n, 0)
+	}
+	deleted := due[:batched]
+	for _, key := range due[batched:] {
+		if err := rm.m.Delete(key); err == nil {
+			deleted = append(deleted, key)
+		} else if !errors.Is(err, ebpf.ErrKeyNotExist) {
+			log.Printf("failed to delete expired entry of eBPF map %s: %s", rm.name, err)
+		}
+	}
+	for _, key := range deleted {
+		rm.toggle(key, -1)
+	}
+	return len(deleted)
+}
+
+// sweepRoutine deletes expired blocklist entries until Close
+func (em *EBPFManager) sweepRoutine(done chan struct{}) {
+	ticker := time.NewTicker(expirySweepInterval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-done:
+			return
+		case <-ticker.C:
+			now := ktimeNow()
+			for _, rm := range em.ruleMaps {
+				rm.sweep(now)
+			}
+		}
+	}
+}
@@ -0,0 +1,11 @@
+package ebpf
+
+import "net/netip"
+
+// UpdateGeo loads the networks of the blocked countries and autonomous
+// systems into the kernel geo tries, packets from them are dropped as
+// MatchByGeo. Changes of a database update are patched into the current
+// tries, see prefixTries.update.
+func (em *EBPFManager) UpdateGeo(prefixes []netip.Prefix) error {
+	return em.geo.update(prefixes)
+}
@@ -0,0 +1,117 @@
+package ebpf
+
+import (
+	"errors"
+	"fmt"
+	"math"
+	"net/netip"
+	"time"
+
+	"github.com/cilium/ebpf"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// threat intel actions understood by xdp_prog, see INTEL_ACTION_* in xdp.c
+const (
+	intelActionOff       uint32 = 0
+	intelActionDrop      uint32 = 1
+	intelActionThreshold uint32 = 2
+)
+
+// Offender is a source xdp_prog dropped for going over its rate limit
+type Offender struct {
+	Addr      netip.Addr
+	MatchType types.MatchType
+	// matches counted on the CPU that flagged the source
+	Hits uint32
+}
+
+// ReplaceIntel loads the aggregated threat intelligence indicators into the
+// kernel tries, the previous set stays active until the new one is complete
+func (em *EBPFManager) ReplaceIntel(prefixes []netip.Prefix) error {
+	return em.intel.replace(prefixes)
+}
+
+// SetIntelDrop makes xdp_prog drop packets whose source is a threat intelligence indicator
+func (em *EBPFManager) SetIntelDrop(enable bool) error {
+	action := intelActionOff
+	if enable {
+		action = intelActionDrop
+	}
+	em.settingsMu.Lock()
+	defer em.settingsMu.Unlock()
+	settings := em.settings
+	settings.IntelAction = action
+	if em.objects != nil {
+		if err := em.objects.Settings.Put(uint32(0), settings); err != nil {
+			return err
+		}
+	}
+	em.settings = settings
+	return nil
+}
+
+// SetIntelThreshold makes xdp_prog count the packets of threat intelligence
+// indicators per source and drop a source once it matched threshold times
+// within window. Dropped sources are reported by DrainOffenders.
+func (em *EBPFManager) SetIntelThreshold(threshold uint32, window time.Duration) error {
+	limit := intelRateLimit(threshold, window)
+	em.settingsMu.Lock()
+	defer em.settingsMu.Unlock()
+	settings := em.settings
+	settings.IntelAction = intelActionThreshold
+	if em.objects != nil {
+		if err := em.objects.RateLimits.Put(uint32(types.MatchByIntel), limit); err != nil {
+			return err
+		}
+		if err := em.objects.Settings.Put(uint32(0), settings); err != nil {
+			return err
+		}
+	}
+	em.intelLimit = limit
+	em.settings = settings
+	return nil
+}
+
+// intelRateLimit converts window to the milliseconds of rate_limit, a window
+// below a millisecond is rounded up as window_ms 0 would drop on the first match
+func intelRateLimit(threshold uint32, window time.Duration) xdpRateLimit {
+	return xdpRateLimit{
+		Threshold: threshold,
+		WindowMs:  uint32(min(max(window.Milliseconds(), 1), math.MaxUint32)),
+	}
+}
+
+// DrainOffenders returns the sources flagged by the rate limiter since the
+// previous call and removes them from the kernel, they pass again unless the
+// caller blocked them in the meantime
+func (em *EBPFManager) DrainOffenders() ([]Offender, error) {
+	if em.objects == nil {
+		return nil, nil
+	}
+	var (
+		key     xdpSrcKey
+		value   xdpOffender
+		keys    []xdpSrcKey
+		flagged []Offender
+	)
+	iter := em.objects.Offenders.Iterate()
+	for iter.Next(&key, &value) {
+		keys = append(keys, key)
+		flagged = append(flagged, Offender{
+			Addr:      netip.AddrFrom16(key.Addr).Unmap(),
+			MatchType: types.MatchType(value.MatchType),
+			Hits:      value.Hits,
+		})
+	}
+	if err := iter.Err(); err != nil {
+		return nil, fmt.Errorf("failed to iterate offenders: %s", err.Error())
+	}
+	for i := range keys {
+		if err := em.objects.Offenders.Delete(&keys[i]); err != nil && !errors.Is(err, ebpf.ErrKeyNotExist) {
+			return flagged, fmt.Errorf("failed to delete offender %s: %s", flagged[i].Addr, err.Error())
+		}
+	}
+	return flagged, nil
+}
@@ -0,0 +1,29 @@
+package ebpf
+
+import (
+	"math"
+	"testing"
+	"time"
+)
+
+func TestIntelRateLimit(t *testing.T) {
+	tests := []struct {
+		window time.Duration
+		want   uint32
+	}{
+		{time.Hour * 24, 86400000},
+		{time.Second, 1000},
+		// below a millisecond or unset never becomes a zero window
+		{time.Microsecond, 1},
+		{0, 1},
+		{-time.Second, 1},
+		// longer than window_ms can hold
+		{time.Hour * 24 * 365 * 10, math.MaxUint32},
+	}
+	for _, tt := range tests {
+		limit := intelRateLimit(3, tt.window)
+		if limit.Threshold != 3 || limit.WindowMs != tt.want {
+			t.Errorf("intelRateLimit(3, %v) = %+v, want window %d", tt.window, limit, tt.want)
+		}
+	}
+}
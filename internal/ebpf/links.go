@@ -0,0 +1,115 @@
+package ebpf
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"net"
+	"strings"
+
+	cfg "github.com/danger-dream/ebpf-firewall/internal/config"
+
+	"github.com/cilium/ebpf/link"
+)
+
+// xsks_map slots of every interface, see XSK_QUEUES in xdp.c
+const xskQueues = 64
+
+// attach flags of linkTypes
+var linkFlags = []link.XDPAttachFlags{link.XDPOffloadMode, link.XDPDriverMode, link.XDPGenericMode}
+
+// xdpLink is the program attached to one interface
+type xdpLink struct {
+	iface string
+	mode  string
+	// first xsks_map slot of the interface
+	xskBase uint32
+	link    link.Link
+}
+
+// LinkInfo describes an interface the program is attached to
+type LinkInfo struct {
+	Interface string `json:"interface"`
+	Mode      string `json:"mode"`
+	// the AF_XDP socket of receive queue q belongs in xsks_map slot XSKBase+q
+	XSKBase uint32 `json:"xsk_base"`
+}
+
+// attachInterfaces attaches the program to every configured interface, all
+// of them share the maps. A failure on one interface fails the start.
+func (em *EBPFManager) attachInterfaces(ifaces []cfg.InterfaceConfig) error {
+	indexes := make([]int, len(ifaces))
+	for i, ic := range ifaces {
+		iface, err := net.InterfaceByName(ic.Name)
+		if err != nil {
+			return fmt.Errorf("failed to get interface %s: %s", ic.Name, err)
+		}
+		indexes[i] = iface.Index
+		// in place before the first packet of the interface can be redirected
+		if err := em.objects.XskBases.Put(uint32(iface.Index), uint32(i*xskQueues)); err != nil {
+			return fmt.Errorf("failed to write AF_XDP slots of %s: %s", ic.Name, err.Error())
+		}
+	}
+	pinned := em.adoptPinnedLinks(ifaces, indexes)
+	for i, ic := range ifaces {
+		l, ok := pinned[ic.Name]
+		if !ok {
+			var err error
+			if l, err = em.attachXDP(ic.Name, indexes[i], ic.Mode); err != nil {
+				return err
+			}
+		}
+		l.xskBase = uint32(i * xskQueues)
+		em.links = append(em.links, l)
+	}
+	return nil
+}
+
+// attachXDP attaches the program to an interface in mode, auto tries the
+// modes of linkTypes in order
+func (em *EBPFManager) attachXDP(name string, index int, mode string) (xdpLink, error) {
+	errs := []string{}
+	for i, flags := range linkFlags {
+		flagName := linkTypes[i]
+		if mode != cfg.AttachModeAuto && mode != flagName {
+			continue
+		}
+		l, err := link.AttachXDP(link.XDPOptions{
+			Program:   em.objects.XdpProg,
+			Interface: index,
+			Flags:     flags,
+		})
+		if err == nil {
+			em.pinLink(l, name, flagName)
+			log.Printf("XDP program attached to %s successfully, current mode: %s", name, flagName)
+			return xdpLink{iface: name, mode: flagName, link: l}, nil
+		}
+		errs = append(errs, fmt.Sprintf("failed to attach XDP program to %s with %s mode: %s", name, flagName, err.Error()))
+	}
+	return xdpLink{}, errors.New(strings.Join(errs, "\n"))
+}
+
+// closeLinks releases the links, pinned links stay attached
+func (em *EBPFManager) closeLinks() {
+	for _, l := range em.links {
+		l.link.Close()
+	}
+	em.links = nil
+}
+
+// GetLinkType returns the attach mode of the first interface
+func (em *EBPFManager) GetLinkType() string {
+	if len(em.links) == 0 {
+		return ""
+	}
+	return em.links[0].mode
+}
+
+// GetLinks returns the interfaces the program is attached to in config order
+func (em *EBPFManager) GetLinks() []LinkInfo {
+	links := make([]LinkInfo, 0, len(em.links))
+	for _, l := range em.links {
+		links = append(links, LinkInfo{Interface: l.iface, Mode: l.mode, XSKBase: l.xskBase})
+	}
+	return links
+}
@@ -0,0 +1,486 @@
+package ebpf
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/fnv"
+	"log"
+	"reflect"
+	"sync"
+	"sync/atomic"
+	"syscall"
+
+	"github.com/cilium/ebpf"
+
+	"github.com/danger-dream/ebpf-firewall/internal/config"
+	"github.com/danger-dream/ebpf-firewall/internal/utils"
+)
+
+const (
+	// BPF_F_NO_PREALLOC from linux/bpf.h, entries are allocated on insert
+	bpfFNoPrealloc = 1 << 0
+	// usage ratio at which a blocklist map is reported as nearly full
+	mapUsageWarning = 0.9
+	// slot of the current instance in the outer maps, see CURRENT_SLOT in xdp.c
+	currentSlot uint32 = 0
+)
+
+// kernel memory estimates per entry, including allocator and node overhead
+const (
+	hashEntryOverhead = 64
+	// an LPM trie may need one intermediate node per inserted prefix
+	trieEntryOverhead = 2 * 48
+)
+
+// MapUsage describes how full a blocklist map is
+type MapUsage struct {
+	Name       string `json:"name"`
+	Entries    int64  `json:"entries"`
+	MaxEntries uint32 `json:"max_entries"`
+	// estimated kernel memory of the current entries and of a full map
+	UsedBytes int64 `json:"used_bytes"`
+	MaxBytes  int64 `json:"max_bytes"`
+}
+
+// ruleMap is a blocklist map with its entry count, the count is kept in user
+// space since all updates go through updateMap. The kernel reads it through
+// an outer array of maps, so a full reload can swap in a new instance.
+type ruleMap struct {
+	name  string
+	outer *ebpf.Map
+	spec  *ebpf.MapSpec
+	// current instance, installed in the outer map
+	mu         sync.RWMutex
+	m          *ebpf.Map
+	maxEntries uint32
+	entryBytes int64
+	entries    atomic.Int64
+	warned     atomic.Bool
+	// generation of the current keys, mirrored to slot of pin_state
+	stateMu    sync.Mutex
+	generation uint64
+	states     *ebpf.Map
+	slot       uint32
+	// keys with an expiry, ordered by it
+	expiryMu sync.Mutex
+	expiring expiryQueue
+}
+
+// keyHash is stable across runs, the generation of a key set is the xor of
+// its key hashes so it can be updated one key at a time
+func keyHash(key []byte) uint64 {
+	h := fnv.New64a()
+	h.Write(key)
+	return h.Sum64()
+}
+
+// keysGeneration returns the generation of keys, which must not contain duplicates
+func keysGeneration(keys [][]byte) uint64 {
+	var generation uint64
+	for _, key := range keys {
+		generation ^= keyHash(key)
+	}
+	return generation
+}
+
+// toggle records that key was inserted or removed
+func (rm *ruleMap) toggle(key []byte, delta int64) {
+	rm.stateMu.Lock()
+	defer rm.stateMu.Unlock()
+	rm.generation ^= keyHash(key)
+	n := rm.entries.Add(delta)
+	rm.saveState()
+	if delta > 0 {
+		rm.checkUsage(n)
+	} else if float64(n) < float64(rm.maxEntries)*mapUsageWarning {
+		rm.warned.Store(false)
+	}
+}
+
+// saveState writes the generation to pin_state, stateMu must be held
+func (rm *ruleMap) saveState() {
+	if rm.states == nil {
+		return
+	}
+	state := xdpMapState{Generation: rm.generation, Entries: uint64(rm.entries.Load())}
+	if err := rm.states.Put(rm.slot, state); err != nil {
+		log.Printf("failed to save state of eBPF map %s: %s", rm.name, err)
+	}
+}
+
+// add inserts key or sets the expiry of the present key, expires is a
+// bpf_ktime_get_coarse_ns time or zero. The generation only covers keys, an
+// expiry changes no generation.
+func (rm *ruleMap) add(key []byte, expires uint64) error {
+	rm.mu.RLock()
+	defer rm.mu.RUnlock()
+	value := rm.value(expires)
+	err := rm.m.Update(key, value, ebpf.UpdateNoExist)
+	if errors.Is(err, ebpf.ErrKeyExist) {
+		err = rm.m.Update(key, value, ebpf.UpdateExist)
+	} else if err == nil {
+		rm.toggle(key, 1)
+	}
+	if errors.Is(err, syscall.E2BIG) || errors.Is(err, syscall.ENOSPC) {
+		return fmt.Errorf("map %s is full (%d entries), raise ebpf.map-size in the config", rm.name, rm.maxEntries)
+	}
+	if err != nil {
+		return err
+	}
+	rm.expiryMu.Lock()
+	rm.schedule(key, expires)
+	rm.expiryMu.Unlock()
+	return nil
+}
+
+// delete removes key, a key the sweeper removed already is no error
+func (rm *ruleMap) delete(key []byte) error {
+	rm.mu.RLock()
+	defer rm.mu.RUnlock()
+	if err := rm.m.Delete(key); err != nil {
+		if errors.Is(err, ebpf.ErrKeyNotExist) {
+			return nil
+		}
+		return err
+	}
+	rm.toggle(key, -1)
+	return nil
+}
+
+func (rm *ruleMap) checkUsage(n int64) {
+	if float64(n) >= float64(rm.maxEntries)*mapUsageWarning && !rm.warned.Swap(true) {
+		log.Printf("eBPF map %s is nearly full: %d of %d entries", rm.name, n, rm.maxEntries)
+	}
+}
+
+// replace fills a new instance with keys and swaps it into the outer map in
+// one update, packets match either the old or the new set but never a mix.
+// When the current instance already holds keys it is kept and only the
+// expiries are written to it, in place and one value at a time, so the
+// kernel ends up with expires even if a crash left it with other ones.
+// keys must not contain duplicates, expires holds the expiry of every key
+// or is nil when none of them expires.
+func (rm *ruleMap) replace(keys [][]byte, expires []uint64) error {
+	if len(keys) > int(rm.maxEntries) {
+		return fmt.Errorf("map %s is full (%d entries), raise ebpf.map-size in the config", rm.name, rm.maxEntries)
+	}
+	generation := keysGeneration(keys)
+	// single updates wait for the swap, otherwise they could land in the old instance
+	rm.mu.Lock()
+	defer rm.mu.Unlock()
+	rm.stateMu.Lock()
+	defer rm.stateMu.Unlock()
+	rm.expiryMu.Lock()
+	rm.expiring = rm.expiring[:0]
+	for i := range expires {
+		rm.schedule(keys[i], expires[i])
+	}
+	rm.expiryMu.Unlock()
+	if rm.m != nil && rm.generation == generation && rm.entries.Load() == int64(len(keys)) {
+		if rm.spec.ValueSize != 8 {
+			// presence values, there is no expiry to bring up to date
+			return nil
+		}
+		if err := rm.batchInsert(rm.m, keys, expires); err != nil {
+			return fmt.Errorf("failed to update expiries of map %s: %s", rm.name, err)
+		}
+		return nil
+	}
+	m, err := ebpf.NewMap(rm.spec)
+	if err != nil {
+		return fmt.Errorf("failed to create map %s: %s", rm.name, err)
+	}
+	if err := rm.batchInsert(m, keys, expires); err != nil {
+		m.Close()
+		return fmt.Errorf("failed to fill map %s: %s", rm.name, err)
+	}
+	if err := rm.outer.Put(currentSlot, m); err != nil {
+		m.Close()
+		return fmt.Errorf("failed to swap map %s: %s", rm.name, err)
+	}
+	if rm.m != nil {
+		// the kernel keeps the old instance alive until running programs are done with it
+		rm.m.Close()
+	}
+	rm.m = m
+	rm.generation = generation
+	rm.entries.Store(int64(len(keys)))
+	rm.saveState()
+	rm.warned.Store(false)
+	rm.checkUsage(int64(len(keys)))
+	return nil
+}
+
+// adopt takes over the instance a previous run left in a pinned outer map.
+// The saved generation is trusted unless it claims an empty map, which is
+// what a state slot that was never written looks like. An instance of the
+// wrong size is copied into a new one, without an instance an empty one is
+// installed.
+func (rm *ruleMap) adopt() error {
+	var inner *ebpf.Map
+	if err := rm.outer.Lookup(currentSlot, &inner); err != nil || inner == nil {
+		return rm.replace(nil, nil)
+	}
+	var state xdpMapState
+	if rm.states != nil {
+		if err := rm.states.Lookup(rm.slot, &state); err != nil {
+			state = xdpMapState{}
+		}
+	}
+	if state.Entries == 0 || inner.MaxEntries() != rm.maxEntries {
+		keys, expires, err := mapEntries(inner)
+		if err != nil {
+			inner.Close()
+			log.Printf("failed to read pinned eBPF map %s: %s", rm.name, err)
+			return rm.replace(nil, nil)
+		}
+		if inner.MaxEntries() != rm.maxEntries {
+			inner.Close()
+			if err := rm.replace(keys, expires); err != nil {
+				log.Printf("failed to resize pinned eBPF map %s: %s", rm.name, err)
+				return rm.replace(nil, nil)
+			}
+			return nil
+		}
+		state = xdpMapState{Generation: keysGeneration(keys), Entries: uint64(len(keys))}
+	}
+	rm.mu.Lock()
+	defer rm.mu.Unlock()
+	rm.stateMu.Lock()
+	defer rm.stateMu.Unlock()
+	rm.m = inner
+	rm.generation = state.Generation
+	rm.entries.Store(int64(state.Entries))
+	rm.saveState()
+	rm.checkUsage(int64(state.Entries))
+	return nil
+}
+
+// mapEntries reads every key of m with its expiry, maps whose entries do not
+// expire return nil expiries
+func mapEntries(m *ebpf.Map) ([][]byte, []uint64, error) {
+	var keys [][]byte
+	var expires []uint64
+	var key, value []byte
+	it := m.Iterate()
+	for it.Next(&key, &value) {
+		keys = append(keys, bytes.Clone(key))
+		if len(value) == 8 {
+			expires = append(expires, binary.NativeEndian.Uint64(value))
+		}
+	}
+	return keys, expires, it.Err()
+}
+
+// values returns the map values of n entries, the expiry of every entry or
+// one byte each in the threat intel tries, whose entries do not expire
+func (rm *ruleMap) values(n int, expires []uint64) any {
+	if rm.spec.ValueSize != 8 {
+		values := make([]uint8, n)
+		for i := range values {
+			values[i] = 1
+		}
+		return values
+	}
+	if expires == nil {
+		return make([]uint64, n)
+	}
+	return expires
+}
+
+// value returns the map value of one entry, see values
+func (rm *ruleMap) value(expires uint64) any {
+	if rm.spec.ValueSize != 8 {
+		return uint8(1)
+	}
+	return expires
+}
+
+// batchInsert writes keys with BPF_MAP_UPDATE_BATCH, kernels or map types
+// without batch support fall back to one update per key
+func (rm *ruleMap) batchInsert(m *ebpf.Map, keys [][]byte, expires []uint64) error {
+	if len(keys) == 0 {
+		return nil
+	}
+	values := rm.values(len(keys), expires)
+	_, err := m.BatchUpdate(batchKeys(keys), values, nil)
+	if !errors.Is(err, ebpf.ErrNotSupported) {
+		return err
+	}
+	batch := reflect.ValueOf(values)
+	for i, key := range keys {
+		if err := m.Put(key, batch.Index(i).Interface()); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// batchKeys packs equally sized keys into a slice of byte arrays, the layout
+// BatchUpdate expects for its keys
+func batchKeys(keys [][]byte) any {
+	batch := reflect.MakeSlice(reflect.SliceOf(reflect.ArrayOf(len(keys[0]), reflect.TypeOf(byte(0)))), len(keys), len(keys))
+	for i, key := range keys {
+		reflect.Copy(batch.Index(i), reflect.ValueOf(key))
+	}
+	return batch.Interface()
+}
+
+func (rm *ruleMap) usage() MapUsage {
+	entries := rm.entries.Load()
+	return MapUsage{
+		Name:       rm.name,
+		Entries:    entries,
+		MaxEntries: rm.maxEntries,
+		UsedBytes:  entries * rm.entryBytes,
+		MaxBytes:   int64(rm.maxEntries) * rm.entryBytes,
+	}
+}
+
+// blocklist maps in xdp.c with the config that sizes them
+var ruleMapSizes = []struct {
+	name   string
+	iptype utils.IPType
+	size   func(config.MapSizeConfig) int
+}{
+	{"ipv4_list", utils.IPTypeIPv4, func(c config.MapSizeConfig) int { return c.IPv4 }},
+	{"ipv4_cidr_trie", utils.IPTypeIPV4CIDR, func(c config.MapSizeConfig) int { return c.IPv4CIDR }},
+	{"ipv6_list", utils.IPTypeIPv6, func(c config.MapSizeConfig) int { return c.IPv6 }},
+	{"ipv6_cidr_trie", utils.IPTypeIPv6CIDR, func(c config.MapSizeConfig) int { return c.IPv6CIDR }},
+	{"mac_list", utils.IPTypeMAC, func(c config.MapSizeConfig) int { return c.MAC }},
+}
+
+// threat intelligence tries in xdp.c with the config that sizes them
+var intelMapSizes = []struct {
+	name string
+	size func(config.MapSizeConfig) int
+}{
+	{"intel_ipv4_trie", func(c config.MapSizeConfig) int { return c.IntelIPv4 }},
+	{"intel_ipv6_trie", func(c config.MapSizeConfig) int { return c.IntelIPv6 }},
+}
+
+// geo tries in xdp.c with the config that sizes them
+var geoMapSizes = []struct {
+	name string
+	size func(config.MapSizeConfig) int
+}{
+	{"geo_ipv4_trie", func(c config.MapSizeConfig) int { return c.GeoIPv4 }},
+	{"geo_ipv6_trie", func(c config.MapSizeConfig) int { return c.GeoIPv6 }},
+}
+
+// tuple rule tries in xdp.c, both are sized by MapSizeConfig.Tuple
+var tupleMapNames = []string{"tuple_ipv4_trie", "tuple_ipv6_trie"}
+
+// configureMapSizes applies the configured blocklist sizes to the inner map
+// specs before they are loaded. None of the maps is preallocated, so a large
+// limit only costs memory once entries are inserted.
+func configureMapSizes(spec *ebpf.CollectionSpec, sizes config.MapSizeConfig) error {
+	resize := func(name string, size int) error {
+		ms, ok := spec.Maps[name]
+		if !ok || ms.InnerMap == nil {
+			return fmt.Errorf("map %s not found in eBPF spec", name)
+		}
+		ms.InnerMap.MaxEntries = uint32(size)
+		ms.InnerMap.Flags |= bpfFNoPrealloc
+		return nil
+	}
+	for _, rm := range ruleMapSizes {
+		if err := resize(rm.name, rm.size(sizes)); err != nil {
+			return err
+		}
+	}
+	for _, im := range intelMapSizes {
+		if err := resize(im.name, im.size(sizes)); err != nil {
+			return err
+		}
+	}
+	for _, gm := range geoMapSizes {
+		if err := resize(gm.name, gm.size(sizes)); err != nil {
+			return err
+		}
+	}
+	for _, name := range tupleMapNames {
+		if err := resize(name, sizes.Tuple); err != nil {
+			return err
+		}
+	}
+	// the port sets are a plain array, only its length changes
+	ms, ok := spec.Maps["port_sets"]
+	if !ok {
+		return fmt.Errorf("map port_sets not found in eBPF spec")
+	}
+	ms.MaxEntries = uint32(sizes.PortSets)
+	return nil
+}
+
+// estimated kernel memory of one entry of a map
+func entryBytes(ms *ebpf.MapSpec) int64 {
+	overhead := int64(hashEntryOverhead)
+	if ms.Type == ebpf.LPMTrie {
+		overhead = trieEntryOverhead
+	}
+	align := func(n uint32) int64 { return int64((n + 7) &^ 7) }
+	return overhead + align(ms.KeySize) + align(ms.ValueSize)
+}
+
+// returns the blocklist maps of the loaded objects keyed by rule type, with
+// the pinned instances adopted and empty ones installed otherwise
+func newRuleMaps(spec *ebpf.CollectionSpec, objects *xdpObjects) (map[utils.IPType]*ruleMap, error) {
+	loaded := map[utils.IPType]*ebpf.Map{
+		utils.IPTypeIPv4:     objects.Ipv4List,
+		utils.IPTypeIPV4CIDR: objects.Ipv4CidrTrie,
+		utils.IPTypeIPv6:     objects.Ipv6List,
+		utils.IPTypeIPv6CIDR: objects.Ipv6CidrTrie,
+		utils.IPTypeMAC:      objects.MacList,
+	}
+	maps := make(map[utils.IPType]*ruleMap, len(ruleMapSizes))
+	for i, rm := range ruleMapSizes {
+		m, err := newRuleMap(spec, rm.name, loaded[rm.iptype], objects.PinState, ruleStateSlot(i))
+		if err != nil {
+			return nil, err
+		}
+		maps[rm.iptype] = m
+	}
+	return maps, nil
+}
+
+func newRuleMap(spec *ebpf.CollectionSpec, name string, outer, states *ebpf.Map, slot uint32) (*ruleMap, error) {
+	inner := spec.Maps[name].InnerMap
+	rm := &ruleMap{
+		name:       name,
+		outer:      outer,
+		spec:       inner,
+		maxEntries: inner.MaxEntries,
+		entryBytes: entryBytes(inner),
+		states:     states,
+		slot:       slot,
+	}
+	if err := rm.adopt(); err != nil {
+		return nil, err
+	}
+	return rm, nil
+}
+
+func (rm *ruleMap) close() {
+	rm.mu.Lock()
+	defer rm.mu.Unlock()
+	if rm.m != nil {
+		rm.m.Close()
+		rm.m = nil
+	}
+}
+
+// GetMapUsage reports the fill level and estimated memory of the blocklist, threat intelligence, geo and tuple rule maps
+func (em *EBPFManager) GetMapUsage() []MapUsage {
+	usage := make([]MapUsage, 0, len(ruleMapSizes)+len(intelMapSizes)+len(geoMapSizes))
+	for _, rm := range ruleMapSizes {
+		if m, ok := em.ruleMaps[rm.iptype]; ok {
+			usage = append(usage, m.usage())
+		}
+	}
+	usage = append(usage, em.intel.usage()...)
+	usage = append(usage, em.geo.usage()...)
+	return append(usage, em.tuples.usage()...)
+}
@@ -0,0 +1,137 @@
+package ebpf
+
+import (
+	"bytes"
+	"net/netip"
+	"testing"
+
+	"github.com/cilium/ebpf"
+
+	"github.com/danger-dream/ebpf-firewall/internal/config"
+)
+
+func TestConfigureMapSizes(t *testing.T) {
+	spec := &ebpf.CollectionSpec{Maps: map[string]*ebpf.MapSpec{}}
+	for _, rm := range ruleMapSizes {
+		spec.Maps[rm.name] = &ebpf.MapSpec{Name: rm.name, MaxEntries: 1, InnerMap: &ebpf.MapSpec{MaxEntries: 1024}}
+	}
+	for _, im := range intelMapSizes {
+		spec.Maps[im.name] = &ebpf.MapSpec{Name: im.name, MaxEntries: 1, InnerMap: &ebpf.MapSpec{MaxEntries: 1024}}
+	}
+	for _, gm := range geoMapSizes {
+		spec.Maps[gm.name] = &ebpf.MapSpec{Name: gm.name, MaxEntries: 1, InnerMap: &ebpf.MapSpec{MaxEntries: 1024}}
+	}
+	for _, name := range tupleMapNames {
+		spec.Maps[name] = &ebpf.MapSpec{Name: name, MaxEntries: 1, InnerMap: &ebpf.MapSpec{MaxEntries: 1024}}
+	}
+	spec.Maps["port_sets"] = &ebpf.MapSpec{Name: "port_sets", MaxEntries: 64}
+	sizes := config.MapSizeConfig{IPv4: 2000000, IPv4CIDR: 500000, IPv6: 100, IPv6CIDR: 200, MAC: 300, IntelIPv4: 400, IntelIPv6: 500, GeoIPv4: 700, GeoIPv6: 800, Tuple: 600, PortSets: 32}
+	if err := configureMapSizes(spec, sizes); err != nil {
+		t.Fatal(err)
+	}
+	want := map[string]uint32{
+		"ipv4_list":       2000000,
+		"ipv4_cidr_trie":  500000,
+		"ipv6_list":       100,
+		"ipv6_cidr_trie":  200,
+		"mac_list":        300,
+		"intel_ipv4_trie": 400,
+		"intel_ipv6_trie": 500,
+		"geo_ipv4_trie":   700,
+		"geo_ipv6_trie":   800,
+		"tuple_ipv4_trie": 600,
+		"tuple_ipv6_trie": 600,
+	}
+	for name, size := range want {
+		if spec.Maps[name].MaxEntries != 1 {
+			t.Errorf("%s outer map was resized", name)
+		}
+		ms := spec.Maps[name].InnerMap
+		if ms.MaxEntries != size {
+			t.Errorf("%s max entries = %d, want %d", name, ms.MaxEntries, size)
+		}
+		if ms.Flags&bpfFNoPrealloc == 0 {
+			t.Errorf("%s is preallocated", name)
+		}
+	}
+
+	delete(spec.Maps, "mac_list")
+	if err := configureMapSizes(spec, sizes); err == nil {
+		t.Fatal("missing map was not reported")
+	}
+}
+
+func TestPrefixKey(t *testing.T) {
+	v4 := prefixKey(netip.MustParsePrefix("192.0.2.0/24"))
+	if want := []byte{24, 0, 0, 0, 192, 0, 2, 0}; !bytes.Equal(v4, want) {
+		t.Errorf("ipv4 key = %v, want %v", v4, want)
+	}
+	v6 := prefixKey(netip.MustParsePrefix("2001:db8::/32"))
+	if len(v6) != 20 || v6[0] != 32 || v6[4] != 0x20 || v6[5] != 0x01 {
+		t.Errorf("ipv6 key = %v", v6)
+	}
+}
+
+func TestBatchKeys(t *testing.T) {
+	keys := [][]byte{{1, 2, 3, 4, 5, 6}, {7, 8, 9, 10, 11, 12}}
+	batch, ok := batchKeys(keys).([][6]byte)
+	if !ok {
+		t.Fatalf("batch keys type = %T, want [][6]byte", batchKeys(keys))
+	}
+	if len(batch) != 2 || batch[0] != [6]byte{1, 2, 3, 4, 5, 6} || batch[1] != [6]byte{7, 8, 9, 10, 11, 12} {
+		t.Errorf("batch keys = %v", batch)
+	}
+}
+
+func TestKeysGeneration(t *testing.T) {
+	a, b := []byte{10, 0, 0, 1}, []byte{10, 0, 0, 2}
+	if keysGeneration([][]byte{a, b}) != keysGeneration([][]byte{b, a}) {
+		t.Error("generation depends on key order")
+	}
+	if keysGeneration([][]byte{a, b})^keyHash(b) != keysGeneration([][]byte{a}) {
+		t.Error("removing a key does not restore the previous generation")
+	}
+	if keysGeneration(nil) != 0 {
+		t.Error("empty key set has a generation")
+	}
+}
+
+func TestPinnedMaps(t *testing.T) {
+	for _, name := range pinnedMaps() {
+		// BPF_OBJ_NAME_LEN includes the terminating zero
+		if len(name) > 15 {
+			t.Errorf("map name %s is too long to be pinned by name", name)
+		}
+	}
+	if last := geoStateSlot(len(geoMapSizes) - 1); last >= linkStateSlot {
+		t.Errorf("state slot %d collides with the link slot", last)
+	}
+}
+
+func TestParseLinkPin(t *testing.T) {
+	iface, mode, ok := parseLinkPin(linkPinName("br-lan", "generic"))
+	if !ok || iface != "br-lan" || mode != "generic" {
+		t.Errorf("parseLinkPin() = %q, %q, %v, want br-lan, generic", iface, mode, ok)
+	}
+	for _, name := range []string{legacyLinkPinName, "link-", "link--driver", "pin_state"} {
+		if _, _, ok := parseLinkPin(name); ok {
+			t.Errorf("parseLinkPin(%q) parsed a link pin", name)
+		}
+	}
+}
+
+func TestDiffPrefixes(t *testing.T) {
+	a := netip.MustParsePrefix("192.0.2.0/24")
+	b := netip.MustParsePrefix("198.51.100.0/24")
+	c := netip.MustParsePrefix("2001:db8::/32")
+	added, removed := diffPrefixes([]netip.Prefix{a, b}, []netip.Prefix{b, c})
+	if len(added) != 1 || added[0] != c {
+		t.Errorf("added = %v, want %v", added, c)
+	}
+	if len(removed) != 1 || removed[0] != a {
+		t.Errorf("removed = %v, want %v", removed, a)
+	}
+	if added, removed := diffPrefixes([]netip.Prefix{a}, []netip.Prefix{a}); added != nil || removed != nil {
+		t.Errorf("equal sets differ by %v and %v", added, removed)
+	}
+}
@@ -0,0 +1,211 @@
+package ebpf
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"os"
+	"path/filepath"
+	"slices"
+	"strings"
+
+	cfg "github.com/danger-dream/ebpf-firewall/internal/config"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/link"
+)
+
+const (
+	// pinned XDP links are named linkPinPrefix<interface>-<attach mode>
+	linkPinPrefix = "link-"
+	// file name of the single link pinned by older versions
+	legacyLinkPinName = "link"
+	// pin_state slot holding the attach mode of the legacy link, the last
+	// one of MAX_MAP_STATES in xdp.c
+	linkStateSlot uint32 = 15
+)
+
+// attach modes in the order attachXDP tries them
+var linkTypes = []string{"offload", "driver", "generic"}
+
+// pin_state slot of the blocklist map ruleMapSizes[i]
+func ruleStateSlot(i int) uint32 {
+	return uint32(i)
+}
+
+// pin_state slot of the threat intel trie intelMapSizes[i]
+func intelStateSlot(i int) uint32 {
+	return uint32(len(ruleMapSizes) + i)
+}
+
+// pin_state slot of the geo trie geoMapSizes[i]
+func geoStateSlot(i int) uint32 {
+	return uint32(len(ruleMapSizes) + len(intelMapSizes) + i)
+}
+
+// maps kept in bpffs across restarts, the others are recreated with the program
+func pinnedMaps() []string {
+	names := make([]string, 0, len(ruleMapSizes)+len(intelMapSizes)+len(geoMapSizes)+2)
+	for _, rm := range ruleMapSizes {
+		names = append(names, rm.name)
+	}
+	for _, im := range intelMapSizes {
+		names = append(names, im.name)
+	}
+	for _, gm := range geoMapSizes {
+		names = append(names, gm.name)
+	}
+	// AF_XDP sockets registered by an analyzer outlive restarts
+	return append(names, "pin_state", "xsks_map")
+}
+
+func linkPinName(iface, mode string) string {
+	return linkPinPrefix + iface + "-" + mode
+}
+
+// parseLinkPin returns the interface and attach mode of a pinned link,
+// interface names may contain dashes but attach modes do not
+func parseLinkPin(name string) (iface, mode string, ok bool) {
+	rest, ok := strings.CutPrefix(name, linkPinPrefix)
+	i := strings.LastIndexByte(rest, '-')
+	if !ok || i <= 0 {
+		return "", "", false
+	}
+	return rest[:i], rest[i+1:], true
+}
+
+// loadObjects loads the program, reusing the maps pinned under the pin path.
+// Pinned maps of an incompatible layout, left by an older version, are
+// replaced. Pinning is skipped if the pin path cannot be created, e.g. when
+// bpffs is not mounted.
+func (em *EBPFManager) loadObjects(spec *ebpf.CollectionSpec) (*xdpObjects, error) {
+	var objects xdpObjects
+	if em.pinPath != "" {
+		if err := os.MkdirAll(em.pinPath, 0700); err != nil {
+			log.Printf("failed to create pin path %s, maps are not pinned: %s", em.pinPath, err.Error())
+			em.pinPath = ""
+		}
+	}
+	if em.pinPath == "" {
+		return &objects, spec.LoadAndAssign(&objects, nil)
+	}
+	for _, name := range pinnedMaps() {
+		if ms, ok := spec.Maps[name]; ok {
+			ms.Pinning = ebpf.PinByName
+		}
+	}
+	opts := &ebpf.CollectionOptions{Maps: ebpf.MapOptions{PinPath: em.pinPath}}
+	var err error
+	if name, stale := em.staleInnerMap(spec); stale {
+		err = fmt.Errorf("%w: instance of %s has another value size", ebpf.ErrMapIncompatible, name)
+	} else {
+		err = spec.LoadAndAssign(&objects, opts)
+	}
+	if errors.Is(err, ebpf.ErrMapIncompatible) {
+		log.Printf("pinned eBPF maps are incompatible, recreating them: %s", err.Error())
+		for _, name := range pinnedMaps() {
+			os.Remove(filepath.Join(em.pinPath, name))
+		}
+		err = spec.LoadAndAssign(&objects, opts)
+	}
+	return &objects, err
+}
+
+// staleInnerMap reports the first pinned outer map whose instance has another
+// value size than the spec, e.g. a blocklist map from before entries carried
+// an expiry. Loading only compares the outer maps, the instance would fail
+// to be swapped later.
+func (em *EBPFManager) staleInnerMap(spec *ebpf.CollectionSpec) (string, bool) {
+	for _, name := range pinnedMaps() {
+		ms, ok := spec.Maps[name]
+		if !ok || ms.InnerMap == nil {
+			continue
+		}
+		outer, err := ebpf.LoadPinnedMap(filepath.Join(em.pinPath, name), nil)
+		if err != nil {
+			continue
+		}
+		var inner *ebpf.Map
+		stale := outer.Lookup(currentSlot, &inner) == nil && inner != nil &&
+			inner.ValueSize() != ms.InnerMap.ValueSize
+		if inner != nil {
+			inner.Close()
+		}
+		outer.Close()
+		if stale {
+			return name, true
+		}
+	}
+	return "", false
+}
+
+// adoptPinnedLinks replaces the program of the links a previous run pinned,
+// the interfaces keep filtering while the daemon restarts. Links of
+// interfaces that are no longer configured, or pinned with another mode than
+// the configured one, are detached.
+func (em *EBPFManager) adoptPinnedLinks(ifaces []cfg.InterfaceConfig, indexes []int) map[string]xdpLink {
+	adopted := make(map[string]xdpLink)
+	if em.pinPath == "" {
+		return adopted
+	}
+	entries, err := os.ReadDir(em.pinPath)
+	if err != nil {
+		return adopted
+	}
+	for _, entry := range entries {
+		var name, mode string
+		if entry.Name() == legacyLinkPinName {
+			// matched by ifindex alone and pinned again under its new name
+			mode = em.pinnedLinkType()
+		} else if iface, m, ok := parseLinkPin(entry.Name()); ok {
+			name, mode = iface, m
+		} else {
+			continue
+		}
+		l, err := link.LoadPinnedLink(filepath.Join(em.pinPath, entry.Name()), nil)
+		if err != nil {
+			continue
+		}
+		i := -1
+		if info, err := l.Info(); err == nil && info.XDP() != nil {
+			i = slices.Index(indexes, int(info.XDP().Ifindex))
+		}
+		if i >= 0 && (name == "" || name == ifaces[i].Name) && (ifaces[i].Mode == cfg.AttachModeAuto || ifaces[i].Mode == mode) {
+			if _, dup := adopted[ifaces[i].Name]; !dup {
+				err := l.Update(em.objects.XdpProg)
+				if err == nil {
+					if name == "" {
+						em.pinLink(l, ifaces[i].Name, mode)
+					}
+					adopted[ifaces[i].Name] = xdpLink{iface: ifaces[i].Name, mode: mode, link: l}
+					log.Printf("XDP program replaced on pinned link of %s, current mode: %s", ifaces[i].Name, mode)
+					continue
+				}
+				log.Printf("failed to update pinned XDP link of %s: %s", ifaces[i].Name, err.Error())
+			}
+		}
+		l.Unpin()
+		l.Close()
+	}
+	return adopted
+}
+
+// pinLink pins a link so it outlives the daemon, a link that is pinned
+// already is renamed
+func (em *EBPFManager) pinLink(l link.Link, iface, mode string) {
+	if em.pinPath == "" {
+		return
+	}
+	if err := l.Pin(filepath.Join(em.pinPath, linkPinName(iface, mode))); err != nil {
+		log.Printf("failed to pin XDP link of %s: %s", iface, err.Error())
+	}
+}
+
+// pinnedLinkType returns the attach mode of the legacy link
+func (em *EBPFManager) pinnedLinkType() string {
+	var state xdpMapState
+	if err := em.objects.PinState.Lookup(linkStateSlot, &state); err == nil && state.Generation > 0 && state.Generation <= uint64(len(linkTypes)) {
+		return linkTypes[state.Generation-1]
+	}
+	return "pinned"
+}
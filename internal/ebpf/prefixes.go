@@ -0,0 +1,180 @@
+package ebpf
+
+import (
+	"encoding/binary"
+	"errors"
+	"net/netip"
+	"sync"
+
+	"github.com/cilium/ebpf"
+)
+
+// prefixTries holds a prefix set loaded into a pair of IPv4 and IPv6 LPM
+// tries, the threat intel indicators and the blocked geo networks. The wanted
+// set outlives the loaded objects, so it is written again when the program is
+// restarted.
+type prefixTries struct {
+	mu     sync.Mutex
+	v4, v6 *ruleMap
+	// nil until a set was given, or after a patch failed
+	wanted []netip.Prefix
+}
+
+// attach adopts the tries named names, their pin state is kept in slots of states
+func (pt *prefixTries) attach(spec *ebpf.CollectionSpec, names [2]string, outer [2]*ebpf.Map, states *ebpf.Map, slots [2]uint32) error {
+	pt.mu.Lock()
+	defer pt.mu.Unlock()
+	v4, err := newRuleMap(spec, names[0], outer[0], states, slots[0])
+	if err != nil {
+		return err
+	}
+	v6, err := newRuleMap(spec, names[1], outer[1], states, slots[1])
+	if err != nil {
+		v4.close()
+		return err
+	}
+	pt.v4, pt.v6 = v4, v6
+	if pt.wanted == nil {
+		// no set was given yet, keep what a previous run pinned
+		return nil
+	}
+	return pt.swap()
+}
+
+func (pt *prefixTries) detach() {
+	pt.mu.Lock()
+	defer pt.mu.Unlock()
+	if pt.v4 != nil {
+		pt.v4.close()
+		pt.v6.close()
+	}
+	pt.v4, pt.v6 = nil, nil
+}
+
+// uniquePrefixes returns the masked valid prefixes without duplicates
+func uniquePrefixes(prefixes []netip.Prefix) []netip.Prefix {
+	seen := make(map[netip.Prefix]struct{}, len(prefixes))
+	unique := make([]netip.Prefix, 0, len(prefixes))
+	for _, p := range prefixes {
+		if !p.IsValid() {
+			continue
+		}
+		p = p.Masked()
+		if _, ok := seen[p]; !ok {
+			seen[p] = struct{}{}
+			unique = append(unique, p)
+		}
+	}
+	return unique
+}
+
+func (pt *prefixTries) replace(prefixes []netip.Prefix) error {
+	wanted := uniquePrefixes(prefixes)
+	pt.mu.Lock()
+	defer pt.mu.Unlock()
+	pt.wanted = wanted
+	if pt.v4 == nil {
+		// not loaded yet, attach writes the set
+		return nil
+	}
+	return pt.swap()
+}
+
+// update changes the loaded tries to hold prefixes. A small change is patched
+// into the current instances, new prefixes are added before the old ones are
+// deleted so an address in both sets is never let through. A change of more
+// than half of the set swaps the tries like replace.
+func (pt *prefixTries) update(prefixes []netip.Prefix) error {
+	wanted := uniquePrefixes(prefixes)
+	pt.mu.Lock()
+	defer pt.mu.Unlock()
+	old := pt.wanted
+	pt.wanted = wanted
+	if pt.v4 == nil {
+		return nil
+	}
+	if old == nil {
+		// the pinned tries hold an unknown set
+		return pt.swap()
+	}
+	added, removed := diffPrefixes(old, wanted)
+	if len(added)+len(removed) > len(wanted)/2 {
+		return pt.swap()
+	}
+	var errs []error
+	for _, p := range added {
+		if err := pt.trie(p).add(prefixKey(p), 0); err != nil {
+			errs = append(errs, err)
+		}
+	}
+	for _, p := range removed {
+		if err := pt.trie(p).delete(prefixKey(p)); err != nil {
+			errs = append(errs, err)
+		}
+	}
+	if len(errs) > 0 {
+		// the tries are swapped by the next update
+		pt.wanted = nil
+	}
+	return errors.Join(errs...)
+}
+
+// diffPrefixes returns the prefixes of to missing from from and the prefixes of from missing from to
+func diffPrefixes(from, to []netip.Prefix) (added, removed []netip.Prefix) {
+	present := make(map[netip.Prefix]struct{}, len(from))
+	for _, p := range from {
+		present[p] = struct{}{}
+	}
+	for _, p := range to {
+		if _, ok := present[p]; ok {
+			delete(present, p)
+		} else {
+			added = append(added, p)
+		}
+	}
+	for _, p := range from {
+		if _, ok := present[p]; ok {
+			removed = append(removed, p)
+		}
+	}
+	return added, removed
+}
+
+func (pt *prefixTries) trie(p netip.Prefix) *ruleMap {
+	if p.Addr().Is4() {
+		return pt.v4
+	}
+	return pt.v6
+}
+
+// swap installs new tries holding the wanted set, each family is switched in one update
+func (pt *prefixTries) swap() error {
+	var v4, v6 [][]byte
+	for _, p := range pt.wanted {
+		if p.Addr().Is4() {
+			v4 = append(v4, prefixKey(p))
+		} else {
+			v6 = append(v6, prefixKey(p))
+		}
+	}
+	return errors.Join(pt.v4.replace(v4, nil), pt.v6.replace(v6, nil))
+}
+
+func (pt *prefixTries) usage() []MapUsage {
+	pt.mu.Lock()
+	defer pt.mu.Unlock()
+	if pt.v4 == nil {
+		return nil
+	}
+	return []MapUsage{pt.v4.usage(), pt.v6.usage()}
+}
+
+// prefixKey encodes p as ipv4_trie_key or ipv6_trie_key, the prefix length is
+// written the same way as the blocklist CIDR keys in utils.ParseValueToBytes
+func prefixKey(p netip.Prefix) []byte {
+	addr := p.Addr().AsSlice()
+	key := make([]byte, 4+len(addr))
+	binary.LittleEndian.PutUint32(key, uint32(p.Bits()))
+	copy(key[4:], addr)
+	return key
+}
@@ -0,0 +1,117 @@
+package ebpf
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"os"
+	"runtime"
+	"time"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/ringbuf"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// upper bound of the ring buffer shards, see MAX_RB_SHARDS in xdp.c
+const maxReaderShards = 256
+
+// readerShard is one ring buffer shard of the per-cpu reader mode, only its
+// own reader thread touches the record and the counters
+type readerShard struct {
+	rb     *ebpf.Map
+	reader *ringbuf.Reader
+	record ringbuf.Record
+	stats  eventStats
+	// keeps the counters of neighbouring shards off this cache line
+	_ [64]byte
+}
+
+// readerShardCount returns one shard per possible CPU, the kernel picks the
+// shard by CPU id so CPUs that are offline now still need one
+func readerShardCount() int {
+	n, err := ebpf.PossibleCPU()
+	if err != nil {
+		n = runtime.NumCPU()
+	}
+	return min(n, maxReaderShards)
+}
+
+// shardRingSize splits the ring buffer size over the shards, a shard stays a
+// power of two multiple of the page size
+func shardRingSize(ringBufSize, shards int) int {
+	size := os.Getpagesize()
+	for size*2 <= ringBufSize/shards {
+		size *= 2
+	}
+	return size
+}
+
+// openShards creates the ring buffer of every shard and its reader
+func (em *EBPFManager) openShards(spec *ebpf.CollectionSpec, count int) error {
+	inner := spec.Maps["rb_shard_events"].InnerMap
+	for i := 0; i < count; i++ {
+		rb, err := ebpf.NewMap(inner)
+		if err != nil {
+			return fmt.Errorf("failed to create ring buffer shard %d: %s", i, err.Error())
+		}
+		shard := &readerShard{rb: rb}
+		em.shards = append(em.shards, shard)
+		if err := em.objects.RbShardEvents.Put(uint32(i), rb); err != nil {
+			return fmt.Errorf("failed to install ring buffer shard %d: %s", i, err.Error())
+		}
+		if shard.reader, err = ringbuf.NewReader(rb); err != nil {
+			return fmt.Errorf("failed to create ring buffer reader of shard %d: %s", i, err.Error())
+		}
+	}
+	return nil
+}
+
+func (em *EBPFManager) closeShards() {
+	for _, shard := range em.shards {
+		if shard.reader != nil {
+			shard.reader.Close()
+		}
+		shard.rb.Close()
+	}
+	em.shards = nil
+}
+
+// monitorShard drains shard i on a locked thread and processes every event on
+// it, so an event is handled by the CPU that produced it when cpu-affinity is set
+func (em *EBPFManager) monitorShard(i int, process func(*types.PacketInfo)) {
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+	if em.cpuAffinity {
+		if err := setCPUAffinity(i); err != nil {
+			log.Printf("failed to pin reader of shard %d to its CPU: %s", i, err.Error())
+		}
+	}
+	shard := em.shards[i]
+	for {
+		select {
+		case <-em.done:
+			return
+		default:
+		}
+		shard.reader.SetDeadline(time.Now().Add(eventFlushInterval))
+		if err := shard.reader.ReadInto(&shard.record); err != nil {
+			if errors.Is(err, os.ErrDeadlineExceeded) {
+				continue
+			}
+			if errors.Is(err, ringbuf.ErrClosed) {
+				return
+			}
+			continue
+		}
+		shard.stats.received.Add(1)
+		pi := types.AcquirePacketInfo()
+		if err := decodePacketInfo(shard.record.RawSample, pi); err != nil {
+			types.ReleasePacketInfo(pi)
+			shard.stats.decodeErrors.Add(1)
+			continue
+		}
+		process(pi)
+	}
+}
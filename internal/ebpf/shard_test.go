@@ -0,0 +1,26 @@
+package ebpf
+
+import (
+	"os"
+	"testing"
+)
+
+func TestShardRingSize(t *testing.T) {
+	page := os.Getpagesize()
+	tests := []struct {
+		ringBufSize, shards, want int
+	}{
+		{1 << 24, 1, 1 << 24},
+		{1 << 24, 4, 1 << 22},
+		// not a power of two per shard, rounded down
+		{1 << 24, 3, 1 << 22},
+		{1 << 24, 256, 1 << 16},
+		// never below one page
+		{page, 64, page},
+	}
+	for _, tt := range tests {
+		if got := shardRingSize(tt.ringBufSize, tt.shards); got != tt.want {
+			t.Errorf("shardRingSize(%d, %d) = %d, want %d", tt.ringBufSize, tt.shards, got, tt.want)
+		}
+	}
+}
@@ -0,0 +1,49 @@
+package ebpf
+
+import (
+	"errors"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// KernelStats are the packet counters of xdp_prog summed over all CPUs, they
+// are counted in the kernel and so never miss a packet the reader lost
+type KernelStats struct {
+	RX   uint64 `json:"rx"`
+	Pass uint64 `json:"pass"`
+	// dropped packets by match type
+	Drop           map[types.MatchType]uint64 `json:"drop"`
+	ParseErrors    uint64                     `json:"parse_errors"`
+	ExportFailures uint64                     `json:"export_failures"`
+	// packets handed to an AF_XDP socket
+	Redirect uint64 `json:"redirect"`
+}
+
+// GetKernelStats reads the per-CPU counters of the stats map
+func (em *EBPFManager) GetKernelStats() (KernelStats, error) {
+	if em.objects == nil {
+		return KernelStats{}, errors.New("eBPF program is not loaded")
+	}
+	var perCPU []xdpXdpStats
+	if err := em.objects.Stats.Lookup(uint32(0), &perCPU); err != nil {
+		return KernelStats{}, err
+	}
+	return sumKernelStats(perCPU), nil
+}
+
+func sumKernelStats(perCPU []xdpXdpStats) KernelStats {
+	stats := KernelStats{Drop: make(map[types.MatchType]uint64)}
+	for _, cpu := range perCPU {
+		stats.RX += cpu.Rx
+		stats.Pass += cpu.Pass
+		stats.ParseErrors += cpu.ParseErrors
+		stats.ExportFailures += cpu.ExportFailures
+		stats.Redirect += cpu.Redirect
+		for matchType, n := range cpu.Drop {
+			if n > 0 {
+				stats.Drop[types.MatchType(matchType)] += n
+			}
+		}
+	}
+	return stats
+}
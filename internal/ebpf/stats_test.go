@@ -0,0 +1,21 @@
+package ebpf
+
+import (
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func TestSumKernelStats(t *testing.T) {
+	perCPU := []xdpXdpStats{
+		{Rx: 10, Pass: 7, ParseErrors: 1, Drop: [9]uint64{types.MatchByIP4Exact: 2, types.MatchByIntel: 1}},
+		{Rx: 6, Pass: 4, ExportFailures: 3, Redirect: 1, Drop: [9]uint64{types.MatchByIntel: 1}},
+	}
+	stats := sumKernelStats(perCPU)
+	if stats.RX != 16 || stats.Pass != 11 || stats.ParseErrors != 1 || stats.ExportFailures != 3 || stats.Redirect != 1 {
+		t.Errorf("sumKernelStats() = %+v", stats)
+	}
+	if len(stats.Drop) != 2 || stats.Drop[types.MatchByIP4Exact] != 2 || stats.Drop[types.MatchByIntel] != 2 {
+		t.Errorf("drops = %v, want 2 exact IPv4 and 2 intel", stats.Drop)
+	}
+}
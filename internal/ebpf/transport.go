@@ -0,0 +1,148 @@
+package ebpf
+
+import (
+	"errors"
+	"fmt"
+	"log"
+	"os"
+	"sync/atomic"
+	"time"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/features"
+
+	"github.com/danger-dream/ebpf-firewall/internal/config"
+	"github.com/danger-dream/ebpf-firewall/internal/utils"
+)
+
+const (
+	// size of a packet_info record in the ring buffer, including the 8 byte record header
+	eventRecordSize = packetInfoSize + 8
+	// with batched wakeups the kernel may leave records pending, drain them at least this often
+	eventFlushInterval = 100 * time.Millisecond
+)
+
+// EventStats describes the health of the kernel to user space event channel
+type EventStats struct {
+	Transport string `json:"transport"`
+	// records read from the transport
+	Received uint64 `json:"received"`
+	// records the perf buffers overwrote before they were read
+	Lost uint64 `json:"lost"`
+	// records the kernel could not export (ring buffer full, perf output failure)
+	Dropped uint64 `json:"dropped"`
+	// records that could not be decoded
+	DecodeErrors uint64 `json:"decode_errors"`
+	// user space queue between the reader and the workers
+	Pool utils.PoolStats `json:"pool"`
+	// ring buffer shards read by their own thread, 0 with a shared reader
+	ReaderShards int `json:"reader_shards"`
+}
+
+type eventStats struct {
+	received     atomic.Uint64
+	lost         atomic.Uint64
+	decodeErrors atomic.Uint64
+}
+
+// selectTransport resolves the configured transport against the running kernel
+func selectTransport(transport string) string {
+	if transport == config.TransportPerf {
+		return config.TransportPerf
+	}
+	if err := features.HaveMapType(ebpf.RingBuf); err != nil {
+		if transport == config.TransportRingBuf {
+			log.Printf("ring buffer is not supported by the kernel, falling back to perf event array: %s", err.Error())
+		}
+		return config.TransportPerf
+	}
+	return config.TransportRingBuf
+}
+
+// configureTransport prepares the collection spec for the selected transport,
+// shards > 0 splits the ring buffer into shards of ringBufSize/shards bytes
+func configureTransport(spec *ebpf.CollectionSpec, transport string, ringBufSize int, shards int) error {
+	useRingBuf := uint32(0)
+	shardEvents := spec.Maps["rb_shard_events"]
+	if transport == config.TransportRingBuf {
+		useRingBuf = 1
+		spec.Maps["rb_events"].MaxEntries = uint32(ringBufSize)
+		// the unused side is kept as small as the kernel allows
+		shardEvents.MaxEntries = 1
+		shardEvents.InnerMap.MaxEntries = uint32(os.Getpagesize())
+		if shards > 0 {
+			spec.Maps["rb_events"].MaxEntries = uint32(os.Getpagesize())
+			shardEvents.MaxEntries = uint32(shards)
+			shardEvents.InnerMap.MaxEntries = uint32(shardRingSize(ringBufSize, shards))
+		}
+	} else {
+		// the map still has to be created, but a kernel without ring buffer support
+		// cannot create one, so replace it with a minimal placeholder that is never used
+		spec.Maps["rb_events"] = &ebpf.MapSpec{
+			Name:       "rb_events",
+			Type:       ebpf.Array,
+			KeySize:    4,
+			ValueSize:  4,
+			MaxEntries: 1,
+		}
+		shardEvents.MaxEntries = 1
+		shardEvents.InnerMap = spec.Maps["rb_events"].Copy()
+		shards = 0
+	}
+	if err := spec.RewriteConstants(map[string]interface{}{"use_ringbuf": useRingBuf, "rb_shards": uint32(shards)}); err != nil {
+		return fmt.Errorf("failed to configure event transport: %s", err.Error())
+	}
+	return nil
+}
+
+// readSample blocks until the next raw record is available on the active transport.
+// A nil sample without error means there is nothing to process yet. The returned
+// slice is only valid until the next call.
+func (em *EBPFManager) readSample() ([]byte, error) {
+	if em.ringReader != nil {
+		em.ringReader.SetDeadline(time.Now().Add(eventFlushInterval))
+		record := &em.ringRecord
+		err := em.ringReader.ReadInto(record)
+		if err != nil {
+			if errors.Is(err, os.ErrDeadlineExceeded) {
+				return nil, nil
+			}
+			return nil, err
+		}
+		return record.RawSample, nil
+	}
+	em.reader.SetDeadline(time.Now().Add(eventFlushInterval))
+	record := &em.perfRecord
+	err := em.reader.ReadInto(record)
+	if err != nil {
+		if errors.Is(err, os.ErrDeadlineExceeded) {
+			return nil, nil
+		}
+		return nil, err
+	}
+	if record.LostSamples > 0 {
+		em.stats.lost.Add(record.LostSamples)
+		return nil, nil
+	}
+	return record.RawSample, nil
+}
+
+// GetEventStats returns the event channel counters, Dropped is summed over all CPUs
+func (em *EBPFManager) GetEventStats() EventStats {
+	stats := EventStats{
+		Transport:    em.transport,
+		Received:     em.stats.received.Load(),
+		Lost:         em.stats.lost.Load(),
+		DecodeErrors: em.stats.decodeErrors.Load(),
+		Pool:         em.pool.Stats(),
+		ReaderShards: len(em.shards),
+	}
+	for _, shard := range em.shards {
+		stats.Received += shard.stats.received.Load()
+		stats.DecodeErrors += shard.stats.decodeErrors.Load()
+	}
+	if kernel, err := em.GetKernelStats(); err == nil {
+		stats.Dropped = kernel.ExportFailures
+	}
+	return stats
+}
@@ -0,0 +1,280 @@
+package ebpf
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"net/netip"
+	"sort"
+	"sync"
+
+	"github.com/cilium/ebpf"
+
+	"github.com/danger-dream/ebpf-firewall/internal/utils"
+)
+
+// protocol bits in front of the address of a tuple trie key, see TUPLE_PROTO_BITS in xdp.c
+const tupleProtoBits = 8
+
+// portSet has one bit per destination port, the layout of struct port_set
+type portSet [1024]uint64
+
+// setRange sets or clears the bits of the ports lo to hi
+func (s *portSet) setRange(lo, hi uint16, deny bool) {
+	for port := uint32(lo); port <= uint32(hi); {
+		word, bit := port>>6, port&63
+		// a run up to the end of the word or of the range
+		n := min(64-bit, uint32(hi)-port+1)
+		mask := ^uint64(0) >> (64 - n) << bit
+		if deny {
+			s[word] |= mask
+		} else {
+			s[word] &^= mask
+		}
+		port += n
+	}
+}
+
+func (s *portSet) denies(port uint16) bool {
+	return s[port>>6]&(1<<(port&63)) != 0
+}
+
+// tupleEntry is one prefix of a tuple trie with the ports it denies
+type tupleEntry struct {
+	key []byte
+	set portSet
+}
+
+// compileTuples folds the rules into one entry per distinct prefix and
+// protocol. An entry holds the rules of every shorter prefix of the same
+// protocol, a longer prefix overrides them and allow overrides deny on the
+// same prefix, so the kernel only needs the longest match.
+func compileTuples(rules []utils.TupleRule) (v4, v6 []tupleEntry) {
+	sorted := append([]utils.TupleRule(nil), rules...)
+	sort.Slice(sorted, func(i, j int) bool {
+		if sorted[i].Prefix.Bits() != sorted[j].Prefix.Bits() {
+			return sorted[i].Prefix.Bits() < sorted[j].Prefix.Bits()
+		}
+		return !sorted[i].Allow && sorted[j].Allow
+	})
+	type prefixKey struct {
+		prefix netip.Prefix
+		proto  uint8
+	}
+	seen := make(map[prefixKey]struct{}, len(sorted))
+	for _, rule := range sorted {
+		pk := prefixKey{rule.Prefix, rule.Proto}
+		if _, ok := seen[pk]; ok {
+			continue
+		}
+		seen[pk] = struct{}{}
+		entry := tupleEntry{key: tupleKey(rule.Prefix, rule.Proto)}
+		for _, r := range sorted {
+			if r.Prefix.Bits() > rule.Prefix.Bits() {
+				break
+			}
+			if r.Proto == rule.Proto && r.Prefix.Contains(rule.Prefix.Addr()) {
+				entry.set.setRange(r.PortMin, r.PortMax, !r.Allow)
+			}
+		}
+		// an entry denying nothing is still written, it shadows the shorter prefixes
+		if rule.Prefix.Addr().Is4() {
+			v4 = append(v4, entry)
+		} else {
+			v6 = append(v6, entry)
+		}
+	}
+	return v4, v6
+}
+
+// tupleKey encodes tuple_ipv4_key or tuple_ipv6_key, the prefix length is
+// written the same way as in prefixKey
+func tupleKey(p netip.Prefix, proto uint8) []byte {
+	addr := p.Addr().AsSlice()
+	// padded to the alignment of prefixlen
+	key := make([]byte, (4+1+len(addr)+3)&^3)
+	binary.LittleEndian.PutUint32(key, uint32(tupleProtoBits+p.Bits()))
+	key[4] = proto
+	copy(key[5:], addr)
+	return key
+}
+
+// tupleTrie is the current instance of a tuple trie, replaced as a whole
+type tupleTrie struct {
+	name  string
+	outer *ebpf.Map
+	spec  *ebpf.MapSpec
+	m     *ebpf.Map
+	// entries of m
+	entries int
+}
+
+func (tt *tupleTrie) swap(entries []tupleEntry, ids map[portSet]uint32) error {
+	if len(entries) > int(tt.spec.MaxEntries) {
+		return fmt.Errorf("map %s is full (%d entries), raise ebpf.map-size.tuple in the config", tt.name, tt.spec.MaxEntries)
+	}
+	m, err := ebpf.NewMap(tt.spec)
+	if err != nil {
+		return fmt.Errorf("failed to create map %s: %s", tt.name, err)
+	}
+	for _, entry := range entries {
+		if err := m.Put(entry.key, ids[entry.set]); err != nil {
+			m.Close()
+			return fmt.Errorf("failed to fill map %s: %s", tt.name, err)
+		}
+	}
+	if err := tt.outer.Put(currentSlot, m); err != nil {
+		m.Close()
+		return fmt.Errorf("failed to swap map %s: %s", tt.name, err)
+	}
+	if tt.m != nil {
+		tt.m.Close()
+	}
+	tt.m = m
+	tt.entries = len(entries)
+	return nil
+}
+
+func (tt *tupleTrie) usage() MapUsage {
+	bytes := entryBytes(tt.spec)
+	return MapUsage{
+		Name:       tt.name,
+		Entries:    int64(tt.entries),
+		MaxEntries: tt.spec.MaxEntries,
+		UsedBytes:  int64(tt.entries) * bytes,
+		MaxBytes:   int64(tt.spec.MaxEntries) * bytes,
+	}
+}
+
+// tupleTables holds the tuple rules loaded into the kernel. Every change
+// compiles the whole rule set again, rules are few and a change must not
+// leave the tries inconsistent with the port sets. The tries are recreated
+// with the program, the rules come back through SetRuleSource.
+type tupleTables struct {
+	mu     sync.Mutex
+	v4, v6 *tupleTrie
+	sets   *ebpf.Map
+	// slot of every set in port_sets the current tries point to, 0 is the empty set
+	ids    map[portSet]uint32
+	wanted map[string]utils.TupleRule
+}
+
+func (tt *tupleTables) attach(spec *ebpf.CollectionSpec, objects *xdpObjects) error {
+	tt.mu.Lock()
+	defer tt.mu.Unlock()
+	tt.v4 = &tupleTrie{name: "tuple_ipv4_trie", outer: objects.TupleIpv4Trie, spec: spec.Maps["tuple_ipv4_trie"].InnerMap}
+	tt.v6 = &tupleTrie{name: "tuple_ipv6_trie", outer: objects.TupleIpv6Trie, spec: spec.Maps["tuple_ipv6_trie"].InnerMap}
+	tt.sets = objects.PortSets
+	tt.ids = map[portSet]uint32{{}: 0}
+	return tt.swap()
+}
+
+func (tt *tupleTables) detach() {
+	tt.mu.Lock()
+	defer tt.mu.Unlock()
+	for _, trie := range []*tupleTrie{tt.v4, tt.v6} {
+		if trie != nil && trie.m != nil {
+			trie.m.Close()
+		}
+	}
+	tt.v4, tt.v6, tt.sets = nil, nil, nil
+}
+
+func (tt *tupleTables) replace(rules []utils.TupleRule) error {
+	wanted := make(map[string]utils.TupleRule, len(rules))
+	for _, rule := range rules {
+		wanted[string(rule.Bytes())] = rule
+	}
+	tt.mu.Lock()
+	defer tt.mu.Unlock()
+	tt.wanted = wanted
+	return tt.swap()
+}
+
+func (tt *tupleTables) update(rule utils.TupleRule, add bool) error {
+	tt.mu.Lock()
+	defer tt.mu.Unlock()
+	key := string(rule.Bytes())
+	if _, ok := tt.wanted[key]; ok == add {
+		return nil
+	}
+	if tt.wanted == nil {
+		tt.wanted = make(map[string]utils.TupleRule)
+	}
+	if add {
+		tt.wanted[key] = rule
+	} else {
+		delete(tt.wanted, key)
+	}
+	return tt.swap()
+}
+
+// swap writes the port sets of the wanted rules to free slots of port_sets
+// and then installs new tries pointing to them. The slots of the old tries
+// are left alone until the next swap, so a packet looking up an old trie
+// still reads the set it was compiled with.
+func (tt *tupleTables) swap() error {
+	if tt.v4 == nil {
+		// not loaded yet, attach writes the rules
+		return nil
+	}
+	rules := make([]utils.TupleRule, 0, len(tt.wanted))
+	for _, rule := range tt.wanted {
+		rules = append(rules, rule)
+	}
+	v4, v6 := compileTuples(rules)
+
+	used := make([]bool, tt.sets.MaxEntries())
+	for _, id := range tt.ids {
+		used[id] = true
+	}
+	ids := map[portSet]uint32{{}: 0}
+	next := uint32(1)
+	for _, entry := range append(v4, v6...) {
+		if _, ok := ids[entry.set]; ok {
+			continue
+		}
+		if id, ok := tt.ids[entry.set]; ok {
+			ids[entry.set] = id
+			continue
+		}
+		for next < uint32(len(used)) && used[next] {
+			next++
+		}
+		if next == uint32(len(used)) {
+			return fmt.Errorf("map port_sets is full (%d sets), raise ebpf.map-size.port-sets in the config", len(used))
+		}
+		if err := tt.sets.Put(next, xdpPortSet{Bits: entry.set}); err != nil {
+			return fmt.Errorf("failed to write port set: %s", err)
+		}
+		used[next] = true
+		ids[entry.set] = next
+	}
+	if err := errors.Join(tt.v4.swap(v4, ids), tt.v6.swap(v6, ids)); err != nil {
+		// keep the slots of both generations, one of the tries may still point to the old ones
+		for set, id := range ids {
+			tt.ids[set] = id
+		}
+		return err
+	}
+	tt.ids = ids
+	return nil
+}
+
+func (tt *tupleTables) usage() []MapUsage {
+	tt.mu.Lock()
+	defer tt.mu.Unlock()
+	if tt.v4 == nil {
+		return nil
+	}
+	sets := int64(len(tt.ids))
+	setBytes := int64(len(portSet{}) * 8)
+	return []MapUsage{tt.v4.usage(), tt.v6.usage(), {
+		Name:       "port_sets",
+		Entries:    sets,
+		MaxEntries: tt.sets.MaxEntries(),
+		UsedBytes:  sets * setBytes,
+		// the array is preallocated, this is what it takes
+		MaxBytes: int64(tt.sets.MaxEntries()) * setBytes,
+	}}
+}
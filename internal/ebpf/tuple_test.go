@@ -0,0 +1,93 @@
+package ebpf
+
+import (
+	"bytes"
+	"net/netip"
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/utils"
+)
+
+func TestPortSetRange(t *testing.T) {
+	var s portSet
+	s.setRange(60, 130, true)
+	s.setRange(64, 127, false)
+	for port := 0; port <= 200; port++ {
+		want := (port >= 60 && port < 64) || (port >= 128 && port <= 130)
+		if got := s.denies(uint16(port)); got != want {
+			t.Errorf("port %d denied = %v, want %v", port, got, want)
+		}
+	}
+	s.setRange(0, 65535, true)
+	for _, word := range s {
+		if word != ^uint64(0) {
+			t.Fatal("full range left ports allowed")
+		}
+	}
+}
+
+func TestCompileTuples(t *testing.T) {
+	var rules []utils.TupleRule
+	for _, value := range []string{
+		"0.0.0.0/0 tcp:0-1023",
+		"10.0.0.0/8 tcp:22 allow",
+		"10.1.0.0/16 tcp:8080",
+		"10.0.0.0/8 udp:53",
+		"2001:db8::/32 udp",
+	} {
+		rule, err := utils.ParseTupleRule(value)
+		if err != nil {
+			t.Fatal(err)
+		}
+		rules = append(rules, rule)
+	}
+	v4, v6 := compileTuples(rules)
+	if len(v4) != 4 || len(v6) != 1 {
+		t.Fatalf("got %d IPv4 and %d IPv6 entries, want 4 and 1", len(v4), len(v6))
+	}
+	lookup := func(entries []tupleEntry, prefix string, proto uint8) *portSet {
+		key := tupleKey(netip.MustParsePrefix(prefix), proto)
+		for i := range entries {
+			if bytes.Equal(entries[i].key, key) {
+				return &entries[i].set
+			}
+		}
+		t.Fatalf("no entry for %s proto %d", prefix, proto)
+		return nil
+	}
+	tests := []struct {
+		set  *portSet
+		port uint16
+		want bool
+	}{
+		{lookup(v4, "0.0.0.0/0", 6), 22, true},
+		{lookup(v4, "0.0.0.0/0", 6), 8080, false},
+		// allow on a longer prefix
+		{lookup(v4, "10.0.0.0/8", 6), 22, false},
+		{lookup(v4, "10.0.0.0/8", 6), 80, true},
+		// inherits from both shorter prefixes
+		{lookup(v4, "10.1.0.0/16", 6), 22, false},
+		{lookup(v4, "10.1.0.0/16", 6), 80, true},
+		{lookup(v4, "10.1.0.0/16", 6), 8080, true},
+		// protocols don't mix
+		{lookup(v4, "10.0.0.0/8", 17), 53, true},
+		{lookup(v4, "10.0.0.0/8", 17), 80, false},
+		{lookup(v6, "2001:db8::/32", 17), 0, true},
+	}
+	for i, tt := range tests {
+		if got := tt.set.denies(tt.port); got != tt.want {
+			t.Errorf("case %d: port %d denied = %v, want %v", i, tt.port, got, tt.want)
+		}
+	}
+}
+
+func TestTupleKey(t *testing.T) {
+	v4 := tupleKey(netip.MustParsePrefix("10.0.0.0/8"), 6)
+	want := []byte{16, 0, 0, 0, 6, 10, 0, 0, 0, 0, 0, 0}
+	if !bytes.Equal(v4, want) {
+		t.Errorf("tupleKey(10.0.0.0/8, tcp) = %v, want %v", v4, want)
+	}
+	if n := len(tupleKey(netip.MustParsePrefix("::/0"), 17)); n != 24 {
+		t.Errorf("IPv6 key is %d bytes, want 24", n)
+	}
+}
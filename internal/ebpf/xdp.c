@@ -5,6 +5,13 @@
  * - IPv4/IPv6 exact match and CIDR match
  * - MAC address exact match
  * - TCP/UDP protocol parsing
+ * - Per-packet event export or in-kernel per-CPU flow aggregation
+ * - Event transport over a BPF ring buffer, with perf event array fallback
+ * - 1-in-N sampling of passed packets, matched packets are always exported
+ * - Optional threat intelligence drop through dedicated LPM tries
+ * - Country and autonomous system drop through LPM tries compiled from GeoIP
+ * - Optional AF_XDP redirect of passed threat intelligence sources
+ * - One program shared by every attached interface
  */
 #include <linux/bpf.h>
 #include <linux/if_ether.h>
@@ -23,17 +30,48 @@
 #define MATCH_BY_IP6_EXACT  3    // Match IPv6 address exactly
 #define MATCH_BY_IP6_CIDR   4    // Match IPv6 address by CIDR block
 #define MATCH_BY_MAC        5    // Match MAC address exactly
+#define MATCH_BY_INTEL      6    // Match threat intelligence indicator
+#define MATCH_BY_TUPLE      7    // Match source prefix, protocol and destination port
+#define MATCH_BY_GEO        8    // Match network of a blocked country or autonomous system
 
-// Maximum number of entries in each map
-#define MAX_ENTRIES_SIZE 1024    // Limit to prevent excessive memory usage
+// Default number of entries in each blocklist map, the loader replaces it
+// with ebpf.map-size from the config before the maps are created
+#define MAX_ENTRIES_SIZE 1024
 
 // Default prefix lengths for IP lookups
 #define DEFAULT_IPV6_PREFIX  128 // Full IPv6 address length for LPM lookup
 #define DEFAULT_IPV4_PREFIX  32  // Full IPv4 address length for LPM lookup
 #define DEFAULT_KEY 0
 
+// Export modes, selected at runtime through the settings map
+#define EXPORT_MODE_EVENT     0  // One perf event per packet
+#define EXPORT_MODE_AGGREGATE 1  // Per-CPU flow counters polled by userspace
+
+// Threat intelligence actions, selected at runtime through the settings map
+#define INTEL_ACTION_OFF  0      // Intel tries are not consulted
+#define INTEL_ACTION_DROP 1      // Packets from intel indicators are dropped
+#define INTEL_ACTION_THRESHOLD 2 // Indicators are dropped once over their rate limit
+
+// Maximum number of flows tracked by the aggregation map, least recently used flows are evicted
+#define MAX_FLOW_ENTRIES 65536
+
+// Upper bound of the sample rate, keeps pkt_size * rate within 32 bits
+#define MAX_SAMPLE_RATE 65536
+
+// Default ring buffer size in bytes, resized by userspace at load time
+#define RINGBUF_SIZE (1 << 24)
+
+// Upper bound of the ring buffer shards, one per CPU in per-cpu reader mode
+#define MAX_RB_SHARDS 256
+
+// AF_XDP sockets, every attached interface owns XSK_QUEUES slots of xsks_map
+#define MAX_XSK_IFACES 16
+#define XSK_QUEUES 64
+
 /* Packet information structure for processing and event reporting
- * Total size: 68 bytes, packed to avoid padding
+ * Total size: 72 bytes, packed to avoid padding
+ * pkt_size and pkt_count describe every packet the record accounts for,
+ * so userspace handles per-packet events and aggregated flows the same way.
  */
 struct packet_info {
     // Network layer - IPv4 addresses
@@ -59,18 +97,102 @@ struct packet_info {
     // Metadata
     __u32 pkt_size;                 // Total packet size. offset: 60, bytes: 4
     __u32 match_type;               // Type of rule that matched. offset: 64, bytes: 4
-} __attribute__((packed));          // 68 bytes
+    __u32 pkt_count;                // Number of packets represented. offset: 68, bytes: 4
+} __attribute__((packed));          // 72 bytes
+
+/* Per-flow traffic counters, one copy per CPU
+ * The flow key is a packet_info with the per-packet fields (src_port, pkt_size, pkt_count) zeroed
+ */
+struct flow_counters {
+    __u64 packets;
+    __u64 bytes;
+};
+
+/* Runtime settings written by userspace before the program is attached */
+struct settings {
+    __u32 export_mode;              // EXPORT_MODE_EVENT or EXPORT_MODE_AGGREGATE
+    __u32 wakeup_bytes;             // Pending ring buffer bytes before userspace is woken up
+    __u32 sample_rate;              // Export 1 in sample_rate passed packets, 0 or 1 exports all
+    __u32 intel_action;             // INTEL_ACTION_OFF, INTEL_ACTION_DROP or INTEL_ACTION_THRESHOLD
+    __u32 xsk_redirect;             // Redirect passed packets of intel sources to xsks_map, see redirect_xsk
+};
+
+/* Rate limit of one match type, written by userspace
+ * A source is dropped once it matched threshold times within window_ms.
+ */
+struct rate_limit {
+    __u32 threshold;                // Matches allowed per window, 0 drops on the first match
+    __u32 window_ms;                // Length of the sliding window in milliseconds
+};
+
+/* Source address of a counted or flagged packet, IPv4 is stored IPv4-mapped */
+struct src_key {
+    __u8 addr[16];
+};
+
+/* Sliding window counter of one source on one CPU
+ * The window is approximated from the current and the previous fixed window.
+ */
+struct rate_window {
+    __u64 start_ns;                 // Start of the current fixed window
+    __u32 count;                    // Matches in the current window
+    __u32 prev_count;               // Matches in the previous window
+};
+
+/* Source dropped by the rate limiter, drained by userspace in batches */
+struct offender {
+    __u64 flagged_ns;               // bpf_ktime_get_ns() when the source went over its limit
+    __u32 match_type;               // Rule class whose limit was exceeded
+    __u32 hits;                     // Matches counted on the flagging CPU
+};
+
+/* Selects the event transport, rewritten by userspace before loading.
+ * Being a constant, the verifier prunes the unused branch, so the ring buffer
+ * helpers are never checked on kernels that fall back to the perf event array.
+ */
+const volatile __u32 use_ringbuf = 0;
+
+/* Number of ring buffer shards, rewritten by userspace before loading.
+ * 0 exports every event through rb_events, otherwise a CPU writes to shard
+ * cpu % rb_shards of rb_shard_events and each shard has its own reader.
+ */
+const volatile __u32 rb_shards = 0;
 
 /* eBPF maps definitions
- * All maps are limited to MAX_ENTRIES_SIZE entries
+ * Blocklist maps are sized at load time and not preallocated, so their
+ * memory grows with the number of rules instead of the configured limit.
+ * Each of them is an array of maps with a single slot holding the current
+ * instance. Full reloads build a new instance in userspace and swap the slot,
+ * so packets never see a half written list.
+ * Struct keys of the inner maps are given by size, older clang releases only
+ * emit a forward declaration for types behind an inner definition.
  */
 
+// Number of match types, the rate_limits map is indexed by match type
+#define MAX_MATCH_TYPES 9
+// Sources that are counted or flagged at a time, least recently seen are evicted
+#define MAX_RATE_ENTRIES 65536
+
+// Slot of the current instance in every outer blocklist map
+#define CURRENT_SLOT 0
+
+/* Values of the blocklist maps are the bpf_ktime_get_coarse_ns time the
+ * entry expires at, 0 never expires. An expired entry is a miss until
+ * userspace sweeps it, so expiry does not depend on the daemon running.
+ * Until then an expired prefix still hides the shorter prefixes it overlaps.
+ */
 // IPv4 exact match hash table
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, __be32);
-    __type(value, __u8);
-    __uint(max_entries, MAX_ENTRIES_SIZE);
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_HASH);
+        __type(key, __be32);
+        __type(value, __u64);     // Expiry, see rule_live
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
 } ipv4_list SEC(".maps");
 
 /* LPM (Longest Prefix Match) Trie key for IPv4 CIDR matching
@@ -83,19 +205,30 @@ struct ipv4_trie_key {
 
 // IPv4 CIDR LPM trie
 struct {
-    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
-    __type(key, struct ipv4_trie_key);
-    __type(value, __u8);
-    __uint(max_entries, MAX_ENTRIES_SIZE);
-    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct ipv4_trie_key));
+        __type(value, __u64);     // Expiry, see rule_live
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
 } ipv4_cidr_trie SEC(".maps");
 
 // IPv6 exact match hash table
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, struct in6_addr);
-    __type(value, __u8);
-    __uint(max_entries, MAX_ENTRIES_SIZE);
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_HASH);
+        __uint(key_size, sizeof(struct in6_addr));
+        __type(value, __u64);     // Expiry, see rule_live
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
 } ipv6_list SEC(".maps");
 
 /* LPM (Longest Prefix Match) Trie key for IPv6 CIDR matching
@@ -108,21 +241,180 @@ struct ipv6_trie_key {
 
 // IPv6 CIDR LPM trie
 struct {
-    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
-    __type(key, struct ipv6_trie_key);
-    __type(value, __u8);
-    __uint(max_entries, MAX_ENTRIES_SIZE);
-    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct ipv6_trie_key));
+        __type(value, __u64);     // Expiry, see rule_live
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
 } ipv6_cidr_trie SEC(".maps");
 
 // MAC address exact match hash table
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, unsigned char[ETH_ALEN]);
-    __type(value, __u8);
-    __uint(max_entries, MAX_ENTRIES_SIZE);
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_HASH);
+        __type(key, unsigned char[ETH_ALEN]);
+        __type(value, __u64);     // Expiry, see rule_live
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
 } mac_list SEC(".maps");
 
+/* Threat intelligence tries, swapped by userspace whenever the feeds are aggregated
+ * Single addresses are stored as full length prefixes
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct ipv4_trie_key));
+        __type(value, __u8);
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
+} intel_ipv4_trie SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct ipv6_trie_key));
+        __type(value, __u8);
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
+} intel_ipv6_trie SEC(".maps");
+
+/* Networks of the blocked countries and autonomous systems, compiled from the
+ * GeoIP databases by userspace and patched in place when a database changes
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct ipv4_trie_key));
+        __type(value, __u8);
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
+} geo_ipv4_trie SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct ipv6_trie_key));
+        __type(value, __u8);
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
+} geo_ipv6_trie SEC(".maps");
+
+/* Tuple rule trie keys, the protocol is matched as the first 8 bits of the
+ * prefix so a single lookup finds the most specific prefix of the protocol.
+ */
+#define TUPLE_PROTO_BITS 8
+// Default number of port sets, resized by userspace before loading
+#define MAX_PORT_SETS 64
+// One bit per destination port
+#define PORT_SET_WORDS 1024
+
+struct tuple_ipv4_key {
+    __u32 prefixlen;                // TUPLE_PROTO_BITS + CIDR prefix length
+    __u8 proto;                     // IP protocol number
+    __u8 addr[4];                   // IPv4 address
+};
+
+struct tuple_ipv6_key {
+    __u32 prefixlen;                // TUPLE_PROTO_BITS + CIDR prefix length
+    __u8 proto;                     // IP protocol number
+    __u8 addr[16];                  // IPv6 address
+};
+
+/* Denied destination ports of a tuple prefix, userspace folds the rules of
+ * less specific prefixes into it, so the longest match alone decides
+ */
+struct port_set {
+    __u64 bits[PORT_SET_WORDS];
+};
+
+// IPv4 tuple rule trie, values index port_sets and 0 denies no port
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct tuple_ipv4_key));
+        __type(value, __u32);
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
+} tuple_ipv4_trie SEC(".maps");
+
+// IPv6 tuple rule trie
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, 1);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __uint(key_size, sizeof(struct tuple_ipv6_key));
+        __type(value, __u32);
+        __uint(max_entries, MAX_ENTRIES_SIZE);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+    });
+} tuple_ipv6_trie SEC(".maps");
+
+/* Port sets of the tuple tries. A rule change writes its new sets to free
+ * slots before the tries are swapped, so a trie never sees a set rewritten.
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct port_set);
+    __uint(max_entries, MAX_PORT_SETS);
+} port_sets SEC(".maps");
+
+// Rate limits indexed by match type
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct rate_limit);
+    __uint(max_entries, MAX_MATCH_TYPES);
+} rate_limits SEC(".maps");
+
+// Per-CPU match counters of the rate limited sources
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __type(key, struct src_key);
+    __type(value, struct rate_window);
+    __uint(max_entries, MAX_RATE_ENTRIES);
+} rate_windows SEC(".maps");
+
+// Sources over their rate limit, dropped until userspace persisted a blocklist rule
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct src_key);
+    __type(value, struct offender);
+    __uint(max_entries, MAX_RATE_ENTRIES);
+} offenders SEC(".maps");
+
 // Scratch map for storing packet information
 struct {
     __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
@@ -139,6 +431,114 @@ struct {
     __uint(max_entries, 128);
 } events SEC(".maps");
 
+// Ring buffer for event reporting, shared by all CPUs
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, RINGBUF_SIZE);
+} rb_events SEC(".maps");
+
+// Ring buffer shards, filled with one ring buffer per shard by userspace
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __type(key, __u32);
+    __uint(max_entries, MAX_RB_SHARDS);
+    __array(values, struct {
+        __uint(type, BPF_MAP_TYPE_RINGBUF);
+        __uint(max_entries, RINGBUF_SIZE);
+    });
+} rb_shard_events SEC(".maps");
+
+/* Packet counters of one CPU, summed by userspace
+ * Every received packet is counted in rx and then in pass, redirect or in drop of its match type.
+ */
+struct xdp_stats {
+    __u64 rx;                       // Packets seen by xdp_prog
+    __u64 pass;                     // Packets passed to the stack
+    __u64 drop[MAX_MATCH_TYPES];    // Dropped packets indexed by MATCH_BY_*
+    __u64 parse_errors;             // Truncated ethernet or IP headers
+    __u64 export_failures;          // Events that could not be exported (ring buffer full, perf output failure)
+    __u64 redirect;                 // Packets redirected to an AF_XDP socket
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct xdp_stats);
+    __uint(max_entries, 1);
+} stats SEC(".maps");
+
+// Per-CPU flow counters used in aggregate export mode
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __type(key, struct packet_info);
+    __type(value, struct flow_counters);
+    __uint(max_entries, MAX_FLOW_ENTRIES);
+} flow_stats SEC(".maps");
+
+/* State of the pinned maps, written by userspace so a restarted daemon can
+ * tell whether a pinned map already holds the wanted entries. Not used by
+ * the program itself.
+ */
+struct map_state {
+    __u64 generation;               // Order independent hash of the map keys
+    __u64 entries;                  // Number of keys in the map
+};
+
+#define MAX_MAP_STATES 16
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct map_state);
+    __uint(max_entries, MAX_MAP_STATES);
+} pin_state SEC(".maps");
+
+/* AF_XDP sockets of a userspace analyzer, registered by the analyzer itself
+ * through the pinned map. Queue q of an interface is slot base + q, with the
+ * base of the interface in xsk_bases.
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, MAX_XSK_IFACES * XSK_QUEUES);
+} xsks_map SEC(".maps");
+
+// First xsks_map slot of every attached interface, keyed by ifindex
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, MAX_XSK_IFACES);
+} xsk_bases SEC(".maps");
+
+// Runtime settings
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct settings);
+    __uint(max_entries, 1);
+} settings SEC(".maps");
+
+
+/* Look up key in the current instance of a blocklist map
+ * @outer: Array of maps holding the instance in CURRENT_SLOT
+ * Returns: Value pointer if found, NULL if not found or no instance is installed
+ */
+static __always_inline void *lookup_current(void *outer, const void *key) {
+    __u32 slot = CURRENT_SLOT;
+    void *inner = bpf_map_lookup_elem(outer, &slot);
+    if (!inner)
+        return NULL;
+    return bpf_map_lookup_elem(inner, key);
+}
+
+/* Check if a blocklist entry is present and has not expired
+ * @expires: Value of the entry, NULL if the lookup missed
+ */
+static __always_inline int rule_live(const __u64 *expires) {
+    return expires && (*expires == 0 || *expires > bpf_ktime_get_coarse_ns());
+}
 
 /* Check if packet matches any configured rules
  * Returns: Match type if matched, RUN_MODE_PASS if not matched
@@ -146,38 +546,195 @@ struct {
  */
 static __always_inline __u32 match_by_rule(struct packet_info *pi) {
     // Check MAC address first (fastest check)
-    if (bpf_map_lookup_elem(&mac_list, pi->src_mac)) return MATCH_BY_MAC;
+    if (rule_live(lookup_current(&mac_list, pi->src_mac))) return MATCH_BY_MAC;
     
     // reference: https://docs.kernel.org/next/bpf/map_lpm_trie.html#bpf-map-lookup-elem
     // Process IPv4 packets
-    if (pi->eth_proto == bpf_htons(ETH_P_IP)) {
+    if (pi->eth_proto == ETH_P_IP) {
         // Try exact match first
-        if (bpf_map_lookup_elem(&ipv4_list, &pi->src_ip)) return MATCH_BY_IP4_EXACT;
+        if (rule_live(lookup_current(&ipv4_list, &pi->src_ip))) return MATCH_BY_IP4_EXACT;
 
         // Then try CIDR match using LPM Trie
         struct ipv4_trie_key key = {
             .prefixlen = DEFAULT_IPV4_PREFIX,
             .addr = pi->src_ip
         };
-        if (bpf_map_lookup_elem(&ipv4_cidr_trie, &key)) return MATCH_BY_IP4_CIDR;
+        if (rule_live(lookup_current(&ipv4_cidr_trie, &key))) return MATCH_BY_IP4_CIDR;
         
-    } else if (pi->eth_proto == bpf_htons(ETH_P_IPV6)) {
+    } else if (pi->eth_proto == ETH_P_IPV6) {
         // Try exact match first
         struct in6_addr ipv6_addr;
         __builtin_memset(&ipv6_addr, 0, sizeof(ipv6_addr));
         __builtin_memcpy(&ipv6_addr, pi->src_ipv6, sizeof(ipv6_addr));
-        if (bpf_map_lookup_elem(&ipv6_list, &ipv6_addr)) return MATCH_BY_IP6_EXACT;
+        if (rule_live(lookup_current(&ipv6_list, &ipv6_addr))) return MATCH_BY_IP6_EXACT;
         
         // Then try CIDR match using LPM Trie
         struct ipv6_trie_key key = {
             .prefixlen = DEFAULT_IPV6_PREFIX,
             .addr = ipv6_addr
         };
-        if (bpf_map_lookup_elem(&ipv6_cidr_trie, &key)) return MATCH_BY_IP6_CIDR;
+        if (rule_live(lookup_current(&ipv6_cidr_trie, &key))) return MATCH_BY_IP6_CIDR;
+    }
+    return MATCH_BY_PASS;
+}
+
+/* Check if the source address is a threat intelligence indicator
+ * Returns: MATCH_BY_INTEL if matched, MATCH_BY_PASS if not matched
+ * Note: eth_proto is in host byte order, see xdp_prog
+ */
+static __always_inline __u32 match_by_intel(struct packet_info *pi) {
+    if (pi->eth_proto == ETH_P_IP) {
+        struct ipv4_trie_key key = {
+            .prefixlen = DEFAULT_IPV4_PREFIX,
+            .addr = pi->src_ip
+        };
+        if (lookup_current(&intel_ipv4_trie, &key)) return MATCH_BY_INTEL;
+    } else if (pi->eth_proto == ETH_P_IPV6) {
+        struct ipv6_trie_key key = {
+            .prefixlen = DEFAULT_IPV6_PREFIX
+        };
+        __builtin_memcpy(&key.addr, pi->src_ipv6, sizeof(key.addr));
+        if (lookup_current(&intel_ipv6_trie, &key)) return MATCH_BY_INTEL;
+    }
+    return MATCH_BY_PASS;
+}
+
+/* Check if the source address is in a blocked country or autonomous system
+ * Returns: MATCH_BY_GEO if matched, MATCH_BY_PASS if not matched
+ */
+static __always_inline __u32 match_by_geo(struct packet_info *pi) {
+    if (pi->eth_proto == ETH_P_IP) {
+        struct ipv4_trie_key key = {
+            .prefixlen = DEFAULT_IPV4_PREFIX,
+            .addr = pi->src_ip
+        };
+        if (lookup_current(&geo_ipv4_trie, &key)) return MATCH_BY_GEO;
+    } else if (pi->eth_proto == ETH_P_IPV6) {
+        struct ipv6_trie_key key = {
+            .prefixlen = DEFAULT_IPV6_PREFIX
+        };
+        __builtin_memcpy(&key.addr, pi->src_ipv6, sizeof(key.addr));
+        if (lookup_current(&geo_ipv6_trie, &key)) return MATCH_BY_GEO;
+    }
+    return MATCH_BY_PASS;
+}
+
+/* Check the packet against the tuple rules
+ * Returns: MATCH_BY_TUPLE if its destination port is denied, MATCH_BY_PASS otherwise
+ * Note: Costs one trie and one array lookup however many rules are loaded
+ */
+static __always_inline __u32 match_by_tuple(struct packet_info *pi) {
+    __u32 *set_id = NULL;
+
+    if (pi->eth_proto == ETH_P_IP) {
+        struct tuple_ipv4_key key = {
+            .prefixlen = TUPLE_PROTO_BITS + DEFAULT_IPV4_PREFIX,
+            .proto = pi->ip_proto
+        };
+        __builtin_memcpy(key.addr, &pi->src_ip, sizeof(key.addr));
+        set_id = lookup_current(&tuple_ipv4_trie, &key);
+    } else if (pi->eth_proto == ETH_P_IPV6) {
+        struct tuple_ipv6_key key = {
+            .prefixlen = TUPLE_PROTO_BITS + DEFAULT_IPV6_PREFIX,
+            .proto = pi->ip_proto
+        };
+        __builtin_memcpy(key.addr, pi->src_ipv6, sizeof(key.addr));
+        set_id = lookup_current(&tuple_ipv6_trie, &key);
     }
+    if (!set_id || *set_id == 0)
+        return MATCH_BY_PASS;
+
+    struct port_set *set = bpf_map_lookup_elem(&port_sets, set_id);
+    if (!set)
+        return MATCH_BY_PASS;
+    // protocols without ports are parsed with port 0
+    __u16 port = pi->dst_port;
+    if (set->bits[port >> 6] & (1ULL << (port & 63)))
+        return MATCH_BY_TUPLE;
     return MATCH_BY_PASS;
 }
 
+static __always_inline void source_key(struct packet_info *pi, struct src_key *key) {
+    if (pi->eth_proto == ETH_P_IP) {
+        key->addr[10] = 0xff;
+        key->addr[11] = 0xff;
+        __builtin_memcpy(&key->addr[12], &pi->src_ip, sizeof(pi->src_ip));
+    } else {
+        __builtin_memcpy(key->addr, pi->src_ipv6, sizeof(key->addr));
+    }
+}
+
+/* Record a source that went over its rate limit, userspace turns it into a block rule */
+static __always_inline void flag_offender(struct src_key *key, __u64 now, __u32 match_type, __u64 hits) {
+    struct offender flagged = {
+        .flagged_ns = now,
+        .match_type = match_type,
+        .hits = hits
+    };
+    bpf_map_update_elem(&offenders, key, &flagged, BPF_NOEXIST);
+}
+
+/* Count a match of the packet source and flag it once over the rate limit
+ * @pi: Packet that matched
+ * @match_type: Rule class of the match, selects the rate limit
+ * Returns: 1 if the source went over its limit and is dropped, 0 otherwise
+ * Note: Counts are kept per CPU. RSS keeps the flows of a source on a few
+ * queues, so a source is flagged at the latest once one CPU saw threshold matches.
+ */
+static __always_inline int rate_exceeded(struct packet_info *pi, __u32 match_type) {
+    struct rate_limit *limit = bpf_map_lookup_elem(&rate_limits, &match_type);
+    struct src_key key = {};
+    struct rate_window *win;
+    __u64 now = bpf_ktime_get_ns();
+    __u64 window_ns, elapsed, estimate;
+
+    if (!limit)
+        return 1;
+    source_key(pi, &key);
+    if (limit->threshold == 0 || limit->window_ms == 0) {
+        // nothing to count in, the first match flags the source
+        flag_offender(&key, now, match_type, pi->pkt_count);
+        return 1;
+    }
+    window_ns = (__u64)limit->window_ms * 1000000;
+
+    win = bpf_map_lookup_elem(&rate_windows, &key);
+    if (!win) {
+        struct rate_window init = {
+            .start_ns = now,
+            .count = pi->pkt_count
+        };
+        bpf_map_update_elem(&rate_windows, &key, &init, BPF_ANY);
+        estimate = init.count;
+    } else {
+        elapsed = now - win->start_ns;
+        if (elapsed >= window_ns) {
+            // roll over, a gap of more than one window forgets the previous one
+            win->prev_count = elapsed < 2 * window_ns ? win->count : 0;
+            win->start_ns += elapsed < 2 * window_ns ? window_ns : elapsed;
+            win->count = 0;
+            elapsed = now - win->start_ns;
+        }
+        win->count += pi->pkt_count;
+        // in milliseconds, so the product can't overflow
+        estimate = win->count + (__u64)win->prev_count * (limit->window_ms - elapsed / 1000000) / limit->window_ms;
+    }
+    if (estimate < limit->threshold)
+        return 0;
+    flag_offender(&key, now, match_type, estimate);
+    return 1;
+}
+
+/* Check a flagged source before any trie lookup */
+static __always_inline int is_offender(struct packet_info *pi) {
+    struct src_key key = {};
+
+    if (pi->eth_proto != ETH_P_IP && pi->eth_proto != ETH_P_IPV6)
+        return 0;
+    source_key(pi, &key);
+    return bpf_map_lookup_elem(&offenders, &key) != NULL;
+}
+
 /* Parse TCP/UDP header information
  * @pkt_info: Packet info structure to fill
  * @data: Pointer to start of transport header
@@ -211,6 +768,186 @@ static __always_inline void parse_transport(struct packet_info *pkt_info, void *
     }
 }
 
+/* Fill the source fields the rule lookups read, straight from packet memory
+ * @pkt_info: Scratch record, eth_proto must be set
+ * @l3: Start of the network header
+ * @data_end: Pointer to end of packet data
+ * Returns: The network header, NULL if the packet is not IP or truncated
+ * Note: Every source field is written on every path, the other fields keep
+ * whatever the previous packet left until fill_export writes them
+ */
+static __always_inline void *parse_source(struct packet_info *pkt_info, void *l3, void *data_end) {
+    switch (pkt_info->eth_proto) {
+    case ETH_P_IP: {
+        struct iphdr *ip = l3;
+        if ((void *)(ip + 1) > data_end)
+            break;
+        pkt_info->src_ip = ip->saddr;
+        parse_transport(pkt_info, (void *)(ip + 1), data_end, ip->protocol);
+        return ip;
+    }
+    case ETH_P_IPV6: {
+        struct ipv6hdr *ip6 = l3;
+        if ((void *)(ip6 + 1) > data_end)
+            break;
+        __builtin_memcpy(pkt_info->src_ipv6, &ip6->saddr, sizeof(pkt_info->src_ipv6));
+        parse_transport(pkt_info, (void *)(ip6 + 1), data_end, ip6->nexthdr);
+        return ip6;
+    }
+    default:
+        break;
+    }
+    // a truncated or non-IP packet is matched and reported with a zero
+    // source, the tuple lookup must not see the previous packet's fields
+    pkt_info->src_ip = 0;
+    __builtin_memset(pkt_info->src_ipv6, 0, sizeof(pkt_info->src_ipv6));
+    pkt_info->ip_proto = 0;
+    pkt_info->src_port = 0;
+    pkt_info->dst_port = 0;
+    return NULL;
+}
+
+/* Complete the record before it leaves the program
+ * @pkt_info: Record filled by parse_source
+ * @eth: Ethernet header of the packet
+ * @l3: Network header returned by parse_source, may be NULL
+ * @data_end: Pointer to end of packet data
+ * Note: Every field of the other address family and of a non-IP packet is
+ * zeroed, so records of one flow compare equal as aggregation keys
+ */
+static __always_inline void fill_export(struct packet_info *pkt_info, struct ethhdr *eth, void *l3, void *data_end) {
+    __builtin_memcpy(pkt_info->dst_mac, eth->h_dest, ETH_ALEN);
+    if (l3 && pkt_info->eth_proto == ETH_P_IP) {
+        struct iphdr *ip = l3;
+        if ((void *)(ip + 1) > data_end)
+            return;
+        pkt_info->dst_ip = ip->daddr;
+        __builtin_memset(pkt_info->src_ipv6, 0, sizeof(pkt_info->src_ipv6));
+        __builtin_memset(pkt_info->dst_ipv6, 0, sizeof(pkt_info->dst_ipv6));
+        return;
+    }
+    if (l3 && pkt_info->eth_proto == ETH_P_IPV6) {
+        struct ipv6hdr *ip6 = l3;
+        if ((void *)(ip6 + 1) > data_end)
+            return;
+        __builtin_memcpy(pkt_info->dst_ipv6, &ip6->daddr, sizeof(pkt_info->dst_ipv6));
+        pkt_info->src_ip = 0;
+        pkt_info->dst_ip = 0;
+        return;
+    }
+    // not IP or truncated, only the link layer is known
+    pkt_info->src_ip = 0;
+    pkt_info->dst_ip = 0;
+    __builtin_memset(pkt_info->src_ipv6, 0, sizeof(pkt_info->src_ipv6));
+    __builtin_memset(pkt_info->dst_ipv6, 0, sizeof(pkt_info->dst_ipv6));
+    pkt_info->src_port = 0;
+    pkt_info->dst_port = 0;
+    pkt_info->ip_proto = 0;
+}
+
+/* Account the packet to its flow in the per-CPU aggregation map
+ * @pkt_info: Fully parsed packet, reused as the flow key
+ * Note: Values are per-CPU, so plain increments are safe without atomics
+ */
+static __always_inline void aggregate_flow(struct packet_info *pkt_info) {
+    __u32 size = pkt_info->pkt_size;
+    struct flow_counters *counters;
+
+    // Strip per-packet fields so packets of the same flow share one key
+    pkt_info->src_port = 0;
+    pkt_info->pkt_size = 0;
+    pkt_info->pkt_count = 0;
+
+    counters = bpf_map_lookup_elem(&flow_stats, pkt_info);
+    if (counters) {
+        counters->packets++;
+        counters->bytes += size;
+        return;
+    }
+    struct flow_counters init = {
+        .packets = 1,
+        .bytes = size
+    };
+    bpf_map_update_elem(&flow_stats, pkt_info, &init, BPF_ANY);
+}
+
+/* Export one packet_info record to userspace
+ * @ctx: XDP context, needed by the perf event output helper
+ * @pkt_info: Record to export
+ * @cfg: Runtime settings, may be NULL
+ * Note: Ring buffer wakeups are batched, userspace is only notified once
+ * wakeup_bytes are pending and drains the rest on its own flush deadline
+ */
+static __always_inline int output_ringbuf(void *rb, struct packet_info *pkt_info, struct settings *cfg) {
+    struct packet_info *rec = bpf_ringbuf_reserve(rb, sizeof(*rec), 0);
+    if (!rec)
+        return -1;
+    __builtin_memcpy(rec, pkt_info, sizeof(*rec));
+    __u64 flags = BPF_RB_FORCE_WAKEUP;
+    if (cfg && bpf_ringbuf_query(rb, BPF_RB_AVAIL_DATA) < cfg->wakeup_bytes)
+        flags = BPF_RB_NO_WAKEUP;
+    bpf_ringbuf_submit(rec, flags);
+    return 0;
+}
+
+static __always_inline void export_event(struct xdp_md *ctx, struct packet_info *pkt_info, struct settings *cfg, struct xdp_stats *st) {
+    if (use_ringbuf && rb_shards) {
+        // the shard of this CPU, read by a reader pinned to the same CPU
+        __u32 shard = bpf_get_smp_processor_id() % rb_shards;
+        void *rb = bpf_map_lookup_elem(&rb_shard_events, &shard);
+        if (rb && output_ringbuf(rb, pkt_info, cfg) == 0)
+            return;
+    } else if (use_ringbuf) {
+        if (output_ringbuf(&rb_events, pkt_info, cfg) == 0)
+            return;
+    } else if (bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, pkt_info, sizeof(*pkt_info)) == 0) {
+        return;
+    }
+
+    if (st)
+        st->export_failures++;
+}
+
+/* Decide whether a passed packet is exported, and weight it if so
+ * @pkt_info: Record to export, pkt_count and pkt_size are scaled by the sample rate
+ * @cfg: Runtime settings, may be NULL
+ * Returns: 1 if the packet should be exported, 0 if it is sampled out
+ */
+static __always_inline int sample_event(struct packet_info *pkt_info, struct settings *cfg) {
+    __u32 rate;
+
+    if (!cfg || cfg->sample_rate <= 1)
+        return 1;
+    rate = cfg->sample_rate;
+    if (rate > MAX_SAMPLE_RATE)
+        rate = MAX_SAMPLE_RATE;
+    if (bpf_get_prandom_u32() % rate)
+        return 0;
+    // The exported packet stands for the rate-1 packets that were skipped
+    pkt_info->pkt_count = rate;
+    pkt_info->pkt_size *= rate;
+    return 1;
+}
+
+/* Hand the packet to the AF_XDP socket bound to its receive queue
+ * Returns: XDP_REDIRECT, or XDP_PASS if no socket is bound to the queue
+ */
+static __always_inline int redirect_xsk(struct xdp_md *ctx, struct xdp_stats *st) {
+    __u32 ifindex = ctx->ingress_ifindex;
+    __u32 *base = bpf_map_lookup_elem(&xsk_bases, &ifindex);
+    int action = XDP_PASS;
+
+    if (base && ctx->rx_queue_index < XSK_QUEUES)
+        action = bpf_redirect_map(&xsks_map, *base + ctx->rx_queue_index, XDP_PASS);
+    if (st) {
+        if (action == XDP_REDIRECT)
+            st->redirect++;
+        else
+            st->pass++;
+    }
+    return action;
+}
+
 /* Main XDP program entry point
  * Processes incoming packets and applies filtering rules
  */
@@ -221,69 +958,89 @@ int xdp_prog(struct xdp_md *ctx)
     void *data = (void *)(long)ctx->data;
     struct ethhdr *eth = data;
     struct packet_info *pkt_info;
+    void *l3;
     __u32 key = DEFAULT_KEY;
     __u32 run_mode_key = DEFAULT_KEY;
     __u32 match_type = DEFAULT_KEY;
-    __u8 *mode;
-    
-    if (data + sizeof(struct ethhdr) > data_end)
+    struct settings *cfg;
+    struct xdp_stats *st;
+    int flagged = 0;
+
+    // Per-CPU, so plain increments are safe without atomics
+    st = bpf_map_lookup_elem(&stats, &key);
+    if (st)
+        st->rx++;
+
+    if (data + sizeof(struct ethhdr) > data_end) {
+        if (st) {
+            st->parse_errors++;
+            st->pass++;
+        }
         return XDP_PASS;
+    }
 
     // Get scratch map element
     pkt_info = bpf_map_lookup_elem(&scratch, &key);
     if (!pkt_info){
         bpf_printk("Failed to lookup scratch map\n");
+        if (st)
+            st->pass++;
         return XDP_PASS;
     }
-    __builtin_memset(pkt_info, 0, sizeof(*pkt_info));
 
-    // Copy MAC addresses
-    bpf_probe_read_kernel(pkt_info->src_mac, ETH_ALEN, eth->h_source);
-
-    // Copy destination MAC address
-    bpf_probe_read_kernel(pkt_info->dst_mac, ETH_ALEN, eth->h_dest);
-
-    // Ethernet protocol
+    // Only the fields the lookups read are filled here, see fill_export
+    __builtin_memcpy(pkt_info->src_mac, eth->h_source, ETH_ALEN);
     pkt_info->eth_proto = bpf_ntohs(eth->h_proto);
-    // Packet size
     pkt_info->pkt_size = data_end - data;
+    pkt_info->pkt_count = 1;
+    l3 = parse_source(pkt_info, data + sizeof(struct ethhdr), data_end);
+    if (!l3 && st && (pkt_info->eth_proto == ETH_P_IP || pkt_info->eth_proto == ETH_P_IPV6))
+        st->parse_errors++;
 
-    // Parse packet based on Ethernet protocol
-    switch (pkt_info->eth_proto) {
-    case ETH_P_IP: {
-        struct iphdr *ip = data + sizeof(struct ethhdr);
-        if ((void *)(ip + 1) > data_end)
-            goto submit;
+    cfg = bpf_map_lookup_elem(&settings, &run_mode_key);
 
-        bpf_probe_read_kernel(&pkt_info->src_ip, sizeof(__be32), &ip->saddr);
-        bpf_probe_read_kernel(&pkt_info->dst_ip, sizeof(__be32), &ip->daddr);
-        parse_transport(pkt_info, (void *)(ip + 1), data_end, ip->protocol);
-        break;
+    // Check if the packet matches any rules, then the geo and threat intelligence tries
+    match_type = match_by_rule(pkt_info);
+    if (match_type == MATCH_BY_PASS)
+        match_type = match_by_tuple(pkt_info);
+    if (match_type == MATCH_BY_PASS)
+        match_type = match_by_geo(pkt_info);
+    if (match_type == MATCH_BY_PASS && cfg && cfg->intel_action == INTEL_ACTION_DROP)
+        match_type = match_by_intel(pkt_info);
+    if (match_type == MATCH_BY_PASS && cfg && cfg->intel_action == INTEL_ACTION_THRESHOLD) {
+        if (is_offender(pkt_info)) {
+            match_type = MATCH_BY_INTEL;
+        } else {
+            match_type = match_by_intel(pkt_info);
+            // below the limit the packet passes, it is only counted
+            if (match_type != MATCH_BY_PASS && !rate_exceeded(pkt_info, match_type)) {
+                match_type = MATCH_BY_PASS;
+                flagged = 1;
+            }
+        }
     }
-    case ETH_P_IPV6: {
-        struct ipv6hdr *ip6 = data + sizeof(struct ethhdr);
-        if ((void *)(ip6 + 1) > data_end)
-            goto submit;
+    pkt_info->match_type = match_type;
 
-        bpf_probe_read_kernel(pkt_info->src_ipv6, sizeof(pkt_info->src_ipv6), &ip6->saddr);
-        bpf_probe_read_kernel(pkt_info->dst_ipv6, sizeof(pkt_info->dst_ipv6), &ip6->daddr);
-        parse_transport(pkt_info, (void *)(ip6 + 1), data_end, ip6->nexthdr);
-        break;
-    }
-    default:
-        break;
+    if (cfg && cfg->export_mode == EXPORT_MODE_AGGREGATE) {
+        fill_export(pkt_info, eth, l3, data_end);
+        aggregate_flow(pkt_info);
+    } else if (match_type != MATCH_BY_PASS || sample_event(pkt_info, cfg)) {
+        // Notify event
+        fill_export(pkt_info, eth, l3, data_end);
+        export_event(ctx, pkt_info, cfg, st);
     }
 
-submit:
-    // Check if the packet matches any rules
-    match_type = match_by_rule(pkt_info);
-    pkt_info->match_type = match_type;
-    // Notify event
-    bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU, pkt_info, sizeof(*pkt_info));
-
     if (match_type != MATCH_BY_PASS) {
+        if (st && match_type < MAX_MATCH_TYPES)
+            st->drop[match_type]++;
         return XDP_DROP;  // Match rule, drop
     }
+    // Passed intel sources are inspected by the analyzer, dropped ones are not
+    if (cfg && cfg->xsk_redirect && (flagged ||
+        (cfg->intel_action == INTEL_ACTION_OFF && match_by_intel(pkt_info) != MATCH_BY_PASS)))
+        return redirect_xsk(ctx, st);
+    if (st)
+        st->pass++;
     return XDP_PASS;
 }
 
@@ -0,0 +1,279 @@
+package ebpf
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"net/netip"
+	"os"
+	"testing"
+	"time"
+
+	"github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/rlimit"
+
+	"github.com/danger-dream/ebpf-firewall/internal/config"
+	"github.com/danger-dream/ebpf-firewall/internal/utils"
+)
+
+// verdicts of xdp_prog, see enum xdp_action in linux/bpf.h
+const (
+	xdpDrop = 1
+	xdpPass = 2
+)
+
+// benchPacket is one synthetic frame of a corpus
+type benchPacket struct {
+	src   netip.Addr
+	proto uint8
+	port  uint16
+	// whether the source is in the loaded rules
+	blocked bool
+}
+
+// frame builds an ethernet frame carrying an IPv4 or IPv6 header and a TCP
+// or UDP header, the checksums are left zero as xdp_prog never reads them
+func (p benchPacket) frame() []byte {
+	frame := make([]byte, 14, 128)
+	copy(frame[0:6], []byte{0x02, 0, 0, 0, 0, 0x01})
+	copy(frame[6:12], []byte{0x02, 0, 0, 0, 0, 0x02})
+	l4 := 20
+	if p.proto == 17 {
+		l4 = 8
+	}
+	if p.src.Is4() {
+		binary.BigEndian.PutUint16(frame[12:], 0x0800)
+		ip := make([]byte, 20)
+		ip[0] = 0x45
+		binary.BigEndian.PutUint16(ip[2:], uint16(20+l4))
+		ip[8] = 64
+		ip[9] = p.proto
+		src := p.src.As4()
+		copy(ip[12:16], src[:])
+		copy(ip[16:20], []byte{192, 0, 2, 1})
+		frame = append(frame, ip...)
+	} else {
+		binary.BigEndian.PutUint16(frame[12:], 0x86DD)
+		ip := make([]byte, 40)
+		ip[0] = 0x60
+		binary.BigEndian.PutUint16(ip[4:], uint16(l4))
+		ip[6] = p.proto
+		ip[7] = 64
+		src := p.src.As16()
+		copy(ip[8:24], src[:])
+		dst := netip.MustParseAddr("2001:db8:ffff::1").As16()
+		copy(ip[24:40], dst[:])
+		frame = append(frame, ip...)
+	}
+	transport := make([]byte, l4)
+	binary.BigEndian.PutUint16(transport[0:], 40000)
+	binary.BigEndian.PutUint16(transport[2:], p.port)
+	if p.proto == 6 {
+		transport[12] = 5 << 4
+	}
+	return append(frame, transport...)
+}
+
+// benchRules returns n exact IPv4, n IPv4 /24 and n exact IPv6 blocklist
+// rules, the i-th of each kind is benchAddr(kind, i)
+func benchRules(n int) []Rule {
+	rules := make([]Rule, 0, 3*n)
+	for i := 0; i < n; i++ {
+		rules = append(rules,
+			Rule{Value: benchAddr("ipv4", i).String()},
+			Rule{Value: netip.PrefixFrom(benchAddr("ipv4-cidr", i), 24).String()},
+			Rule{Value: benchAddr("ipv6", i).String()})
+	}
+	return rules
+}
+
+func benchAddr(kind string, i int) netip.Addr {
+	var b [4]byte
+	switch kind {
+	case "ipv4":
+		binary.BigEndian.PutUint32(b[:], 0x0a000000+uint32(i))
+	case "ipv4-cidr":
+		// one /24 per rule, the host part is what packets vary
+		binary.BigEndian.PutUint32(b[:], 0x20000000+uint32(i)<<8+7)
+	case "ipv6":
+		a := netip.MustParseAddr("2001:db8::").As16()
+		binary.BigEndian.PutUint32(a[12:], uint32(i))
+		return netip.AddrFrom16(a)
+	}
+	return netip.AddrFrom4(b)
+}
+
+// loadBenchProgram loads xdp_prog with n rules of every kind, it skips the
+// benchmark when the process may not load BPF programs
+func loadBenchProgram(tb testing.TB, n int) *EBPFManager {
+	tb.Helper()
+	if os.Geteuid() != 0 {
+		tb.Skip("loading BPF programs requires root")
+	}
+	if err := rlimit.RemoveMemlock(); err != nil {
+		tb.Skipf("failed to remove memlock: %s", err)
+	}
+	spec, err := loadXdp()
+	if err != nil {
+		tb.Fatal(err)
+	}
+	if err := configureTransport(spec, config.TransportRingBuf, 1<<20, 0); err != nil {
+		tb.Fatal(err)
+	}
+	size := max(n, 1024)
+	sizes := config.MapSizeConfig{
+		IPv4: size, IPv4CIDR: size, IPv6: size, IPv6CIDR: size, MAC: 1024,
+		IntelIPv4: 1024, IntelIPv6: 1024, GeoIPv4: 1024, GeoIPv6: 1024, Tuple: 1024, PortSets: 16,
+	}
+	if err := configureMapSizes(spec, sizes); err != nil {
+		tb.Fatal(err)
+	}
+	em := &EBPFManager{}
+	if em.objects, err = em.loadObjects(spec); err != nil {
+		if errors.Is(err, os.ErrPermission) {
+			tb.Skipf("not permitted to load BPF programs: %s", err)
+		}
+		tb.Fatal(err)
+	}
+	tb.Cleanup(func() { em.Close() })
+	if em.ruleMaps, err = newRuleMaps(spec, em.objects); err != nil {
+		tb.Fatal(err)
+	}
+	if err := em.tuples.attach(spec, em.objects); err != nil {
+		tb.Fatal(err)
+	}
+	if err := em.ReplaceRules(benchRules(n)); err != nil {
+		tb.Fatal(err)
+	}
+	// passed packets are sampled out, dropped ones fill the unread ring
+	// buffer and then only cost a failed reserve
+	em.settings = xdpSettings{ExportMode: exportModeEvent, SampleRate: config.MaxSampleRate}
+	if err := em.objects.Settings.Put(uint32(0), em.settings); err != nil {
+		tb.Fatal(err)
+	}
+	return em
+}
+
+// benchCorpora are the packet mixes run against every rule set size
+func benchCorpora(n int) map[string][]benchPacket {
+	hit4 := benchAddr("ipv4", n/2)
+	hitCIDR := benchAddr("ipv4-cidr", n/2)
+	hit6 := benchAddr("ipv6", n/2)
+	miss4 := netip.MustParseAddr("198.51.100.7")
+	miss6 := netip.MustParseAddr("2001:db8:ffff::7")
+	corpora := map[string][]benchPacket{
+		"ipv4-tcp-hit":  {{hit4, 6, 443, true}},
+		"ipv4-cidr-hit": {{hitCIDR, 17, 53, true}},
+		"ipv4-tcp-miss": {{miss4, 6, 443, false}},
+		"ipv4-udp-miss": {{miss4, 17, 53, false}},
+		"ipv6-udp-hit":  {{hit6, 17, 53, true}},
+		"ipv6-tcp-miss": {{miss6, 6, 443, false}},
+		"ipv6-udp-miss": {{miss6, 17, 53, false}},
+	}
+	// one packet in four is blocked
+	var mixed []benchPacket
+	for i := 0; i < 64; i++ {
+		if i%4 == 0 {
+			mixed = append(mixed, benchPacket{benchAddr("ipv4", i*n/64), 6, 443, true})
+		} else {
+			mixed = append(mixed, benchPacket{miss4, 6, 443, false})
+		}
+	}
+	corpora["mixed"] = mixed
+	return corpora
+}
+
+// runCorpus runs every packet of corpus the same number of times through
+// BPF_PROG_TEST_RUN and reports the kernel time per packet and the verdicts
+func runCorpus(b *testing.B, em *EBPFManager, corpus []benchPacket) {
+	frames := make([][]byte, len(corpus))
+	for i, p := range corpus {
+		frames[i] = p.frame()
+	}
+	repeat := max(b.N/len(frames), 1)
+	var total time.Duration
+	verdicts := make(map[uint32]int)
+	b.ResetTimer()
+	for _, frame := range frames {
+		ret, perRun, err := em.objects.XdpProg.Benchmark(frame, repeat, nil)
+		if err != nil {
+			b.Fatal(err)
+		}
+		total += perRun
+		verdicts[ret]++
+	}
+	b.StopTimer()
+	b.ReportMetric(float64(total.Nanoseconds())/float64(len(frames)), "ns/pkt")
+	b.ReportMetric(float64(verdicts[xdpDrop])/float64(len(frames)), "drop-ratio")
+	b.ReportMetric(float64(verdicts[xdpPass])/float64(len(frames)), "pass-ratio")
+}
+
+// BenchmarkXDPProg measures xdp_prog in the kernel over synthetic corpora,
+// run as root with e.g. go test -run '^$' -bench XDPProg ./internal/ebpf
+func BenchmarkXDPProg(b *testing.B) {
+	for _, n := range []int{1_000, 10_000, 100_000, 1_000_000} {
+		if n > 100_000 && testing.Short() {
+			continue
+		}
+		b.Run(fmt.Sprintf("rules=%d", n), func(b *testing.B) {
+			em := loadBenchProgram(b, n)
+			for name, corpus := range benchCorpora(n) {
+				b.Run(name, func(b *testing.B) {
+					runCorpus(b, em, corpus)
+				})
+			}
+		})
+	}
+}
+
+// TestXDPProg_Verdicts checks the verdict of every benchmark corpus, so a
+// benchmark never measures a path that stopped matching
+func TestXDPProg_Verdicts(t *testing.T) {
+	const n = 1000
+	em := loadBenchProgram(t, n)
+	for name, corpus := range benchCorpora(n) {
+		for _, p := range corpus {
+			ret, err := em.objects.XdpProg.Run(&ebpf.RunOptions{Data: p.frame()})
+			if err != nil {
+				t.Fatal(err)
+			}
+			want := uint32(xdpPass)
+			if p.blocked {
+				want = xdpDrop
+			}
+			if ret != want {
+				t.Errorf("%s: %s returned %d, want %d", name, p.src, ret, want)
+			}
+		}
+	}
+}
+
+// TestXDPProg_Expiry checks that xdp_prog ignores expired entries before they are swept
+func TestXDPProg_Expiry(t *testing.T) {
+	em := loadBenchProgram(t, 1000)
+	src := netip.MustParseAddr("198.51.100.9")
+	frame := benchPacket{src, 6, 443, false}.frame()
+	verdict := func() uint32 {
+		ret, err := em.objects.XdpProg.Run(&ebpf.RunOptions{Data: frame})
+		if err != nil {
+			t.Fatal(err)
+		}
+		return ret
+	}
+	if err := em.AddRule(src.String(), time.Now().Add(time.Hour).Unix()); err != nil {
+		t.Fatal(err)
+	}
+	if ret := verdict(); ret != xdpDrop {
+		t.Fatalf("rule expiring in an hour returned %d, want %d", ret, xdpDrop)
+	}
+	// setting an expiry in the past expires the present entry
+	if err := em.AddRule(src.String(), time.Now().Add(-time.Second).Unix()); err != nil {
+		t.Fatal(err)
+	}
+	if ret := verdict(); ret != xdpPass {
+		t.Fatalf("expired rule returned %d, want %d", ret, xdpPass)
+	}
+	if n := em.ruleMaps[utils.IPTypeIPv4].sweep(ktimeNow()); n != 1 {
+		t.Errorf("sweep deleted %d entries, want 1", n)
+	}
+}
@@ -12,16 +12,20 @@ import (
 	"github.com/cilium/ebpf"
 )
 
-type xdpIn6Addr struct{ In6U struct{ U6Addr8 [16]uint8 } }
+type xdpFlowCounters struct {
+	Packets uint64
+	Bytes   uint64
+}
 
-type xdpIpv4TrieKey struct {
-	Prefixlen uint32
-	Addr      uint32
+type xdpMapState struct {
+	Generation uint64
+	Entries    uint64
 }
 
-type xdpIpv6TrieKey struct {
-	Prefixlen uint32
-	Addr      xdpIn6Addr
+type xdpOffender struct {
+	FlaggedNs uint64
+	MatchType uint32
+	Hits      uint32
 }
 
 type xdpPacketInfo struct {
@@ -37,6 +41,39 @@ type xdpPacketInfo struct {
 	IpProto   uint16
 	PktSize   uint32
 	MatchType uint32
+	PktCount  uint32
+}
+
+type xdpPortSet struct{ Bits [1024]uint64 }
+
+type xdpRateLimit struct {
+	Threshold uint32
+	WindowMs  uint32
+}
+
+type xdpRateWindow struct {
+	StartNs   uint64
+	Count     uint32
+	PrevCount uint32
+}
+
+type xdpSettings struct {
+	ExportMode  uint32
+	WakeupBytes uint32
+	SampleRate  uint32
+	IntelAction uint32
+	XskRedirect uint32
+}
+
+type xdpSrcKey struct{ Addr [16]uint8 }
+
+type xdpXdpStats struct {
+	Rx             uint64
+	Pass           uint64
+	Drop           [9]uint64
+	ParseErrors    uint64
+	ExportFailures uint64
+	Redirect       uint64
 }
 
 // loadXdp returns the embedded CollectionSpec for xdp.
@@ -87,13 +124,31 @@ type xdpProgramSpecs struct {
 //
 // It can be passed ebpf.CollectionSpec.Assign.
 type xdpMapSpecs struct {
-	Events       *ebpf.MapSpec `ebpf:"events"`
-	Ipv4CidrTrie *ebpf.MapSpec `ebpf:"ipv4_cidr_trie"`
-	Ipv4List     *ebpf.MapSpec `ebpf:"ipv4_list"`
-	Ipv6CidrTrie *ebpf.MapSpec `ebpf:"ipv6_cidr_trie"`
-	Ipv6List     *ebpf.MapSpec `ebpf:"ipv6_list"`
-	MacList      *ebpf.MapSpec `ebpf:"mac_list"`
-	Scratch      *ebpf.MapSpec `ebpf:"scratch"`
+	Events        *ebpf.MapSpec `ebpf:"events"`
+	FlowStats     *ebpf.MapSpec `ebpf:"flow_stats"`
+	GeoIpv4Trie   *ebpf.MapSpec `ebpf:"geo_ipv4_trie"`
+	GeoIpv6Trie   *ebpf.MapSpec `ebpf:"geo_ipv6_trie"`
+	IntelIpv4Trie *ebpf.MapSpec `ebpf:"intel_ipv4_trie"`
+	IntelIpv6Trie *ebpf.MapSpec `ebpf:"intel_ipv6_trie"`
+	Ipv4CidrTrie  *ebpf.MapSpec `ebpf:"ipv4_cidr_trie"`
+	Ipv4List      *ebpf.MapSpec `ebpf:"ipv4_list"`
+	Ipv6CidrTrie  *ebpf.MapSpec `ebpf:"ipv6_cidr_trie"`
+	Ipv6List      *ebpf.MapSpec `ebpf:"ipv6_list"`
+	MacList       *ebpf.MapSpec `ebpf:"mac_list"`
+	Offenders     *ebpf.MapSpec `ebpf:"offenders"`
+	PinState      *ebpf.MapSpec `ebpf:"pin_state"`
+	PortSets      *ebpf.MapSpec `ebpf:"port_sets"`
+	RateLimits    *ebpf.MapSpec `ebpf:"rate_limits"`
+	RateWindows   *ebpf.MapSpec `ebpf:"rate_windows"`
+	RbEvents      *ebpf.MapSpec `ebpf:"rb_events"`
+	RbShardEvents *ebpf.MapSpec `ebpf:"rb_shard_events"`
+	Scratch       *ebpf.MapSpec `ebpf:"scratch"`
+	Settings      *ebpf.MapSpec `ebpf:"settings"`
+	Stats         *ebpf.MapSpec `ebpf:"stats"`
+	TupleIpv4Trie *ebpf.MapSpec `ebpf:"tuple_ipv4_trie"`
+	TupleIpv6Trie *ebpf.MapSpec `ebpf:"tuple_ipv6_trie"`
+	XskBases      *ebpf.MapSpec `ebpf:"xsk_bases"`
+	XsksMap       *ebpf.MapSpec `ebpf:"xsks_map"`
 }
 
 // xdpObjects contains all objects after they have been loaded into the kernel.
@@ -115,24 +170,60 @@ func (o *xdpObjects) Close() error {
 //
 // It can be passed to loadXdpObjects or ebpf.CollectionSpec.LoadAndAssign.
 type xdpMaps struct {
-	Events       *ebpf.Map `ebpf:"events"`
-	Ipv4CidrTrie *ebpf.Map `ebpf:"ipv4_cidr_trie"`
-	Ipv4List     *ebpf.Map `ebpf:"ipv4_list"`
-	Ipv6CidrTrie *ebpf.Map `ebpf:"ipv6_cidr_trie"`
-	Ipv6List     *ebpf.Map `ebpf:"ipv6_list"`
-	MacList      *ebpf.Map `ebpf:"mac_list"`
-	Scratch      *ebpf.Map `ebpf:"scratch"`
+	Events        *ebpf.Map `ebpf:"events"`
+	FlowStats     *ebpf.Map `ebpf:"flow_stats"`
+	GeoIpv4Trie   *ebpf.Map `ebpf:"geo_ipv4_trie"`
+	GeoIpv6Trie   *ebpf.Map `ebpf:"geo_ipv6_trie"`
+	IntelIpv4Trie *ebpf.Map `ebpf:"intel_ipv4_trie"`
+	IntelIpv6Trie *ebpf.Map `ebpf:"intel_ipv6_trie"`
+	Ipv4CidrTrie  *ebpf.Map `ebpf:"ipv4_cidr_trie"`
+	Ipv4List      *ebpf.Map `ebpf:"ipv4_list"`
+	Ipv6CidrTrie  *ebpf.Map `ebpf:"ipv6_cidr_trie"`
+	Ipv6List      *ebpf.Map `ebpf:"ipv6_list"`
+	MacList       *ebpf.Map `ebpf:"mac_list"`
+	Offenders     *ebpf.Map `ebpf:"offenders"`
+	PinState      *ebpf.Map `ebpf:"pin_state"`
+	PortSets      *ebpf.Map `ebpf:"port_sets"`
+	RateLimits    *ebpf.Map `ebpf:"rate_limits"`
+	RateWindows   *ebpf.Map `ebpf:"rate_windows"`
+	RbEvents      *ebpf.Map `ebpf:"rb_events"`
+	RbShardEvents *ebpf.Map `ebpf:"rb_shard_events"`
+	Scratch       *ebpf.Map `ebpf:"scratch"`
+	Settings      *ebpf.Map `ebpf:"settings"`
+	Stats         *ebpf.Map `ebpf:"stats"`
+	TupleIpv4Trie *ebpf.Map `ebpf:"tuple_ipv4_trie"`
+	TupleIpv6Trie *ebpf.Map `ebpf:"tuple_ipv6_trie"`
+	XskBases      *ebpf.Map `ebpf:"xsk_bases"`
+	XsksMap       *ebpf.Map `ebpf:"xsks_map"`
 }
 
 func (m *xdpMaps) Close() error {
 	return _XdpClose(
 		m.Events,
+		m.FlowStats,
+		m.GeoIpv4Trie,
+		m.GeoIpv6Trie,
+		m.IntelIpv4Trie,
+		m.IntelIpv6Trie,
 		m.Ipv4CidrTrie,
 		m.Ipv4List,
 		m.Ipv6CidrTrie,
 		m.Ipv6List,
 		m.MacList,
+		m.Offenders,
+		m.PinState,
+		m.PortSets,
+		m.RateLimits,
+		m.RateWindows,
+		m.RbEvents,
+		m.RbShardEvents,
 		m.Scratch,
+		m.Settings,
+		m.Stats,
+		m.TupleIpv4Trie,
+		m.TupleIpv6Trie,
+		m.XskBases,
+		m.XsksMap,
 	)
 }
 
@@ -0,0 +1,123 @@
+package metrics
+
+import "container/heap"
+
+const (
+	// targets kept per source in bounded mode
+	boundedTargetsPerSource = 32
+	// approximate memory of a tracked source, its targets and sketch counters
+	approxSourceBytes = 160 + boundedTargetsPerSource*96 + 2*cmsDepth*4
+	// counters per sketch row for small capacities
+	minSketchWidth = 1024
+)
+
+// sourceLimit bounds the number of tracked sources with Space-Saving: when
+// the table is full a new source replaces the one with the fewest packets,
+// but only if the Count-Min sketch estimates it has seen more than that
+type sourceLimit struct {
+	capacity int
+	heap     sourceHeap
+	sketch   *countMinSketch
+	evicted  int64
+}
+
+// returns the per shard source capacity of a memory budget in bytes
+func boundedCapacity(budget int64, shards int) int {
+	capacity := int(budget / int64(shards) / approxSourceBytes)
+	if capacity < 1 {
+		capacity = 1
+	}
+	return capacity
+}
+
+func newSourceLimit(capacity int) *sourceLimit {
+	return &sourceLimit{
+		capacity: capacity,
+		heap:     make(sourceHeap, 0, capacity),
+		sketch:   newCountMinSketch(max(capacity*2, minSketchWidth)),
+	}
+}
+
+// admit decides whether a new source is tracked, evicting the smallest one if
+// needed, and returns the packets it inherits from the sketch estimate
+func (l *sourceLimit) admit(s *metricsState, hash uint64, count uint32) (int64, bool) {
+	if len(l.heap) < l.capacity {
+		return 0, true
+	}
+	estimate := int64(l.sketch.add(hash, count))
+	victim := l.heap[0]
+	if estimate <= victim.TotalPackets {
+		return 0, false
+	}
+	heap.Pop(&l.heap)
+	delete(s.sources, victim.key)
+	l.evicted++
+	return estimate - int64(count), true
+}
+
+func (l *sourceLimit) track(source *sourceEntry) {
+	heap.Push(&l.heap, source)
+}
+
+func (l *sourceLimit) update(source *sourceEntry) {
+	heap.Fix(&l.heap, source.index)
+}
+
+// rebuilds the heap from the sources and evicts the smallest beyond capacity
+func (l *sourceLimit) reset(s *metricsState) {
+	l.heap = l.heap[:0]
+	for key, source := range s.sources {
+		source.key = key
+		l.heap = append(l.heap, source)
+	}
+	heap.Init(&l.heap)
+	for len(l.heap) > l.capacity {
+		victim := heap.Pop(&l.heap).(*sourceEntry)
+		delete(s.sources, victim.key)
+		l.evicted++
+	}
+}
+
+// adds a target to a full source by replacing the one with the fewest
+// packets, it inherits that count as with Space-Saving
+func replaceMinTarget(targets map[targetKey]*TrafficMetrics, key targetKey, now int64) *TrafficMetrics {
+	var minKey targetKey
+	var minTarget *TrafficMetrics
+	for k, target := range targets {
+		if minTarget == nil || target.TotalPackets < minTarget.TotalPackets {
+			minKey, minTarget = k, target
+		}
+	}
+	delete(targets, minKey)
+	target := &TrafficMetrics{
+		TotalPackets: minTarget.TotalPackets,
+		TotalBytes:   minTarget.TotalBytes,
+		FirstSeenAt:  now,
+	}
+	targets[key] = target
+	return target
+}
+
+// min-heap of tracked sources on total packets
+type sourceHeap []*sourceEntry
+
+func (h sourceHeap) Len() int           { return len(h) }
+func (h sourceHeap) Less(i, j int) bool { return h[i].TotalPackets < h[j].TotalPackets }
+func (h sourceHeap) Swap(i, j int) {
+	h[i], h[j] = h[j], h[i]
+	h[i].index = i
+	h[j].index = j
+}
+func (h *sourceHeap) Push(x any) {
+	source := x.(*sourceEntry)
+	source.index = len(*h)
+	*h = append(*h, source)
+}
+func (h *sourceHeap) Pop() any {
+	old := *h
+	n := len(old)
+	source := old[n-1]
+	old[n-1] = nil
+	*h = old[:n-1]
+	return source
+}
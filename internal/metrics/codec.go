@@ -0,0 +1,278 @@
+package metrics
+
+import (
+	"encoding/binary"
+	"fmt"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// binary record encoding of the metrics state. Every record carries absolute
+// values, so replaying a record again or out of a newer base is harmless.
+
+const (
+	recordTotals    = 1
+	recordDay       = 2
+	recordDimension = 3
+	recordSource    = 4
+	recordTarget    = 5
+)
+
+// dimension identifiers in dimension records
+const (
+	dimCountry = iota + 1
+	dimCity
+	dimPort
+	dimEthType
+	dimIPProto
+	dimMatch
+)
+
+const metricsSize = 32
+
+func appendMetrics(b []byte, m *TrafficMetrics) []byte {
+	b = binary.LittleEndian.AppendUint64(b, uint64(m.TotalPackets))
+	b = binary.LittleEndian.AppendUint64(b, uint64(m.TotalBytes))
+	b = binary.LittleEndian.AppendUint64(b, uint64(m.FirstSeenAt))
+	return binary.LittleEndian.AppendUint64(b, uint64(m.LastSeenAt))
+}
+
+func appendString(b []byte, s string) []byte {
+	b = binary.AppendUvarint(b, uint64(len(s)))
+	return append(b, s...)
+}
+
+func appendSourceKey(b []byte, key sourceKey) []byte {
+	b = append(b, key.MAC[:]...)
+	return append(b, key.IP[:]...)
+}
+
+func appendTargetKey(b []byte, key targetKey) []byte {
+	b = append(b, key.MAC[:]...)
+	b = append(b, key.IP[:]...)
+	b = binary.LittleEndian.AppendUint16(b, key.Port)
+	b = binary.LittleEndian.AppendUint16(b, uint16(key.EthType))
+	return binary.LittleEndian.AppendUint16(b, uint16(key.IPProto))
+}
+
+func appendDimension[K comparable](b []byte, id byte, d dimension[K], since int64, appendKey func([]byte, K) []byte) []byte {
+	for key, stat := range d {
+		if stat.LastSeenAt < since {
+			continue
+		}
+		b = append(b, recordDimension, id)
+		b = appendKey(b, key)
+		b = appendMetrics(b, stat)
+	}
+	return b
+}
+
+// appendTotals encodes totals, days and the dimensions seen since the given time
+func appendTotals(b []byte, s *metricsState, since int64) []byte {
+	b = append(b, recordTotals)
+	b = binary.LittleEndian.AppendUint64(b, uint64(s.totalPackets))
+	b = binary.LittleEndian.AppendUint64(b, uint64(s.totalBytes))
+	for day, stat := range s.day {
+		b = append(b, recordDay)
+		b = appendString(b, day)
+		b = binary.LittleEndian.AppendUint64(b, uint64(stat.TotalPackets))
+		b = binary.LittleEndian.AppendUint64(b, uint64(stat.TotalBytes))
+	}
+	b = appendDimension(b, dimCountry, s.countries, since, appendString)
+	b = appendDimension(b, dimCity, s.cities, since, appendString)
+	b = appendDimension(b, dimPort, s.ports, since, func(b []byte, port uint16) []byte {
+		return binary.LittleEndian.AppendUint16(b, port)
+	})
+	b = appendDimension(b, dimEthType, s.ethTypes, since, func(b []byte, et types.EthernetType) []byte {
+		return binary.LittleEndian.AppendUint16(b, uint16(et))
+	})
+	b = appendDimension(b, dimIPProto, s.ipProtos, since, func(b []byte, proto types.IPProtocol) []byte {
+		return binary.LittleEndian.AppendUint16(b, uint16(proto))
+	})
+	b = appendDimension(b, dimMatch, s.matches, since, func(b []byte, key matchKey) []byte {
+		b = append(b, key.MAC[:]...)
+		return append(b, key.IP[:]...)
+	})
+	return b
+}
+
+// appendSources encodes the sources and targets seen since the given time
+func appendSources(b []byte, s *metricsState, since int64) []byte {
+	for key, source := range s.sources {
+		if source.LastSeenAt < since {
+			continue
+		}
+		b = append(b, recordSource)
+		b = appendSourceKey(b, key)
+		b = appendString(b, source.Location.Country)
+		b = appendString(b, source.Location.City)
+		b = appendMetrics(b, &source.TrafficMetrics)
+		for tk, target := range source.targets {
+			if target.LastSeenAt < since {
+				continue
+			}
+			b = append(b, recordTarget)
+			b = appendSourceKey(b, key)
+			b = appendTargetKey(b, tk)
+			b = appendMetrics(b, target)
+		}
+	}
+	return b
+}
+
+// recordDecoder reads records from a frame payload
+type recordDecoder struct {
+	b   []byte
+	err error
+}
+
+func (d *recordDecoder) next(n int) []byte {
+	if d.err != nil {
+		return nil
+	}
+	if len(d.b) < n {
+		d.err = fmt.Errorf("truncated metrics record")
+		return nil
+	}
+	v := d.b[:n]
+	d.b = d.b[n:]
+	return v
+}
+
+func (d *recordDecoder) uint16() uint16 {
+	if v := d.next(2); v != nil {
+		return binary.LittleEndian.Uint16(v)
+	}
+	return 0
+}
+
+func (d *recordDecoder) int64() int64 {
+	if v := d.next(8); v != nil {
+		return int64(binary.LittleEndian.Uint64(v))
+	}
+	return 0
+}
+
+func (d *recordDecoder) string() string {
+	if d.err != nil {
+		return ""
+	}
+	n, size := binary.Uvarint(d.b)
+	if size <= 0 || n > uint64(len(d.b)-size) {
+		d.err = fmt.Errorf("invalid metrics string")
+		return ""
+	}
+	d.b = d.b[size:]
+	return string(d.next(int(n)))
+}
+
+func (d *recordDecoder) metrics() *TrafficMetrics {
+	return &TrafficMetrics{
+		TotalPackets: d.int64(),
+		TotalBytes:   d.int64(),
+		FirstSeenAt:  d.int64(),
+		LastSeenAt:   d.int64(),
+	}
+}
+
+func (d *recordDecoder) sourceKey() sourceKey {
+	var key sourceKey
+	if v := d.next(len(key.MAC) + len(key.IP)); v != nil {
+		copy(key.MAC[:], v)
+		copy(key.IP[:], v[len(key.MAC):])
+	}
+	return key
+}
+
+func (d *recordDecoder) targetKey() targetKey {
+	source := d.sourceKey()
+	return targetKey{
+		MAC:     source.MAC,
+		IP:      source.IP,
+		Port:    d.uint16(),
+		EthType: types.EthernetType(d.uint16()),
+		IPProto: types.IPProtocol(d.uint16()),
+	}
+}
+
+// decodeRecords applies the records of a frame payload to the state
+func decodeRecords(s *metricsState, payload []byte) error {
+	d := &recordDecoder{b: payload}
+	for len(d.b) > 0 && d.err == nil {
+		switch tag := d.next(1)[0]; tag {
+		case recordTotals:
+			s.totalPackets = d.int64()
+			s.totalBytes = d.int64()
+		case recordDay:
+			day := d.string()
+			stat := &Statistics{Key: day}
+			stat.TotalPackets = d.int64()
+			stat.TotalBytes = d.int64()
+			if d.err == nil {
+				s.day[day] = stat
+			}
+		case recordDimension:
+			d.dimension(s)
+		case recordSource:
+			key := d.sourceKey()
+			location := GeoLocation{Country: d.string(), City: d.string()}
+			metrics := d.metrics()
+			if d.err != nil {
+				break
+			}
+			if source, ok := s.sources[key]; ok {
+				source.Location = location
+				source.TrafficMetrics = *metrics
+			} else {
+				s.sources[key] = &sourceEntry{
+					Location:       location,
+					TrafficMetrics: *metrics,
+					targets:        make(map[targetKey]*TrafficMetrics),
+					key:            key,
+				}
+			}
+		case recordTarget:
+			key := d.sourceKey()
+			target := d.targetKey()
+			metrics := d.metrics()
+			// targets always follow their source record
+			if source, ok := s.sources[key]; ok && d.err == nil {
+				source.targets[target] = metrics
+			}
+		default:
+			return fmt.Errorf("unknown metrics record: %d", tag)
+		}
+	}
+	return d.err
+}
+
+func (d *recordDecoder) dimension(s *metricsState) {
+	id := d.next(1)
+	if id == nil {
+		return
+	}
+	switch id[0] {
+	case dimCountry, dimCity:
+		key := d.string()
+		metrics := d.metrics()
+		if d.err == nil && id[0] == dimCountry {
+			s.countries[key] = metrics
+		} else if d.err == nil {
+			s.cities[key] = metrics
+		}
+	case dimPort:
+		key := d.uint16()
+		s.ports[key] = d.metrics()
+	case dimEthType:
+		key := types.EthernetType(d.uint16())
+		s.ethTypes[key] = d.metrics()
+	case dimIPProto:
+		key := types.IPProtocol(d.uint16())
+		s.ipProtos[key] = d.metrics()
+	case dimMatch:
+		source := d.sourceKey()
+		s.matches[matchKey(source)] = d.metrics()
+	default:
+		d.err = fmt.Errorf("unknown metrics dimension: %d", id[0])
+	}
+}
@@ -1,15 +1,16 @@
 package metrics
 
 import (
-	"fmt"
+	"hash/maphash"
 	"log"
+	"runtime"
 	"sort"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/danger-dream/ebpf-firewall/internal/config"
 	"github.com/danger-dream/ebpf-firewall/internal/types"
-	"github.com/danger-dream/ebpf-firewall/internal/utils"
 )
 
 const (
@@ -31,6 +32,10 @@ type GeoLocation struct {
 	City    string `json:"city"`
 }
 
+// Locator returns the location of a source address, it is called with the
+// shard of the source locked, once per new source
+type Locator func(ip types.IPAddr) GeoLocation
+
 // protocol of a packet
 type Protocol struct {
 	EthType types.EthernetType `json:"eth_type"`
@@ -99,50 +104,140 @@ type MetricsSummary struct {
 	Source       map[string]SourceStatistic        `json:"source"`
 }
 
+// one stripe of the collector state, a source always maps to the same shard
+type collectorShard struct {
+	mu    sync.Mutex
+	state *metricsState
+}
+
 // MetricsCollector handles the collection and aggregation of network metrics
 type MetricsCollector struct {
-	summary MetricsSummary
-	mu      sync.RWMutex
-	done    chan struct{}
-	storage *MetricsStorage
+	shards   []*collectorShard
+	mask     uint64
+	seed     maphash.Seed
+	snapshot atomic.Pointer[metricsSnapshot]
+	series   *timeSeries
+	done     chan struct{}
+	storage  *MetricsStorage
+	// serializes persists, persistedAt is when the last one started
+	persistMu   sync.Mutex
+	persistedAt int64
+	persistBuf  []byte
+	compact     atomic.Bool
+
+	// contended shard locks in CollectPacket and the time spent waiting on them
+	lockWaits  atomic.Uint64
+	lockWaitNs atomic.Uint64
+}
+
+// LockStats describes the contention on the collector shards
+type LockStats struct {
+	Waits      uint64 `json:"waits"`
+	WaitTimeNs uint64 `json:"wait_time_ns"`
+}
+
+// returns the number of shards, twice the usable CPUs rounded up to a power of two
+func shardCount() int {
+	n := 1
+	for n < runtime.GOMAXPROCS(0)*2 {
+		n <<= 1
+	}
+	return n
 }
 
 // NewMetricsCollector creates and initializes a new metrics collector instance
 func NewMetricsCollector() *MetricsCollector {
 	storage := NewMetricsStorage(config.GetConfig().DataDir)
 
-	var summary MetricsSummary
-	if metrics, err := storage.Load(); err == nil && metrics != nil {
-		summary = *metrics
-	} else {
-		summary = MetricsSummary{
-			Day:        make(map[string]Statistics),
-			Statistics: make(map[string]map[string]*Statistics),
-			Source:     make(map[string]SourceStatistic),
-		}
+	metricsCollector := newShardedCollector(shardCount())
+	metricsCollector.storage = storage
+	if budget := config.GetConfig().MetricsMemoryBudget; budget > 0 {
+		metricsCollector.bound(int64(budget) << 20)
 	}
-
-	metricsCollector := &MetricsCollector{
-		summary: summary,
-		done:    make(chan struct{}),
-		storage: storage,
+	if state, err := storage.Load(); err != nil {
+		log.Printf("加载指标数据失败: %v", err)
+	} else if state != nil {
+		metricsCollector.restore(state)
 	}
 
 	go metricsCollector.autoCleanup()
 	go metricsCollector.autoPersist()
+	go metricsCollector.autoPublish()
+	go metricsCollector.autoSeries()
 	return metricsCollector
 }
 
+func newShardedCollector(n int) *MetricsCollector {
+	mc := &MetricsCollector{
+		shards: make([]*collectorShard, n),
+		mask:   uint64(n - 1),
+		seed:   maphash.MakeSeed(),
+		series: newTimeSeries(),
+		done:   make(chan struct{}),
+	}
+	for i := range mc.shards {
+		mc.shards[i] = &collectorShard{state: newMetricsState()}
+	}
+	return mc
+}
+
+// bound limits the tracked sources to a memory budget in bytes, only heavy
+// hitters are kept per source while totals and dimensions stay exact
+func (mc *MetricsCollector) bound(budget int64) {
+	capacity := boundedCapacity(budget, len(mc.shards))
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		shard.state.limit = newSourceLimit(capacity)
+		shard.state.limit.reset(shard.state)
+		shard.mu.Unlock()
+	}
+}
+
+func (mc *MetricsCollector) hash(key sourceKey) uint64 {
+	b := key.bytes()
+	return maphash.Bytes(mc.seed, b[:])
+}
+
+func (mc *MetricsCollector) shard(key sourceKey) *collectorShard {
+	return mc.shards[mc.hash(key)&mc.mask]
+}
+
+// restore distributes a loaded state over the shards, totals and dimensions
+// stay on the first shard and every source moves to the shard of its key
+func (mc *MetricsCollector) restore(state *metricsState) {
+	for key, source := range state.sources {
+		hash := mc.hash(key)
+		shard := mc.shards[hash&mc.mask]
+		shard.state.distinct.add(hash)
+		if shard != mc.shards[0] {
+			shard.state.sources[key] = source
+			delete(state.sources, key)
+		}
+	}
+	first := mc.shards[0].state
+	state.distinct, state.limit = first.distinct, first.limit
+	mc.shards[0].state = state
+	for _, shard := range mc.shards {
+		if shard.state.limit != nil {
+			shard.state.limit.reset(shard.state)
+		}
+	}
+}
+
 // periodically persist metrics data
 func (mc *MetricsCollector) autoPersist() {
-	ticker := time.NewTicker(time.Minute * time.Duration(config.GetConfig().MetricsPersistInterval))
+	interval := config.GetConfig().MetricsPersistInterval
+	if interval <= 0 {
+		return
+	}
+	ticker := time.NewTicker(time.Minute * time.Duration(interval))
 	defer ticker.Stop()
 	for {
 		select {
 		case <-mc.done:
 			return
 		case <-ticker.C:
-			if err := mc.storage.Save(&mc.summary); err != nil {
+			if err := mc.persist(false); err != nil {
 				log.Printf("保存指标数据失败: %v", err)
 			}
 		}
@@ -164,191 +259,92 @@ func (mc *MetricsCollector) autoCleanup() {
 }
 
 func (mc *MetricsCollector) CleanupStaleMetrics(retention time.Duration) {
-	now := time.Now().Unix()
-
-	for _, stats := range mc.summary.Statistics {
-		for key, stat := range stats {
-			if now-stat.LastSeenAt > int64(retention.Seconds()) {
-				delete(stats, key)
-			}
-		}
-	}
-	for _, source := range mc.summary.Source {
-		if now-source.LastSeenAt > int64(retention.Seconds()) {
-			delete(mc.summary.Source, source.Key)
-		}
-	}
+	before := time.Now().Unix() - int64(retention.Seconds())
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		shard.state.cleanup(before)
+		shard.mu.Unlock()
+	}
+	// removed entries only disappear from disk with the next base
+	mc.compact.Store(true)
 }
 
-// processes metrics for a single packet
+// processes metrics for a single packet, only the shard of its source is locked
 func (mc *MetricsCollector) CollectPacket(packet *types.Packet) {
-	mc.mu.Lock()
-	defer mc.mu.Unlock()
-	mc.updateSummaryMetrics(packet)
-	mc.updateDimensionMetrics(packet)
-	mc.updateSourceMetrics(packet)
-}
-
-func (mc *MetricsCollector) updateSummaryMetrics(packet *types.Packet) {
-	mc.summary.TotalPackets++
-	mc.summary.TotalBytes += int64(packet.Size)
-	day := time.Now().Format(DayFormat)
-	dayData, ok := mc.summary.Day[day]
-	if !ok {
-		dayData = Statistics{
-			Key: day,
-		}
-	}
-	dayData.TotalPackets++
-	dayData.TotalBytes += int64(packet.Size)
-	mc.summary.Day[day] = dayData
+	key := sourceKey{MAC: packet.SrcMAC, IP: packet.SrcIP}
+	hash := mc.hash(key)
+	shard := mc.shards[hash&mc.mask]
+	if !shard.mu.TryLock() {
+		// only a contended lock is timed, the fast path stays a single CAS
+		start := time.Now()
+		shard.mu.Lock()
+		mc.lockWaits.Add(1)
+		mc.lockWaitNs.Add(uint64(time.Since(start)))
+	}
+	shard.state.collect(packet, key, hash)
+	shard.mu.Unlock()
 }
 
-// updates metrics for dimensions
-func (mc *MetricsCollector) updateDimensionMetrics(packet *types.Packet) {
-	mc.updateMetrics(dimensionCountry, packet.Country, packet.Size)
-	mc.updateMetrics(dimensionCity, packet.City, packet.Size)
-	if packet.DstPort > 0 {
-		mc.updateMetrics(dimensionPort, fmt.Sprint(packet.DstPort), packet.Size)
-	}
-	mc.updateMetrics(dimensionEthType, packet.EthType.String(), packet.Size)
-	mc.updateMetrics(dimensionIPProto, packet.IPProto.String(), packet.Size)
-
-	if packet.MatchType != types.NoMatch {
-		key := packet.SrcIP
-		if packet.MatchType == types.MatchByMAC {
-			key = packet.SrcMAC
-		}
-		mc.updateMetrics(dimensionMatch, key, packet.Size)
+// SetLocator sets how sources are located, sources seen before keep their location
+func (mc *MetricsCollector) SetLocator(locate Locator) {
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		shard.state.locate = locate
+		shard.mu.Unlock()
 	}
 }
 
-func (mc *MetricsCollector) updateSourceMetrics(packet *types.Packet) {
-	sourceKey := utils.MD5(fmt.Sprintf("%s:%s", packet.SrcMAC, packet.SrcIP))
-	sourceData, ok := mc.summary.Source[sourceKey]
-	if !ok {
-		// create new source metrics if not exists
-		sourceData = SourceStatistic{
-			Key: sourceKey,
-			Source: Source{
-				IP:  packet.SrcIP,
-				MAC: packet.SrcMAC,
-				Location: GeoLocation{
-					Country: packet.Country,
-					City:    packet.City,
-				},
-			},
-			TrafficMetrics: TrafficMetrics{
-				TotalPackets: 0,
-				TotalBytes:   0,
-				FirstSeenAt:  time.Now().Unix(),
-				LastSeenAt:   time.Now().Unix(),
-			},
-			Target: make(map[string]TargetStatistic),
-		}
-	}
-	sourceData.TrafficMetrics.TotalPackets++
-	sourceData.TrafficMetrics.TotalBytes += int64(packet.Size)
-	sourceData.TrafficMetrics.LastSeenAt = time.Now().Unix()
-
-	targetKey := utils.MD5(fmt.Sprintf("%s:%s:%d:%s:%s", packet.DstMAC, packet.DstIP, packet.DstPort, packet.EthType, packet.IPProto))
-	targetData, ok := sourceData.Target[targetKey]
-	if !ok {
-		// create new target metrics if not exists
-		targetData = TargetStatistic{
-			Key: targetKey,
-			Destination: Destination{
-				MAC:  packet.DstMAC,
-				IP:   packet.DstIP,
-				Port: packet.DstPort,
-				Protocol: Protocol{
-					EthType: packet.EthType,
-					IPProto: packet.IPProto,
-				},
-			},
-			TrafficMetrics: TrafficMetrics{
-				TotalPackets: 0,
-				TotalBytes:   0,
-				FirstSeenAt:  time.Now().Unix(),
-				LastSeenAt:   time.Now().Unix(),
-			},
-		}
-	}
-	targetData.TrafficMetrics.TotalPackets++
-	targetData.TrafficMetrics.TotalBytes += int64(packet.Size)
-	targetData.TrafficMetrics.LastSeenAt = time.Now().Unix()
-	sourceData.Target[targetKey] = targetData
-	mc.summary.Source[sourceKey] = sourceData
+// LockStats returns how often CollectPacket had to wait for a shard and for how long
+func (mc *MetricsCollector) LockStats() LockStats {
+	return LockStats{Waits: mc.lockWaits.Load(), WaitTimeNs: mc.lockWaitNs.Load()}
 }
 
-// updates metrics for a given dimension and key
-func (mc *MetricsCollector) updateMetrics(dimension string, key string, size uint32) {
-	if dimension == "" || key == "" {
-		return
-	}
-	// initialize dimension if not exists
-	if _, exists := mc.summary.Statistics[dimension]; !exists {
-		mc.summary.Statistics[dimension] = make(map[string]*Statistics)
-	}
-	// update metrics if key exists
-	if stat, exists := mc.summary.Statistics[dimension][key]; exists {
-		stat.TrafficMetrics.TotalPackets++
-		stat.TrafficMetrics.TotalBytes += int64(size)
-		stat.TrafficMetrics.LastSeenAt = time.Now().Unix()
-	} else {
-		// create new metrics if key does not exist
-		mc.summary.Statistics[dimension][key] = &Statistics{
-			Key: key,
-			TrafficMetrics: TrafficMetrics{
-				TotalPackets: 1,
-				TotalBytes:   int64(size),
-				FirstSeenAt:  time.Now().Unix(),
-				LastSeenAt:   time.Now().Unix(),
-			},
-		}
+// merges totals, day and dimension statistics of all shards
+func (mc *MetricsCollector) mergeTotals() *metricsState {
+	merged := newMetricsState()
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		merged.mergeTotals(shard.state)
+		shard.mu.Unlock()
 	}
+	return merged
 }
 
 // summary report of collected metrics
 type MetricsReport struct {
-	TotalPackets int64                   `json:"total_packets"`
-	TotalBytes   int64                   `json:"total_bytes"`
-	Day          []Statistics            `json:"day"`
-	Dimension    map[string][]Statistics `json:"dimension"`
+	TotalPackets int64 `json:"total_packets"`
+	TotalBytes   int64 `json:"total_bytes"`
+	// approximate number of distinct sources seen
+	DistinctSources int64 `json:"distinct_sources"`
+	// sources dropped from the bounded source table
+	EvictedSources int64                   `json:"evicted_sources"`
+	Day            []Statistics            `json:"day"`
+	Dimension      map[string][]Statistics `json:"dimension"`
 }
 
 // GenerateReport creates a summary report of collected metrics
-// top parameter determines the maximum number of entries to include in each category
+// top parameter determines the maximum number of entries to include in each category,
+// it is served from the latest snapshot and capped at maxReportTop
 func (mc *MetricsCollector) GenerateReport(top int) MetricsReport {
-	mc.mu.Lock()
-	defer mc.mu.Unlock()
+	snapshot := mc.current()
 	result := MetricsReport{
-		TotalPackets: mc.summary.TotalPackets,
-		TotalBytes:   mc.summary.TotalBytes,
+		TotalPackets:    snapshot.totalPackets,
+		TotalBytes:      snapshot.totalBytes,
+		DistinctSources: snapshot.distinctSources,
+		EvictedSources:  snapshot.evictedSources,
 	}
 
 	// collect day statistics
-	dayList := make([]Statistics, 0, len(mc.summary.Day))
-	for _, day := range mc.summary.Day {
-		dayList = append(dayList, day)
-	}
-	if len(dayList) > DefaultRetentionDays {
-		result.Day = dayList[len(dayList)-DefaultRetentionDays:]
+	if len(snapshot.day) > DefaultRetentionDays {
+		result.Day = snapshot.day[len(snapshot.day)-DefaultRetentionDays:]
 	} else {
-		result.Day = dayList
+		result.Day = snapshot.day
 	}
 
-	// collect dimension statistics
-	result.Dimension = make(map[string][]Statistics, len(mc.summary.Statistics))
-	for category, statsMap := range mc.summary.Statistics {
-		statsList := make([]Statistics, 0, len(statsMap))
-		for _, stat := range statsMap {
-			statsList = append(statsList, *stat)
-		}
-		sort.Slice(statsList, func(i, j int) bool {
-			return statsList[i].TrafficMetrics.TotalPackets > statsList[j].TrafficMetrics.TotalPackets
-		})
-		if len(statsList) > top {
+	// collect dimension statistics, they are already sorted in the snapshot
+	result.Dimension = make(map[string][]Statistics, len(snapshot.dimension))
+	for category, statsList := range snapshot.dimension {
+		if top >= 0 && len(statsList) > top {
 			result.Dimension[category] = statsList[:top]
 		} else {
 			result.Dimension[category] = statsList
@@ -363,54 +359,21 @@ type SourcePage struct {
 }
 
 func (mc *MetricsCollector) GetSources(page int, pageSize int, order string, sortDir string) SourcePage {
-	mc.mu.Lock()
-	defer mc.mu.Unlock()
-	result := make([]SourceStatisticResult, 0, len(mc.summary.Source))
-	for _, source := range mc.summary.Source {
-		result = append(result, SourceStatisticResult{
-			Key:            source.Key,
-			Source:         source.Source,
-			TrafficMetrics: source.TrafficMetrics,
-			Targets:        int64(len(source.Target)),
-		})
-	}
-	getField := func(s SourceStatisticResult) int64 {
-		switch order {
-		case "total_packets":
-			return s.TotalPackets
-		case "total_bytes":
-			return s.TotalBytes
-		case "first_seen_at":
-			return s.FirstSeenAt
-		case "targets":
-			return s.Targets
-		default: // last_seen_at
-			return s.LastSeenAt
-		}
-	}
-	if sortDir == "" {
-		sortDir = "desc"
-	}
-	sort.Slice(result, func(i, j int) bool {
-		if sortDir == "desc" {
-			return getField(result[i]) > getField(result[j])
+	snapshot := mc.current()
+	indices := snapshot.sourceOrder(order)
+	start, end := pageRange(len(indices), page, pageSize)
+	// only the returned page is rendered to strings
+	items := make([]SourceStatisticResult, 0, end-start)
+	for i := start; i < end; i++ {
+		index := i
+		if sortDir != "" && sortDir != "desc" {
+			index = len(indices) - 1 - i
 		}
-		return getField(result[i]) < getField(result[j])
-	})
-	if page == 0 {
-		page = 1
-	}
-	if pageSize == 0 {
-		pageSize = 20
-	}
-	start := (page - 1) * pageSize
-	end := start + pageSize
-	if end > len(result) {
-		end = len(result)
+		items = append(items, snapshot.sources[indices[index]].result())
 	}
 	return SourcePage{
-		Total: len(result),
-		Items: result[start:end],
+		Total: len(indices),
+		Items: items,
 	}
 }
 
@@ -419,21 +382,38 @@ type TargetPage struct {
 	Items []TargetStatistic `json:"items"`
 }
 
+// a copy of the metrics of a target
+type targetRow struct {
+	key targetKey
+	TrafficMetrics
+}
+
 func (mc *MetricsCollector) GetTargets(sourceId string, page int, pageSize int, order string, sortDir string) TargetPage {
-	mc.mu.Lock()
-	defer mc.mu.Unlock()
-	sourceData, ok := mc.summary.Source[sourceId]
+	key, ok := parseSourceKey(sourceId)
 	if !ok {
 		return TargetPage{
 			Total: 0,
 			Items: []TargetStatistic{},
 		}
 	}
-	result := make([]TargetStatistic, 0, len(sourceData.Target))
-	for _, target := range sourceData.Target {
-		result = append(result, target)
+	// a source lives in a single shard, only that one is locked while copying
+	var rows []targetRow
+	shard := mc.shard(key)
+	shard.mu.Lock()
+	if sourceData, exists := shard.state.sources[key]; exists {
+		rows = make([]targetRow, 0, len(sourceData.targets))
+		for tk, target := range sourceData.targets {
+			rows = append(rows, targetRow{key: tk, TrafficMetrics: *target})
+		}
+	}
+	shard.mu.Unlock()
+	if rows == nil {
+		return TargetPage{
+			Total: 0,
+			Items: []TargetStatistic{},
+		}
 	}
-	getField := func(s TargetStatistic) int64 {
+	getField := func(s *targetRow) int64 {
 		switch order {
 		case "total_packets":
 			return s.TotalPackets
@@ -442,9 +422,9 @@ func (mc *MetricsCollector) GetTargets(sourceId string, page int, pageSize int,
 		case "first_seen_at":
 			return s.FirstSeenAt
 		case "eth_type":
-			return int64(s.EthType)
+			return int64(s.key.EthType)
 		case "ip_proto":
-			return int64(s.IPProto)
+			return int64(s.key.IPProto)
 		default: // last_seen_at
 			return s.LastSeenAt
 		}
@@ -452,33 +432,47 @@ func (mc *MetricsCollector) GetTargets(sourceId string, page int, pageSize int,
 	if sortDir == "" {
 		sortDir = "desc"
 	}
-	sort.Slice(result, func(i, j int) bool {
+	sort.Slice(rows, func(i, j int) bool {
 		if sortDir == "desc" {
-			return getField(result[i]) > getField(result[j])
+			return getField(&rows[i]) > getField(&rows[j])
 		}
-		return getField(result[i]) < getField(result[j])
+		return getField(&rows[i]) < getField(&rows[j])
 	})
-	if page == 0 {
+	start, end := pageRange(len(rows), page, pageSize)
+	items := make([]TargetStatistic, 0, end-start)
+	for _, row := range rows[start:end] {
+		items = append(items, row.key.statistic(&row.TrafficMetrics))
+	}
+	return TargetPage{
+		Total: len(rows),
+		Items: items,
+	}
+}
+
+// returns the bounds of the requested page within total items
+func pageRange(total int, page int, pageSize int) (int, int) {
+	if page <= 0 {
 		page = 1
 	}
-	if pageSize == 0 {
+	if pageSize <= 0 {
 		pageSize = 20
 	}
 	start := (page - 1) * pageSize
-	end := start + pageSize
-	if end > len(result) {
-		end = len(result)
+	if start > total {
+		start = total
 	}
-	return TargetPage{
-		Total: len(result),
-		Items: result[start:end],
+	end := start + pageSize
+	if end > total {
+		end = total
 	}
+	return start, end
 }
 
 func (mc *MetricsCollector) Close() error {
 	close(mc.done)
-	if mc.storage != nil {
-		if err := mc.storage.Save(&mc.summary); err != nil {
+	if mc.storage != nil && config.GetConfig().MetricsPersistInterval > 0 {
+		// a full base keeps the next startup free of log replay
+		if err := mc.persist(true); err != nil {
 			return err
 		}
 	}
@@ -0,0 +1,125 @@
+package metrics
+
+import (
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func TestMetricsCollector_MergesShards(t *testing.T) {
+	mc := newShardedCollector(8)
+	for i := 0; i < 64; i++ {
+		packet := testPacket()
+		packet.SrcIP = types.IPv4Addr([4]byte{198, 51, 100, byte(i)})
+		mc.CollectPacket(&packet)
+		mc.CollectPacket(&packet)
+	}
+
+	report := mc.GenerateReport(10)
+	if report.TotalPackets != 128 || report.TotalBytes != 128*1500 {
+		t.Fatalf("report totals = %d/%d", report.TotalPackets, report.TotalBytes)
+	}
+	if ports := report.Dimension[dimensionPort]; len(ports) != 1 || ports[0].TotalPackets != 128 {
+		t.Fatalf("port dimension = %+v", ports)
+	}
+	if matches := report.Dimension[dimensionMatch]; len(matches) != 10 {
+		t.Fatalf("match dimension has %d entries, want top 10", len(matches))
+	}
+
+	sources := mc.GetSources(1, 100, "total_packets", "desc")
+	if sources.Total != 64 || len(sources.Items) != 64 {
+		t.Fatalf("sources = %d/%d, want 64", sources.Total, len(sources.Items))
+	}
+	targets := mc.GetTargets(sources.Items[0].Key, 1, 20, "", "")
+	if targets.Total != 1 || targets.Items[0].TotalPackets != 2 || targets.Items[0].IP != "192.168.1.10" {
+		t.Fatalf("targets = %+v", targets)
+	}
+	if empty := mc.GetTargets("missing", 1, 20, "", ""); empty.Total != 0 {
+		t.Fatalf("unknown source returned %d targets", empty.Total)
+	}
+
+	state := newMetricsState()
+	state.load(mergedSummary(mc))
+	restored := newShardedCollector(4)
+	restored.restore(state)
+	if got := restored.GetSources(1, 1, "", ""); got.Total != 64 {
+		t.Fatalf("restored %d sources, want 64", got.Total)
+	}
+	if got := restored.GenerateReport(1); got.TotalPackets != 128 {
+		t.Fatalf("restored total packets = %d", got.TotalPackets)
+	}
+}
+
+// renders all shards to the legacy summary form
+func mergedSummary(mc *MetricsCollector) *MetricsSummary {
+	summary := mc.mergeTotals().summary()
+	for _, shard := range mc.shards {
+		shard.state.summarizeSources(summary.Source)
+	}
+	return summary
+}
+
+func BenchmarkMetricsCollector_CollectParallel(b *testing.B) {
+	mc := newShardedCollector(shardCount())
+	b.ReportAllocs()
+	b.RunParallel(func(pb *testing.PB) {
+		packet := testPacket()
+		var i byte
+		for pb.Next() {
+			i++
+			packet.SrcIP = types.IPv4Addr([4]byte{198, 51, 100, i})
+			mc.CollectPacket(&packet)
+		}
+	})
+}
+
+func TestMetricsCollector_SnapshotOrder(t *testing.T) {
+	mc := newShardedCollector(4)
+	for i := 1; i <= 5; i++ {
+		packet := testPacket()
+		packet.SrcIP = types.IPv4Addr([4]byte{198, 51, 100, byte(i)})
+		packet.Count = uint32(i)
+		mc.CollectPacket(&packet)
+	}
+	mc.publish()
+
+	desc := mc.GetSources(1, 2, "total_packets", "desc")
+	if desc.Total != 5 || desc.Items[0].TotalPackets != 5 || desc.Items[1].TotalPackets != 4 {
+		t.Fatalf("desc page = %+v", desc.Items)
+	}
+	asc := mc.GetSources(2, 2, "total_packets", "asc")
+	if len(asc.Items) != 2 || asc.Items[0].TotalPackets != 3 || asc.Items[1].TotalPackets != 4 {
+		t.Fatalf("asc page = %+v", asc.Items)
+	}
+	if last := mc.GetSources(3, 2, "total_packets", "desc"); len(last.Items) != 1 {
+		t.Fatalf("last page has %d items, want 1", len(last.Items))
+	}
+
+	// collection after a publish is only visible in the next snapshot
+	packet := testPacket()
+	mc.CollectPacket(&packet)
+	if got := mc.GenerateReport(10).TotalPackets; got != 15 {
+		t.Fatalf("snapshot total = %d, want 15", got)
+	}
+	mc.publish()
+	if got := mc.GenerateReport(10).TotalPackets; got != 16 {
+		t.Fatalf("published total = %d, want 16", got)
+	}
+}
+
+func TestTopStatistics(t *testing.T) {
+	stats := make(map[string]*Statistics)
+	for i := 0; i < 50; i++ {
+		key := renderPort(uint16(i))
+		stats[key] = &Statistics{Key: key, TrafficMetrics: TrafficMetrics{TotalPackets: int64(i)}}
+	}
+	top := topStatistics(stats, 5)
+	if len(top) != 5 {
+		t.Fatalf("got %d entries, want 5", len(top))
+	}
+	for i, stat := range top {
+		if stat.TotalPackets != int64(49-i) {
+			t.Fatalf("top[%d] = %d, want %d", i, stat.TotalPackets, 49-i)
+		}
+	}
+}
@@ -0,0 +1,124 @@
+package metrics
+
+import (
+	"encoding/hex"
+	"strconv"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// binary map keys used by the collector, they are only rendered to strings
+// when results are serialized for the API or for persistence
+
+// identifies a traffic source
+type sourceKey struct {
+	MAC types.MACAddr
+	IP  types.IPAddr
+}
+
+func (k sourceKey) bytes() [22]byte {
+	var b [22]byte
+	copy(b[:6], k.MAC[:])
+	copy(b[6:], k.IP[:])
+	return b
+}
+
+func (k sourceKey) String() string {
+	b := k.bytes()
+	return hex.EncodeToString(b[:])
+}
+
+func parseSourceKey(s string) (sourceKey, bool) {
+	var k sourceKey
+	var b [22]byte
+	if hex.DecodedLen(len(s)) != len(b) {
+		return k, false
+	}
+	if _, err := hex.Decode(b[:], []byte(s)); err != nil {
+		return k, false
+	}
+	copy(k.MAC[:], b[:6])
+	copy(k.IP[:], b[6:])
+	return k, true
+}
+
+// identifies a target of a source
+type targetKey struct {
+	MAC     types.MACAddr
+	IP      types.IPAddr
+	Port    uint16
+	EthType types.EthernetType
+	IPProto types.IPProtocol
+}
+
+func (k targetKey) String() string {
+	var b [28]byte
+	copy(b[:6], k.MAC[:])
+	copy(b[6:22], k.IP[:])
+	b[22], b[23] = byte(k.Port>>8), byte(k.Port)
+	b[24], b[25] = byte(k.EthType>>8), byte(k.EthType)
+	b[26], b[27] = byte(k.IPProto>>8), byte(k.IPProto)
+	return hex.EncodeToString(b[:])
+}
+
+// identifies the address a rule matched on, MAC is only set for MAC rules
+type matchKey struct {
+	MAC types.MACAddr
+	IP  types.IPAddr
+}
+
+func (k matchKey) String() string {
+	if k.IP.IsZero() {
+		return k.MAC.String()
+	}
+	return k.IP.String()
+}
+
+func parseMatchKey(s string) (matchKey, bool) {
+	if ip, err := types.ParseIPAddr(s); err == nil {
+		return matchKey{IP: ip}, true
+	}
+	if mac, err := types.ParseMACAddr(s); err == nil {
+		return matchKey{MAC: mac}, true
+	}
+	return matchKey{}, false
+}
+
+func renderString(s string) string {
+	return s
+}
+
+func parseString(s string) (string, bool) {
+	return s, s != ""
+}
+
+func renderPort(port uint16) string {
+	return strconv.FormatUint(uint64(port), 10)
+}
+
+func parsePort(s string) (uint16, bool) {
+	n, err := strconv.ParseUint(s, 10, 16)
+	return uint16(n), err == nil
+}
+
+func renderEthType(et types.EthernetType) string {
+	return et.String()
+}
+
+func parseEthType(s string) (types.EthernetType, bool) {
+	n, err := strconv.ParseUint(s, 10, 16)
+	return types.EthernetType(n), err == nil
+}
+
+func renderIPProto(proto types.IPProtocol) string {
+	return proto.String()
+}
+
+func parseIPProto(s string) (types.IPProtocol, bool) {
+	n, err := strconv.ParseUint(s, 10, 16)
+	return types.IPProtocol(n), err == nil
+}
+
+func renderMatch(k matchKey) string {
+	return k.String()
+}
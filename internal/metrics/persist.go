@@ -0,0 +1,54 @@
+package metrics
+
+import "time"
+
+// entries seen this long before the previous persist started are written
+// again, so packets that were queued while it ran are not missed
+const persistSlack = 60
+
+// persist writes the metrics seen since the previous persist to the delta log,
+// or the full state to a new base when compaction is due
+func (mc *MetricsCollector) persist(compact bool) error {
+	mc.persistMu.Lock()
+	defer mc.persistMu.Unlock()
+
+	start := time.Now().Unix()
+	compact = compact || mc.compact.Swap(false) || mc.storage.NeedsCompaction()
+	since := mc.persistedAt - persistSlack
+	if compact || mc.persistedAt == 0 {
+		compact, since = true, 0
+	}
+	if err := mc.write(compact, since); err != nil {
+		if compact {
+			mc.compact.Store(true)
+		}
+		return err
+	}
+	mc.persistedAt = start
+	return nil
+}
+
+// writes one frame for totals and dimensions and one per shard. Each shard is
+// only locked while its records are encoded, the file is written without locks.
+func (mc *MetricsCollector) write(compact bool, since int64) error {
+	w, err := mc.storage.Begin(compact)
+	if err != nil {
+		return err
+	}
+	buf := appendTotals(mc.persistBuf[:0], mc.mergeTotals(), since)
+	if err := w.WriteFrame(buf); err != nil {
+		w.Abort()
+		return err
+	}
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		buf = appendSources(buf[:0], shard.state, since)
+		shard.mu.Unlock()
+		if err := w.WriteFrame(buf); err != nil {
+			w.Abort()
+			return err
+		}
+	}
+	mc.persistBuf = buf[:0]
+	return w.Commit()
+}
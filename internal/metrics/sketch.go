@@ -0,0 +1,105 @@
+package metrics
+
+import (
+	"math"
+	"math/bits"
+)
+
+const (
+	// log2 of the HyperLogLog register count, the standard error is 1.04/sqrt(1<<hllPrecision)
+	hllPrecision = 14
+	cmsDepth     = 4
+)
+
+// hyperLogLog estimates the number of distinct hashes added to it
+type hyperLogLog struct {
+	registers [1 << hllPrecision]uint8
+}
+
+func (h *hyperLogLog) add(hash uint64) {
+	index := hash >> (64 - hllPrecision)
+	// rank of the first set bit in the remaining bits, a guard bit caps it
+	rank := uint8(bits.LeadingZeros64(hash<<hllPrecision|1<<(hllPrecision-1))) + 1
+	if rank > h.registers[index] {
+		h.registers[index] = rank
+	}
+}
+
+// merge adds the registers of other, the result estimates the union of both
+func (h *hyperLogLog) merge(other *hyperLogLog) {
+	for i, rank := range other.registers {
+		if rank > h.registers[i] {
+			h.registers[i] = rank
+		}
+	}
+}
+
+func (h *hyperLogLog) estimate() int64 {
+	const m = float64(len(h.registers))
+	sum := 0.0
+	zeros := 0
+	for _, rank := range h.registers {
+		sum += 1 / float64(uint64(1)<<rank)
+		if rank == 0 {
+			zeros++
+		}
+	}
+	estimate := 0.7213 / (1 + 1.079/m) * m * m / sum
+	// linear counting is more accurate for small cardinalities
+	if estimate <= 2.5*m && zeros > 0 {
+		estimate = m * math.Log(m/float64(zeros))
+	}
+	return int64(estimate + 0.5)
+}
+
+// countMinSketch estimates packet counts of keys that are not tracked exactly
+type countMinSketch struct {
+	mask     uint64
+	counters []uint32
+	// counters are halved after this many additions so that a flood of
+	// distinct keys cannot inflate every estimate
+	additions int
+	resetAt   int
+}
+
+// creates a sketch with at least width counters per row
+func newCountMinSketch(width int) *countMinSketch {
+	w := 64
+	for w < width {
+		w <<= 1
+	}
+	return &countMinSketch{
+		mask:     uint64(w - 1),
+		counters: make([]uint32, w*cmsDepth),
+		resetAt:  w * 10,
+	}
+}
+
+// add counts n for hash and returns the new estimate
+func (c *countMinSketch) add(hash uint64, n uint32) uint32 {
+	if c.additions++; c.additions >= c.resetAt {
+		c.decay()
+	}
+	h1, h2 := hash, hash>>32|hash<<32|1
+	estimate := uint32(math.MaxUint32)
+	for i := uint64(0); i < cmsDepth; i++ {
+		counter := &c.counters[i*(c.mask+1)+(h1+i*h2)&c.mask]
+		if *counter <= math.MaxUint32-n {
+			*counter += n
+		} else {
+			*counter = math.MaxUint32
+		}
+		if *counter < estimate {
+			estimate = *counter
+		}
+	}
+	return estimate
+}
+
+// halves all counters so that old traffic stops blocking admission
+func (c *countMinSketch) decay() {
+	for i := range c.counters {
+		c.counters[i] >>= 1
+	}
+	c.additions /= 2
+}
@@ -0,0 +1,160 @@
+package metrics
+
+import (
+	"container/heap"
+	"sort"
+	"sync"
+	"time"
+)
+
+const (
+	// interval at which a new snapshot is published for the API
+	snapshotInterval = time.Second
+	// maximum number of entries per dimension kept in a snapshot
+	maxReportTop = 1000
+)
+
+// metricsSnapshot is an immutable view of the collected metrics, API queries
+// are served from it without touching the shards
+type metricsSnapshot struct {
+	totalPackets    int64
+	totalBytes      int64
+	distinctSources int64
+	evictedSources  int64
+	day             []Statistics
+	dimension       map[string][]Statistics
+	sources         []sourceRow
+
+	// source indices sorted descending by a field, built on first use
+	mu     sync.Mutex
+	orders map[string][]int
+}
+
+// builds a snapshot, each shard is only locked while its entries are copied
+func (mc *MetricsCollector) buildSnapshot() *metricsSnapshot {
+	merged := newMetricsState()
+	var sources []sourceRow
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		merged.mergeTotals(shard.state)
+		for key, source := range shard.state.sources {
+			sources = append(sources, source.row(key))
+		}
+		shard.mu.Unlock()
+	}
+
+	snapshot := &metricsSnapshot{
+		totalPackets:    merged.totalPackets,
+		totalBytes:      merged.totalBytes,
+		distinctSources: merged.distinct.estimate(),
+		evictedSources:  merged.evicted,
+		day:             make([]Statistics, 0, len(merged.day)),
+		dimension:       make(map[string][]Statistics),
+		sources:         sources,
+		orders:          make(map[string][]int),
+	}
+	for _, day := range merged.day {
+		snapshot.day = append(snapshot.day, *day)
+	}
+	sort.Slice(snapshot.day, func(i, j int) bool {
+		return snapshot.day[i].Key < snapshot.day[j].Key
+	})
+	for category, stats := range merged.dimensionStatistics() {
+		snapshot.dimension[category] = topStatistics(stats, maxReportTop)
+	}
+	return snapshot
+}
+
+// publishes a new snapshot and returns it
+func (mc *MetricsCollector) publish() *metricsSnapshot {
+	snapshot := mc.buildSnapshot()
+	mc.snapshot.Store(snapshot)
+	return snapshot
+}
+
+// returns the latest snapshot, building the first one on demand
+func (mc *MetricsCollector) current() *metricsSnapshot {
+	if snapshot := mc.snapshot.Load(); snapshot != nil {
+		return snapshot
+	}
+	return mc.publish()
+}
+
+// periodically publish snapshots for the API
+func (mc *MetricsCollector) autoPublish() {
+	ticker := time.NewTicker(snapshotInterval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-mc.done:
+			return
+		case <-ticker.C:
+			mc.publish()
+		}
+	}
+}
+
+// returns source indices ordered descending by the given field
+func (s *metricsSnapshot) sourceOrder(order string) []int {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if indices, ok := s.orders[order]; ok {
+		return indices
+	}
+	getField := func(s *sourceRow) int64 {
+		switch order {
+		case "total_packets":
+			return s.TotalPackets
+		case "total_bytes":
+			return s.TotalBytes
+		case "first_seen_at":
+			return s.FirstSeenAt
+		case "targets":
+			return s.targets
+		default: // last_seen_at
+			return s.LastSeenAt
+		}
+	}
+	indices := make([]int, len(s.sources))
+	for i := range indices {
+		indices[i] = i
+	}
+	sort.SliceStable(indices, func(i, j int) bool {
+		return getField(&s.sources[indices[i]]) > getField(&s.sources[indices[j]])
+	})
+	s.orders[order] = indices
+	return indices
+}
+
+// min-heap on total packets used to select the top entries of a dimension
+type statisticsHeap []Statistics
+
+func (h statisticsHeap) Len() int           { return len(h) }
+func (h statisticsHeap) Less(i, j int) bool { return h[i].TotalPackets < h[j].TotalPackets }
+func (h statisticsHeap) Swap(i, j int)      { h[i], h[j] = h[j], h[i] }
+func (h *statisticsHeap) Push(x any)        { *h = append(*h, x.(Statistics)) }
+func (h *statisticsHeap) Pop() any {
+	old := *h
+	n := len(old)
+	item := old[n-1]
+	*h = old[:n-1]
+	return item
+}
+
+// returns the k entries with the most packets sorted descending, in O(n log k)
+func topStatistics(stats map[string]*Statistics, k int) []Statistics {
+	h := make(statisticsHeap, 0, min(k, len(stats)))
+	for _, stat := range stats {
+		if len(h) < k {
+			heap.Push(&h, *stat)
+		} else if stat.TotalPackets > h[0].TotalPackets {
+			h[0] = *stat
+			heap.Fix(&h, 0)
+		}
+	}
+	result := make([]Statistics, len(h))
+	for i := len(h) - 1; i >= 0; i-- {
+		result[i] = heap.Pop(&h).(Statistics)
+	}
+	return result
+}
@@ -0,0 +1,447 @@
+package metrics
+
+import (
+	"time"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+// traffic metrics of a dimension, keyed by the binary value of the dimension
+type dimension[K comparable] map[K]*TrafficMetrics
+
+func (d dimension[K]) add(key K, count uint32, size uint32, now int64) {
+	if stat, exists := d[key]; exists {
+		stat.TotalPackets += int64(count)
+		stat.TotalBytes += int64(size)
+		stat.LastSeenAt = now
+		return
+	}
+	d[key] = &TrafficMetrics{
+		TotalPackets: int64(count),
+		TotalBytes:   int64(size),
+		FirstSeenAt:  now,
+		LastSeenAt:   now,
+	}
+}
+
+// merge adds the metrics of src to d, entries are copied
+func (d dimension[K]) merge(src dimension[K]) {
+	for key, stat := range src {
+		if dst, exists := d[key]; exists {
+			dst.merge(stat)
+			continue
+		}
+		metrics := *stat
+		d[key] = &metrics
+	}
+}
+
+func (d dimension[K]) cleanup(before int64) {
+	for key, stat := range d {
+		if stat.LastSeenAt < before {
+			delete(d, key)
+		}
+	}
+}
+
+// renders the dimension to the serialized form
+func (d dimension[K]) statistics(render func(K) string) map[string]*Statistics {
+	result := make(map[string]*Statistics, len(d))
+	for key, stat := range d {
+		name := render(key)
+		result[name] = &Statistics{Key: name, TrafficMetrics: *stat}
+	}
+	return result
+}
+
+// restores the dimension from the serialized form, unparsable keys are skipped
+func (d dimension[K]) load(stats map[string]*Statistics, parse func(string) (K, bool)) {
+	for name, stat := range stats {
+		if stat == nil {
+			continue
+		}
+		if key, ok := parse(name); ok {
+			metrics := stat.TrafficMetrics
+			d[key] = &metrics
+		}
+	}
+}
+
+func (m *TrafficMetrics) merge(src *TrafficMetrics) {
+	m.TotalPackets += src.TotalPackets
+	m.TotalBytes += src.TotalBytes
+	if src.FirstSeenAt < m.FirstSeenAt {
+		m.FirstSeenAt = src.FirstSeenAt
+	}
+	if src.LastSeenAt > m.LastSeenAt {
+		m.LastSeenAt = src.LastSeenAt
+	}
+}
+
+// statistics of a source, targets are keyed by their binary key
+type sourceEntry struct {
+	Location GeoLocation
+	TrafficMetrics
+	targets map[targetKey]*TrafficMetrics
+	// key of the entry and its position in the bounded mode heap
+	key   sourceKey
+	index int
+}
+
+// metricsState holds the collected metrics in binary keyed form
+type metricsState struct {
+	totalPackets int64
+	totalBytes   int64
+	day          map[string]*Statistics
+	// statistics of the current day, valid while the packet time is before dayEnd
+	today     *Statistics
+	dayEnd    int64
+	countries dimension[string]
+	cities    dimension[string]
+	ports     dimension[uint16]
+	ethTypes  dimension[types.EthernetType]
+	ipProtos  dimension[types.IPProtocol]
+	matches   dimension[matchKey]
+	sources   map[sourceKey]*sourceEntry
+	// approximate number of distinct sources seen
+	distinct *hyperLogLog
+	// bounds the tracked sources, nil keeps every source
+	limit *sourceLimit
+	// sources evicted from merged shards
+	evicted int64
+	// traffic since the time series last advanced
+	interval SeriesPoint
+	// resolves the location of a source, nil leaves sources without one
+	locate Locator
+}
+
+func newMetricsState() *metricsState {
+	return &metricsState{
+		day:       make(map[string]*Statistics),
+		countries: make(dimension[string]),
+		cities:    make(dimension[string]),
+		ports:     make(dimension[uint16]),
+		ethTypes:  make(dimension[types.EthernetType]),
+		ipProtos:  make(dimension[types.IPProtocol]),
+		matches:   make(dimension[matchKey]),
+		sources:   make(map[sourceKey]*sourceEntry),
+		distinct:  &hyperLogLog{},
+	}
+}
+
+// collect adds a packet, hash is the hash of the source key
+func (s *metricsState) collect(packet *types.Packet, key sourceKey, hash uint64) {
+	now := packet.Timestamp
+	s.distinct.add(hash)
+	s.interval.collect(packet)
+	s.updateSummary(packet)
+	location := s.updateSource(packet, key, hash, now)
+	s.updateDimensions(packet, location, now)
+}
+
+func (s *metricsState) updateSummary(packet *types.Packet) {
+	s.totalPackets += int64(packet.Count)
+	s.totalBytes += int64(packet.Size)
+	if s.today == nil || packet.Timestamp >= s.dayEnd {
+		s.rollDay(packet.Timestamp)
+	}
+	s.today.TotalPackets += int64(packet.Count)
+	s.today.TotalBytes += int64(packet.Size)
+}
+
+// switches the current day statistics to the local day containing now
+func (s *metricsState) rollDay(now int64) {
+	t := time.Unix(now, 0)
+	day := t.Format(DayFormat)
+	dayData, ok := s.day[day]
+	if !ok {
+		dayData = &Statistics{Key: day}
+		s.day[day] = dayData
+	}
+	s.today = dayData
+	s.dayEnd = time.Date(t.Year(), t.Month(), t.Day()+1, 0, 0, 0, 0, t.Location()).Unix()
+}
+
+func (s *metricsState) updateDimensions(packet *types.Packet, location GeoLocation, now int64) {
+	if location.Country != "" {
+		s.countries.add(location.Country, packet.Count, packet.Size, now)
+	}
+	if location.City != "" {
+		s.cities.add(location.City, packet.Count, packet.Size, now)
+	}
+	if packet.DstPort > 0 {
+		s.ports.add(packet.DstPort, packet.Count, packet.Size, now)
+	}
+	s.ethTypes.add(packet.EthType, packet.Count, packet.Size, now)
+	s.ipProtos.add(packet.IPProto, packet.Count, packet.Size, now)
+
+	if packet.MatchType != types.NoMatch {
+		key := matchKey{IP: packet.SrcIP}
+		if packet.MatchType == types.MatchByMAC {
+			key = matchKey{MAC: packet.SrcMAC}
+		}
+		s.matches.add(key, packet.Count, packet.Size, now)
+	}
+}
+
+// locateSource returns the location of the source of packet
+func (s *metricsState) locateSource(packet *types.Packet) GeoLocation {
+	if s.locate == nil || packet.SrcIP.IsZero() {
+		return GeoLocation{}
+	}
+	return s.locate(packet.SrcIP)
+}
+
+// updateSource adds the packet to its source and returns the location of the
+// source, located once when the source is first seen
+func (s *metricsState) updateSource(packet *types.Packet, key sourceKey, hash uint64, now int64) GeoLocation {
+	source, ok := s.sources[key]
+	if !ok {
+		var inherited int64
+		if s.limit != nil {
+			if inherited, ok = s.limit.admit(s, hash, packet.Count); !ok {
+				// the packet is still part of the totals and dimensions
+				return s.locateSource(packet)
+			}
+		}
+		// create new source metrics if not exists
+		source = &sourceEntry{
+			Location:       s.locateSource(packet),
+			TrafficMetrics: TrafficMetrics{TotalPackets: inherited, FirstSeenAt: now},
+			targets:        make(map[targetKey]*TrafficMetrics),
+			key:            key,
+		}
+		s.sources[key] = source
+		if s.limit != nil {
+			s.limit.track(source)
+		}
+	}
+	source.TotalPackets += int64(packet.Count)
+	source.TotalBytes += int64(packet.Size)
+	source.LastSeenAt = now
+	if s.limit != nil {
+		s.limit.update(source)
+	}
+
+	target := targetKey{
+		MAC:     packet.DstMAC,
+		IP:      packet.DstIP,
+		Port:    packet.DstPort,
+		EthType: packet.EthType,
+		IPProto: packet.IPProto,
+	}
+	targetData, ok := source.targets[target]
+	if !ok {
+		if s.limit != nil && len(source.targets) >= boundedTargetsPerSource {
+			targetData = replaceMinTarget(source.targets, target, now)
+		} else {
+			// create new target metrics if not exists
+			targetData = &TrafficMetrics{FirstSeenAt: now}
+			source.targets[target] = targetData
+		}
+	}
+	targetData.TotalPackets += int64(packet.Count)
+	targetData.TotalBytes += int64(packet.Size)
+	targetData.LastSeenAt = now
+	return source.Location
+}
+
+// mergeTotals adds the totals, day and dimension statistics of src to s,
+// sources are left out since every source lives in exactly one shard
+func (s *metricsState) mergeTotals(src *metricsState) {
+	s.totalPackets += src.totalPackets
+	s.totalBytes += src.totalBytes
+	for day, stat := range src.day {
+		if dst, ok := s.day[day]; ok {
+			dst.TotalPackets += stat.TotalPackets
+			dst.TotalBytes += stat.TotalBytes
+			continue
+		}
+		dayData := *stat
+		s.day[day] = &dayData
+	}
+	s.countries.merge(src.countries)
+	s.cities.merge(src.cities)
+	s.ports.merge(src.ports)
+	s.ethTypes.merge(src.ethTypes)
+	s.ipProtos.merge(src.ipProtos)
+	s.matches.merge(src.matches)
+	s.distinct.merge(src.distinct)
+	if src.limit != nil {
+		s.evicted += src.limit.evicted
+	}
+}
+
+// removes entries that have not been seen since before
+func (s *metricsState) cleanup(before int64) {
+	s.countries.cleanup(before)
+	s.cities.cleanup(before)
+	s.ports.cleanup(before)
+	s.ethTypes.cleanup(before)
+	s.ipProtos.cleanup(before)
+	s.matches.cleanup(before)
+	for key, source := range s.sources {
+		if source.LastSeenAt < before {
+			delete(s.sources, key)
+		}
+	}
+	if s.limit != nil {
+		s.limit.reset(s)
+	}
+}
+
+// dimension statistics rendered to their serialized form
+func (s *metricsState) dimensionStatistics() map[string]map[string]*Statistics {
+	result := make(map[string]map[string]*Statistics)
+	add := func(name string, stats map[string]*Statistics) {
+		if len(stats) > 0 {
+			result[name] = stats
+		}
+	}
+	add(dimensionCountry, s.countries.statistics(renderString))
+	add(dimensionCity, s.cities.statistics(renderString))
+	add(dimensionPort, s.ports.statistics(renderPort))
+	add(dimensionEthType, s.ethTypes.statistics(renderEthType))
+	add(dimensionIPProto, s.ipProtos.statistics(renderIPProto))
+	add(dimensionMatch, s.matches.statistics(renderMatch))
+	return result
+}
+
+// a copy of the per source metrics that stays valid after the shard is unlocked
+type sourceRow struct {
+	key      sourceKey
+	location GeoLocation
+	TrafficMetrics
+	targets int64
+}
+
+func (source *sourceEntry) row(key sourceKey) sourceRow {
+	return sourceRow{
+		key:            key,
+		location:       source.Location,
+		TrafficMetrics: source.TrafficMetrics,
+		targets:        int64(len(source.targets)),
+	}
+}
+
+func (r sourceRow) result() SourceStatisticResult {
+	return SourceStatisticResult{
+		Key: r.key.String(),
+		Source: Source{
+			MAC:      r.key.MAC.String(),
+			IP:       r.key.IP.String(),
+			Location: r.location,
+		},
+		TrafficMetrics: r.TrafficMetrics,
+		Targets:        r.targets,
+	}
+}
+
+func (key targetKey) statistic(target *TrafficMetrics) TargetStatistic {
+	return TargetStatistic{
+		Key: key.String(),
+		Destination: Destination{
+			MAC:  key.MAC.String(),
+			IP:   key.IP.String(),
+			Port: key.Port,
+			Protocol: Protocol{
+				EthType: key.EthType,
+				IPProto: key.IPProto,
+			},
+		},
+		TrafficMetrics: *target,
+	}
+}
+
+// summary renders the whole state to its serialized form
+func (s *metricsState) summary() *MetricsSummary {
+	summary := &MetricsSummary{
+		TotalPackets: s.totalPackets,
+		TotalBytes:   s.totalBytes,
+		Day:          make(map[string]Statistics, len(s.day)),
+		Statistics:   s.dimensionStatistics(),
+		Source:       make(map[string]SourceStatistic, len(s.sources)),
+	}
+	for day, stat := range s.day {
+		summary.Day[day] = *stat
+	}
+	s.summarizeSources(summary.Source)
+	return summary
+}
+
+// renders the sources with their targets into dst
+func (s *metricsState) summarizeSources(dst map[string]SourceStatistic) {
+	for key, source := range s.sources {
+		result := source.row(key).result()
+		targets := make(map[string]TargetStatistic, len(source.targets))
+		for tk, target := range source.targets {
+			stat := tk.statistic(target)
+			targets[stat.Key] = stat
+		}
+		dst[result.Key] = SourceStatistic{
+			Key:            result.Key,
+			Source:         result.Source,
+			TrafficMetrics: result.TrafficMetrics,
+			Target:         targets,
+		}
+	}
+}
+
+// load restores the state from its serialized form. Keys are rebuilt from the
+// address fields, so summaries written with the former MD5 keys load as well.
+func (s *metricsState) load(summary *MetricsSummary) {
+	s.totalPackets = summary.TotalPackets
+	s.totalBytes = summary.TotalBytes
+	for day, stat := range summary.Day {
+		stat := stat
+		s.day[day] = &stat
+	}
+	s.countries.load(summary.Statistics[dimensionCountry], parseString)
+	s.cities.load(summary.Statistics[dimensionCity], parseString)
+	s.ports.load(summary.Statistics[dimensionPort], parsePort)
+	s.ethTypes.load(summary.Statistics[dimensionEthType], parseEthType)
+	s.ipProtos.load(summary.Statistics[dimensionIPProto], parseIPProto)
+	s.matches.load(summary.Statistics[dimensionMatch], parseMatchKey)
+
+	for _, stat := range summary.Source {
+		key, ok := parseSourceAddresses(stat.MAC, stat.IP)
+		if !ok {
+			continue
+		}
+		source := &sourceEntry{
+			Location:       stat.Location,
+			TrafficMetrics: stat.TrafficMetrics,
+			targets:        make(map[targetKey]*TrafficMetrics, len(stat.Target)),
+		}
+		for _, target := range stat.Target {
+			tk, ok := parseSourceAddresses(target.MAC, target.IP)
+			if !ok {
+				continue
+			}
+			metrics := target.TrafficMetrics
+			source.targets[targetKey{
+				MAC:     tk.MAC,
+				IP:      tk.IP,
+				Port:    target.Port,
+				EthType: target.EthType,
+				IPProto: target.IPProto,
+			}] = &metrics
+		}
+		s.sources[key] = source
+	}
+}
+
+// parses rendered MAC and IP strings, an empty IP means a non-IP packet
+func parseSourceAddresses(mac string, ip string) (sourceKey, bool) {
+	var key sourceKey
+	var err error
+	if key.MAC, err = types.ParseMACAddr(mac); err != nil {
+		return key, false
+	}
+	if ip != "" {
+		if key.IP, err = types.ParseIPAddr(ip); err != nil {
+			return key, false
+		}
+	}
+	return key, true
+}
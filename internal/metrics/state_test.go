@@ -0,0 +1,178 @@
+package metrics
+
+import (
+	"hash/maphash"
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func testPacket() types.Packet {
+	return types.Packet{
+		Timestamp: 1700000000,
+		SrcMAC:    types.MACAddr{0x02, 0x42, 0xac, 0x11, 0x00, 0x02},
+		DstMAC:    types.MACAddr{0x02, 0x42, 0xac, 0x11, 0x00, 0x03},
+		SrcIP:     types.IPv4Addr([4]byte{203, 0, 113, 7}),
+		DstIP:     types.IPv4Addr([4]byte{192, 168, 1, 10}),
+		DstPort:   443,
+		Size:      1500,
+		Count:     1,
+		EthType:   0x0800,
+		IPProto:   6,
+		MatchType: types.MatchByIP4Exact,
+	}
+}
+
+func collectState(state *metricsState, packet *types.Packet) {
+	key := sourceKey{MAC: packet.SrcMAC, IP: packet.SrcIP}
+	b := key.bytes()
+	state.collect(packet, key, maphash.Bytes(testSeed, b[:]))
+}
+
+var testSeed = maphash.MakeSeed()
+
+func TestMetricsState_SummaryRoundTrip(t *testing.T) {
+	state := newMetricsState()
+	packet := testPacket()
+	collectState(state, &packet)
+	collectState(state, &packet)
+
+	summary := state.summary()
+	if summary.TotalPackets != 2 || summary.TotalBytes != 3000 {
+		t.Fatalf("totals = %d/%d, want 2/3000", summary.TotalPackets, summary.TotalBytes)
+	}
+	if stat := summary.Statistics[dimensionMatch]["203.0.113.7"]; stat == nil || stat.TotalPackets != 2 {
+		t.Fatalf("match dimension = %+v", summary.Statistics[dimensionMatch])
+	}
+	if stat := summary.Statistics[dimensionPort]["443"]; stat == nil || stat.TotalBytes != 3000 {
+		t.Fatalf("port dimension = %+v", summary.Statistics[dimensionPort])
+	}
+
+	key := sourceKey{MAC: packet.SrcMAC, IP: packet.SrcIP}
+	source, ok := summary.Source[key.String()]
+	if !ok {
+		t.Fatalf("source %s missing", key)
+	}
+	if source.IP != "203.0.113.7" || source.MAC != "02:42:ac:11:00:02" || len(source.Target) != 1 {
+		t.Fatalf("source = %+v", source)
+	}
+	if parsed, ok := parseSourceKey(key.String()); !ok || parsed != key {
+		t.Fatalf("parseSourceKey(%s) = %v, %v", key, parsed, ok)
+	}
+
+	restored := newMetricsState()
+	restored.load(summary)
+	entry, ok := restored.sources[key]
+	if !ok || entry.TotalPackets != 2 || len(entry.targets) != 1 {
+		t.Fatalf("restored source = %+v", entry)
+	}
+	if stat := restored.matches[matchKey{IP: packet.SrcIP}]; stat == nil || stat.TotalPackets != 2 {
+		t.Fatalf("restored match = %+v", restored.matches)
+	}
+	if stat := restored.ports[443]; stat == nil || stat.TotalPackets != 2 {
+		t.Fatalf("restored port = %+v", restored.ports)
+	}
+}
+
+func TestMetricsState_Locate(t *testing.T) {
+	state := newMetricsState()
+	calls := 0
+	state.locate = func(ip types.IPAddr) GeoLocation {
+		calls++
+		return GeoLocation{Country: "CN", City: "Shanghai"}
+	}
+	packet := testPacket()
+	for i := 0; i < 3; i++ {
+		collectState(state, &packet)
+	}
+	if calls != 1 {
+		t.Errorf("locate called %d times, want once per source", calls)
+	}
+	if stat := state.countries["CN"]; stat == nil || stat.TotalPackets != 3 {
+		t.Errorf("country dimension = %+v", state.countries)
+	}
+	if stat := state.cities["Shanghai"]; stat == nil || stat.TotalPackets != 3 {
+		t.Errorf("city dimension = %+v", state.cities)
+	}
+}
+
+func TestMetricsState_Cleanup(t *testing.T) {
+	state := newMetricsState()
+	packet := testPacket()
+	collectState(state, &packet)
+	state.cleanup(packet.Timestamp + 1)
+	if len(state.sources) != 0 || len(state.countries) != 0 || len(state.matches) != 0 {
+		t.Fatalf("stale entries left: %d sources, %d countries", len(state.sources), len(state.countries))
+	}
+}
+
+func BenchmarkMetricsState_Collect(b *testing.B) {
+	state := newMetricsState()
+	packet := testPacket()
+	collectState(state, &packet)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		collectState(state, &packet)
+	}
+}
+
+func TestMetricsState_BoundedSources(t *testing.T) {
+	state := newMetricsState()
+	state.limit = newSourceLimit(16)
+
+	heavy := testPacket()
+	heavy.SrcIP = types.IPv4Addr([4]byte{203, 0, 113, 1})
+	for i := 0; i < 100; i++ {
+		collectState(state, &heavy)
+	}
+	// a flood of single packet sources must not grow the table
+	for i := 0; i < 10000; i++ {
+		packet := testPacket()
+		packet.SrcIP = types.IPv4Addr([4]byte{10, byte(i >> 16), byte(i >> 8), byte(i)})
+		packet.DstPort = uint16(i)
+		collectState(state, &packet)
+	}
+	if len(state.sources) > 16 {
+		t.Fatalf("tracked %d sources, capacity is 16", len(state.sources))
+	}
+	entry, ok := state.sources[sourceKey{MAC: heavy.SrcMAC, IP: heavy.SrcIP}]
+	if !ok || entry.TotalPackets != 100 {
+		t.Fatalf("heavy hitter = %+v, want exact 100 packets", entry)
+	}
+	if state.totalPackets != 10100 {
+		t.Fatalf("total packets = %d, want 10100", state.totalPackets)
+	}
+
+	// the sketch admits a repeated source once it outgrows the smallest entry
+	repeated := testPacket()
+	repeated.SrcIP = types.IPv4Addr([4]byte{198, 51, 100, 1})
+	for i := 0; i < 200; i++ {
+		collectState(state, &repeated)
+	}
+	if _, ok := state.sources[sourceKey{MAC: repeated.SrcMAC, IP: repeated.SrcIP}]; !ok {
+		t.Fatal("repeated source was not admitted")
+	}
+
+	// targets of a source are bounded as well
+	for i := 0; i < 1000; i++ {
+		heavy.DstPort = uint16(i)
+		collectState(state, &heavy)
+	}
+	if n := len(entry.targets); n > boundedTargetsPerSource {
+		t.Fatalf("tracked %d targets, limit is %d", n, boundedTargetsPerSource)
+	}
+}
+
+func TestHyperLogLog_Estimate(t *testing.T) {
+	for _, n := range []int{100, 10000, 200000} {
+		var h hyperLogLog
+		for i := 0; i < n; i++ {
+			h.add(maphash.Bytes(testSeed, []byte{byte(i), byte(i >> 8), byte(i >> 16)}))
+		}
+		estimate := h.estimate()
+		if diff := float64(estimate-int64(n)) / float64(n); diff > 0.05 || diff < -0.05 {
+			t.Errorf("estimate for %d = %d, error %.3f", n, estimate, diff)
+		}
+	}
+}
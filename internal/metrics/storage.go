@@ -1,39 +1,175 @@
 package metrics
 
 import (
+	"bufio"
+	"encoding/binary"
 	"encoding/json"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
 	"os"
 	"path/filepath"
 	"sync"
 )
 
+// On disk the metrics consist of a base file holding a full copy of the state
+// and an append-only delta log. Both start with a header and hold a sequence
+// of frames (length, crc32, records). The log header names the sequence of the
+// base it applies to, so a log left behind by an interrupted compaction is
+// ignored instead of rolling the new base back.
+
+const (
+	metricsMagic   = "EFWM"
+	metricsVersion = 1
+	headerSize     = 16
+	frameSize      = 8
+	// upper bound of a frame payload, larger lengths mean a corrupt file
+	maxFrameSize = 1 << 30
+)
+
 type MetricsStorage struct {
-	filePath string
-	mu       sync.RWMutex
+	basePath   string
+	logPath    string
+	legacyPath string
+	mu         sync.Mutex
+	seq        uint64
+	baseSize   int64
+	logSize    int64
 }
 
 func NewMetricsStorage(dataDir string) *MetricsStorage {
 	return &MetricsStorage{
-		filePath: filepath.Join(dataDir, "metrics.json"),
+		basePath:   filepath.Join(dataDir, "metrics.bin"),
+		logPath:    filepath.Join(dataDir, "metrics.log"),
+		legacyPath: filepath.Join(dataDir, "metrics.json"),
+	}
+}
+
+func appendHeader(b []byte, seq uint64) []byte {
+	b = append(b, metricsMagic...)
+	b = binary.LittleEndian.AppendUint32(b, metricsVersion)
+	return binary.LittleEndian.AppendUint64(b, seq)
+}
+
+func readHeader(r io.Reader) (uint64, error) {
+	var header [headerSize]byte
+	if _, err := io.ReadFull(r, header[:]); err != nil {
+		return 0, err
+	}
+	if string(header[:4]) != metricsMagic || binary.LittleEndian.Uint32(header[4:]) != metricsVersion {
+		return 0, fmt.Errorf("invalid metrics file header")
+	}
+	return binary.LittleEndian.Uint64(header[8:]), nil
+}
+
+// reads the next frame into buf, io.EOF marks a clean end of the file
+func readFrame(r *bufio.Reader, buf []byte) ([]byte, error) {
+	var frame [frameSize]byte
+	if _, err := io.ReadFull(r, frame[:]); err != nil {
+		if errors.Is(err, io.ErrUnexpectedEOF) {
+			return nil, fmt.Errorf("truncated metrics frame")
+		}
+		return nil, err
+	}
+	size := binary.LittleEndian.Uint32(frame[:])
+	if size > maxFrameSize {
+		return nil, fmt.Errorf("invalid metrics frame size: %d", size)
+	}
+	if cap(buf) < int(size) {
+		buf = make([]byte, size)
+	}
+	buf = buf[:size]
+	if _, err := io.ReadFull(r, buf); err != nil {
+		return nil, fmt.Errorf("truncated metrics frame")
 	}
+	if crc32.ChecksumIEEE(buf) != binary.LittleEndian.Uint32(frame[4:]) {
+		return nil, fmt.Errorf("metrics frame checksum mismatch")
+	}
+	return buf, nil
 }
 
-func (ms *MetricsStorage) Save(metrics *MetricsSummary) error {
+// Load streams the base file and replays the delta log into a new state. A
+// metrics.json written by earlier versions is migrated when no base exists.
+// It returns nil when there is nothing to load.
+func (ms *MetricsStorage) Load() (*metricsState, error) {
 	ms.mu.Lock()
 	defer ms.mu.Unlock()
 
-	data, err := json.Marshal(metrics)
+	file, err := os.Open(ms.basePath)
+	if os.IsNotExist(err) {
+		return ms.loadLegacy()
+	}
 	if err != nil {
-		return err
+		return nil, err
 	}
-	return os.WriteFile(ms.filePath, data, 0644)
+	defer file.Close()
+
+	state := newMetricsState()
+	r := bufio.NewReaderSize(file, 1<<16)
+	if ms.seq, err = readHeader(r); err != nil {
+		return nil, err
+	}
+	var buf []byte
+	for {
+		if buf, err = readFrame(r, buf); err == io.EOF {
+			break
+		} else if err != nil {
+			return nil, err
+		}
+		if err := decodeRecords(state, buf); err != nil {
+			return nil, err
+		}
+	}
+	if info, err := file.Stat(); err == nil {
+		ms.baseSize = info.Size()
+	}
+	if err := ms.replayLog(state); err != nil {
+		return nil, err
+	}
+	return state, nil
 }
 
-func (ms *MetricsStorage) Load() (*MetricsSummary, error) {
-	ms.mu.RLock()
-	defer ms.mu.RUnlock()
+// replays the frames of the delta log, a torn frame at the end left by a crash
+// is cut off so that later appends start on a frame boundary
+func (ms *MetricsStorage) replayLog(state *metricsState) error {
+	file, err := os.OpenFile(ms.logPath, os.O_RDWR, 0644)
+	if os.IsNotExist(err) {
+		return nil
+	}
+	if err != nil {
+		return err
+	}
+	defer file.Close()
+
+	r := bufio.NewReaderSize(file, 1<<16)
+	if seq, err := readHeader(r); err != nil || seq != ms.seq {
+		// the log belongs to another base, the next persist rewrites it
+		ms.logSize = -1
+		return nil
+	}
+	offset := int64(headerSize)
+	var buf []byte
+	for {
+		if buf, err = readFrame(r, buf); err != nil {
+			break
+		}
+		if err := decodeRecords(state, buf); err != nil {
+			return err
+		}
+		offset += frameSize + int64(len(buf))
+	}
+	if err != io.EOF {
+		if err := file.Truncate(offset); err != nil {
+			return err
+		}
+	}
+	ms.logSize = offset
+	return nil
+}
 
-	data, err := os.ReadFile(ms.filePath)
+func (ms *MetricsStorage) loadLegacy() (*metricsState, error) {
+	data, err := os.ReadFile(ms.legacyPath)
 	if err != nil {
 		if os.IsNotExist(err) {
 			return nil, nil
@@ -45,11 +181,141 @@ func (ms *MetricsStorage) Load() (*MetricsSummary, error) {
 	if err := json.Unmarshal(data, &metrics); err != nil {
 		return nil, err
 	}
-	return &metrics, nil
+	state := newMetricsState()
+	state.load(&metrics)
+	return state, nil
+}
+
+// NeedsCompaction reports whether the next write should rewrite the base,
+// which is the case without a usable base or once the log outgrows it
+func (ms *MetricsStorage) NeedsCompaction() bool {
+	ms.mu.Lock()
+	defer ms.mu.Unlock()
+	return ms.baseSize == 0 || ms.logSize < 0 || ms.logSize > ms.baseSize
+}
+
+// MetricsWriter writes frames either to a new base or to the delta log
+type MetricsWriter struct {
+	ms      *MetricsStorage
+	file    *os.File
+	w       *bufio.Writer
+	compact bool
+	size    int64
+	frame   [frameSize]byte
+}
+
+// Begin starts a write, a compacting write replaces the base and the log
+// once committed while other writes append to the log
+func (ms *MetricsStorage) Begin(compact bool) (*MetricsWriter, error) {
+	ms.mu.Lock()
+	mw := &MetricsWriter{ms: ms, compact: compact}
+	var err error
+	if compact {
+		mw.file, err = os.Create(ms.basePath + ".tmp")
+		if err == nil {
+			mw.w = bufio.NewWriterSize(mw.file, 1<<16)
+			_, err = mw.w.Write(appendHeader(nil, ms.seq+1))
+			mw.size = headerSize
+		}
+	} else {
+		flags := os.O_WRONLY | os.O_CREATE | os.O_APPEND
+		if ms.logSize <= 0 {
+			// no usable log, start a new one for the current base
+			flags |= os.O_TRUNC
+		}
+		mw.file, err = os.OpenFile(ms.logPath, flags, 0644)
+		if err == nil {
+			mw.w = bufio.NewWriterSize(mw.file, 1<<16)
+			if ms.logSize <= 0 {
+				_, err = mw.w.Write(appendHeader(nil, ms.seq))
+				mw.size = headerSize
+			}
+		}
+	}
+	if err != nil {
+		mw.Abort()
+		return nil, err
+	}
+	return mw, nil
+}
+
+func (mw *MetricsWriter) WriteFrame(payload []byte) error {
+	if len(payload) == 0 {
+		return nil
+	}
+	binary.LittleEndian.PutUint32(mw.frame[:4], uint32(len(payload)))
+	binary.LittleEndian.PutUint32(mw.frame[4:], crc32.ChecksumIEEE(payload))
+	if _, err := mw.w.Write(mw.frame[:]); err != nil {
+		return err
+	}
+	if _, err := mw.w.Write(payload); err != nil {
+		return err
+	}
+	mw.size += frameSize + int64(len(payload))
+	return nil
+}
+
+// Commit flushes the frames, a compacting write renames the new base into
+// place, starts an empty log for it and removes a migrated metrics.json
+func (mw *MetricsWriter) Commit() error {
+	ms := mw.ms
+	defer ms.mu.Unlock()
+	err := mw.w.Flush()
+	if closeErr := mw.file.Close(); err == nil {
+		err = closeErr
+	}
+	if err != nil {
+		if mw.compact {
+			os.Remove(ms.basePath + ".tmp")
+		} else {
+			// the log may end in a partial frame, rewrite it with the next base
+			ms.logSize = -1
+		}
+		return err
+	}
+	if !mw.compact {
+		if ms.logSize < 0 {
+			ms.logSize = 0
+		}
+		ms.logSize += mw.size
+		return nil
+	}
+	if err := os.Rename(ms.basePath+".tmp", ms.basePath); err != nil {
+		return err
+	}
+	ms.seq++
+	ms.baseSize = mw.size
+	if err := os.WriteFile(ms.logPath, appendHeader(nil, ms.seq), 0644); err != nil {
+		// the stale log is ignored on load because of the sequence mismatch
+		ms.logSize = -1
+		return err
+	}
+	ms.logSize = headerSize
+	os.Remove(ms.legacyPath)
+	return nil
+}
+
+// Abort discards a write that has not been committed
+func (mw *MetricsWriter) Abort() {
+	if mw.file != nil {
+		mw.file.Close()
+		if mw.compact {
+			os.Remove(mw.ms.basePath + ".tmp")
+		} else {
+			mw.ms.logSize = -1
+		}
+	}
+	mw.ms.mu.Unlock()
 }
 
 func (ms *MetricsStorage) DeleteMetrics() error {
 	ms.mu.Lock()
 	defer ms.mu.Unlock()
-	return os.Remove(ms.filePath)
+	for _, path := range []string{ms.basePath, ms.logPath, ms.legacyPath} {
+		if err := os.Remove(path); err != nil && !os.IsNotExist(err) {
+			return err
+		}
+	}
+	ms.seq, ms.baseSize, ms.logSize = 0, 0, 0
+	return nil
 }
@@ -0,0 +1,177 @@
+package metrics
+
+import (
+	"encoding/json"
+	"os"
+	"testing"
+	"time"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func newTestCollector(dir string, sources int) *MetricsCollector {
+	mc := newShardedCollector(4)
+	mc.storage = NewMetricsStorage(dir)
+	for i := 0; i < sources; i++ {
+		packet := testPacket()
+		packet.Timestamp = time.Now().Unix()
+		packet.SrcIP = types.IPv4Addr([4]byte{10, byte(i >> 16), byte(i >> 8), byte(i)})
+		mc.CollectPacket(&packet)
+	}
+	return mc
+}
+
+func loadCollector(t *testing.T, dir string) *MetricsCollector {
+	t.Helper()
+	state, err := NewMetricsStorage(dir).Load()
+	if err != nil || state == nil {
+		t.Fatalf("Load() = %v, %v", state, err)
+	}
+	mc := newShardedCollector(2)
+	mc.restore(state)
+	return mc
+}
+
+func TestMetricsStorage_BaseAndLog(t *testing.T) {
+	dir := t.TempDir()
+	mc := newTestCollector(dir, 100)
+	if err := mc.persist(false); err != nil {
+		t.Fatalf("first persist: %v", err)
+	}
+	base, _ := os.Stat(mc.storage.basePath)
+
+	// the second persist only appends the changes to the log
+	packet := testPacket()
+	packet.Timestamp = time.Now().Unix()
+	packet.SrcIP = types.IPv4Addr([4]byte{10, 0, 0, 0})
+	packet.DstPort = 8080
+	mc.CollectPacket(&packet)
+	if err := mc.persist(false); err != nil {
+		t.Fatalf("delta persist: %v", err)
+	}
+	if after, _ := os.Stat(mc.storage.basePath); after.ModTime() != base.ModTime() || after.Size() != base.Size() {
+		t.Fatal("delta persist rewrote the base")
+	}
+
+	restored := loadCollector(t, dir)
+	report := restored.GenerateReport(10)
+	if report.TotalPackets != 101 {
+		t.Fatalf("restored total packets = %d, want 101", report.TotalPackets)
+	}
+	key := sourceKey{MAC: packet.SrcMAC, IP: packet.SrcIP}
+	targets := restored.GetTargets(key.String(), 1, 10, "total_packets", "desc")
+	if targets.Total != 2 {
+		t.Fatalf("restored %d targets, want 2", targets.Total)
+	}
+	if got := restored.GetSources(1, 1, "", ""); got.Total != 100 {
+		t.Fatalf("restored %d sources, want 100", got.Total)
+	}
+}
+
+func TestMetricsStorage_TornLog(t *testing.T) {
+	dir := t.TempDir()
+	mc := newTestCollector(dir, 10)
+	if err := mc.persist(false); err != nil {
+		t.Fatal(err)
+	}
+	packet := testPacket()
+	mc.CollectPacket(&packet)
+	if err := mc.persist(false); err != nil {
+		t.Fatal(err)
+	}
+	// simulate a crash in the middle of an append
+	info, _ := os.Stat(mc.storage.logPath)
+	file, _ := os.OpenFile(mc.storage.logPath, os.O_WRONLY|os.O_APPEND, 0644)
+	file.Write([]byte{0xff, 0x00, 0x00, 0x00, 0x01, 0x02})
+	file.Close()
+
+	restored := loadCollector(t, dir)
+	if got := restored.GenerateReport(1).TotalPackets; got != 11 {
+		t.Fatalf("restored total packets = %d, want 11", got)
+	}
+	if after, _ := os.Stat(mc.storage.logPath); after.Size() != info.Size() {
+		t.Fatalf("log size = %d, want the torn frame cut to %d", after.Size(), info.Size())
+	}
+}
+
+func TestMetricsStorage_StaleLogIgnored(t *testing.T) {
+	dir := t.TempDir()
+	mc := newTestCollector(dir, 10)
+	if err := mc.persist(false); err != nil {
+		t.Fatal(err)
+	}
+	stale, _ := os.ReadFile(mc.storage.logPath)
+	packet := testPacket()
+	mc.CollectPacket(&packet)
+	if err := mc.persist(false); err != nil {
+		t.Fatal(err)
+	}
+	staleDelta, _ := os.ReadFile(mc.storage.logPath)
+	// a compaction that crashed after renaming the base leaves the old log
+	if err := mc.persist(true); err != nil {
+		t.Fatal(err)
+	}
+	if len(stale) >= len(staleDelta) {
+		t.Fatal("delta persist did not grow the log")
+	}
+	os.WriteFile(mc.storage.logPath, staleDelta, 0644)
+
+	restored := loadCollector(t, dir)
+	if got := restored.GenerateReport(1).TotalPackets; got != 11 {
+		t.Fatalf("restored total packets = %d, want 11", got)
+	}
+}
+
+func TestMetricsStorage_MigratesJSON(t *testing.T) {
+	dir := t.TempDir()
+	mc := newTestCollector(dir, 20)
+	data, _ := json.Marshal(mergedSummary(mc))
+	storage := NewMetricsStorage(dir)
+	if err := os.WriteFile(storage.legacyPath, data, 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	state, err := storage.Load()
+	if err != nil || state == nil || len(state.sources) != 20 {
+		t.Fatalf("legacy Load() = %v, %v", state, err)
+	}
+	migrated := newShardedCollector(2)
+	migrated.storage = storage
+	migrated.restore(state)
+	if err := migrated.persist(false); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := os.Stat(storage.legacyPath); !os.IsNotExist(err) {
+		t.Fatal("metrics.json was not removed after migration")
+	}
+	if got := loadCollector(t, dir).GenerateReport(1).TotalPackets; got != 20 {
+		t.Fatalf("migrated total packets = %d, want 20", got)
+	}
+}
+
+func BenchmarkMetricsStorage_Base(b *testing.B) {
+	mc := newTestCollector(b.TempDir(), 100000)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := mc.persist(true); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkMetricsStorage_JSON(b *testing.B) {
+	dir := b.TempDir()
+	mc := newTestCollector(dir, 100000)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		data, err := json.Marshal(mergedSummary(mc))
+		if err != nil {
+			b.Fatal(err)
+		}
+		if err := os.WriteFile(mc.storage.legacyPath, data, 0644); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
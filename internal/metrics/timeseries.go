@@ -0,0 +1,222 @@
+package metrics
+
+import (
+	"sync"
+	"time"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+const (
+	// history kept per resolution
+	secondSlots = 300
+	minuteSlots = 1440
+	// number of match types counted per interval, indexed by types.MatchType
+	// MatchByGeo is the last of them
+	seriesMatchTypes = int(types.MatchByGeo) + 1
+
+	ResolutionSecond = "second"
+	ResolutionMinute = "minute"
+)
+
+// packets per transport protocol
+type ProtocolCounters struct {
+	TCP   int64 `json:"tcp"`
+	UDP   int64 `json:"udp"`
+	ICMP  int64 `json:"icmp"`
+	Other int64 `json:"other"`
+}
+
+// traffic counted in one interval
+type SeriesPoint struct {
+	Timestamp int64 `json:"timestamp"`
+	Packets   int64 `json:"packets"`
+	Bytes     int64 `json:"bytes"`
+	// packets that matched a rule and were dropped
+	Dropped int64 `json:"dropped"`
+	// packets per match type, indexed by the match type value
+	Matches   [seriesMatchTypes]int64 `json:"matches"`
+	Protocols ProtocolCounters        `json:"protocols"`
+}
+
+func (p *SeriesPoint) collect(packet *types.Packet) {
+	count := int64(packet.Count)
+	p.Packets += count
+	p.Bytes += int64(packet.Size)
+	if packet.MatchType != types.NoMatch {
+		p.Dropped += count
+	}
+	if int(packet.MatchType) < seriesMatchTypes {
+		p.Matches[packet.MatchType] += count
+	}
+	switch packet.IPProto {
+	case 6:
+		p.Protocols.TCP += count
+	case 17:
+		p.Protocols.UDP += count
+	case 1, 58:
+		p.Protocols.ICMP += count
+	default:
+		p.Protocols.Other += count
+	}
+}
+
+func (p *SeriesPoint) add(src *SeriesPoint) {
+	p.Packets += src.Packets
+	p.Bytes += src.Bytes
+	p.Dropped += src.Dropped
+	for i := range p.Matches {
+		p.Matches[i] += src.Matches[i]
+	}
+	p.Protocols.TCP += src.Protocols.TCP
+	p.Protocols.UDP += src.Protocols.UDP
+	p.Protocols.ICMP += src.Protocols.ICMP
+	p.Protocols.Other += src.Protocols.Other
+}
+
+// seriesRing is a preallocated ring of points spaced step seconds apart
+type seriesRing struct {
+	points []SeriesPoint
+	next   int
+	full   bool
+	step   int64
+}
+
+func newSeriesRing(slots int, step int64) *seriesRing {
+	return &seriesRing{points: make([]SeriesPoint, slots), step: step}
+}
+
+func (r *seriesRing) push(point SeriesPoint) {
+	r.points[r.next] = point
+	if r.next++; r.next == len(r.points) {
+		r.next, r.full = 0, true
+	}
+}
+
+// returns the timestamp of the newest point, 0 when empty
+func (r *seriesRing) last() int64 {
+	if !r.full && r.next == 0 {
+		return 0
+	}
+	return r.points[(r.next+len(r.points)-1)%len(r.points)].Timestamp
+}
+
+// pushes point at ts, intervals skipped since the newest point are zero filled
+func (r *seriesRing) advance(ts int64, point SeriesPoint) {
+	if last := r.last(); last > 0 {
+		gap := (ts - last) / r.step
+		if gap > int64(len(r.points)) {
+			gap = int64(len(r.points))
+		}
+		for i := gap - 1; i > 0; i-- {
+			r.push(SeriesPoint{Timestamp: ts - i*r.step})
+		}
+	}
+	point.Timestamp = ts
+	r.push(point)
+}
+
+// copies up to limit of the newest points into dst, oldest first
+func (r *seriesRing) appendTo(dst []SeriesPoint, limit int) []SeriesPoint {
+	n := r.next
+	if r.full {
+		n = len(r.points)
+	}
+	if limit > 0 && limit < n {
+		n = limit
+	}
+	for i := n; i > 0; i-- {
+		dst = append(dst, r.points[(r.next-i+len(r.points))%len(r.points)])
+	}
+	return dst
+}
+
+// timeSeries keeps per second and per minute history, it is advanced once a
+// second from the interval counters of the shards
+type timeSeries struct {
+	mu      sync.RWMutex
+	seconds *seriesRing
+	minutes *seriesRing
+	// the minute that is still being accumulated
+	minute SeriesPoint
+}
+
+func newTimeSeries() *timeSeries {
+	return &timeSeries{
+		seconds: newSeriesRing(secondSlots, 1),
+		minutes: newSeriesRing(minuteSlots, 60),
+	}
+}
+
+func (ts *timeSeries) advance(now int64, point SeriesPoint) {
+	ts.mu.Lock()
+	defer ts.mu.Unlock()
+	ts.seconds.advance(now, point)
+	minute := now - now%60
+	if ts.minute.Timestamp != minute {
+		if ts.minute.Timestamp != 0 {
+			ts.minutes.advance(ts.minute.Timestamp, ts.minute)
+		}
+		ts.minute = SeriesPoint{Timestamp: minute}
+	}
+	ts.minute.add(&point)
+}
+
+// TimeSeries is the traffic history at one resolution
+type TimeSeries struct {
+	Resolution string        `json:"resolution"`
+	Step       int64         `json:"step"`
+	Points     []SeriesPoint `json:"points"`
+}
+
+func (ts *timeSeries) get(resolution string, limit int) TimeSeries {
+	ts.mu.RLock()
+	defer ts.mu.RUnlock()
+	if resolution == ResolutionMinute {
+		// the minute still being accumulated is the newest point
+		points := ts.minutes.appendTo(make([]SeriesPoint, 0, minuteSlots+1), 0)
+		if ts.minute.Timestamp != 0 {
+			points = append(points, ts.minute)
+		}
+		if limit > 0 && limit < len(points) {
+			points = points[len(points)-limit:]
+		}
+		return TimeSeries{Resolution: ResolutionMinute, Step: 60, Points: points}
+	}
+	return TimeSeries{
+		Resolution: ResolutionSecond,
+		Step:       1,
+		Points:     ts.seconds.appendTo(make([]SeriesPoint, 0, secondSlots), limit),
+	}
+}
+
+// collects the interval counters of all shards once a second
+func (mc *MetricsCollector) autoSeries() {
+	ticker := time.NewTicker(time.Second)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-mc.done:
+			return
+		case now := <-ticker.C:
+			mc.advanceSeries(now.Unix())
+		}
+	}
+}
+
+func (mc *MetricsCollector) advanceSeries(now int64) {
+	var point SeriesPoint
+	for _, shard := range mc.shards {
+		shard.mu.Lock()
+		point.add(&shard.state.interval)
+		shard.state.interval = SeriesPoint{}
+		shard.mu.Unlock()
+	}
+	mc.series.advance(now, point)
+}
+
+// GetTimeSeries returns up to limit of the newest points at the given
+// resolution, limit 0 returns the whole history
+func (mc *MetricsCollector) GetTimeSeries(resolution string, limit int) TimeSeries {
+	return mc.series.get(resolution, limit)
+}
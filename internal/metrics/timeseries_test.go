@@ -0,0 +1,83 @@
+package metrics
+
+import (
+	"testing"
+
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+)
+
+func TestSeriesRing_AdvanceAndWrap(t *testing.T) {
+	r := newSeriesRing(4, 1)
+	r.advance(100, SeriesPoint{Packets: 1})
+	// a late tick zero fills the skipped seconds
+	r.advance(103, SeriesPoint{Packets: 2})
+	points := r.appendTo(nil, 0)
+	if len(points) != 4 || points[0].Timestamp != 100 || points[3].Timestamp != 103 {
+		t.Fatalf("points = %+v", points)
+	}
+	if points[1].Packets != 0 || points[3].Packets != 2 {
+		t.Fatalf("unexpected counters: %+v", points)
+	}
+
+	r.advance(104, SeriesPoint{Packets: 3})
+	points = r.appendTo(nil, 2)
+	if len(points) != 2 || points[0].Timestamp != 103 || points[1].Timestamp != 104 {
+		t.Fatalf("newest points = %+v", points)
+	}
+	if all := r.appendTo(nil, 0); len(all) != 4 || all[0].Timestamp != 101 {
+		t.Fatalf("wrapped points = %+v", all)
+	}
+}
+
+func TestMetricsCollector_TimeSeries(t *testing.T) {
+	mc := newShardedCollector(4)
+	packet := testPacket()
+	packet.Count = 5
+	mc.CollectPacket(&packet)
+	packet.MatchType = types.NoMatch
+	packet.IPProto = 17
+	mc.CollectPacket(&packet)
+	mc.advanceSeries(6000)
+	mc.advanceSeries(6001)
+	mc.CollectPacket(&packet)
+	mc.advanceSeries(6060)
+
+	seconds := mc.GetTimeSeries(ResolutionSecond, 0)
+	if len(seconds.Points) != 61 {
+		t.Fatalf("got %d second points, want 61", len(seconds.Points))
+	}
+	first := seconds.Points[0]
+	if first.Packets != 10 || first.Dropped != 5 || first.Matches[types.MatchByIP4Exact] != 5 {
+		t.Fatalf("first second = %+v", first)
+	}
+	if first.Protocols.TCP != 5 || first.Protocols.UDP != 5 {
+		t.Fatalf("first second protocols = %+v", first.Protocols)
+	}
+
+	minutes := mc.GetTimeSeries(ResolutionMinute, 0)
+	if len(minutes.Points) != 2 || minutes.Points[0].Timestamp != 6000 || minutes.Points[0].Packets != 10 {
+		t.Fatalf("minutes = %+v", minutes.Points)
+	}
+	if current := minutes.Points[1]; current.Timestamp != 6060 || current.Packets != 5 {
+		t.Fatalf("current minute = %+v", current)
+	}
+	if last := mc.GetTimeSeries(ResolutionMinute, 1); len(last.Points) != 1 || last.Points[0].Timestamp != 6060 {
+		t.Fatalf("limited minutes = %+v", last.Points)
+	}
+}
+
+func TestSeriesPoint_CollectEveryMatchType(t *testing.T) {
+	var p SeriesPoint
+	packet := testPacket()
+	packet.Count = 1
+	for mt := types.MatchByIP4Exact; mt <= types.MatchByGeo; mt++ {
+		packet.MatchType = mt
+		p.collect(&packet)
+		if p.Matches[mt] != 1 {
+			t.Fatalf("match type %d counted %d times, want 1", mt, p.Matches[mt])
+		}
+	}
+	if p.Dropped != int64(types.MatchByGeo) {
+		t.Fatalf("dropped = %d, want %d", p.Dropped, types.MatchByGeo)
+	}
+}
@@ -13,6 +13,10 @@ const (
 	defaultCleanupInterval = time.Second * 15
 	defaultBlockDuration   = time.Hour * 24 * 7
 	defaultConfigFile      = "processor.json"
+	// how often the sources flagged by the kernel rate limiter are collected
+	offenderDrainInterval = time.Second
+	// how often the GeoIP databases are checked for an update
+	geoBlockCheckInterval = time.Minute
 )
 
 type BlockSourceType uint8
@@ -33,7 +37,7 @@ const (
 
 type BlockRule struct {
 	ID         string          `json:"id"`
-	Value      string          `json:"value"` // IP/CIDR、MAC
+	Value      string          `json:"value"` // IP/CIDR、MAC、"<src> <proto>[:<ports>] [deny|allow]"
 	Note       string          `json:"note"`
 	Source     BlockSourceType `json:"source"`
 	CreateTime int64           `json:"create_time"`
@@ -47,7 +51,8 @@ type ProcessorConfig struct {
 	Blocklist       struct {
 		// default block duration
 		DefaultBlockDuration time.Duration `json:"default_block_duration"`
-		Rules                []BlockRule   `json:"rules"`
+		// written on save only, the current rules are in Processor.rules
+		Rules []BlockRule `json:"rules"`
 	} `json:"blocklist"`
 
 	ThreatIntel struct {
@@ -58,9 +63,24 @@ type ProcessorConfig struct {
 		MatchThreshold int           `json:"match_threshold"`
 		MatchWindow    time.Duration `json:"match_window"`
 		// The duration for which the IP is blocked after it is matched.
-		BlockDuration time.Duration                       `json:"block_duration"`
-		Feeds         map[string]threatintel.FeedMetadata `json:"feeds"`
+		BlockDuration time.Duration `json:"block_duration"`
+		// Load the aggregated indicators into the kernel and drop matching packets in XDP.
+		// Match mode, threshold and block duration do not apply to these packets.
+		KernelDrop bool `json:"kernel_drop"`
+		// With kernel drop, count the matches of a source in XDP and only drop it
+		// once it reached match threshold within match window, a blocklist rule is
+		// added for every source over the threshold.
+		KernelThreshold bool                                `json:"kernel_threshold"`
+		Feeds           map[string]threatintel.FeedMetadata `json:"feeds"`
 	} `json:"threat_intel"`
+
+	// Networks dropped in XDP by the GeoIP databases, reported as MatchByGeo.
+	GeoBlock struct {
+		// ISO 3166-1 alpha-2 codes of the countries to block.
+		Countries []string `json:"countries"`
+		// Autonomous system numbers to block, requires geoip-asn-path.
+		ASNs []uint32 `json:"asns"`
+	} `json:"geo_block"`
 }
 
 func (p *Processor) getDefaultConfig() *ProcessorConfig {
@@ -93,37 +113,48 @@ func (p *Processor) updateConfig(updater func(*ProcessorConfig) error) error {
 	return nil
 }
 
+// loadConfig reads processor.json and replays the rule journal on top of its
+// rules, the rules then live in p.rules
 func (p *Processor) loadConfig() error {
 	configPath := filepath.Join(p.dataDir, defaultConfigFile)
 
+	config := &ProcessorConfig{}
 	if _, err := os.Stat(configPath); os.IsNotExist(err) {
-		config := p.getDefaultConfig()
-		p.config.Store(config)
-		if err := p.saveConfig(); err != nil {
+		config = p.getDefaultConfig()
+	} else {
+		data, err := os.ReadFile(configPath)
+		if err != nil {
+			return err
+		}
+		if err := json.Unmarshal(data, config); err != nil {
 			return err
 		}
-		return nil
-	}
-
-	data, err := os.ReadFile(configPath)
-	if err != nil {
-		return err
 	}
 
-	config := &ProcessorConfig{}
-	if err := json.Unmarshal(data, config); err != nil {
+	p.rules = newRuleStore(config.Blocklist.Rules)
+	config.Blocklist.Rules = nil
+	if err := p.rules.openJournal(filepath.Join(p.dataDir, defaultJournalFile)); err != nil {
 		return err
 	}
-
 	p.config.Store(config)
-	return nil
+	return p.saveConfig()
 }
 
+// saveConfig writes processor.json with the current rules and truncates the
+// rule journal they include
 func (p *Processor) saveConfig() error {
-	data, err := json.MarshalIndent(*p.getConfig(), "", "\t")
-	if err != nil {
-		return err
-	}
-
-	return os.WriteFile(filepath.Join(p.dataDir, defaultConfigFile), data, 0644)
+	return p.rules.compactJournal(func(rules []BlockRule) error {
+		config := *p.getConfig()
+		config.Blocklist.Rules = rules
+		data, err := json.MarshalIndent(config, "", "\t")
+		if err != nil {
+			return err
+		}
+		// written next to the old file first, a crash leaves one of both intact
+		path := filepath.Join(p.dataDir, defaultConfigFile)
+		if err := os.WriteFile(path+".tmp", data, 0644); err != nil {
+			return err
+		}
+		return os.Rename(path+".tmp", path)
+	})
 }
@@ -0,0 +1,181 @@
+package processor
+
+import (
+	"fmt"
+	"log"
+	"net"
+	"net/netip"
+	"os"
+	"strings"
+	"time"
+
+	"github.com/danger-dream/ebpf-firewall/internal/threatintel/iptrie"
+	"github.com/oschwald/maxminddb-golang"
+)
+
+// the fields of a City and an ASN database record the geo block reads
+type countryRecord struct {
+	Country struct {
+		ISOCode string `maxminddb:"iso_code"`
+	} `maxminddb:"country"`
+}
+
+type asnRecord struct {
+	ASN uint32 `maxminddb:"autonomous_system_number"`
+}
+
+// geoBlocker compiles the blocked countries and autonomous systems into the
+// prefixes of the kernel geo tries. The databases are walked again whenever
+// one of them changes on disk, the kernel only receives the difference.
+type geoBlocker struct {
+	cityPath  string
+	asnPath   string
+	countries map[string]struct{}
+	asns      map[uint32]struct{}
+	load      func([]netip.Prefix) error
+	// modification times of the databases of the loaded prefixes
+	compiled        bool
+	cityMod, asnMod time.Time
+}
+
+func newGeoBlocker(cityPath, asnPath string, countries []string, asns []uint32, load func([]netip.Prefix) error) *geoBlocker {
+	g := &geoBlocker{
+		cityPath:  cityPath,
+		asnPath:   asnPath,
+		countries: make(map[string]struct{}, len(countries)),
+		asns:      make(map[uint32]struct{}, len(asns)),
+		load:      load,
+	}
+	for _, country := range countries {
+		g.countries[strings.ToUpper(strings.TrimSpace(country))] = struct{}{}
+	}
+	for _, asn := range asns {
+		g.asns[asn] = struct{}{}
+	}
+	if len(g.countries) > 0 && cityPath == "" {
+		log.Printf("geoip-path is not set, countries are not blocked")
+	}
+	if len(g.asns) > 0 && asnPath == "" {
+		log.Printf("geoip-asn-path is not set, autonomous systems are not blocked")
+	}
+	return g
+}
+
+// refresh compiles and loads the prefixes unless the databases are unchanged
+// since the last load, an empty block list still clears the pinned tries
+func (g *geoBlocker) refresh() error {
+	cityMod, asnMod := modTime(g.cityPath), modTime(g.asnPath)
+	if g.compiled && cityMod.Equal(g.cityMod) && asnMod.Equal(g.asnMod) {
+		return nil
+	}
+	start := time.Now()
+	prefixes, err := g.compile()
+	if err != nil {
+		return err
+	}
+	if err := g.load(prefixes); err != nil {
+		return fmt.Errorf("failed to load geo block networks: %v", err)
+	}
+	g.compiled, g.cityMod, g.asnMod = true, cityMod, asnMod
+	if len(g.countries) > 0 || len(g.asns) > 0 {
+		log.Printf("Geo block compiled to %d prefixes in %s", len(prefixes), time.Since(start).Round(time.Millisecond))
+	}
+	return nil
+}
+
+// compile returns the collapsed networks of the blocked countries and autonomous systems
+func (g *geoBlocker) compile() ([]netip.Prefix, error) {
+	var prefixes []netip.Prefix
+	var err error
+	if len(g.countries) > 0 && g.cityPath != "" {
+		prefixes, err = walkNetworks(g.cityPath, prefixes, func(record *countryRecord) bool {
+			_, ok := g.countries[record.Country.ISOCode]
+			return ok
+		})
+		if err != nil {
+			return nil, err
+		}
+	}
+	if len(g.asns) > 0 && g.asnPath != "" {
+		prefixes, err = walkNetworks(g.asnPath, prefixes, func(record *asnRecord) bool {
+			_, ok := g.asns[record.ASN]
+			return ok
+		})
+		if err != nil {
+			return nil, err
+		}
+	}
+	// the databases split a country into many small networks, most of them adjacent
+	return iptrie.Collapse(prefixes), nil
+}
+
+// walkNetworks appends the networks of the database at path whose record match accepts
+func walkNetworks[R any](path string, prefixes []netip.Prefix, match func(*R) bool) ([]netip.Prefix, error) {
+	db, err := maxminddb.Open(path)
+	if err != nil {
+		return prefixes, fmt.Errorf("failed to open GeoIP database %s: %v", path, err)
+	}
+	defer db.Close()
+	// IPv4 networks are reported once, not again under every IPv6 alias
+	networks := db.Networks(maxminddb.SkipAliasedNetworks)
+	for networks.Next() {
+		var record R
+		network, err := networks.Network(&record)
+		if err != nil {
+			return prefixes, fmt.Errorf("failed to read GeoIP database %s: %v", path, err)
+		}
+		if !match(&record) {
+			continue
+		}
+		if prefix, ok := ipNetPrefix(network); ok {
+			prefixes = append(prefixes, prefix)
+		}
+	}
+	if err := networks.Err(); err != nil {
+		return prefixes, fmt.Errorf("failed to read GeoIP database %s: %v", path, err)
+	}
+	return prefixes, nil
+}
+
+// ipNetPrefix converts a database network, IPv4 networks may come as IPv4-mapped addresses
+func ipNetPrefix(network *net.IPNet) (netip.Prefix, bool) {
+	addr, ok := netip.AddrFromSlice(network.IP)
+	if !ok {
+		return netip.Prefix{}, false
+	}
+	bits, _ := network.Mask.Size()
+	if addr.Is4In6() && len(network.Mask) == net.IPv6len {
+		if bits < 96 {
+			return netip.Prefix{}, false
+		}
+		bits -= 96
+	}
+	return netip.PrefixFrom(addr.Unmap(), bits).Masked(), true
+}
+
+// modTime returns the modification time of path, zero if it does not exist
+func modTime(path string) time.Time {
+	if path == "" {
+		return time.Time{}
+	}
+	info, err := os.Stat(path)
+	if err != nil {
+		return time.Time{}
+	}
+	return info.ModTime()
+}
+
+func (p *Processor) geoBlockRoutine(g *geoBlocker) {
+	ticker := time.NewTicker(geoBlockCheckInterval)
+	defer ticker.Stop()
+	for {
+		if err := g.refresh(); err != nil {
+			log.Printf("Failed to compile geo block: %v", err)
+		}
+		select {
+		case <-p.done:
+			return
+		case <-ticker.C:
+		}
+	}
+}
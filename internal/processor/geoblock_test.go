@@ -0,0 +1,67 @@
+package processor
+
+import (
+	"net"
+	"net/netip"
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+)
+
+func TestIPNetPrefix(t *testing.T) {
+	tests := []struct {
+		network *net.IPNet
+		want    string
+	}{
+		{&net.IPNet{IP: net.IP{192, 0, 2, 0}, Mask: net.CIDRMask(24, 32)}, "192.0.2.0/24"},
+		// IPv4-mapped with an IPv6 mask
+		{&net.IPNet{IP: net.ParseIP("192.0.2.0"), Mask: net.CIDRMask(120, 128)}, "192.0.2.0/24"},
+		// IPv4-mapped with an IPv4 mask
+		{&net.IPNet{IP: net.ParseIP("198.51.100.0"), Mask: net.CIDRMask(22, 32)}, "198.51.100.0/22"},
+		{&net.IPNet{IP: net.ParseIP("2001:db8::"), Mask: net.CIDRMask(32, 128)}, "2001:db8::/32"},
+	}
+	for _, tt := range tests {
+		got, ok := ipNetPrefix(tt.network)
+		if !ok || got != netip.MustParsePrefix(tt.want) {
+			t.Errorf("ipNetPrefix(%v) = %v, %v, want %s", tt.network, got, ok, tt.want)
+		}
+	}
+	if _, ok := ipNetPrefix(&net.IPNet{IP: net.ParseIP("::"), Mask: net.CIDRMask(80, 128)}); !ok {
+		t.Error("IPv6 network was dropped")
+	}
+}
+
+func TestGeoBlocker_Refresh(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "GeoLite2-City.mmdb")
+	if err := os.WriteFile(path, nil, 0644); err != nil {
+		t.Fatal(err)
+	}
+	loads := 0
+	g := newGeoBlocker(path, "", nil, nil, func(prefixes []netip.Prefix) error {
+		loads++
+		if len(prefixes) != 0 {
+			t.Errorf("loaded %v without blocked networks", prefixes)
+		}
+		return nil
+	})
+	for i := 0; i < 2; i++ {
+		if err := g.refresh(); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if loads != 1 {
+		t.Fatalf("unchanged databases loaded %d times, want 1", loads)
+	}
+	// a replaced database is compiled again
+	later := time.Now().Add(time.Minute)
+	if err := os.Chtimes(path, later, later); err != nil {
+		t.Fatal(err)
+	}
+	if err := g.refresh(); err != nil {
+		t.Fatal(err)
+	}
+	if loads != 2 {
+		t.Errorf("updated database loaded %d times, want 2", loads)
+	}
+}
@@ -0,0 +1,78 @@
+package processor
+
+import (
+	"hash/maphash"
+	"net"
+	"sync"
+
+	"github.com/danger-dream/ebpf-firewall/internal/metrics"
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+	"github.com/danger-dream/ebpf-firewall/internal/utils"
+	"github.com/oschwald/geoip2-golang"
+)
+
+// geoLocator resolves source addresses with the GeoIP database. A lookup
+// decodes the whole city record, so results are cached by address and only
+// the interned names are kept.
+type geoLocator struct {
+	db *geoip2.Reader
+	// nil when caching is disabled
+	cache *utils.ShardedLRU[types.IPAddr, metrics.GeoLocation]
+}
+
+func newGeoLocator(db *geoip2.Reader, cacheSize int) *geoLocator {
+	g := &geoLocator{db: db}
+	if cacheSize > 0 {
+		seed := maphash.MakeSeed()
+		g.cache = utils.NewShardedLRU[types.IPAddr, metrics.GeoLocation](cacheSize, func(ip types.IPAddr) uint64 {
+			return maphash.Bytes(seed, ip[:])
+		})
+	}
+	return g
+}
+
+// locate is the metrics.Locator of the collector
+func (g *geoLocator) locate(ip types.IPAddr) metrics.GeoLocation {
+	if utils.IsLocalAddr(ip.Addr()) {
+		return metrics.GeoLocation{Country: LocalNetworkLabel, City: LocalNetworkLabel}
+	}
+	if g.cache != nil {
+		if location, ok := g.cache.Get(ip); ok {
+			return location
+		}
+	}
+	location := g.lookup(ip)
+	// addresses missing from the database are cached too
+	if g.cache != nil {
+		g.cache.Add(ip, location)
+	}
+	return location
+}
+
+func (g *geoLocator) lookup(ip types.IPAddr) metrics.GeoLocation {
+	var location metrics.GeoLocation
+	record, err := g.db.City(net.IP(ip.Addr().AsSlice()))
+	if err != nil || record.Country.GeoNameID == 0 {
+		return location
+	}
+	location.Country = localizedName(record.Country.Names)
+	location.City = localizedName(record.City.Names)
+	return location
+}
+
+// names handed out by localizedName, bounded by the names in the database
+var geoNames sync.Map
+
+// localizedName prefers the chinese name, the strings are interned as every
+// source of a city would otherwise hold its own copy of the name
+func localizedName(names map[string]string) string {
+	name := names["zh-CN"]
+	if name == "" {
+		name = names["en"]
+	}
+	if name == "" {
+		return ""
+	}
+	interned, _ := geoNames.LoadOrStore(name, name)
+	return interned.(string)
+}
@@ -3,7 +3,7 @@ package processor
 import (
 	"fmt"
 	"log"
-	"net"
+	"net/netip"
 	"os"
 	"path/filepath"
 	"sync"
@@ -39,6 +39,9 @@ type Processor struct {
 	config           atomic.Value
 	windowStates     sync.Map
 	done             chan struct{}
+	// blocklist rules, ruleMu serializes changes to them and the kernel
+	rules  *ruleStore
+	ruleMu sync.Mutex
 }
 
 func NewProcessor(pool *utils.ElasticPool[*types.PacketInfo], ebpfManager *ebpf.EBPFManager, collector *metrics.MetricsCollector) (*Processor, error) {
@@ -65,10 +68,37 @@ func NewProcessor(pool *utils.ElasticPool[*types.PacketInfo], ebpfManager *ebpf.
 	if err := p.loadConfig(); err != nil {
 		return nil, err
 	}
+	if geoipDB != nil {
+		collector.SetLocator(newGeoLocator(geoipDB, systemConfig.GeoIPCacheSize).locate)
+	}
 
+	// the kernel blocklist is rebuilt from the saved rules whenever eBPF starts
+	ebpfManager.SetRuleSource(p.activeRules)
+	if intel := p.getConfig().ThreatIntel; intel.KernelDrop {
+		// indicators are matched by xdp_prog and reported as MatchByIntel
+		p.threatAggregator.SetIndicatorSink(p.loadKernelIntel)
+		if intel.KernelThreshold {
+			if err := ebpfManager.SetIntelThreshold(uint32(max(intel.MatchThreshold, 0)), intel.MatchWindow); err != nil {
+				return nil, err
+			}
+			go p.offenderRoutine()
+		} else if err := ebpfManager.SetIntelDrop(true); err != nil {
+			return nil, err
+		}
+	}
 	if err := p.threatAggregator.Initialize(p.getConfig().ThreatIntel.Feeds); err != nil {
 		return nil, err
 	}
+	// compiled even without blocked networks, the pinned geo tries of a previous config are cleared
+	geo := p.getConfig().GeoBlock
+	cityPath, asnPath := systemConfig.GeoIPPath, systemConfig.GeoIPASNPath
+	if cityPath != "" {
+		cityPath = filepath.Join(dir, cityPath)
+	}
+	if asnPath != "" {
+		asnPath = filepath.Join(dir, asnPath)
+	}
+	go p.geoBlockRoutine(newGeoBlocker(cityPath, asnPath, geo.Countries, geo.ASNs, ebpfManager.UpdateGeo))
 	p.pool.SetProcessor(p.processPackets)
 	go p.cleanupRoutine()
 	return p, nil
@@ -101,7 +131,10 @@ func loadGeoip(path string) *geoip2.Reader {
 
 func (p *Processor) Close() error {
 	close(p.done)
-	p.saveConfig()
+	if err := p.saveConfig(); err != nil {
+		log.Printf("Failed to save processor config: %v", err)
+	}
+	p.rules.close()
 	p.threatAggregator.Close()
 	if p.geoipDB != nil {
 		p.geoipDB.Close()
@@ -111,71 +144,77 @@ func (p *Processor) Close() error {
 
 func (p *Processor) processPackets(pi *types.PacketInfo) {
 	packet := p.createPacket(pi)
-	p.collector.CollectPacket(packet)
+	// everything needed has been copied out, the record goes back to the pool
+	types.ReleasePacketInfo(pi)
+	p.collector.CollectPacket(&packet)
 
 	if packet.MatchType != types.NoMatch {
 		// drop the packet if it's not a normal packet
 		return
 	}
 
-	if packet.SrcIP != "" {
-		srcIP := packet.SrcIP
+	if !packet.SrcIP.IsZero() {
 		config := p.getConfig()
-		isLocalAndIgnored := config.ThreatIntel.IgnoreLocalNetwork && utils.IsLocalIP(srcIP)
-		if !isLocalAndIgnored && p.threatAggregator.Contains(srcIP) {
-			p.handleThreatIntelMatch(srcIP)
+		if config.ThreatIntel.KernelDrop {
+			// matching sources were already dropped in the kernel
+			return
+		}
+		isLocalAndIgnored := config.ThreatIntel.IgnoreLocalNetwork && utils.IsLocalAddr(packet.SrcIP.Addr())
+		if isLocalAndIgnored {
+			return
+		}
+		if p.threatAggregator.ContainsAddr(packet.SrcIP.Addr()) {
+			p.handleThreatIntelMatch(packet.SrcIP.String(), packet.Count)
 			return
 		}
 	}
 }
 
-func (p *Processor) createPacket(pi *types.PacketInfo) *types.Packet {
-	var srcIP, dstIP string
-	if pi.EthProto == types.EthernetType(0x0800) { // IPv4
-		srcIP = net.IP(pi.SrcIP[:]).String()
-		dstIP = net.IP(pi.DstIP[:]).String()
-	} else if pi.EthProto == types.EthernetType(0x86DD) { // IPv6
-		srcIP = net.IP(pi.SrcIPv6[:]).String()
-		dstIP = net.IP(pi.DstIPv6[:]).String()
+// loadKernelIntel hands the aggregated threat intelligence indicators to the kernel tries
+func (p *Processor) loadKernelIntel(prefixes []netip.Prefix) error {
+	if p.getConfig().ThreatIntel.IgnoreLocalNetwork {
+		filtered := prefixes[:0]
+		for _, prefix := range prefixes {
+			if !utils.IsLocalAddr(prefix.Addr()) {
+				filtered = append(filtered, prefix)
+			}
+		}
+		prefixes = filtered
 	}
-	packet := &types.Packet{
+	return p.ebpfManager.ReplaceIntel(prefixes)
+}
+
+// createPacket converts the kernel record to a packet, addresses stay in binary
+// form and the collector locates a source when it first sees it
+func (p *Processor) createPacket(pi *types.PacketInfo) types.Packet {
+	count := pi.PktCount
+	if count == 0 {
+		count = 1
+	}
+	packet := types.Packet{
 		Timestamp: time.Now().Unix(),
-		SrcMAC:    net.HardwareAddr(pi.SrcMAC[:]).String(),
-		DstMAC:    net.HardwareAddr(pi.DstMAC[:]).String(),
-		SrcIP:     srcIP,
-		DstIP:     dstIP,
+		SrcMAC:    pi.SrcMAC,
+		DstMAC:    pi.DstMAC,
 		SrcPort:   pi.SrcPort,
 		DstPort:   pi.DstPort,
 		Size:      pi.PktSize,
+		Count:     count,
 		EthType:   pi.EthProto,
 		IPProto:   pi.IPProto,
 		MatchType: pi.MatchType,
 	}
-
-	if packet.SrcIP != "" && p.geoipDB != nil {
-		if utils.IsLocalIP(packet.SrcIP) {
-			packet.Country = LocalNetworkLabel
-			packet.City = LocalNetworkLabel
-			return packet
-		}
-		record, err := p.geoipDB.City(net.ParseIP(packet.SrcIP))
-		if err == nil && record.Country.GeoNameID != 0 {
-			if country, ok := record.Country.Names["zh-CN"]; ok && country != "" {
-				packet.Country = country
-			} else {
-				packet.Country = record.Country.Names["en"]
-			}
-			if city, ok := record.City.Names["zh-CN"]; ok && city != "" {
-				packet.City = city
-			} else {
-				packet.City = record.City.Names["en"]
-			}
-		}
+	if pi.EthProto == types.EthernetType(0x0800) { // IPv4
+		packet.SrcIP = types.IPv4Addr(pi.SrcIP)
+		packet.DstIP = types.IPv4Addr(pi.DstIP)
+	} else if pi.EthProto == types.EthernetType(0x86DD) { // IPv6
+		packet.SrcIP = types.IPAddr(pi.SrcIPv6)
+		packet.DstIP = types.IPAddr(pi.DstIPv6)
 	}
 	return packet
 }
 
-func (p *Processor) handleThreatIntelMatch(srcIP string) {
+// handleThreatIntelMatch records count matches of srcIP against the threat intelligence feeds
+func (p *Processor) handleThreatIntelMatch(srcIP string, count uint32) {
 	config := p.getConfig()
 	enable := config.ThreatIntel.MatchMode == MatchActionModeBlock
 	if config.ThreatIntel.MatchMode == MatchActionModeThreshold {
@@ -188,16 +227,16 @@ func (p *Processor) handleThreatIntelMatch(srcIP string) {
 			state = val.(*WindowState)
 			if now-state.FirstTime > int64(window) {
 				state = &WindowState{
-					Count:     1,
+					Count:     int32(count),
 					FirstTime: now,
 				}
 				p.windowStates.Store(srcIP, state)
 			} else {
-				atomic.AddInt32(&state.Count, 1)
+				atomic.AddInt32(&state.Count, int32(count))
 			}
 		} else {
 			state = &WindowState{
-				Count:     1,
+				Count:     int32(count),
 				FirstTime: now,
 			}
 			p.windowStates.Store(srcIP, state)
@@ -209,6 +248,16 @@ func (p *Processor) handleThreatIntelMatch(srcIP string) {
 			return
 		}
 	}
+	p.blockIntelSource(srcIP, enable)
+}
+
+// blockIntelSource adds the blocklist rule of a source that matched threat intelligence
+func (p *Processor) blockIntelSource(srcIP string, enable bool) {
+	// a source keeps matching until its rule is active, every match must not add another rule
+	if p.rules.hasValue(srcIP, "", enable, time.Now().Unix()) {
+		return
+	}
+	config := p.getConfig()
 	expireTime := int64(0)
 	if config.ThreatIntel.BlockDuration > 0 {
 		expireTime = time.Now().Add(time.Duration(config.ThreatIntel.BlockDuration) * time.Second).Unix()
@@ -225,22 +274,81 @@ func (p *Processor) handleThreatIntelMatch(srcIP string) {
 	}
 }
 
+// drainOffenders persists the sources the kernel rate limiter dropped, the
+// blocklist rule keeps them dropped once the kernel forgot them
+func (p *Processor) drainOffenders() {
+	offenders, err := p.ebpfManager.DrainOffenders()
+	if err != nil {
+		log.Printf("Failed to drain rate limited sources: %v", err)
+	}
+	for _, offender := range offenders {
+		p.blockIntelSource(offender.Addr.String(), true)
+	}
+}
+
+func (p *Processor) offenderRoutine() {
+	ticker := time.NewTicker(offenderDrainInterval)
+	defer ticker.Stop()
+	for {
+		select {
+		case <-p.done:
+			return
+		case <-ticker.C:
+			p.drainOffenders()
+		}
+	}
+}
+
 func (p *Processor) updateBlockRuleToKernel(rule *BlockRule) error {
 	if !rule.Enabled {
 		return nil
 	}
 
-	if rule.ExpireTime > 0 && rule.ExpireTime <= time.Now().Unix() {
+	now := time.Now().Unix()
+	if rule.ExpireTime > 0 && rule.ExpireTime <= now {
 		rule.Enabled = false
 		return nil
 	}
 
-	if err := p.ebpfManager.AddRule(rule.Value); err != nil {
+	// the kernel drops the value until the last of its rules expires
+	expireTime := rule.ExpireTime
+	if other, ok := p.rules.activeExpiry(rule.Value, rule.ID, now); ok && expireTime != 0 {
+		expireTime = max(expireTime, other)
+		if other == 0 {
+			expireTime = 0
+		}
+	}
+	if err := p.ebpfManager.AddRule(rule.Value, expireTime); err != nil {
 		return err
 	}
 	return nil
 }
 
+// activeRules returns the enabled rules that have not expired, the kernel
+// removes them once they expire
+func (p *Processor) activeRules() []ebpf.Rule {
+	now := time.Now().Unix()
+	var rules []ebpf.Rule
+	p.rules.each(func(rule *BlockRule) {
+		if rule.Enabled && (rule.ExpireTime == 0 || rule.ExpireTime > now) {
+			rules = append(rules, ebpf.Rule{Value: rule.Value, ExpireTime: rule.ExpireTime})
+		}
+	})
+	return rules
+}
+
+// removeRuleFromKernel deletes the value of rule from the kernel unless
+// another active rule still blocks it, the value then expires with that rule
+func (p *Processor) removeRuleFromKernel(rule BlockRule, now int64) error {
+	if !rule.Enabled {
+		return nil
+	}
+	if expireTime, ok := p.rules.activeExpiry(rule.Value, rule.ID, now); ok {
+		return p.ebpfManager.AddRule(rule.Value, expireTime)
+	}
+	return p.ebpfManager.DeleteRule(rule.Value)
+}
+
 func (p *Processor) cleanupWindowStates() {
 	now := time.Now().Unix()
 	window := p.getConfig().ThreatIntel.MatchWindow
@@ -254,26 +362,27 @@ func (p *Processor) cleanupWindowStates() {
 	})
 }
 
+// cleanupBlockRules removes the rules that are due, the rules are taken from
+// the expiry heap so rules that are not due are never visited
 func (p *Processor) cleanupBlockRules() {
 	now := time.Now().Unix()
-
-	p.updateConfig(func(config *ProcessorConfig) error {
-		rules := config.Blocklist.Rules
-		for i := len(rules) - 1; i >= 0; i-- {
-			rule := &rules[i]
-			if rule.ExpireTime > 0 && rule.ExpireTime <= now {
-				if rule.Enabled {
-					if err := p.ebpfManager.DeleteRule(rule.Value); err != nil {
-						log.Printf("Failed to remove expired rule from kernel: %v", err)
-						continue
-					}
-				}
-				rules = append(rules[:i], rules[i+1:]...)
-			}
+	p.ruleMu.Lock()
+	defer p.ruleMu.Unlock()
+	for _, rule := range p.rules.expired(now) {
+		if err := p.removeRuleFromKernel(rule, now); err != nil {
+			log.Printf("Failed to remove expired rule from kernel: %v", err)
+			p.rules.retry(rule)
+			continue
 		}
-		config.Blocklist.Rules = rules
-		return nil
-	})
+		if _, _, err := p.rules.remove(rule.ID); err != nil {
+			log.Printf("Failed to journal block rule: %v", err)
+		}
+	}
+	if p.rules.needsCompaction() {
+		if err := p.saveConfig(); err != nil {
+			log.Printf("Failed to compact rule journal: %v", err)
+		}
+	}
 }
 
 func (p *Processor) cleanupRoutine() {
@@ -297,70 +406,73 @@ func (p *Processor) GetBlockRules(page, pageSize int) ([]BlockRule, int, error)
 	if pageSize < 1 {
 		pageSize = 20
 	}
-	config := p.getConfig()
-	total := len(config.Blocklist.Rules)
-	start := (page - 1) * pageSize
-	if start >= total {
-		return []BlockRule{}, total, nil
-	}
-
-	end := start + pageSize
-	if end > total {
-		end = total
-	}
-
-	return config.Blocklist.Rules[start:end], total, nil
+	rules, total := p.rules.page(page, pageSize)
+	return rules, total, nil
 }
 
 func (p *Processor) AddBlockRule(rule *BlockRule) error {
 	rule.ID = utils.GenerateUUID()
-	if err := p.updateConfig(func(config *ProcessorConfig) error {
-		if err := p.updateBlockRuleToKernel(rule); err != nil {
-			return fmt.Errorf("failed to update block rule to kernel: %v", err)
-		}
-		config.Blocklist.Rules = append(config.Blocklist.Rules, *rule)
-		return nil
-	}); err != nil {
-		return err
+	p.ruleMu.Lock()
+	defer p.ruleMu.Unlock()
+	if err := p.updateBlockRuleToKernel(rule); err != nil {
+		return fmt.Errorf("failed to update block rule to kernel: %v", err)
+	}
+	if err := p.rules.add(*rule); err != nil {
+		log.Printf("Failed to journal block rule: %v", err)
 	}
-
 	return nil
 }
 
 func (p *Processor) UpdateBlockRule(id string, rule BlockRule) error {
-	return p.updateConfig(func(config *ProcessorConfig) error {
-		for i := range config.Blocklist.Rules {
-			if config.Blocklist.Rules[i].ID == id {
-				oldEnabled := config.Blocklist.Rules[i].Enabled
-				config.Blocklist.Rules[i] = rule
-				if oldEnabled != rule.Enabled {
-					if rule.Enabled {
-						if err := p.updateBlockRuleToKernel(&rule); err != nil {
-							return err
-						}
-					} else {
-						if err := p.ebpfManager.DeleteRule(rule.Value); err != nil {
-							return err
-						}
-					}
-				}
-				return nil
+	p.ruleMu.Lock()
+	defer p.ruleMu.Unlock()
+	old, ok := p.rules.get(id)
+	if !ok {
+		return fmt.Errorf("rule not found: %s", id)
+	}
+	rule.ID = id
+	if old.Enabled && (!rule.Enabled || old.Value != rule.Value) {
+		if err := p.removeRuleFromKernel(old, time.Now().Unix()); err != nil {
+			return err
+		}
+	}
+	if rule.Enabled && (!old.Enabled || old.Value != rule.Value) {
+		if err := p.updateBlockRuleToKernel(&rule); err != nil {
+			return err
+		}
+	}
+	if rule.Enabled && old.Enabled && old.Value == rule.Value && old.ExpireTime != rule.ExpireTime {
+		// the kernel expires the value by itself, it has to see the new expiry
+		if err := p.updateBlockRuleToKernel(&rule); err != nil {
+			return err
+		}
+		if !rule.Enabled {
+			// moved into the past, the old expiry is still in the kernel
+			if err := p.removeRuleFromKernel(old, time.Now().Unix()); err != nil {
+				return err
 			}
 		}
-		return fmt.Errorf("rule not found: %s", id)
-	})
+	}
+	if err := p.rules.add(rule); err != nil {
+		log.Printf("Failed to journal block rule: %v", err)
+	}
+	return nil
 }
 
 func (p *Processor) DeleteBlockRule(id string) error {
-	return p.updateConfig(func(config *ProcessorConfig) error {
-		for i := range config.Blocklist.Rules {
-			if config.Blocklist.Rules[i].ID == id {
-				config.Blocklist.Rules = append(config.Blocklist.Rules[:i], config.Blocklist.Rules[i+1:]...)
-				return nil
-			}
-		}
+	p.ruleMu.Lock()
+	defer p.ruleMu.Unlock()
+	rule, ok := p.rules.get(id)
+	if !ok {
 		return fmt.Errorf("rule not found: %s", id)
-	})
+	}
+	if err := p.removeRuleFromKernel(rule, time.Now().Unix()); err != nil {
+		return err
+	}
+	if _, _, err := p.rules.remove(id); err != nil {
+		log.Printf("Failed to journal block rule: %v", err)
+	}
+	return nil
 }
 
 func (p *Processor) GetThreatIntelAggregator() *threatintel.Aggregator {
@@ -0,0 +1,389 @@
+package processor
+
+import (
+	"bufio"
+	"container/heap"
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"sync"
+)
+
+const (
+	defaultJournalFile = "processor.journal"
+	// journal records always tolerated before the journal is folded into processor.json
+	minJournalCompaction = 4096
+)
+
+// journalRecord is one line of the rule journal, a put replaces the rule
+// with the same ID
+type journalRecord struct {
+	Op   string     `json:"op"`
+	Rule *BlockRule `json:"rule,omitempty"`
+	ID   string     `json:"id,omitempty"`
+}
+
+const (
+	journalPut    = "put"
+	journalDelete = "delete"
+)
+
+// expiry is a pending expiry of a rule, stale when the rule was deleted or
+// its expire time changed since it was pushed
+type expiry struct {
+	at int64
+	id string
+}
+
+type expiryHeap []expiry
+
+func (h expiryHeap) Len() int           { return len(h) }
+func (h expiryHeap) Less(i, j int) bool { return h[i].at < h[j].at }
+func (h expiryHeap) Swap(i, j int)      { h[i], h[j] = h[j], h[i] }
+func (h *expiryHeap) Push(x any)        { *h = append(*h, x.(expiry)) }
+func (h *expiryHeap) Pop() any {
+	old := *h
+	e := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return e
+}
+
+// ruleStore holds the blocklist rules indexed by ID and by value. Rules keep
+// their insertion order for paging, deleted rules leave a hole that is
+// compacted away once holes make up half of the slice. Every change is
+// appended to a journal, processor.json holds the rules as of the last
+// compaction.
+type ruleStore struct {
+	mu      sync.RWMutex
+	rules   []*BlockRule
+	holes   int
+	byID    map[string]int
+	byValue map[string][]string
+	expiry  expiryHeap
+	journal *os.File
+	// records written to the journal since the last compaction
+	journaled int
+}
+
+func newRuleStore(rules []BlockRule) *ruleStore {
+	s := &ruleStore{
+		rules:   make([]*BlockRule, 0, len(rules)),
+		byID:    make(map[string]int, len(rules)),
+		byValue: make(map[string][]string, len(rules)),
+	}
+	for i := range rules {
+		s.put(rules[i])
+	}
+	return s
+}
+
+// openJournal replays the journal at path and keeps it open for appending
+func (s *ruleStore) openJournal(path string) error {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	f, err := os.OpenFile(path, os.O_RDWR|os.O_CREATE, 0644)
+	if err != nil {
+		return fmt.Errorf("failed to open rule journal: %v", err)
+	}
+	// end of the last complete record
+	var size int64
+	scanner := bufio.NewScanner(f)
+	scanner.Buffer(make([]byte, 64*1024), 16*1024*1024)
+	for scanner.Scan() {
+		var record journalRecord
+		// a record cut short by a crash ends the journal
+		if err := json.Unmarshal(scanner.Bytes(), &record); err != nil {
+			break
+		}
+		switch {
+		case record.Op == journalPut && record.Rule != nil:
+			s.put(*record.Rule)
+		case record.Op == journalDelete:
+			s.delete(record.ID)
+		}
+		s.journaled++
+		size += int64(len(scanner.Bytes())) + 1
+	}
+	// the records appended next must not follow a partial one
+	if err := f.Truncate(size); err != nil {
+		f.Close()
+		return fmt.Errorf("failed to truncate rule journal: %v", err)
+	}
+	if _, err := f.Seek(size, io.SeekStart); err != nil {
+		f.Close()
+		return fmt.Errorf("failed to seek rule journal: %v", err)
+	}
+	s.journal = f
+	return nil
+}
+
+// append writes one record to the journal, a failed write only costs the
+// record if the process stops before the next compaction
+func (s *ruleStore) append(record journalRecord) error {
+	if s.journal == nil {
+		return nil
+	}
+	data, err := json.Marshal(record)
+	if err != nil {
+		return err
+	}
+	s.journaled++
+	if _, err := s.journal.Write(append(data, '\n')); err != nil {
+		return fmt.Errorf("failed to write rule journal: %v", err)
+	}
+	return nil
+}
+
+// put inserts or replaces a rule, the caller holds mu
+func (s *ruleStore) put(rule BlockRule) {
+	expires := rule.ExpireTime > 0
+	if i, ok := s.byID[rule.ID]; ok {
+		old := s.rules[i]
+		if old.Value != rule.Value {
+			s.unindexValue(old.Value, old.ID)
+			s.byValue[rule.Value] = append(s.byValue[rule.Value], rule.ID)
+		}
+		// the pending expiry of the old rule still matches
+		expires = expires && old.ExpireTime != rule.ExpireTime
+		*old = rule
+	} else {
+		s.byID[rule.ID] = len(s.rules)
+		s.rules = append(s.rules, &rule)
+		s.byValue[rule.Value] = append(s.byValue[rule.Value], rule.ID)
+	}
+	if expires {
+		heap.Push(&s.expiry, expiry{at: rule.ExpireTime, id: rule.ID})
+	}
+}
+
+// delete removes a rule, the caller holds mu
+func (s *ruleStore) delete(id string) (BlockRule, bool) {
+	i, ok := s.byID[id]
+	if !ok {
+		return BlockRule{}, false
+	}
+	rule := *s.rules[i]
+	delete(s.byID, id)
+	s.unindexValue(rule.Value, id)
+	s.rules[i] = nil
+	s.holes++
+	if s.holes > len(s.rules)/2 {
+		s.compact()
+	}
+	return rule, true
+}
+
+func (s *ruleStore) unindexValue(value, id string) {
+	ids := s.byValue[value]
+	for i := range ids {
+		if ids[i] == id {
+			ids[i] = ids[len(ids)-1]
+			ids = ids[:len(ids)-1]
+			break
+		}
+	}
+	if len(ids) == 0 {
+		delete(s.byValue, value)
+	} else {
+		s.byValue[value] = ids
+	}
+}
+
+// compact closes the holes of deleted rules, the caller holds mu
+func (s *ruleStore) compact() {
+	live := s.rules[:0]
+	for _, rule := range s.rules {
+		if rule != nil {
+			s.byID[rule.ID] = len(live)
+			live = append(live, rule)
+		}
+	}
+	clear(s.rules[len(live):])
+	s.rules = live
+	s.holes = 0
+	// drop the stale expiries with the holes, they would otherwise pile up
+	// with every rule that was deleted before it expired
+	if len(s.expiry) > 2*len(s.rules) {
+		pending := s.expiry[:0]
+		for _, e := range s.expiry {
+			if i, ok := s.byID[e.id]; ok && s.rules[i].ExpireTime == e.at {
+				pending = append(pending, e)
+			}
+		}
+		s.expiry = pending
+		heap.Init(&s.expiry)
+	}
+}
+
+func (s *ruleStore) get(id string) (BlockRule, bool) {
+	s.mu.RLock()
+	defer s.mu.RUnlock()
+	if i, ok := s.byID[id]; ok {
+		return *s.rules[i], true
+	}
+	return BlockRule{}, false
+}
+
+// add stores a new rule or replaces the rule with the same ID
+func (s *ruleStore) add(rule BlockRule) error {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	s.put(rule)
+	return s.append(journalRecord{Op: journalPut, Rule: &rule})
+}
+
+func (s *ruleStore) remove(id string) (BlockRule, bool, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	rule, ok := s.delete(id)
+	if !ok {
+		return rule, false, nil
+	}
+	return rule, true, s.append(journalRecord{Op: journalDelete, ID: id})
+}
+
+// hasValue reports whether a rule other than except blocks value, only
+// enabled rules that have not expired at now count when active is set
+func (s *ruleStore) hasValue(value, except string, active bool, now int64) bool {
+	s.mu.RLock()
+	defer s.mu.RUnlock()
+	for _, id := range s.byValue[value] {
+		if id == except {
+			continue
+		}
+		rule := s.rules[s.byID[id]]
+		if !active || rule.Enabled && (rule.ExpireTime == 0 || rule.ExpireTime > now) {
+			return true
+		}
+	}
+	return false
+}
+
+// activeExpiry returns the expire time the kernel entry of value needs for
+// the enabled rules other than except that have not expired at now, zero if
+// one of them never expires. ok is false without such a rule.
+func (s *ruleStore) activeExpiry(value, except string, now int64) (expireTime int64, ok bool) {
+	s.mu.RLock()
+	defer s.mu.RUnlock()
+	for _, id := range s.byValue[value] {
+		rule := s.rules[s.byID[id]]
+		if id == except || !rule.Enabled || rule.ExpireTime != 0 && rule.ExpireTime <= now {
+			continue
+		}
+		if rule.ExpireTime == 0 {
+			return 0, true
+		}
+		expireTime, ok = max(expireTime, rule.ExpireTime), true
+	}
+	return expireTime, ok
+}
+
+// expired pops the rules whose expire time is at or before now, they stay
+// in the store until they are removed
+func (s *ruleStore) expired(now int64) []BlockRule {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	var due []BlockRule
+	var seen map[string]struct{}
+	for len(s.expiry) > 0 && s.expiry[0].at <= now {
+		e := heap.Pop(&s.expiry).(expiry)
+		i, ok := s.byID[e.id]
+		if !ok || s.rules[i].ExpireTime != e.at {
+			continue
+		}
+		// a rule whose expire time was changed back has two entries
+		if _, dup := seen[e.id]; dup {
+			continue
+		}
+		if seen == nil {
+			seen = make(map[string]struct{})
+		}
+		seen[e.id] = struct{}{}
+		due = append(due, *s.rules[i])
+	}
+	return due
+}
+
+// retry queues an expired rule that could not be removed for the next cleanup
+func (s *ruleStore) retry(rule BlockRule) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	heap.Push(&s.expiry, expiry{at: rule.ExpireTime, id: rule.ID})
+}
+
+// page returns the rules of a page in insertion order and the number of rules
+func (s *ruleStore) page(page, pageSize int) ([]BlockRule, int) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.holes > 0 {
+		s.compact()
+	}
+	total := len(s.rules)
+	start := (page - 1) * pageSize
+	if start >= total {
+		return []BlockRule{}, total
+	}
+	end := min(start+pageSize, total)
+	rules := make([]BlockRule, 0, end-start)
+	for _, rule := range s.rules[start:end] {
+		rules = append(rules, *rule)
+	}
+	return rules, total
+}
+
+// each calls fn with every rule in insertion order, fn must not call the store
+func (s *ruleStore) each(fn func(rule *BlockRule)) {
+	s.mu.RLock()
+	defer s.mu.RUnlock()
+	for _, rule := range s.rules {
+		if rule != nil {
+			fn(rule)
+		}
+	}
+}
+
+// needsCompaction reports whether the journal grew past the rules it describes
+func (s *ruleStore) needsCompaction() bool {
+	s.mu.RLock()
+	defer s.mu.RUnlock()
+	return s.journaled > max(2*len(s.byID), minJournalCompaction)
+}
+
+// compactJournal folds the journal into processor.json, save writes the
+// rules it is given. Changes are held off until the journal is truncated.
+func (s *ruleStore) compactJournal(save func(rules []BlockRule) error) error {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	rules := make([]BlockRule, 0, len(s.byID))
+	for _, rule := range s.rules {
+		if rule != nil {
+			rules = append(rules, *rule)
+		}
+	}
+	if err := save(rules); err != nil {
+		return err
+	}
+	if s.journal == nil {
+		return nil
+	}
+	if err := s.journal.Truncate(0); err != nil {
+		return fmt.Errorf("failed to truncate rule journal: %v", err)
+	}
+	if _, err := s.journal.Seek(0, io.SeekStart); err != nil {
+		return fmt.Errorf("failed to seek rule journal: %v", err)
+	}
+	s.journaled = 0
+	return nil
+}
+
+func (s *ruleStore) close() error {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.journal == nil {
+		return nil
+	}
+	err := s.journal.Close()
+	s.journal = nil
+	return err
+}
@@ -0,0 +1,104 @@
+package processor
+
+import (
+	"fmt"
+	"os"
+	"path/filepath"
+	"testing"
+)
+
+func TestRuleStore_IndexAndPage(t *testing.T) {
+	s := newRuleStore(nil)
+	for i := 0; i < 10; i++ {
+		s.add(BlockRule{ID: fmt.Sprint(i), Value: fmt.Sprintf("10.0.0.%d", i%5), Enabled: true})
+	}
+	for i := 0; i < 10; i += 2 {
+		if _, ok, _ := s.remove(fmt.Sprint(i)); !ok {
+			t.Fatalf("remove(%d) found nothing", i)
+		}
+	}
+	rules, total := s.page(2, 3)
+	if total != 5 || len(rules) != 2 || rules[0].ID != "7" || rules[1].ID != "9" {
+		t.Fatalf("page(2, 3) = %+v, %d", rules, total)
+	}
+	if rule, ok := s.get("3"); !ok || rule.Value != "10.0.0.3" {
+		t.Errorf("get(3) = %+v, %v", rule, ok)
+	}
+	// 10.0.0.1 is blocked by rules 1 and 6, 6 was removed
+	if s.hasValue("10.0.0.1", "1", false, 0) {
+		t.Error("hasValue found a removed rule")
+	}
+	if !s.hasValue("10.0.0.2", "", true, 0) {
+		t.Error("hasValue missed rule 7")
+	}
+}
+
+func TestRuleStore_Expired(t *testing.T) {
+	s := newRuleStore([]BlockRule{
+		{ID: "a", ExpireTime: 100},
+		{ID: "b", ExpireTime: 200},
+		{ID: "c"},
+	})
+	// moved and moved back, the rule is due once
+	s.add(BlockRule{ID: "a", ExpireTime: 300})
+	s.add(BlockRule{ID: "a", ExpireTime: 100})
+	s.remove("b")
+	due := s.expired(250)
+	if len(due) != 1 || due[0].ID != "a" {
+		t.Fatalf("expired(250) = %+v", due)
+	}
+	if again := s.expired(250); len(again) != 0 {
+		t.Fatalf("expired(250) again = %+v", again)
+	}
+	s.retry(due[0])
+	if again := s.expired(250); len(again) != 1 {
+		t.Fatalf("expired(250) after retry = %+v", again)
+	}
+}
+
+func TestRuleStore_Journal(t *testing.T) {
+	path := filepath.Join(t.TempDir(), defaultJournalFile)
+	s := newRuleStore([]BlockRule{{ID: "a", Value: "10.0.0.1"}})
+	if err := s.openJournal(path); err != nil {
+		t.Fatal(err)
+	}
+	s.add(BlockRule{ID: "b", Value: "10.0.0.2"})
+	s.add(BlockRule{ID: "a", Value: "10.0.0.3"})
+	s.remove("b")
+	s.close()
+	// a record cut short ends the replay
+	f, _ := os.OpenFile(path, os.O_WRONLY|os.O_APPEND, 0644)
+	f.WriteString(`{"op":"delete","id":"a"`)
+	f.Close()
+
+	replayed := newRuleStore([]BlockRule{{ID: "a", Value: "10.0.0.1"}})
+	if err := replayed.openJournal(path); err != nil {
+		t.Fatal(err)
+	}
+	defer replayed.close()
+	rules, total := replayed.page(1, 10)
+	if total != 1 || rules[0].Value != "10.0.0.3" {
+		t.Fatalf("replayed rules = %+v", rules)
+	}
+	// appended after the cut record was dropped
+	replayed.add(BlockRule{ID: "c", Value: "10.0.0.4"})
+	replayed.close()
+	replayed = newRuleStore(nil)
+	if err := replayed.openJournal(path); err != nil {
+		t.Fatal(err)
+	}
+	if _, total := replayed.page(1, 10); total != 2 {
+		t.Fatalf("replayed %d rules after the cut record, want 2", total)
+	}
+
+	var saved []BlockRule
+	if err := replayed.compactJournal(func(rules []BlockRule) error {
+		saved = rules
+		return nil
+	}); err != nil {
+		t.Fatal(err)
+	}
+	if info, _ := os.Stat(path); len(saved) != 2 || info.Size() != 0 {
+		t.Errorf("compaction saved %+v and left %d journal bytes", saved, info.Size())
+	}
+}
@@ -5,6 +5,7 @@ import (
 	"strconv"
 	"time"
 
+	"github.com/danger-dream/ebpf-firewall/internal/metrics"
 	"github.com/gofiber/fiber/v3"
 )
 
@@ -16,6 +17,33 @@ func (s *Server) GetLinkType(c fiber.Ctx) error {
 	return c.SendString(s.ebpf.GetLinkType())
 }
 
+func (s *Server) GetLinks(c fiber.Ctx) error {
+	return c.JSON(s.ebpf.GetLinks())
+}
+
+func (s *Server) GetEventStats(c fiber.Ctx) error {
+	return c.JSON(s.ebpf.GetEventStats())
+}
+
+func (s *Server) GetMapUsage(c fiber.Ctx) error {
+	return c.JSON(s.ebpf.GetMapUsage())
+}
+
+func (s *Server) GetSampleRate(c fiber.Ctx) error {
+	return c.JSON(fiber.Map{"sample_rate": s.ebpf.GetSampleRate()})
+}
+
+func (s *Server) SetSampleRate(c fiber.Ctx) error {
+	rate, err := strconv.ParseUint(c.Query("rate"), 10, 32)
+	if err != nil {
+		return c.SendStatus(fiber.StatusBadRequest)
+	}
+	if err := s.ebpf.SetSampleRate(uint32(rate)); err != nil {
+		return c.Status(fiber.StatusBadRequest).SendString(err.Error())
+	}
+	return c.SendStatus(fiber.StatusNoContent)
+}
+
 func (s *Server) GetMetricsReport(c fiber.Ctx) error {
 	topStr := c.Query("top", "10")
 	top, err := strconv.Atoi(topStr)
@@ -25,6 +53,18 @@ func (s *Server) GetMetricsReport(c fiber.Ctx) error {
 	return c.JSON(s.metrics.GenerateReport(top))
 }
 
+func (s *Server) GetTimeSeries(c fiber.Ctx) error {
+	resolution := c.Query("resolution", metrics.ResolutionSecond)
+	if resolution != metrics.ResolutionSecond && resolution != metrics.ResolutionMinute {
+		return c.SendStatus(fiber.StatusBadRequest)
+	}
+	limit, err := strconv.Atoi(c.Query("limit", "0"))
+	if err != nil || limit < 0 {
+		limit = 0
+	}
+	return c.JSON(s.metrics.GetTimeSeries(resolution, limit))
+}
+
 func (s *Server) GetSources(c fiber.Ctx) error {
 	page, err := strconv.Atoi(c.Query("page", "1"))
 	if err != nil {
@@ -0,0 +1,145 @@
+package server
+
+import (
+	"fmt"
+	"sort"
+	"strings"
+	"time"
+
+	"github.com/danger-dream/ebpf-firewall/internal/config"
+	"github.com/danger-dream/ebpf-firewall/internal/types"
+	"github.com/gofiber/fiber/v3"
+)
+
+const metricPrefix = "ebpf_firewall_"
+
+// label values of the dropped packet counter
+var matchTypeNames = map[types.MatchType]string{
+	types.MatchByIP4Exact: "ip4_exact",
+	types.MatchByIP4CIDR:  "ip4_cidr",
+	types.MatchByIP6Exact: "ip6_exact",
+	types.MatchByIP6CIDR:  "ip6_cidr",
+	types.MatchByMAC:      "mac",
+	types.MatchByIntel:    "intel",
+	types.MatchByTuple:    "tuple",
+	types.MatchByGeo:      "geo",
+}
+
+// promWriter writes the Prometheus text exposition format, a metric family
+// is announced once and then takes any number of samples
+type promWriter struct {
+	b strings.Builder
+}
+
+func (w *promWriter) family(name, kind, help string) {
+	fmt.Fprintf(&w.b, "# HELP %s%s %s\n# TYPE %s%s %s\n", metricPrefix, name, help, metricPrefix, name, kind)
+}
+
+// sample writes one value, labels are name/value pairs
+func (w *promWriter) sample(name string, value float64, labels ...string) {
+	w.b.WriteString(metricPrefix + name)
+	if len(labels) > 0 {
+		w.b.WriteByte('{')
+		for i := 0; i+1 < len(labels); i += 2 {
+			if i > 0 {
+				w.b.WriteByte(',')
+			}
+			fmt.Fprintf(&w.b, "%s=%q", labels[i], labels[i+1])
+		}
+		w.b.WriteByte('}')
+	}
+	fmt.Fprintf(&w.b, " %g\n", value)
+}
+
+func (w *promWriter) metric(name, kind, help string, value float64) {
+	w.family(name, kind, help)
+	w.sample(name, value)
+}
+
+func nsToSeconds(ns uint64) float64 {
+	return float64(ns) / float64(time.Second)
+}
+
+// authorizeScrape returns the status a scrape is refused with, StatusOK if it
+// is served. The API token is accepted as is or as a bearer token, the forms
+// Prometheus scrape configs send in the Authorization header. Sources are
+// blocked and rate limited like API clients and a wrong token is recorded.
+func (s *Server) authorizeScrape(c fiber.Ctx) int {
+	srcIP := requestIP(c)
+	if status := s.checkSource(srcIP); status != fiber.StatusOK {
+		return status
+	}
+	auth := config.GetConfig().Auth
+	if auth == "" {
+		return fiber.StatusOK
+	}
+	header := c.Get("Authorization")
+	if header != auth && header != "Bearer "+auth {
+		s.security.AddRecord(srcIP, "metrics auth failed: "+header)
+		return fiber.StatusUnauthorized
+	}
+	return fiber.StatusOK
+}
+
+// GetPrometheusMetrics exposes the kernel counters and the health of the
+// user space pipeline for Prometheus
+func (s *Server) GetPrometheusMetrics(c fiber.Ctx) error {
+	if status := s.authorizeScrape(c); status != fiber.StatusOK {
+		return c.SendStatus(status)
+	}
+	w := &promWriter{}
+
+	if kernel, err := s.ebpf.GetKernelStats(); err == nil {
+		w.metric("xdp_rx_packets_total", "counter", "Packets seen by the XDP program.", float64(kernel.RX))
+		w.metric("xdp_passed_packets_total", "counter", "Packets passed to the network stack.", float64(kernel.Pass))
+		w.metric("xdp_redirected_packets_total", "counter", "Packets redirected to an AF_XDP socket.", float64(kernel.Redirect))
+		w.family("xdp_dropped_packets_total", "counter", "Packets dropped by the XDP program by match type.")
+		matchTypes := make([]types.MatchType, 0, len(matchTypeNames))
+		for matchType := range matchTypeNames {
+			matchTypes = append(matchTypes, matchType)
+		}
+		sort.Slice(matchTypes, func(i, j int) bool { return matchTypes[i] < matchTypes[j] })
+		for _, matchType := range matchTypes {
+			w.sample("xdp_dropped_packets_total", float64(kernel.Drop[matchType]), "match", matchTypeNames[matchType])
+		}
+		w.metric("xdp_parse_errors_total", "counter", "Packets with a truncated ethernet or IP header.", float64(kernel.ParseErrors))
+		w.metric("xdp_export_failures_total", "counter", "Events the kernel could not hand to user space.", float64(kernel.ExportFailures))
+	}
+
+	events := s.ebpf.GetEventStats()
+	w.metric("events_received_total", "counter", "Events read from the kernel.", float64(events.Received))
+	w.metric("events_lost_total", "counter", "Events the perf buffers overwrote before they were read.", float64(events.Lost))
+	w.metric("events_decode_errors_total", "counter", "Events that could not be decoded.", float64(events.DecodeErrors))
+
+	pool := events.Pool
+	w.metric("pool_queue_depth", "gauge", "Events queued for the workers.", float64(pool.QueueDepth))
+	w.metric("pool_queue_capacity", "gauge", "Capacity of the worker queue.", float64(pool.QueueCapacity))
+	w.metric("pool_queue_high_water", "gauge", "Highest queue depth since start.", float64(pool.HighWater))
+	w.metric("pool_workers", "gauge", "Running workers.", float64(pool.Workers))
+	w.metric("pool_enqueued_total", "counter", "Events queued for the workers.", float64(pool.Enqueued))
+	w.metric("pool_dropped_total", "counter", "Events dropped by the overload policy.", float64(pool.Dropped))
+	w.metric("pool_sampled_total", "counter", "Events dropped by the sample policy before the queue was full.", float64(pool.Sampled))
+
+	lock := s.metrics.LockStats()
+	w.metric("collector_lock_waits_total", "counter", "Contended collector shard locks.", float64(lock.Waits))
+	w.metric("collector_lock_wait_seconds_total", "counter", "Time spent waiting for collector shard locks.", nsToSeconds(lock.WaitTimeNs))
+
+	rebuild := s.processor.GetThreatIntelAggregator().RebuildStats()
+	w.metric("intel_rebuilds_total", "counter", "Threat intel indicator table rebuilds.", float64(rebuild.Rebuilds))
+	w.metric("intel_rebuild_seconds_total", "counter", "Time spent rebuilding the indicator table.", nsToSeconds(rebuild.TotalTimeNs))
+	w.metric("intel_last_rebuild_seconds", "gauge", "Duration of the last indicator table rebuild.", nsToSeconds(uint64(rebuild.LastTimeNs)))
+	w.metric("intel_prefixes", "gauge", "Prefixes in the indicator table.", float64(rebuild.Prefixes))
+
+	usage := s.ebpf.GetMapUsage()
+	w.family("map_entries", "gauge", "Entries of the blocklist and rule maps.")
+	for _, u := range usage {
+		w.sample("map_entries", float64(u.Entries), "map", u.Name)
+	}
+	w.family("map_max_entries", "gauge", "Capacity of the blocklist and rule maps.")
+	for _, u := range usage {
+		w.sample("map_max_entries", float64(u.MaxEntries), "map", u.Name)
+	}
+
+	c.Set("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+	return c.SendString(w.b.String())
+}
@@ -53,7 +53,7 @@ func (s *Server) initServer() {
 		TimeZone:   "Asia/Shanghai",
 		TimeFormat: "2006-01-02 15:04:05",
 		Next: func(c fiber.Ctx) bool {
-			paths := []string{"/api/v1/metrics", "/api/v1/sources"}
+			paths := []string{"/api/v1/metrics", "/api/v1/sources", "/metrics"}
 			for _, path := range paths {
 				if strings.HasPrefix(c.Path(), path) {
 					return true
@@ -64,31 +64,47 @@ func (s *Server) initServer() {
 	}))
 }
 
-func (s *Server) setupRoutes() {
-	config := config.GetConfig()
-	api := s.app.Group("/api/v1", func(c fiber.Ctx) error {
-		// fiber ctx.IP() -> fasthttp ctx.RemoteIP()
-		// Get IP address from header
-		srcIP := c.Get("X-Real-IP")
-		if srcIP == "" {
-			forwardedFor := c.Get("X-Forwarded-For")
-			if forwardedFor != "" {
-				srcIP = strings.Split(forwardedFor, ",")[0]
-			}
+// requestIP returns the client address, the proxy headers take precedence
+func requestIP(c fiber.Ctx) string {
+	// fiber ctx.IP() -> fasthttp ctx.RemoteIP()
+	// Get IP address from header
+	srcIP := c.Get("X-Real-IP")
+	if srcIP == "" {
+		forwardedFor := c.Get("X-Forwarded-For")
+		if forwardedFor != "" {
+			srcIP = strings.Split(forwardedFor, ",")[0]
 		}
+	}
 
-		// If the IP address is not obtained from the header, use the IP address directly connected to the server
-		if srcIP == "" {
-			srcIP = c.IP()
+	// If the IP address is not obtained from the header, use the IP address directly connected to the server
+	if srcIP == "" {
+		srcIP = c.IP()
+	}
+	return srcIP
+}
+
+// checkSource returns the status a request of srcIP is refused with, StatusOK if it may go on
+func (s *Server) checkSource(srcIP string) int {
+	// If the IP address is not local, check if it is blocked or rate limited
+	if !utils.IsLocalIP(srcIP) {
+		if s.security.IsBlocked(srcIP) {
+			return fiber.StatusForbidden
 		}
-		// If the IP address is not local, check if it is blocked or rate limited
-		if !utils.IsLocalIP(srcIP) {
-			if s.security.IsBlocked(srcIP) {
-				return c.SendStatus(fiber.StatusForbidden)
-			}
-			if s.limiter.IsRateLimited(srcIP) {
-				return c.SendStatus(fiber.StatusTooManyRequests)
-			}
+		if s.limiter.IsRateLimited(srcIP) {
+			return fiber.StatusTooManyRequests
+		}
+	}
+	return fiber.StatusOK
+}
+
+func (s *Server) setupRoutes() {
+	config := config.GetConfig()
+	// scraped by Prometheus at the root path, it is guarded like the api group
+	s.app.Get("/metrics", s.GetPrometheusMetrics)
+	api := s.app.Group("/api/v1", func(c fiber.Ctx) error {
+		srcIP := requestIP(c)
+		if status := s.checkSource(srcIP); status != fiber.StatusOK {
+			return c.SendStatus(status)
 		}
 		if config.Auth == "" {
 			return c.Next()
@@ -106,8 +122,14 @@ func (s *Server) setupRoutes() {
 	})
 	api.Get("/ping", s.Ping)
 	api.Get("/link-type", s.GetLinkType)
+	api.Get("/links", s.GetLinks)
+	api.Get("/event-stats", s.GetEventStats)
+	api.Get("/map-usage", s.GetMapUsage)
+	api.Get("/sample-rate", s.GetSampleRate)
+	api.Post("/sample-rate", s.SetSampleRate)
 
 	api.Get("/metrics", s.GetMetricsReport)
+	api.Get("/metrics/timeseries", s.GetTimeSeries)
 	api.Get("/sources", s.GetSources)
 	api.Get("/:sourceId/targets", s.GetTargets)
 
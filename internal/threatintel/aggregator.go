@@ -1,20 +1,23 @@
 package threatintel
 
 import (
+	"bufio"
 	"errors"
 	"fmt"
 	"log"
+	"net/netip"
 	"os"
 	"path/filepath"
 	"strings"
 	"sync"
+	"sync/atomic"
+	"time"
 
 	"github.com/robfig/cron/v3"
 	"golang.org/x/exp/maps"
 
 	"github.com/danger-dream/ebpf-firewall/internal/threatintel/iptrie"
 	"github.com/danger-dream/ebpf-firewall/internal/threatintel/provider"
-	"github.com/danger-dream/ebpf-firewall/internal/utils"
 )
 
 type FeedMetadata struct {
@@ -29,7 +32,9 @@ type ThreatFeed interface {
 	Name() string
 	Description() string
 	Schedule() string
-	Fetch(params map[string]string) ([]string, error)
+	// Stream calls emit for every indicator of the sources that were read
+	// completely, a source is never emitted half read
+	Stream(params map[string]string, emit func(string)) error
 	DefaultParams() map[string]string
 }
 
@@ -37,10 +42,30 @@ type Aggregator struct {
 	dataDir  string
 	cron     *cron.Cron
 	entryIDs map[string]cron.EntryID
-	trie     *iptrie.IPTrie
+	// immutable snapshot swapped by aggregateIndicators, read without locking
+	table    atomic.Pointer[iptrie.Table]
 	feeds    map[string]ThreatFeed
 	metadata *sync.Map
-	mu       sync.RWMutex
+	// parsed indicators of each feed, so a rebuild only parses the feed that changed
+	indicators   map[string][]netip.Prefix
+	indicatorsMu sync.Mutex
+	// receives every aggregated indicator set, see SetIndicatorSink
+	sink func([]netip.Prefix) error
+	mu   sync.RWMutex
+
+	// completed aggregations, their total and last duration
+	rebuilds      atomic.Uint64
+	rebuildTimeNs atomic.Uint64
+	lastRebuildNs atomic.Int64
+}
+
+// RebuildStats describes the indicator table rebuilds of aggregateIndicators
+type RebuildStats struct {
+	Rebuilds    uint64 `json:"rebuilds"`
+	TotalTimeNs uint64 `json:"total_time_ns"`
+	LastTimeNs  int64  `json:"last_time_ns"`
+	// prefixes of the current table
+	Prefixes int `json:"prefixes"`
 }
 
 func NewAggregator(dataDir string) (*Aggregator, error) {
@@ -50,12 +75,12 @@ func NewAggregator(dataDir string) (*Aggregator, error) {
 	}
 
 	agg := &Aggregator{
-		dataDir:  dir,
-		cron:     cron.New(),
-		entryIDs: make(map[string]cron.EntryID),
-		trie:     iptrie.NewIPTrie(),
-		feeds:    make(map[string]ThreatFeed),
-		metadata: &sync.Map{},
+		dataDir:    dir,
+		cron:       cron.New(),
+		entryIDs:   make(map[string]cron.EntryID),
+		feeds:      make(map[string]ThreatFeed),
+		metadata:   &sync.Map{},
+		indicators: make(map[string][]netip.Prefix),
 	}
 	if err := agg.registerFeed(&provider.AbuseIPDB{}); err != nil {
 		return nil, err
@@ -100,14 +125,17 @@ func (a *Aggregator) GenerateFeedsMetadata() map[string]FeedMetadata {
 }
 
 func (a *Aggregator) Initialize(metadata map[string]FeedMetadata) error {
+	var enabled []string
 	for name, info := range metadata {
 		a.metadata.Store(name, &info)
 		if info.Enabled {
-			if err := a.schedule(name, info.Schedule); err != nil {
+			if err := a.addSchedule(name, info.Schedule); err != nil {
 				return fmt.Errorf("failed to schedule feed %s: %v", name, err)
 			}
+			enabled = append(enabled, name)
 		}
 	}
+	a.syncFeeds(enabled)
 	a.cron.Start()
 	return nil
 }
@@ -117,79 +145,215 @@ func (a *Aggregator) getIntelligenceFilename(name string) string {
 }
 
 func (a *Aggregator) syncFeed(name string) {
+	if prefixes, ok := a.fetchFeed(name); ok {
+		a.aggregateIndicators(map[string][]netip.Prefix{name: prefixes})
+	}
+}
+
+// syncFeeds fetches the feeds in parallel and aggregates them once
+func (a *Aggregator) syncFeeds(names []string) {
+	var wg sync.WaitGroup
+	var mu sync.Mutex
+	updates := make(map[string][]netip.Prefix, len(names))
+	for _, name := range names {
+		wg.Add(1)
+		go func(name string) {
+			defer wg.Done()
+			if prefixes, ok := a.fetchFeed(name); ok {
+				mu.Lock()
+				updates[name] = prefixes
+				mu.Unlock()
+			}
+		}(name)
+	}
+	wg.Wait()
+	a.aggregateIndicators(updates)
+}
+
+// fetchFeed downloads feed name, parsing each indicator as it arrives and
+// writing the valid ones to the feed file. The file is replaced only once
+// the feed was read completely, a failed fetch keeps the previous one.
+func (a *Aggregator) fetchFeed(name string) ([]netip.Prefix, bool) {
 	source, exists := a.feeds[name]
 	if !exists {
-		return
+		return nil, false
 	}
 	infoVal, exists := a.metadata.Load(name)
 	info, _ := infoVal.(*FeedMetadata)
 	if !exists || info == nil || !info.Enabled {
-		return
+		return nil, false
 	}
 
-	ips, err := source.Fetch(info.Params)
+	filename := a.getIntelligenceFilename(name)
+	file, err := os.CreateTemp(a.dataDir, name+".*.tmp")
+	if err != nil {
+		log.Printf("Failed to save data for feed %s: %v", name, err)
+		return nil, false
+	}
+	defer os.Remove(file.Name())
+	defer file.Close()
+	w := bufio.NewWriter(file)
+
+	var prefixes []netip.Prefix
+	received := 0
+	err = source.Stream(info.Params, func(line string) {
+		received++
+		line = strings.TrimSpace(line)
+		if p, ok := parseIndicator(line); ok {
+			prefixes = append(prefixes, p)
+			w.WriteString(line)
+			w.WriteByte('\n')
+		}
+	})
 	if err != nil {
 		log.Printf("Failed to fetch data from feed %s: %v", name, err)
-		return
+		return nil, false
 	}
-	if len(ips) == 0 {
+	if received == 0 {
 		log.Printf("No indicators retrieved from feed %s", name)
-		return
-	}
-
-	validIPs := make([]string, 0, len(ips))
-	for _, ip := range ips {
-		if utils.ParseStringToIPType(ip) != utils.IPTypeUnknown {
-			validIPs = append(validIPs, ip)
-		}
+		return nil, false
 	}
-	ips = validIPs
-
-	if len(ips) == 0 {
+	if len(prefixes) == 0 {
 		log.Printf("No valid indicators retrieved from feed %s", name)
-		return
+		return nil, false
 	}
 
-	log.Printf("Successfully retrieved %d indicators from feed %s", len(ips), name)
+	log.Printf("Successfully retrieved %d indicators from feed %s", len(prefixes), name)
 
-	filename := a.getIntelligenceFilename(name)
-	if err := os.WriteFile(filename, []byte(strings.Join(ips, "\n")), 0644); err != nil {
+	if err := w.Flush(); err == nil {
+		err = file.Close()
+	}
+	if err == nil {
+		err = os.Rename(file.Name(), filename)
+	}
+	if err != nil {
 		log.Printf("Failed to save data for feed %s: %v", name, err)
-		return
+		return nil, false
 	}
+	return iptrie.Collapse(prefixes), true
+}
 
-	a.aggregateIndicators()
+// SetIndicatorSink registers a callback that receives the full indicator set
+// after each aggregation, e.g. to load it into the kernel
+func (a *Aggregator) SetIndicatorSink(sink func([]netip.Prefix) error) {
+	a.mu.Lock()
+	a.sink = sink
+	a.mu.Unlock()
+}
+
+// parseIndicator converts a feed line to a prefix, single addresses become
+// full length prefixes and IPv4-mapped IPv6 indicators are unmapped
+func parseIndicator(line string) (netip.Prefix, bool) {
+	if strings.Contains(line, "/") {
+		p, err := netip.ParsePrefix(line)
+		if err != nil {
+			return netip.Prefix{}, false
+		}
+		if addr := p.Addr(); addr.Is4In6() {
+			if p.Bits() < 96 {
+				return netip.Prefix{}, false
+			}
+			p = netip.PrefixFrom(addr.Unmap(), p.Bits()-96)
+		}
+		return p.Masked(), true
+	}
+	addr, err := netip.ParseAddr(line)
+	if err != nil {
+		return netip.Prefix{}, false
+	}
+	addr = addr.Unmap().WithZone("")
+	return netip.PrefixFrom(addr, addr.BitLen()), true
 }
 
-func (a *Aggregator) aggregateIndicators() {
-	trie := iptrie.NewIPTrie()
+// readIndicators parses a saved feed file line by line
+func readIndicators(filename string) ([]netip.Prefix, error) {
+	file, err := os.Open(filename)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+	var prefixes []netip.Prefix
+	scanner := bufio.NewScanner(file)
+	for scanner.Scan() {
+		if p, ok := parseIndicator(strings.TrimSpace(scanner.Text())); ok {
+			prefixes = append(prefixes, p)
+		}
+	}
+	return iptrie.Collapse(prefixes), scanner.Err()
+}
+
+// aggregateIndicators replaces the indicators of the feeds in updates, a nil
+// set removes the feed, and publishes a new table. Enabled feeds that were
+// not parsed yet are read from their saved file, the other feeds are reused
+// as parsed.
+func (a *Aggregator) aggregateIndicators(updates map[string][]netip.Prefix) {
+	a.mu.RLock()
+	sink := a.sink
+	a.mu.RUnlock()
+
+	a.indicatorsMu.Lock()
+	start := time.Now()
+	for name, feedIndicators := range updates {
+		if feedIndicators != nil {
+			a.indicators[name] = feedIndicators
+		} else {
+			delete(a.indicators, name)
+		}
+	}
 	total := 0
 	a.metadata.Range(func(key, value interface{}) bool {
 		info, _ := value.(*FeedMetadata)
+		feed := key.(string)
 		if !info.Enabled {
+			delete(a.indicators, feed)
 			return true
 		}
-		filename := a.getIntelligenceFilename(info.Name)
-		if _, err := os.Stat(filename); os.IsNotExist(err) {
-			return true
-		}
-		data, err := os.ReadFile(filename)
-		if err != nil {
-			log.Printf("Failed to read feed file %s: %v", filename, err)
-			return true
-		}
-		for _, line := range strings.Split(string(data), "\n") {
-			line = strings.TrimSpace(line)
-			if err := trie.Insert(line); err == nil {
-				total++
+		if _, ok := a.indicators[feed]; !ok {
+			if prefixes, err := readIndicators(a.getIntelligenceFilename(feed)); err == nil {
+				a.indicators[feed] = prefixes
+			} else if !os.IsNotExist(err) {
+				log.Printf("Failed to read feed file of %s: %v", feed, err)
 			}
 		}
+		total += len(a.indicators[feed])
 		return true
 	})
-	a.mu.Lock()
-	a.trie = trie
-	a.mu.Unlock()
-	log.Printf("threatintel aggregate indicators: %d", total)
+	prefixes := make([]netip.Prefix, 0, total)
+	for _, p := range a.indicators {
+		prefixes = append(prefixes, p...)
+	}
+	// feeds overlap, collapse across them too before building the table and
+	// loading the kernel
+	prefixes = iptrie.Collapse(prefixes)
+	// built once per aggregation, lookups then never allocate
+	table := iptrie.NewTable(prefixes)
+	a.table.Store(table)
+	log.Printf("threatintel aggregate indicators: %d, %d prefixes after collapsing", total, table.Size())
+	// still under indicatorsMu, so the sink sees the sets in order
+	if sink != nil {
+		if err := sink(prefixes); err != nil {
+			log.Printf("Failed to load threat intel indicators: %v", err)
+		}
+	}
+	elapsed := time.Since(start)
+	a.rebuilds.Add(1)
+	a.rebuildTimeNs.Add(uint64(elapsed))
+	a.lastRebuildNs.Store(int64(elapsed))
+	a.indicatorsMu.Unlock()
+}
+
+// RebuildStats returns the number and duration of the indicator rebuilds,
+// including the hand over to the indicator sink
+func (a *Aggregator) RebuildStats() RebuildStats {
+	stats := RebuildStats{
+		Rebuilds:    a.rebuilds.Load(),
+		TotalTimeNs: a.rebuildTimeNs.Load(),
+		LastTimeNs:  a.lastRebuildNs.Load(),
+	}
+	if table := a.table.Load(); table != nil {
+		stats.Prefixes = table.Size()
+	}
+	return stats
 }
 
 func (a *Aggregator) Close() {
@@ -197,6 +361,14 @@ func (a *Aggregator) Close() {
 }
 
 func (a *Aggregator) schedule(name, schedule string) error {
+	if err := a.addSchedule(name, schedule); err != nil {
+		return err
+	}
+	a.syncFeed(name)
+	return nil
+}
+
+func (a *Aggregator) addSchedule(name, schedule string) error {
 	// remove the old schedule
 	a.mu.Lock()
 	if id, exists := a.entryIDs[name]; exists {
@@ -212,7 +384,6 @@ func (a *Aggregator) schedule(name, schedule string) error {
 	}
 	a.entryIDs[name] = id
 	a.mu.Unlock()
-	a.syncFeed(name)
 	return nil
 }
 
@@ -231,7 +402,7 @@ func (a *Aggregator) disableFeed(name string) {
 		}
 		a.metadata.Delete(name)
 	}
-	a.aggregateIndicators()
+	a.aggregateIndicators(map[string][]netip.Prefix{name: nil})
 }
 
 func (a *Aggregator) UpdateFeedMetadata(name string, metadata *FeedMetadata) error {
@@ -297,10 +468,14 @@ func (a *Aggregator) GetFeedsMetadata() map[string]*FeedMetadata {
 }
 
 func (a *Aggregator) Contains(ip string) bool {
-	if ip == "" || a.trie == nil || a.trie.Size() < 1 {
+	addr, err := netip.ParseAddr(ip)
+	if err != nil {
 		return false
 	}
-	a.mu.RLock()
-	defer a.mu.RUnlock()
-	return a.trie.Contains(ip)
+	return a.ContainsAddr(addr)
+}
+
+// ContainsAddr is Contains for a parsed address, it neither allocates nor locks
+func (a *Aggregator) ContainsAddr(addr netip.Addr) bool {
+	return a.table.Load().Contains(addr)
 }
@@ -0,0 +1,129 @@
+package threatintel
+
+import (
+	"net/netip"
+	"os"
+	"testing"
+)
+
+func TestParseIndicator(t *testing.T) {
+	tests := []struct {
+		line string
+		want string
+	}{
+		{"192.0.2.1", "192.0.2.1/32"},
+		{"192.0.2.7/24", "192.0.2.0/24"},
+		{"2001:db8::1", "2001:db8::1/128"},
+		{"::ffff:192.0.2.1", "192.0.2.1/32"},
+		{"::ffff:192.0.2.0/120", "192.0.2.0/24"},
+		{"fe80::1%eth0", "fe80::1/128"},
+		{"not an ip", ""},
+		{"::ffff:0.0.0.0/64", ""},
+	}
+	for _, tt := range tests {
+		p, ok := parseIndicator(tt.line)
+		if got := ""; ok {
+			got = p.String()
+			if got != tt.want {
+				t.Errorf("parseIndicator(%q) = %s, want %s", tt.line, got, tt.want)
+			}
+		} else if tt.want != "" {
+			t.Errorf("parseIndicator(%q) failed, want %s", tt.line, tt.want)
+		}
+	}
+}
+
+func TestAggregateIndicators(t *testing.T) {
+	a, err := NewAggregator(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	a.metadata.Store("a", &FeedMetadata{Name: "A", Enabled: true})
+	a.metadata.Store("b", &FeedMetadata{Name: "B", Enabled: true})
+	// feed b was saved by a previous run and is read from its file
+	if err := os.WriteFile(a.getIntelligenceFilename("b"), []byte("198.51.100.0/24\n2001:db8::1"), 0644); err != nil {
+		t.Fatal(err)
+	}
+	var sunk []netip.Prefix
+	a.SetIndicatorSink(func(prefixes []netip.Prefix) error {
+		sunk = prefixes
+		return nil
+	})
+	if a.ContainsAddr(netip.MustParseAddr("192.0.2.1")) {
+		t.Fatal("empty aggregator contains an address")
+	}
+
+	a.aggregateIndicators(map[string][]netip.Prefix{"a": {netip.MustParsePrefix("192.0.2.1/32")}})
+	for _, ip := range []string{"192.0.2.1", "198.51.100.7", "2001:db8::1"} {
+		if !a.Contains(ip) {
+			t.Errorf("Contains(%s) = false after aggregation", ip)
+		}
+	}
+	if len(sunk) != 3 {
+		t.Errorf("sink received %d indicators, want 3", len(sunk))
+	}
+
+	// the cached set of b is reused even once its file is gone
+	os.Remove(a.getIntelligenceFilename("b"))
+	a.aggregateIndicators(map[string][]netip.Prefix{"a": nil})
+	if a.Contains("192.0.2.1") || !a.Contains("198.51.100.7") {
+		t.Error("removing feed a did not keep exactly feed b")
+	}
+}
+
+type staticFeed struct {
+	name  string
+	lines []string
+}
+
+func (f *staticFeed) Name() string                     { return f.name }
+func (f *staticFeed) Description() string              { return f.name }
+func (f *staticFeed) Schedule() string                 { return "0 0 * * *" }
+func (f *staticFeed) DefaultParams() map[string]string { return nil }
+func (f *staticFeed) Stream(params map[string]string, emit func(string)) error {
+	for _, line := range f.lines {
+		emit(line)
+	}
+	return nil
+}
+
+func TestSyncFeeds(t *testing.T) {
+	a, err := NewAggregator(t.TempDir())
+	if err != nil {
+		t.Fatal(err)
+	}
+	feeds := []*staticFeed{
+		{name: "one", lines: []string{"192.0.2.0/25", "192.0.2.128/25", "192.0.2.7", "bogus"}},
+		{name: "two", lines: []string{"192.0.2.1", "2001:db8::/33", "2001:db8:8000::/33"}},
+	}
+	for _, feed := range feeds {
+		if err := a.registerFeed(feed); err != nil {
+			t.Fatal(err)
+		}
+		a.metadata.Store(feed.name, &FeedMetadata{Name: feed.name, Enabled: true})
+	}
+	var sunk []netip.Prefix
+	a.SetIndicatorSink(func(prefixes []netip.Prefix) error {
+		sunk = prefixes
+		return nil
+	})
+	a.syncFeeds([]string{"one", "two"})
+
+	want := []string{"192.0.2.0/24", "2001:db8::/32"}
+	if len(sunk) != len(want) {
+		t.Fatalf("sink received %v, want %v", sunk, want)
+	}
+	for i, p := range sunk {
+		if p.String() != want[i] {
+			t.Errorf("sink received %v, want %v", sunk, want)
+		}
+	}
+	if !a.Contains("192.0.2.200") || !a.Contains("2001:db8:ffff::1") || a.Contains("198.51.100.1") {
+		t.Error("Contains does not match the synced feeds")
+	}
+	// only the valid lines are saved
+	prefixes, err := readIndicators(a.getIntelligenceFilename("one"))
+	if err != nil || len(prefixes) != 1 || prefixes[0].String() != "192.0.2.0/24" {
+		t.Errorf("saved feed reads back as %v, %v", prefixes, err)
+	}
+}
@@ -0,0 +1,56 @@
+package iptrie
+
+import (
+	"net/netip"
+	"sort"
+)
+
+// Collapse returns the smallest sorted set of prefixes covering the same
+// addresses as prefixes: duplicates and prefixes inside a shorter one are
+// dropped and adjacent halves are merged into their parent. The input slice
+// is sorted in place and reused for the result.
+func Collapse(prefixes []netip.Prefix) []netip.Prefix {
+	out := prefixes[:0]
+	for _, p := range prefixes {
+		if p.IsValid() {
+			out = append(out, p.Masked())
+		}
+	}
+	sort.Slice(out, func(i, j int) bool {
+		if c := out[i].Addr().Compare(out[j].Addr()); c != 0 {
+			return c < 0
+		}
+		return out[i].Bits() < out[j].Bits()
+	})
+
+	// out[:n] is the collapsed stack, every entry starts after the previous one ends
+	n := 0
+	for _, p := range out {
+		if n > 0 && out[n-1].Bits() <= p.Bits() && out[n-1].Contains(p.Addr()) {
+			continue
+		}
+		out[n] = p
+		n++
+		for n > 1 {
+			parent, ok := siblings(out[n-2], out[n-1])
+			if !ok {
+				break
+			}
+			out[n-2] = parent
+			n--
+		}
+	}
+	return out[:n]
+}
+
+// siblings returns the parent of a and b if they are the two halves of it
+func siblings(a, b netip.Prefix) (netip.Prefix, bool) {
+	if a.Bits() != b.Bits() || a.Bits() == 0 || a.Addr().BitLen() != b.Addr().BitLen() {
+		return netip.Prefix{}, false
+	}
+	parent, _ := a.Addr().Prefix(a.Bits() - 1)
+	if other, _ := b.Addr().Prefix(b.Bits() - 1); other != parent {
+		return netip.Prefix{}, false
+	}
+	return parent, true
+}
@@ -4,6 +4,7 @@ import (
 	"fmt"
 	"math/rand"
 	"net"
+	"net/netip"
 	"sync"
 	"testing"
 )
@@ -528,3 +529,199 @@ func BenchmarkIpTrieQuery(b *testing.B) {
 		trie.Contains(queryIPs[i])
 	}
 }
+
+func TestTable_Contains(t *testing.T) {
+	prefixes := []netip.Prefix{
+		netip.MustParsePrefix("10.0.0.0/8"),
+		netip.MustParsePrefix("192.168.1.1/32"),
+		netip.MustParsePrefix("172.16.0.0/12"),
+		netip.MustParsePrefix("203.0.113.128/25"),
+		netip.MustParsePrefix("2001:db8::/32"),
+		netip.MustParsePrefix("2001:db9::1/128"),
+		netip.MustParsePrefix("fe80::/10"),
+	}
+	table := NewTable(prefixes)
+	tests := []struct {
+		addr string
+		want bool
+	}{
+		{"10.0.0.1", true},
+		{"10.255.255.255", true},
+		{"11.0.0.0", false},
+		{"192.168.1.1", true},
+		{"192.168.1.2", false},
+		{"172.31.255.255", true},
+		{"172.32.0.0", false},
+		{"203.0.113.127", false},
+		{"203.0.113.128", true},
+		{"::ffff:10.1.2.3", true},
+		{"2001:db8:ffff::1", true},
+		{"2001:db9::1", true},
+		{"2001:db9::2", false},
+		{"febf::1", true},
+		{"fec0::1", false},
+	}
+	for _, tt := range tests {
+		if got := table.Contains(netip.MustParseAddr(tt.addr)); got != tt.want {
+			t.Errorf("Contains(%s) = %v, want %v", tt.addr, got, tt.want)
+		}
+	}
+	if table.Size() != len(prefixes) {
+		t.Errorf("Size() = %d, want %d", table.Size(), len(prefixes))
+	}
+
+	all := NewTable([]netip.Prefix{netip.MustParsePrefix("0.0.0.0/0")})
+	if !all.Contains(netip.MustParseAddr("1.2.3.4")) || all.Contains(netip.MustParseAddr("::1")) {
+		t.Error("0.0.0.0/0 must cover IPv4 only")
+	}
+	var empty *Table
+	if empty.Contains(netip.MustParseAddr("1.2.3.4")) || NewTable(nil).Contains(netip.MustParseAddr("::1")) {
+		t.Error("empty table contains an address")
+	}
+}
+
+func TestTable_MatchesIPTrie(t *testing.T) {
+	r := rand.New(rand.NewSource(1234))
+	ips, cidrs := generateTestData(r, 20000, 2000)
+	trie := NewIPTrie()
+	var prefixes []netip.Prefix
+	for _, s := range append(ips, cidrs...) {
+		trie.Insert(s)
+		if p, err := netip.ParsePrefix(s); err == nil {
+			prefixes = append(prefixes, p)
+		} else if addr, err := netip.ParseAddr(s); err == nil {
+			prefixes = append(prefixes, netip.PrefixFrom(addr, addr.BitLen()))
+		}
+	}
+	table := NewTable(prefixes)
+	queries, _ := generateTestData(r, 50000, 0)
+	// the inserted addresses themselves must all match
+	for _, q := range append(queries, ips...) {
+		addr := netip.MustParseAddr(q)
+		if got, want := table.Contains(addr), trie.Contains(q); got != want {
+			t.Fatalf("Contains(%s) = %v, IPTrie says %v", q, got, want)
+		}
+	}
+}
+
+func TestCollapse(t *testing.T) {
+	tests := []struct {
+		in   []string
+		want []string
+	}{
+		{nil, nil},
+		{[]string{"10.0.0.0/8", "10.1.0.0/16", "10.0.0.0/8"}, []string{"10.0.0.0/8"}},
+		{[]string{"192.0.2.1/32", "192.0.2.0/32", "192.0.2.2/31"}, []string{"192.0.2.0/30"}},
+		{[]string{"192.0.2.0/25", "192.0.2.129/25"}, []string{"192.0.2.0/24"}},
+		{[]string{"192.0.2.128/25", "192.0.3.0/25"}, []string{"192.0.2.128/25", "192.0.3.0/25"}},
+		{[]string{"0.0.0.0/1", "128.0.0.0/1", "::/1", "8000::/1"}, []string{"0.0.0.0/0", "::/0"}},
+		{[]string{"2001:db8::1/128", "2001:db8::/127", "192.0.2.1/32"}, []string{"192.0.2.1/32", "2001:db8::/127"}},
+	}
+	for _, tt := range tests {
+		var in []netip.Prefix
+		for _, s := range tt.in {
+			in = append(in, netip.MustParsePrefix(s))
+		}
+		got := Collapse(in)
+		if len(got) != len(tt.want) {
+			t.Errorf("Collapse(%v) = %v, want %v", tt.in, got, tt.want)
+			continue
+		}
+		for i := range got {
+			if got[i].String() != tt.want[i] {
+				t.Errorf("Collapse(%v) = %v, want %v", tt.in, got, tt.want)
+				break
+			}
+		}
+	}
+}
+
+func TestCollapse_SameCoverage(t *testing.T) {
+	r := rand.New(rand.NewSource(1234))
+	prefixes := generateTablePrefixes(r, 20000)
+	table := NewTable(prefixes)
+	collapsed := NewTable(Collapse(append([]netip.Prefix(nil), prefixes...)))
+	queries, _ := generateTestData(r, 50000, 0)
+	for _, q := range queries {
+		addr := netip.MustParseAddr(q)
+		if table.Contains(addr) != collapsed.Contains(addr) {
+			t.Fatalf("collapsed table disagrees on %s", q)
+		}
+	}
+}
+
+func generateTablePrefixes(r *rand.Rand, count int) []netip.Prefix {
+	ips, cidrs := generateTestData(r, count/2, count/2)
+	prefixes := make([]netip.Prefix, 0, count)
+	for _, s := range append(ips, cidrs...) {
+		if p, err := netip.ParsePrefix(s); err == nil {
+			prefixes = append(prefixes, p)
+		} else if addr, err := netip.ParseAddr(s); err == nil {
+			prefixes = append(prefixes, netip.PrefixFrom(addr, addr.BitLen()))
+		}
+	}
+	return prefixes
+}
+
+func BenchmarkTableBuild(b *testing.B) {
+	r := rand.New(rand.NewSource(1234))
+	prefixes := generateTablePrefixes(r, 1000000)
+
+	b.ResetTimer()
+	b.ReportAllocs()
+
+	for i := 0; i < b.N; i++ {
+		NewTable(prefixes)
+	}
+}
+
+func BenchmarkIpTrieBuild(b *testing.B) {
+	r := rand.New(rand.NewSource(1234))
+	ips, cidrs := generateTestData(r, 500000, 500000)
+	values := append(ips, cidrs...)
+
+	b.ResetTimer()
+	b.ReportAllocs()
+
+	for i := 0; i < b.N; i++ {
+		trie := NewIPTrie()
+		for _, v := range values {
+			trie.Insert(v)
+		}
+	}
+}
+
+// same data set as BenchmarkIpTrieQuery
+func BenchmarkTableQuery(b *testing.B) {
+	r := rand.New(rand.NewSource(1234))
+	table := NewTable(generateTablePrefixes(r, 1000000))
+
+	queryIPs, _ := generateTestData(r, b.N, 0)
+	addrs := make([]netip.Addr, len(queryIPs))
+	for i, q := range queryIPs {
+		addrs[i] = netip.MustParseAddr(q)
+	}
+
+	b.ResetTimer()
+	b.ReportAllocs()
+
+	for i := 0; i < b.N; i++ {
+		table.Contains(addrs[i])
+	}
+}
+
+func BenchmarkTableQueryIPv4(b *testing.B) {
+	r := rand.New(rand.NewSource(1234))
+	table := NewTable(generateTablePrefixes(r, 1000000))
+	addrs := make([]uint32, 1<<16)
+	for i := range addrs {
+		addrs[i] = r.Uint32()
+	}
+
+	b.ResetTimer()
+	b.ReportAllocs()
+
+	for i := 0; i < b.N; i++ {
+		table.ContainsIPv4(addrs[i&(len(addrs)-1)])
+	}
+}
@@ -0,0 +1,195 @@
+package iptrie
+
+import (
+	"encoding/binary"
+	"math/bits"
+	"net/netip"
+	"sort"
+)
+
+// stride of the multibit trie, one node covers 6 address bits so its 64
+// slots fit in one bitmap word
+const tableStride = 6
+
+// tableNode is one level of the trie. A slot either holds a leaf, set in
+// leaf when the slot is covered by a prefix, or a child, set in children.
+// The children of a node are stored next to each other starting at base, so
+// slot s is found at base + popcount(children below s), as in poptrie.
+// The node holds no pointers, so the GC never scans the node array.
+type tableNode struct {
+	children uint64
+	leaf     uint64
+	base     uint32
+}
+
+// addrTable is the trie of one address family, nodes[0] is the root
+type addrTable struct {
+	nodes []tableNode
+	bits  uint
+}
+
+// Table is an immutable set of prefixes built in one pass, looked up without
+// allocating. It only answers whether an address is covered, which lets
+// prefixes covered by a shorter one be dropped while building.
+type Table struct {
+	v4, v6 addrTable
+	size   int
+}
+
+// tableEntry is a prefix as a left aligned 128 bit address
+type tableEntry struct {
+	hi, lo uint64
+	bits   uint
+}
+
+// NewTable builds a table from prefixes, invalid prefixes are skipped and
+// IPv4-mapped IPv6 prefixes are not unmapped
+func NewTable(prefixes []netip.Prefix) *Table {
+	var v4, v6 []tableEntry
+	for _, p := range prefixes {
+		if !p.IsValid() {
+			continue
+		}
+		p = p.Masked()
+		addr := p.Addr()
+		if addr.Is4() {
+			b := addr.As4()
+			v4 = append(v4, tableEntry{hi: uint64(binary.BigEndian.Uint32(b[:])) << 32, bits: uint(p.Bits())})
+		} else {
+			b := addr.As16()
+			v6 = append(v6, tableEntry{hi: binary.BigEndian.Uint64(b[:8]), lo: binary.BigEndian.Uint64(b[8:]), bits: uint(p.Bits())})
+		}
+	}
+	return &Table{
+		v4:   buildAddrTable(v4, 32),
+		v6:   buildAddrTable(v6, 128),
+		size: len(v4) + len(v6),
+	}
+}
+
+// Size returns the number of prefixes the table was built from
+func (t *Table) Size() int {
+	if t == nil {
+		return 0
+	}
+	return t.size
+}
+
+// Contains reports whether addr is covered by any prefix of the table
+func (t *Table) Contains(addr netip.Addr) bool {
+	if t == nil {
+		return false
+	}
+	addr = addr.Unmap()
+	if addr.Is4() {
+		b := addr.As4()
+		return t.ContainsIPv4(binary.BigEndian.Uint32(b[:]))
+	}
+	if !addr.Is6() {
+		return false
+	}
+	b := addr.As16()
+	return t.v6.contains(binary.BigEndian.Uint64(b[:8]), binary.BigEndian.Uint64(b[8:]))
+}
+
+// ContainsIPv4 is Contains for an IPv4 address in host byte order
+func (t *Table) ContainsIPv4(addr uint32) bool {
+	if t == nil {
+		return false
+	}
+	return t.v4.contains(uint64(addr)<<32, 0)
+}
+
+func (at *addrTable) contains(hi, lo uint64) bool {
+	if len(at.nodes) == 0 {
+		return false
+	}
+	n := &at.nodes[0]
+	for off := uint(0); off < at.bits; off += tableStride {
+		bit := uint64(1) << chunk(hi, lo, off, min(tableStride, at.bits-off))
+		if n.children&bit == 0 {
+			return n.leaf&bit != 0
+		}
+		n = &at.nodes[n.base+uint32(bits.OnesCount64(n.children&(bit-1)))]
+	}
+	return false
+}
+
+// chunk returns the width bits of the 128 bit address hi:lo starting at bit off
+func chunk(hi, lo uint64, off, width uint) uint64 {
+	var v uint64
+	switch end := off + width; {
+	case end <= 64:
+		v = hi >> (64 - end)
+	case off >= 64:
+		v = lo >> (128 - end)
+	default:
+		v = hi<<(end-64) | lo>>(128-end)
+	}
+	return v & (1<<width - 1)
+}
+
+func buildAddrTable(entries []tableEntry, addrBits uint) addrTable {
+	less := func(i, j int) bool {
+		if entries[i].hi != entries[j].hi {
+			return entries[i].hi < entries[j].hi
+		}
+		return entries[i].lo < entries[j].lo
+	}
+	// the output of Collapse is already sorted
+	if !sort.SliceIsSorted(entries, less) {
+		sort.Slice(entries, less)
+	}
+	at := addrTable{nodes: make([]tableNode, 1, 1+len(entries)/4), bits: addrBits}
+	at.fill(0, entries, 0)
+	return at
+}
+
+// fill builds node idx from the sorted entries passing through it at bit off.
+// The children are allocated as one block before recursing, so they stay
+// adjacent in the node array.
+func (at *addrTable) fill(idx int, entries []tableEntry, off uint) {
+	width := min(tableStride, at.bits-off)
+	end := off + width
+	var node tableNode
+	for _, e := range entries {
+		if e.bits <= end {
+			span := uint64(1) << (end - e.bits)
+			start := chunk(e.hi, e.lo, off, width) &^ (span - 1)
+			node.leaf |= (1<<span - 1) << start
+		}
+	}
+	// a slot that is already covered needs no child, longer prefixes below it change nothing
+	for _, e := range entries {
+		if e.bits > end {
+			if bit := uint64(1) << chunk(e.hi, e.lo, off, width); node.leaf&bit == 0 {
+				node.children |= bit
+			}
+		}
+	}
+	node.base = uint32(len(at.nodes))
+	at.nodes = append(at.nodes, make([]tableNode, bits.OnesCount64(node.children))...)
+	at.nodes[idx] = node
+
+	// entries are sorted, so the entries of one slot are contiguous
+	child := int(node.base)
+	for i := 0; i < len(entries); {
+		slot := chunk(entries[i].hi, entries[i].lo, off, width)
+		j := i + 1
+		for j < len(entries) && chunk(entries[j].hi, entries[j].lo, off, width) == slot {
+			j++
+		}
+		if node.children&(uint64(1)<<slot) != 0 {
+			// keep the entries that go deeper, in place and still sorted
+			deeper := entries[i:i]
+			for _, e := range entries[i:j] {
+				if e.bits > end {
+					deeper = append(deeper, e)
+				}
+			}
+			at.fill(child, deeper, end)
+			child++
+		}
+		i = j
+	}
+}
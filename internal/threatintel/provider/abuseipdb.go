@@ -3,8 +3,6 @@ package provider
 import (
 	"errors"
 	"fmt"
-	"io"
-	"net/http"
 	"strings"
 )
 
@@ -56,6 +54,14 @@ func (a *AbuseIPDB) DefaultParams() map[string]string {
 }
 
 func (a *AbuseIPDB) Fetch(params map[string]string) ([]string, error) {
+	return collect(func(emit func(string)) error {
+		return a.Stream(params, emit)
+	})
+}
+
+// Stream calls emit for the indicators of every source that downloaded
+// completely, a source that failed is dropped
+func (a *AbuseIPDB) Stream(params map[string]string, emit func(string)) error {
 	baseURL := params["baseURL"]
 	if baseURL == "" {
 		baseURL = defaultBaseURL
@@ -63,9 +69,9 @@ func (a *AbuseIPDB) Fetch(params map[string]string) ([]string, error) {
 	baseURL = strings.TrimSuffix(baseURL, "/")
 	sources := strings.Split(params["source"], ",")
 	if len(sources) == 0 {
-		return nil, fmt.Errorf("source is required")
+		return fmt.Errorf("source is required")
 	}
-	results := make([]string, 0)
+	emitted := 0
 	errs := make([]error, 0)
 	for _, source := range sources {
 		requestURL := ""
@@ -76,27 +82,19 @@ func (a *AbuseIPDB) Fetch(params map[string]string) ([]string, error) {
 			continue
 		}
 		url := fmt.Sprintf("%s/%s", baseURL, requestURL)
-		resp, err := http.Get(url)
-		if err != nil {
-			errs = append(errs, fmt.Errorf("failed to fetch %s: %v", source, err))
-			continue
-		}
-		defer resp.Body.Close()
-		body, err := io.ReadAll(resp.Body)
-		if err != nil {
-			errs = append(errs, fmt.Errorf("failed to read body of %s: %v", source, err))
-			continue
-		}
-		blocklist := strings.Split(string(body), "\n")
-		for _, line := range blocklist {
+		err := streamLines(url, func(line string) {
 			if line == "" || strings.HasPrefix(line, "#") {
-				continue
+				return
 			}
-			results = append(results, line)
+			emitted++
+			emit(line)
+		})
+		if err != nil {
+			errs = append(errs, fmt.Errorf("failed to fetch %s: %v", source, err))
 		}
 	}
-	if len(results) > 0 {
-		return results, nil
+	if emitted > 0 {
+		return nil
 	}
-	return nil, errors.Join(errs...)
+	return errors.Join(errs...)
 }
@@ -3,8 +3,6 @@ package provider
 import (
 	"errors"
 	"fmt"
-	"io"
-	"net/http"
 	"strings"
 )
 
@@ -34,32 +32,32 @@ func (s *Spamhaus) DefaultParams() map[string]string {
 }
 
 func (s *Spamhaus) Fetch(params map[string]string) ([]string, error) {
-	results := make([]string, 0)
+	return collect(func(emit func(string)) error {
+		return s.Stream(params, emit)
+	})
+}
+
+// Stream calls emit for the indicators of every list that downloaded
+// completely, a list that failed is dropped
+func (s *Spamhaus) Stream(params map[string]string, emit func(string)) error {
+	emitted := 0
 	errs := make([]error, 0)
 	for _, url := range dropURLs {
-		resp, err := http.Get(url)
-		if err != nil {
-			errs = append(errs, fmt.Errorf("failed to fetch %s: %v", url, err))
-			continue
-		}
-		defer resp.Body.Close()
-		body, err := io.ReadAll(resp.Body)
-		if err != nil {
-			errs = append(errs, fmt.Errorf("failed to read body of %s: %v", url, err))
-			continue
-		}
-		lines := strings.Split(string(body), "\n")
-		for _, line := range lines {
+		err := streamLines(url, func(line string) {
 			line = strings.TrimSpace(line)
 			if line == "" || strings.HasPrefix(line, ";") {
-				continue
+				return
 			}
 			ip := strings.Split(line, ";")[0]
-			results = append(results, ip)
+			emitted++
+			emit(ip)
+		})
+		if err != nil {
+			errs = append(errs, fmt.Errorf("failed to fetch %s: %v", url, err))
 		}
 	}
-	if len(results) > 0 {
-		return results, nil
+	if emitted > 0 {
+		return nil
 	}
-	return nil, errors.Join(errs...)
+	return errors.Join(errs...)
 }
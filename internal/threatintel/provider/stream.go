@@ -0,0 +1,45 @@
+package provider
+
+import (
+	"bufio"
+	"fmt"
+	"net/http"
+)
+
+// streamLines calls emit for every line of the body at url once the body was
+// read completely. A body that fails mid-download emits nothing, so a source
+// is either taken as a whole or dropped, never half read.
+func streamLines(url string, emit func(string)) error {
+	resp, err := http.Get(url)
+	if err != nil {
+		return err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		return fmt.Errorf("unexpected status: %s", resp.Status)
+	}
+	var lines []string
+	scanner := bufio.NewScanner(resp.Body)
+	for scanner.Scan() {
+		lines = append(lines, scanner.Text())
+	}
+	if err := scanner.Err(); err != nil {
+		return err
+	}
+	for _, line := range lines {
+		emit(line)
+	}
+	return nil
+}
+
+// collect gathers the indicators of stream into a slice
+func collect(stream func(emit func(string)) error) ([]string, error) {
+	results := make([]string, 0)
+	err := stream(func(indicator string) {
+		results = append(results, indicator)
+	})
+	if err != nil {
+		return nil, err
+	}
+	return results, nil
+}
@@ -0,0 +1,37 @@
+package provider
+
+import (
+	"fmt"
+	"net/http"
+	"net/http/httptest"
+	"testing"
+)
+
+func TestStreamLines(t *testing.T) {
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		if r.URL.Path == "/truncated" {
+			// the connection is closed before the announced length was sent
+			w.Header().Set("Content-Length", "100")
+			fmt.Fprint(w, "1.2.3.4\n5.6.7.8\n")
+			return
+		}
+		fmt.Fprint(w, "1.2.3.4\n5.6.7.8\n")
+	}))
+	defer server.Close()
+
+	var lines []string
+	if err := streamLines(server.URL+"/complete", func(line string) { lines = append(lines, line) }); err != nil {
+		t.Fatalf("complete body: %v", err)
+	}
+	if len(lines) != 2 || lines[0] != "1.2.3.4" || lines[1] != "5.6.7.8" {
+		t.Fatalf("lines = %v", lines)
+	}
+
+	lines = nil
+	if err := streamLines(server.URL+"/truncated", func(line string) { lines = append(lines, line) }); err == nil {
+		t.Fatal("truncated body: want error")
+	}
+	if len(lines) != 0 {
+		t.Fatalf("truncated body emitted %v", lines)
+	}
+}
@@ -2,6 +2,9 @@ package types
 
 import (
 	"fmt"
+	"net"
+	"net/netip"
+	"sync"
 )
 
 type MatchType uint32
@@ -13,6 +16,9 @@ const (
 	MatchByIP6Exact MatchType = 3
 	MatchByIP6CIDR  MatchType = 4
 	MatchByMAC      MatchType = 5
+	MatchByIntel    MatchType = 6
+	MatchByTuple    MatchType = 7
+	MatchByGeo      MatchType = 8
 )
 
 type MatchRule struct {
@@ -45,19 +51,95 @@ type PacketInfo struct {
 	IPProto   IPProtocol
 	PktSize   uint32
 	MatchType MatchType
+	PktCount  uint32
+}
+
+var packetInfoPool = sync.Pool{
+	New: func() any {
+		return new(PacketInfo)
+	},
+}
+
+// AcquirePacketInfo returns a PacketInfo from the shared pool, its content is undefined
+func AcquirePacketInfo() *PacketInfo {
+	return packetInfoPool.Get().(*PacketInfo)
+}
+
+// ReleasePacketInfo returns pi to the shared pool, pi must not be used afterwards
+func ReleasePacketInfo(pi *PacketInfo) {
+	packetInfoPool.Put(pi)
+}
+
+// IPAddr is an IPv6 or IPv4-mapped IPv6 address in binary form, the zero value means no address
+type IPAddr [16]byte
+
+// IPv4Addr converts a 4 byte IPv4 address to its IPv4-mapped form
+func IPv4Addr(ip [4]byte) IPAddr {
+	var addr IPAddr
+	addr[10], addr[11] = 0xff, 0xff
+	copy(addr[12:], ip[:])
+	return addr
+}
+
+// ParseIPAddr parses an IPv4 or IPv6 address string
+func ParseIPAddr(s string) (IPAddr, error) {
+	addr, err := netip.ParseAddr(s)
+	if err != nil {
+		return IPAddr{}, err
+	}
+	return addr.As16(), nil
+}
+
+func (a IPAddr) IsZero() bool {
+	return a == IPAddr{}
+}
+
+// Addr returns the address as netip.Addr, IPv4-mapped addresses are unmapped
+func (a IPAddr) Addr() netip.Addr {
+	if a.IsZero() {
+		return netip.Addr{}
+	}
+	return netip.AddrFrom16(a).Unmap()
+}
+
+func (a IPAddr) String() string {
+	if a.IsZero() {
+		return ""
+	}
+	return a.Addr().String()
+}
+
+// MACAddr is a binary Ethernet hardware address
+type MACAddr [6]byte
+
+// ParseMACAddr parses a 6 byte hardware address string
+func ParseMACAddr(s string) (MACAddr, error) {
+	var mac MACAddr
+	hw, err := net.ParseMAC(s)
+	if err != nil {
+		return mac, err
+	}
+	if len(hw) != len(mac) {
+		return mac, fmt.Errorf("invalid MAC address: %s", s)
+	}
+	copy(mac[:], hw)
+	return mac, nil
+}
+
+func (m MACAddr) String() string {
+	return net.HardwareAddr(m[:]).String()
 }
 
 type Packet struct {
 	Timestamp int64
-	SrcMAC    string
-	SrcIP     string
-	DstMAC    string
-	DstIP     string
+	SrcMAC    MACAddr
+	SrcIP     IPAddr
+	DstMAC    MACAddr
+	DstIP     IPAddr
 	SrcPort   uint16
 	DstPort   uint16
 	Size      uint32
-	Country   string
-	City      string
+	Count     uint32
 	EthType   EthernetType
 	IPProto   IPProtocol
 	MatchType MatchType
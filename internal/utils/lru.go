@@ -0,0 +1,102 @@
+package utils
+
+import (
+	"container/list"
+	"runtime"
+	"sync"
+)
+
+type lruEntry[K comparable, V any] struct {
+	key K
+	val V
+}
+
+// one stripe of a ShardedLRU, a key always maps to the same shard
+type lruShard[K comparable, V any] struct {
+	mu       sync.Mutex
+	items    map[K]*list.Element
+	order    *list.List
+	capacity int
+}
+
+// ShardedLRU is a bounded least recently used cache split into shards by
+// the hash of the key, so readers of different keys rarely share a lock
+type ShardedLRU[K comparable, V any] struct {
+	shards []*lruShard[K, V]
+	mask   uint64
+	hash   func(K) uint64
+}
+
+// entries a shard holds at least, below that eviction order gets too coarse
+const lruMinShardSize = 64
+
+// NewShardedLRU creates a cache of about size entries, the shard count is a
+// power of two following the number of CPUs
+func NewShardedLRU[K comparable, V any](size int, hash func(K) uint64) *ShardedLRU[K, V] {
+	count := 1
+	for count < runtime.NumCPU()*4 && count*2*lruMinShardSize <= size {
+		count <<= 1
+	}
+	c := &ShardedLRU[K, V]{shards: make([]*lruShard[K, V], count), mask: uint64(count - 1), hash: hash}
+	for i := range c.shards {
+		capacity := max((size+count-1)/count, 1)
+		c.shards[i] = &lruShard[K, V]{
+			items:    make(map[K]*list.Element, capacity),
+			order:    list.New(),
+			capacity: capacity,
+		}
+	}
+	return c
+}
+
+func (c *ShardedLRU[K, V]) shard(key K) *lruShard[K, V] {
+	return c.shards[c.hash(key)&c.mask]
+}
+
+// Get returns the value of key and marks it as recently used
+func (c *ShardedLRU[K, V]) Get(key K) (V, bool) {
+	s := c.shard(key)
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if e, ok := s.items[key]; ok {
+		s.order.MoveToFront(e)
+		return e.Value.(*lruEntry[K, V]).val, true
+	}
+	var zero V
+	return zero, false
+}
+
+// Add stores the value of key, evicting the least recently used key of the
+// shard when it is full
+func (c *ShardedLRU[K, V]) Add(key K, val V) {
+	s := c.shard(key)
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if e, ok := s.items[key]; ok {
+		e.Value.(*lruEntry[K, V]).val = val
+		s.order.MoveToFront(e)
+		return
+	}
+	if s.order.Len() >= s.capacity {
+		// the oldest element is reused for the new key
+		e := s.order.Back()
+		entry := e.Value.(*lruEntry[K, V])
+		delete(s.items, entry.key)
+		entry.key, entry.val = key, val
+		s.items[key] = e
+		s.order.MoveToFront(e)
+		return
+	}
+	s.items[key] = s.order.PushFront(&lruEntry[K, V]{key: key, val: val})
+}
+
+// Len returns the number of cached keys
+func (c *ShardedLRU[K, V]) Len() int {
+	n := 0
+	for _, s := range c.shards {
+		s.mu.Lock()
+		n += s.order.Len()
+		s.mu.Unlock()
+	}
+	return n
+}
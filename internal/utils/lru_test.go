@@ -0,0 +1,55 @@
+package utils
+
+import (
+	"sync"
+	"testing"
+)
+
+func identityHash(k int) uint64 { return uint64(k) }
+
+func TestShardedLRU_Evict(t *testing.T) {
+	// small caches have a single shard
+	c := NewShardedLRU[int, string](3, identityHash)
+	c.Add(1, "a")
+	c.Add(2, "b")
+	c.Add(3, "c")
+	if v, ok := c.Get(1); !ok || v != "a" {
+		t.Fatalf("Get(1) = %q, %v", v, ok)
+	}
+	// 2 is now the least recently used
+	c.Add(4, "d")
+	if _, ok := c.Get(2); ok {
+		t.Error("Expected 2 to be evicted")
+	}
+	for _, k := range []int{1, 3, 4} {
+		if _, ok := c.Get(k); !ok {
+			t.Errorf("Expected %d to be cached", k)
+		}
+	}
+	c.Add(4, "e")
+	if v, _ := c.Get(4); v != "e" {
+		t.Errorf("Get(4) = %q, want e", v)
+	}
+	if c.Len() != 3 {
+		t.Errorf("Len() = %d, want 3", c.Len())
+	}
+}
+
+func TestShardedLRU_Bounded(t *testing.T) {
+	c := NewShardedLRU[int, int](1024, identityHash)
+	var wg sync.WaitGroup
+	for g := 0; g < 4; g++ {
+		wg.Add(1)
+		go func(g int) {
+			defer wg.Done()
+			for i := 0; i < 1000; i++ {
+				c.Add(g*1000+i, i)
+				c.Get(g*1000 + i/2)
+			}
+		}(g)
+	}
+	wg.Wait()
+	if n := c.Len(); n == 0 || n > 1024 {
+		t.Errorf("Len() = %d, want 1..1024", n)
+	}
+}
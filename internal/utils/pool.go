@@ -12,14 +12,64 @@ type TaskProducer[T any] func(func(T))
 
 type WorkerFunc[T any] func(T)
 
+// ShardProducer reads one shard of the input and runs every task through
+// process on its own goroutine, without going through the queue
+type ShardProducer[T any] func(shard int, process func(T))
+
+// OverloadPolicy decides what submit does while the workers fall behind
+type OverloadPolicy string
+
+const (
+	// wait for room in the queue, the producer stalls and the kernel buffers fill up
+	OverloadBlock OverloadPolicy = "block"
+	// drop the task being submitted when the queue is full
+	OverloadDropNewest OverloadPolicy = "drop-newest"
+	// drop the oldest queued task to make room, the queue keeps the latest tasks
+	OverloadDropOldest OverloadPolicy = "drop-oldest"
+	// keep 1 in N tasks once the queue is half full, N doubles as the queue
+	// fills up, and drop the task when it is full
+	OverloadSample OverloadPolicy = "sample"
+)
+
+// PoolStats are the queue counters of an ElasticPool
+type PoolStats struct {
+	Policy OverloadPolicy `json:"policy"`
+	// tasks queued for the workers
+	Enqueued uint64 `json:"enqueued"`
+	// tasks dropped by the overload policy, including Sampled
+	Dropped uint64 `json:"dropped"`
+	// tasks dropped by the sample policy before the queue was full
+	Sampled uint64 `json:"sampled"`
+	// current number of queued tasks and its highest value since start
+	QueueDepth    int    `json:"queue_depth"`
+	QueueCapacity int    `json:"queue_capacity"`
+	HighWater     uint64 `json:"high_water"`
+	Workers       int32  `json:"workers"`
+}
+
 type ElasticPool[T any] struct {
-	taskQueue   chan T
+	taskQueue   *Ring[T]
 	done        chan struct{}
 	workerCount *atomic.Int32
 	producer    TaskProducer[T]
 	processor   WorkerFunc[T]
 	config      PoolConfig
 	lastScale   atomic.Value
+	// idle workers and blocked producers park on these instead of spinning
+	tasks     notifier
+	space     notifier
+	batchSize int
+	// receives the tasks dropped by the overload policy
+	dropHandler WorkerFunc[T]
+	enqueued    atomic.Uint64
+	dropped     atomic.Uint64
+	sampled     atomic.Uint64
+	sampleSeq   atomic.Uint64
+	highWater   atomic.Uint64
+
+	// replaces producer and the workers when set, see SetShardProducer
+	shardProducer ShardProducer[T]
+	shards        int
 }
 
 type PoolConfig struct {
@@ -29,6 +79,27 @@ type PoolConfig struct {
 	ScaleInterval time.Duration
 	IdleTimeout   time.Duration
 	BackoffTime   time.Duration
+	// most tasks a worker takes from the queue at once, at most
+	// QueueSize/MaxWorkers so one worker can't hold the whole backlog
+	BatchSize int
+	// what submit does when the queue is full, OverloadBlock by default
+	Overload OverloadPolicy
+}
+
+// notifier wakes goroutines waiting for a condition, wake costs one atomic
+// load while nobody waits
+type notifier struct {
+	waiting atomic.Int32
+	ch      chan struct{}
+}
+
+func (n *notifier) wake() {
+	if n.waiting.Load() > 0 {
+		select {
+		case n.ch <- struct{}{}:
+		default:
+		}
+	}
 }
 
 func NewElasticPool[T any](config PoolConfig) *ElasticPool[T] {
@@ -50,11 +121,21 @@ func NewElasticPool[T any](config PoolConfig) *ElasticPool[T] {
 	if config.BackoffTime == 0 {
 		config.BackoffTime = 10 * time.Millisecond
 	}
+	if config.BatchSize == 0 {
+		config.BatchSize = 64
+	}
+	if config.Overload == "" {
+		config.Overload = OverloadBlock
+	}
+	batchSize := max(1, min(config.BatchSize, config.QueueSize/int(config.MaxWorkers)))
 
 	p := &ElasticPool[T]{
-		taskQueue:   make(chan T, config.QueueSize),
+		taskQueue:   NewRing[T](config.QueueSize),
 		done:        make(chan struct{}),
 		workerCount: &atomic.Int32{},
+		tasks:       notifier{ch: make(chan struct{}, 1)},
+		space:       notifier{ch: make(chan struct{}, 1)},
+		batchSize:   batchSize,
 		config:      config,
 	}
 	p.lastScale.Store(time.Now())
@@ -65,18 +146,40 @@ func (p *ElasticPool[T]) SetProducer(producer TaskProducer[T]) {
 	p.producer = producer
 }
 
+// SetShardProducer replaces the producer by shards goroutines that each
+// process the tasks they read themselves, so a task stays on the thread,
+// and with CPU affinity on the core, that read it. The queue and the
+// workers are not started.
+func (p *ElasticPool[T]) SetShardProducer(shards int, producer ShardProducer[T]) {
+	p.shards = shards
+	p.shardProducer = producer
+}
+
 func (p *ElasticPool[T]) SetProcessor(processor WorkerFunc[T]) {
 	p.processor = processor
 }
 
+// SetDropHandler registers a callback for the tasks the overload policy
+// drops, e.g. to return them to a sync.Pool
+func (p *ElasticPool[T]) SetDropHandler(handler WorkerFunc[T]) {
+	p.dropHandler = handler
+}
+
 func (p *ElasticPool[T]) Start() error {
-	if p.producer == nil {
+	if p.producer == nil && p.shardProducer == nil {
 		return fmt.Errorf("producer not registered")
 	}
 	if p.processor == nil {
 		return fmt.Errorf("processor not registered")
 	}
+	if p.shardProducer != nil {
+		for i := 0; i < p.shards; i++ {
+			go p.shardProducer(i, p.processLocal)
+		}
+		return nil
+	}
 	for i := int32(0); i < p.config.MinWorkers; i++ {
+		p.workerCount.Add(1)
 		go p.startWorker()
 	}
 	go p.startProducer()
@@ -85,53 +188,164 @@ func (p *ElasticPool[T]) Start() error {
 }
 
 func (p *ElasticPool[T]) startProducer() {
+	p.producer(p.submit)
+}
 
-	p.producer(func(data T) {
-		select {
-		case <-p.done:
-			return
-		case p.taskQueue <- data:
+// submit queues data, a full queue is handled by the overload policy
+func (p *ElasticPool[T]) submit(data T) {
+	if p.config.Overload == OverloadSample && !p.admit() {
+		p.sampled.Add(1)
+		p.drop(data)
+		return
+	}
+	for !p.taskQueue.Push(data) {
+		switch p.config.Overload {
+		case OverloadBlock:
+			if !p.waitForSpace() {
+				return
+			}
+		case OverloadDropOldest:
+			var oldest [1]T
+			if p.taskQueue.PopBatch(oldest[:]) == 1 {
+				p.drop(oldest[0])
+			}
+		default:
+			p.drop(data)
 			return
 		}
-	})
+	}
+	p.enqueued.Add(1)
+	depth := uint64(p.taskQueue.Len())
+	for high := p.highWater.Load(); depth > high && !p.highWater.CompareAndSwap(high, depth); high = p.highWater.Load() {
+	}
+	p.tasks.wake()
 }
 
-func (p *ElasticPool[T]) startWorker() {
-	p.workerCount.Add(1)
-	defer p.workerCount.Add(-1)
+// waitForSpace parks the producer until a worker made room, like a blocked
+// channel send. It returns false once the pool is closed.
+func (p *ElasticPool[T]) waitForSpace() bool {
+	p.space.waiting.Add(1)
+	defer p.space.waiting.Add(-1)
+	// recheck after announcing the wait, a worker may have made room before it
+	if p.taskQueue.Len() < p.taskQueue.Cap() {
+		return true
+	}
+	select {
+	case <-p.done:
+		return false
+	case <-p.space.ch:
+	case <-time.After(p.config.BackoffTime):
+	}
+	return true
+}
+
+// admit decides whether the sample policy keeps the next task, below half
+// of the queue every task is kept
+func (p *ElasticPool[T]) admit() bool {
+	half := p.taskQueue.Cap() / 2
+	over := p.taskQueue.Len() - half
+	if over < 0 {
+		return true
+	}
+	// keep 1 in 2^level, level goes from 0 at half full to 7 just below full
+	level := min(over*8/max(half, 1), 7)
+	return p.sampleSeq.Add(1)&(1<<level-1) == 0
+}
 
+func (p *ElasticPool[T]) drop(data T) {
+	p.dropped.Add(1)
+	if p.dropHandler != nil {
+		p.dropHandler(data)
+	}
+}
+
+// startWorker runs tasks in batches and parks while the queue is empty. The
+// worker count is raised by the caller, so the monitor never overshoots.
+func (p *ElasticPool[T]) startWorker() {
+	batch := make([]T, p.batchSize)
 	idleTimeout := time.NewTimer(p.config.IdleTimeout)
+	idleTimeout.Stop()
 	defer idleTimeout.Stop()
 
 	for {
+		if n := p.taskQueue.PopBatch(batch); n > 0 {
+			p.space.wake()
+			if p.taskQueue.Len() > 0 {
+				// more work left, let the next parked worker take it
+				p.tasks.wake()
+			}
+			for done := 0; done < n; {
+				done += p.process(batch[done:n])
+			}
+			clear(batch[:n])
+			continue
+		}
+
+		p.tasks.waiting.Add(1)
+		if p.taskQueue.Len() > 0 {
+			p.tasks.waiting.Add(-1)
+			continue
+		}
+		idleTimeout.Reset(p.config.IdleTimeout)
 		select {
 		case <-p.done:
+			p.tasks.waiting.Add(-1)
+			p.workerCount.Add(-1)
 			return
-		case data, ok := <-p.taskQueue:
-			if !ok {
-				return
-			}
-
+		case <-p.tasks.ch:
+			p.tasks.waiting.Add(-1)
 			if !idleTimeout.Stop() {
 				select {
 				case <-idleTimeout.C:
 				default:
 				}
 			}
-			idleTimeout.Reset(p.config.IdleTimeout)
-			func() {
-				defer func() {
-					if r := recover(); r != nil {
-						log.Printf("Worker recovered from panic: %v", r)
-					}
-				}()
-				p.processor(data)
-			}()
 		case <-idleTimeout.C:
-			if p.workerCount.Load() > p.config.MinWorkers {
+			p.tasks.waiting.Add(-1)
+			if p.retire() {
 				return
 			}
-			idleTimeout.Reset(p.config.IdleTimeout)
+		}
+	}
+}
+
+// process runs the tasks of batch until one panics and returns how many ran,
+// so the recover is paid once per batch instead of once per task
+func (p *ElasticPool[T]) process(batch []T) (done int) {
+	defer func() {
+		if r := recover(); r != nil {
+			log.Printf("Worker recovered from panic: %v", r)
+			// skip the task that panicked
+			done++
+		}
+	}()
+	for _, data := range batch {
+		p.processor(data)
+		done++
+	}
+	return done
+}
+
+// processLocal runs one task of a shard producer
+func (p *ElasticPool[T]) processLocal(data T) {
+	defer func() {
+		if r := recover(); r != nil {
+			log.Printf("Worker recovered from panic: %v", r)
+		}
+	}()
+	p.processor(data)
+}
+
+// retire removes an idle worker unless the pool is at MinWorkers, idle
+// workers timing out together can't take the pool below it
+func (p *ElasticPool[T]) retire() bool {
+	for {
+		current := p.workerCount.Load()
+		if current <= p.config.MinWorkers {
+			return false
+		}
+		if p.workerCount.CompareAndSwap(current, current-1) {
+			return true
 		}
 	}
 }
@@ -148,10 +362,10 @@ func (p *ElasticPool[T]) startMonitor() {
 		case <-p.done:
 			return
 		case <-ticker.C:
-			queueLen = len(p.taskQueue)
+			queueLen = p.taskQueue.Len()
 			if queueLen > p.config.QueueSize/2 {
 				currentWorkers = p.workerCount.Load()
-				if currentWorkers < p.config.MaxWorkers {
+				if currentWorkers < p.config.MaxWorkers && p.workerCount.CompareAndSwap(currentWorkers, currentWorkers+1) {
 					go p.startWorker()
 				}
 			}
@@ -159,8 +373,21 @@ func (p *ElasticPool[T]) startMonitor() {
 	}
 }
 
+func (p *ElasticPool[T]) Stats() PoolStats {
+	return PoolStats{
+		Policy:        p.config.Overload,
+		Enqueued:      p.enqueued.Load(),
+		Dropped:       p.dropped.Load(),
+		Sampled:       p.sampled.Load(),
+		QueueDepth:    p.taskQueue.Len(),
+		QueueCapacity: p.taskQueue.Cap(),
+		HighWater:     p.highWater.Load(),
+		Workers:       p.workerCount.Load(),
+	}
+}
+
+// Close stops the workers, tasks still queued are dropped and later submits return at once
 func (p *ElasticPool[T]) Close() error {
 	close(p.done)
-	close(p.taskQueue)
 	return nil
 }
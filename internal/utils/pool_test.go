@@ -6,6 +6,7 @@ import (
 	"math"
 	"math/rand"
 	"runtime"
+	"sort"
 	"sync"
 	"sync/atomic"
 	"testing"
@@ -226,8 +227,8 @@ func TestElasticPool_ConfigValidation(t *testing.T) {
 		t.Run(tt.name, func(t *testing.T) {
 			pool := NewElasticPool[int](tt.config)
 
-			if tt.config.QueueSize == 0 && cap(pool.taskQueue) != 1024 {
-				t.Errorf("Expected default queue size 1024, got %d", cap(pool.taskQueue))
+			if tt.config.QueueSize == 0 && pool.taskQueue.Cap() != 1024 {
+				t.Errorf("Expected default queue size 1024, got %d", pool.taskQueue.Cap())
 			}
 
 			if tt.config.MinWorkers == 0 && pool.config.MinWorkers != 1 {
@@ -744,7 +745,7 @@ func BenchmarkComplexCalculations(b *testing.B) {
 			case <-deadline:
 				b.Fatal("Timeout waiting for tasks to complete")
 			case <-ticker.C:
-				if len(pool.taskQueue) == 0 {
+				if pool.taskQueue.Len() == 0 {
 					duration := time.Since(start)
 					memAfter := getMemStats()
 					results["ElasticPool"] = struct {
@@ -779,3 +780,238 @@ func BenchmarkComplexCalculations(b *testing.B) {
 		)
 	}
 }
+
+func TestElasticPool_OverloadPolicy(t *testing.T) {
+	tests := []struct {
+		policy OverloadPolicy
+		// tasks expected to be processed out of 100 with room for 16
+		minProcessed, maxProcessed int
+		// the drop-oldest pool keeps the newest tasks
+		wantLast bool
+	}{
+		{OverloadDropNewest, 16, 17, false},
+		{OverloadDropOldest, 16, 17, true},
+		{OverloadSample, 9, 16, false},
+	}
+	for _, tt := range tests {
+		t.Run(string(tt.policy), func(t *testing.T) {
+			pool := NewElasticPool[int](PoolConfig{
+				QueueSize:  16,
+				MinWorkers: 1,
+				MaxWorkers: 1,
+				BatchSize:  1,
+				Overload:   tt.policy,
+			})
+			release := make(chan struct{})
+			var mu sync.Mutex
+			var processed []int
+			pool.SetProcessor(func(task int) {
+				<-release
+				mu.Lock()
+				processed = append(processed, task)
+				mu.Unlock()
+			})
+			var dropped atomic.Int32
+			pool.SetDropHandler(func(int) { dropped.Add(1) })
+
+			// no worker runs yet, so the queue fills up and stays full
+			for i := 0; i < 100; i++ {
+				pool.submit(i)
+			}
+			stats := pool.Stats()
+			if stats.Enqueued+stats.Dropped < 100 || stats.Dropped != uint64(dropped.Load()) {
+				t.Errorf("Unexpected counters %+v, drop handler saw %d", stats, dropped.Load())
+			}
+			if stats.HighWater != uint64(stats.QueueDepth) || stats.QueueDepth > 16 {
+				t.Errorf("Unexpected queue depth %+v", stats)
+			}
+			if tt.policy == OverloadSample && stats.Sampled == 0 {
+				t.Errorf("Sample policy sampled nothing: %+v", stats)
+			}
+
+			pool.SetProducer(func(func(int)) {})
+			if err := pool.Start(); err != nil {
+				t.Fatalf("Failed to start pool: %v", err)
+			}
+			close(release)
+			deadline := time.After(2 * time.Second)
+			for pool.taskQueue.Len() > 0 {
+				select {
+				case <-deadline:
+					t.Fatal("Timeout waiting for the queue to drain")
+				default:
+					time.Sleep(10 * time.Millisecond)
+				}
+			}
+			time.Sleep(20 * time.Millisecond)
+			pool.Close()
+
+			mu.Lock()
+			defer mu.Unlock()
+			if len(processed) < tt.minProcessed || len(processed) > tt.maxProcessed {
+				t.Errorf("Expected %d to %d processed tasks, got %d", tt.minProcessed, tt.maxProcessed, len(processed))
+			}
+			if last := processed[len(processed)-1]; tt.wantLast != (last == 99) {
+				t.Errorf("Last processed task is %d", last)
+			}
+		})
+	}
+}
+
+func TestElasticPool_ShardProducer(t *testing.T) {
+	pool := NewElasticPool[int](PoolConfig{MinWorkers: 2})
+	var processed, panics atomic.Int32
+	pool.SetProcessor(func(task int) {
+		if task < 0 {
+			panics.Add(1)
+			panic("simulated panic")
+		}
+		processed.Add(1)
+	})
+	var wg sync.WaitGroup
+	wg.Add(4)
+	pool.SetShardProducer(4, func(shard int, process func(int)) {
+		defer wg.Done()
+		process(-1)
+		for i := 0; i < 100; i++ {
+			process(shard*100 + i)
+		}
+	})
+	if err := pool.Start(); err != nil {
+		t.Fatalf("Failed to start pool: %v", err)
+	}
+	wg.Wait()
+	if processed.Load() != 400 || panics.Load() != 4 {
+		t.Errorf("Expected 400 tasks and 4 panics, got %d and %d", processed.Load(), panics.Load())
+	}
+	if pool.workerCount.Load() != 0 {
+		t.Errorf("Expected no queue workers with a shard producer, got %d", pool.workerCount.Load())
+	}
+	pool.Close()
+}
+
+// channelPool is the previous channel based worker loop, kept as the
+// baseline of BenchmarkPoolLatency
+type channelPool[T any] struct {
+	queue chan T
+	done  chan struct{}
+	wg    sync.WaitGroup
+}
+
+func newChannelPool[T any](queueSize, workers int, processor func(T)) *channelPool[T] {
+	p := &channelPool[T]{queue: make(chan T, queueSize), done: make(chan struct{})}
+	for i := 0; i < workers; i++ {
+		p.wg.Add(1)
+		go func() {
+			defer p.wg.Done()
+			idleTimeout := time.NewTimer(time.Second)
+			defer idleTimeout.Stop()
+			for {
+				select {
+				case <-p.done:
+					return
+				case data := <-p.queue:
+					if !idleTimeout.Stop() {
+						select {
+						case <-idleTimeout.C:
+						default:
+						}
+					}
+					idleTimeout.Reset(time.Second)
+					func() {
+						defer func() {
+							recover()
+						}()
+						processor(data)
+					}()
+				case <-idleTimeout.C:
+					idleTimeout.Reset(time.Second)
+				}
+			}
+		}()
+	}
+	return p
+}
+
+func (p *channelPool[T]) submit(data T) {
+	select {
+	case <-p.done:
+	case p.queue <- data:
+	}
+}
+
+func (p *channelPool[T]) close() {
+	close(p.done)
+	p.wg.Wait()
+}
+
+// BenchmarkPoolLatency compares the throughput and the p99 queueing
+// latency, from submit to the start of processing, of the ring based pool
+// against the channel baseline
+func BenchmarkPoolLatency(b *testing.B) {
+	workers := runtime.NumCPU()
+	// run submits b.N timestamps from producers goroutines and waits until all were processed
+	run := func(b *testing.B, producers int, submit func(int64), processed *sync.WaitGroup) {
+		b.ResetTimer()
+		start := time.Now()
+		var wg sync.WaitGroup
+		for i := 0; i < producers; i++ {
+			n := b.N / producers
+			if i == 0 {
+				n += b.N % producers
+			}
+			wg.Add(1)
+			go func() {
+				defer wg.Done()
+				for j := 0; j < n; j++ {
+					submit(time.Now().UnixNano())
+				}
+			}()
+		}
+		wg.Wait()
+		processed.Wait()
+		b.StopTimer()
+		b.ReportMetric(float64(b.N)/time.Since(start).Seconds(), "tasks/sec")
+	}
+	// record returns a processor storing the latency of every task
+	record := func(b *testing.B, processed *sync.WaitGroup) (func(int64), func()) {
+		latencies := make([]int64, b.N)
+		var next atomic.Int64
+		processed.Add(b.N)
+		return func(submitted int64) {
+				latencies[next.Add(1)-1] = time.Now().UnixNano() - submitted
+				processed.Done()
+			}, func() {
+				sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+				b.ReportMetric(float64(latencies[len(latencies)*99/100]), "p99-ns")
+			}
+	}
+
+	for _, producers := range []int{1, 4} {
+		b.Run(fmt.Sprintf("Channel_%dProducers", producers), func(b *testing.B) {
+			var processed sync.WaitGroup
+			processor, report := record(b, &processed)
+			pool := newChannelPool(1024, workers, processor)
+			run(b, producers, pool.submit, &processed)
+			pool.close()
+			report()
+		})
+
+		b.Run(fmt.Sprintf("Ring_%dProducers", producers), func(b *testing.B) {
+			var processed sync.WaitGroup
+			processor, report := record(b, &processed)
+			pool := NewElasticPool[int64](PoolConfig{QueueSize: 1024, MinWorkers: int32(workers), MaxWorkers: int32(workers)})
+			pool.SetProcessor(processor)
+			ready := make(chan func(int64))
+			pool.SetProducer(func(submit func(int64)) {
+				ready <- submit
+			})
+			if err := pool.Start(); err != nil {
+				b.Fatalf("Failed to start pool: %v", err)
+			}
+			run(b, producers, <-ready, &processed)
+			pool.Close()
+			report()
+		})
+	}
+}
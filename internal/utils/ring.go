@@ -0,0 +1,105 @@
+package utils
+
+import "sync/atomic"
+
+const cacheLineSize = 64
+
+type ringSlot[T any] struct {
+	// the position the slot is ready for: pos when free for the producer
+	// of pos, pos+1 once it holds the value of pos
+	seq atomic.Uint64
+	val T
+}
+
+// Ring is a bounded lock-free multi-producer multi-consumer queue after
+// Dmitry Vyukov's design. Consumers take runs of values in one CAS.
+type Ring[T any] struct {
+	_     [cacheLineSize]byte
+	tail  atomic.Uint64
+	_     [cacheLineSize - 8]byte
+	head  atomic.Uint64
+	_     [cacheLineSize - 8]byte
+	slots []ringSlot[T]
+	mask  uint64
+}
+
+// NewRing creates a ring holding at least size values, the capacity is
+// rounded up to a power of two
+func NewRing[T any](size int) *Ring[T] {
+	capacity := 1
+	for capacity < size {
+		capacity <<= 1
+	}
+	r := &Ring[T]{slots: make([]ringSlot[T], capacity), mask: uint64(capacity - 1)}
+	for i := range r.slots {
+		r.slots[i].seq.Store(uint64(i))
+	}
+	return r
+}
+
+// Push appends v, it returns false if the ring is full
+func (r *Ring[T]) Push(v T) bool {
+	pos := r.tail.Load()
+	for {
+		slot := &r.slots[pos&r.mask]
+		seq := slot.seq.Load()
+		switch {
+		case seq == pos:
+			if r.tail.CompareAndSwap(pos, pos+1) {
+				slot.val = v
+				slot.seq.Store(pos + 1)
+				return true
+			}
+			pos = r.tail.Load()
+		case seq < pos:
+			// the slot still holds the value of the previous lap
+			return false
+		default:
+			pos = r.tail.Load()
+		}
+	}
+}
+
+// PopBatch moves up to len(buf) values into buf and returns their number
+func (r *Ring[T]) PopBatch(buf []T) int {
+	var zero T
+	for {
+		pos := r.head.Load()
+		n := 0
+		for n < len(buf) && r.slots[(pos+uint64(n))&r.mask].seq.Load() == pos+uint64(n)+1 {
+			n++
+		}
+		if n == 0 {
+			if r.slots[pos&r.mask].seq.Load() < pos+1 && r.head.Load() == pos {
+				return 0
+			}
+			continue
+		}
+		// the run is ours once head moves past it, producers can't reuse its slots before
+		if !r.head.CompareAndSwap(pos, pos+uint64(n)) {
+			continue
+		}
+		for i := 0; i < n; i++ {
+			slot := &r.slots[(pos+uint64(i))&r.mask]
+			buf[i] = slot.val
+			slot.val = zero
+			slot.seq.Store(pos + uint64(i) + r.mask + 1)
+		}
+		return n
+	}
+}
+
+// Len returns the number of queued values, it is only a snapshot under concurrent use
+func (r *Ring[T]) Len() int {
+	head := r.head.Load()
+	tail := r.tail.Load()
+	if tail < head {
+		return 0
+	}
+	return int(tail - head)
+}
+
+// Cap returns the number of values the ring holds when full
+func (r *Ring[T]) Cap() int {
+	return len(r.slots)
+}
@@ -0,0 +1,93 @@
+package utils
+
+import (
+	"runtime"
+	"sync"
+	"testing"
+)
+
+func TestRing_PushPop(t *testing.T) {
+	r := NewRing[int](5)
+	if r.Cap() != 8 {
+		t.Fatalf("Expected capacity 8, got %d", r.Cap())
+	}
+	for i := 0; i < 8; i++ {
+		if !r.Push(i) {
+			t.Fatalf("Push %d failed on a ring that is not full", i)
+		}
+	}
+	if r.Push(8) {
+		t.Fatal("Push succeeded on a full ring")
+	}
+	buf := make([]int, 3)
+	// wrap around a few laps
+	for want := 0; want < 64; {
+		n := r.PopBatch(buf)
+		if n == 0 {
+			t.Fatalf("PopBatch returned nothing, want %d", want)
+		}
+		for _, v := range buf[:n] {
+			if v != want {
+				t.Fatalf("Expected %d, got %d", want, v)
+			}
+			want++
+			if want+7 < 64 && !r.Push(want+7) {
+				t.Fatalf("Push %d failed after a pop", want+7)
+			}
+		}
+	}
+	if n := r.PopBatch(buf); n != 0 || r.Len() != 0 {
+		t.Errorf("Expected an empty ring, popped %d with length %d", n, r.Len())
+	}
+}
+
+func TestRing_Concurrent(t *testing.T) {
+	const producers, consumers, perProducer = 4, 4, 5000
+	r := NewRing[int](64)
+	seen := make([]int32, producers*perProducer)
+	var wg sync.WaitGroup
+	for p := 0; p < producers; p++ {
+		wg.Add(1)
+		go func(p int) {
+			defer wg.Done()
+			for i := 0; i < perProducer; i++ {
+				for !r.Push(p*perProducer + i) {
+					runtime.Gosched()
+				}
+			}
+		}(p)
+	}
+	var mu sync.Mutex
+	total := 0
+	var cwg sync.WaitGroup
+	for c := 0; c < consumers; c++ {
+		cwg.Add(1)
+		go func() {
+			defer cwg.Done()
+			buf := make([]int, 16)
+			for {
+				n := r.PopBatch(buf)
+				if n == 0 {
+					runtime.Gosched()
+				}
+				mu.Lock()
+				for _, v := range buf[:n] {
+					seen[v]++
+				}
+				total += n
+				finished := total == len(seen)
+				mu.Unlock()
+				if finished {
+					return
+				}
+			}
+		}()
+	}
+	wg.Wait()
+	cwg.Wait()
+	for v, count := range seen {
+		if count != 1 {
+			t.Fatalf("Value %d popped %d times", v, count)
+		}
+	}
+}
@@ -0,0 +1,119 @@
+package utils
+
+import (
+	"encoding/binary"
+	"fmt"
+	"math"
+	"net/netip"
+	"strconv"
+	"strings"
+)
+
+// protocols accepted by name in tuple rules
+var tupleProtocols = map[string]uint8{
+	"icmp":   1,
+	"tcp":    6,
+	"udp":    17,
+	"icmpv6": 58,
+	"sctp":   132,
+}
+
+// TupleRule matches packets by source prefix, IP protocol and destination
+// port range. It is written as "<src> <proto>[:<port>[-<port>]] [deny|allow]",
+// e.g. "10.0.0.0/8 tcp:22" or "::/0 udp:53 allow". The action defaults to deny.
+type TupleRule struct {
+	Prefix  netip.Prefix
+	Proto   uint8
+	PortMin uint16
+	PortMax uint16
+	Allow   bool
+}
+
+// HasPorts reports whether the kernel reads destination ports of proto, other
+// protocols are always matched with port 0
+func HasPorts(proto uint8) bool {
+	return proto == tupleProtocols["tcp"] || proto == tupleProtocols["udp"]
+}
+
+// IsTupleRule reports whether value is written in the tuple rule syntax
+func IsTupleRule(value string) bool {
+	return strings.ContainsAny(strings.TrimSpace(value), " \t")
+}
+
+func ParseTupleRule(value string) (TupleRule, error) {
+	var rule TupleRule
+	fields := strings.Fields(value)
+	if len(fields) < 2 || len(fields) > 3 {
+		return rule, fmt.Errorf("invalid tuple rule: %s", value)
+	}
+	if strings.Contains(fields[0], "/") {
+		prefix, err := netip.ParsePrefix(fields[0])
+		if err != nil {
+			return rule, fmt.Errorf("invalid tuple rule source: %s", fields[0])
+		}
+		rule.Prefix = prefix.Masked()
+	} else {
+		addr, err := netip.ParseAddr(fields[0])
+		if err != nil {
+			return rule, fmt.Errorf("invalid tuple rule source: %s", fields[0])
+		}
+		rule.Prefix = netip.PrefixFrom(addr, addr.BitLen())
+	}
+	if rule.Prefix.Addr().Is4In6() {
+		return rule, fmt.Errorf("invalid tuple rule source: %s", fields[0])
+	}
+
+	proto, ports, hasPorts := strings.Cut(strings.ToLower(fields[1]), ":")
+	if n, ok := tupleProtocols[proto]; ok {
+		rule.Proto = n
+	} else if n, err := strconv.ParseUint(proto, 10, 8); err == nil && n > 0 {
+		rule.Proto = uint8(n)
+	} else {
+		return rule, fmt.Errorf("invalid tuple rule protocol: %s", proto)
+	}
+	rule.PortMin, rule.PortMax = 0, math.MaxUint16
+	if hasPorts {
+		if !HasPorts(rule.Proto) {
+			return rule, fmt.Errorf("protocol %s has no ports: %s", proto, value)
+		}
+		low, high, isRange := strings.Cut(ports, "-")
+		if !isRange {
+			high = low
+		}
+		min, err1 := strconv.ParseUint(low, 10, 16)
+		max, err2 := strconv.ParseUint(high, 10, 16)
+		if err1 != nil || err2 != nil || min > max {
+			return rule, fmt.Errorf("invalid tuple rule ports: %s", ports)
+		}
+		rule.PortMin, rule.PortMax = uint16(min), uint16(max)
+	}
+
+	if len(fields) == 3 {
+		switch strings.ToLower(fields[2]) {
+		case "deny":
+		case "allow":
+			rule.Allow = true
+		default:
+			return rule, fmt.Errorf("invalid tuple rule action: %s", fields[2])
+		}
+	}
+	return rule, nil
+}
+
+// Bytes encodes the rule canonically, two spellings of one rule encode the same
+func (r TupleRule) Bytes() []byte {
+	addr := r.Prefix.Addr().As16()
+	out := make([]byte, 0, 25)
+	out = append(out, byte(r.Prefix.Bits()), r.Proto)
+	out = binary.BigEndian.AppendUint16(out, r.PortMin)
+	out = binary.BigEndian.AppendUint16(out, r.PortMax)
+	if r.Allow {
+		out = append(out, 1)
+	} else {
+		out = append(out, 0)
+	}
+	if r.Prefix.Addr().Is4() {
+		return append(out, addr[12:]...)
+	}
+	return append(out, addr[:]...)
+}
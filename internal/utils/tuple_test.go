@@ -0,0 +1,62 @@
+package utils
+
+import (
+	"bytes"
+	"net/netip"
+	"testing"
+)
+
+func TestParseTupleRule(t *testing.T) {
+	tests := []struct {
+		input   string
+		want    TupleRule
+		wantErr bool
+	}{
+		{input: "10.0.0.0/8 tcp:22", want: TupleRule{Prefix: netip.MustParsePrefix("10.0.0.0/8"), Proto: 6, PortMin: 22, PortMax: 22}},
+		{input: "10.1.2.3/8 TCP:1000-2000 deny", want: TupleRule{Prefix: netip.MustParsePrefix("10.0.0.0/8"), Proto: 6, PortMin: 1000, PortMax: 2000}},
+		{input: "192.168.1.1 udp allow", want: TupleRule{Prefix: netip.MustParsePrefix("192.168.1.1/32"), Proto: 17, PortMax: 65535, Allow: true}},
+		{input: "::/0 udp:53 allow", want: TupleRule{Prefix: netip.MustParsePrefix("::/0"), Proto: 17, PortMin: 53, PortMax: 53, Allow: true}},
+		{input: "2001:db8::1 icmpv6", want: TupleRule{Prefix: netip.MustParsePrefix("2001:db8::1/128"), Proto: 58, PortMax: 65535}},
+		{input: "0.0.0.0/0 47", want: TupleRule{Prefix: netip.MustParsePrefix("0.0.0.0/0"), Proto: 47, PortMax: 65535}},
+		{input: "10.0.0.0/8", wantErr: true},
+		{input: "10.0.0.0/33 tcp", wantErr: true},
+		{input: "::ffff:10.0.0.1 tcp", wantErr: true},
+		{input: "10.0.0.0/8 foo", wantErr: true},
+		{input: "10.0.0.0/8 0", wantErr: true},
+		{input: "10.0.0.0/8 icmp:8", wantErr: true},
+		{input: "10.0.0.0/8 tcp:2000-1000", wantErr: true},
+		{input: "10.0.0.0/8 tcp:65536", wantErr: true},
+		{input: "10.0.0.0/8 tcp:22 drop", wantErr: true},
+		{input: "10.0.0.0/8 tcp:22 deny extra", wantErr: true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.input, func(t *testing.T) {
+			got, err := ParseTupleRule(tt.input)
+			if (err != nil) != tt.wantErr {
+				t.Fatalf("ParseTupleRule() error = %v, wantErr %v", err, tt.wantErr)
+			}
+			if !tt.wantErr && got != tt.want {
+				t.Errorf("ParseTupleRule() = %+v, want %+v", got, tt.want)
+			}
+		})
+	}
+}
+
+func TestParseValueToBytes_Tuple(t *testing.T) {
+	a, iptype, err := ParseValueToBytes("10.0.0.0/8 tcp:22")
+	if err != nil || iptype != IPTypeTuple {
+		t.Fatalf("ParseValueToBytes() = %v, %v", iptype, err)
+	}
+	// the same rule spelled differently has the same key
+	b, _, _ := ParseValueToBytes("10.1.0.0/8  tcp:22-22 deny")
+	if !bytes.Equal(a, b) {
+		t.Errorf("keys differ: %x != %x", a, b)
+	}
+	c, _, _ := ParseValueToBytes("10.0.0.0/8 tcp:22 allow")
+	if bytes.Equal(a, c) {
+		t.Errorf("allow and deny rules share key %x", a)
+	}
+	if got := ParseStringToIPType("10.0.0.0/8 tcp:22"); got != IPTypeTuple {
+		t.Errorf("ParseStringToIPType() = %v, want %v", got, IPTypeTuple)
+	}
+}
@@ -12,6 +12,7 @@ import (
 	"math/rand"
 	"net"
 	"net/http"
+	"net/netip"
 	"os"
 	"strings"
 	"time"
@@ -39,7 +40,8 @@ var (
 		"240.0.0.0/4",
 		"255.255.255.255/32",
 	}
-	localIPNets []*net.IPNet
+	localIPNets     []*net.IPNet
+	localIPPrefixes []netip.Prefix
 )
 
 func init() {
@@ -49,6 +51,7 @@ func init() {
 			continue
 		}
 		localIPNets = append(localIPNets, ipNet)
+		localIPPrefixes = append(localIPPrefixes, netip.MustParsePrefix(ip))
 	}
 }
 
@@ -63,6 +66,17 @@ func IsLocalIP(ip string) bool {
 	return false
 }
 
+// IsLocalAddr is the allocation free variant of IsLocalIP for binary addresses
+func IsLocalAddr(addr netip.Addr) bool {
+	addr = addr.Unmap()
+	for _, prefix := range localIPPrefixes {
+		if prefix.Contains(addr) {
+			return true
+		}
+	}
+	return false
+}
+
 func GetDefaultInterface() string {
 	interfaces, err := net.Interfaces()
 	if err != nil {
@@ -125,10 +139,18 @@ const (
 	IPTypeIPv6     IPType = 3
 	IPTypeIPv6CIDR IPType = 4
 	IPTypeMAC      IPType = 5
+	// source prefix, protocol and destination ports, see TupleRule
+	IPTypeTuple IPType = 6
 )
 
 func ParseStringToIPType(value string) IPType {
 	value = strings.TrimSpace(value)
+	if IsTupleRule(value) {
+		if _, err := ParseTupleRule(value); err != nil {
+			return IPTypeUnknown
+		}
+		return IPTypeTuple
+	}
 	_, ipNet, err := net.ParseCIDR(value)
 	if err != nil {
 		ip := net.ParseIP(value)
@@ -155,6 +177,13 @@ func ParseStringToIPType(value string) IPType {
 
 func ParseValueToBytes(value string) ([]byte, IPType, error) {
 	value = strings.TrimSpace(value)
+	if IsTupleRule(value) {
+		rule, err := ParseTupleRule(value)
+		if err != nil {
+			return nil, IPTypeUnknown, err
+		}
+		return rule.Bytes(), IPTypeTuple, nil
+	}
 	// try to parse as CIDR
 	_, ipNet, err := net.ParseCIDR(value)
 	if err != nil {
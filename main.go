@@ -34,7 +34,9 @@ func main() {
 		QueueSize:  1024,
 		MinWorkers: 3,
 		MaxWorkers: int32(runtime.NumCPU() * 2),
+		Overload:   utils.OverloadPolicy(config.EBPF.OverloadPolicy),
 	})
+	pool.SetDropHandler(types.ReleasePacketInfo)
 
 	collector := metrics.NewMetricsCollector()
 	ebpfManager := ebpf.NewEBPFManager(pool)
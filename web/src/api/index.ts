@@ -1,5 +1,5 @@
 import request from './request'
-import type { MetricsReport, TargetPage, LinkType, SourcePage } from '../types'
+import type { MetricsReport, TargetPage, LinkType, SourcePage, SeriesResolution, TimeSeries } from '../types'
 
 type ResponseData<T> = Promise<T>
 
@@ -8,6 +8,9 @@ export const getLinkType = () => request.get<any, ResponseData<LinkType>>('/link
 
 export const getMetricsReport = (top: number = 10) => request.get<any, ResponseData<MetricsReport>>('/metrics', { params: { top } })
 
+export const getTimeSeries = (resolution: SeriesResolution = 'second', limit: number = 0) =>
+	request.get<any, ResponseData<TimeSeries>>('/metrics/timeseries', { params: { resolution, limit } })
+
 export const getSources = (page: number = 1, pageSize: number = 20, order: string = 'last_seen_at', sortDir: string = 'desc') =>
 	request.get<any, ResponseData<SourcePage>>('/sources', { params: { page, page_size: pageSize, order, sort_dir: sortDir } })
 
@@ -1,12 +1,39 @@
 import { useState, useEffect, useRef } from 'react'
 import { date_format } from '../utils'
-import { MetricsReport, DimensionKey, Statistics, IncrementMetrics, DeltaMetrics } from '../types'
+import { MetricsReport, DimensionKey, Statistics, IncrementMetrics, DeltaMetrics, TimeSeries } from '../types'
 import * as api from '../api'
 
+// 图表展示的时间点数量
+const HISTORY_POINTS = 30
+
+// 将服务端时间序列按刷新间隔合并为图表数据，缺失的时间段补 0
+function bucketSeries(series: TimeSeries, bucketSeconds: number, now: number): IncrementMetrics[] {
+	const end = Math.floor(now / 1000 / bucketSeconds) * bucketSeconds
+	const buckets = Array.from({ length: HISTORY_POINTS }, (_, i) => ({
+		start: end - (HISTORY_POINTS - 1 - i) * bucketSeconds,
+		packets: 0,
+		bytes: 0
+	}))
+	for (const point of series.points) {
+		const index = HISTORY_POINTS - 1 - (end / bucketSeconds - Math.floor(point.timestamp / bucketSeconds))
+		if (index >= 0 && index < HISTORY_POINTS) {
+			buckets[index].packets += point.packets
+			buckets[index].bytes += point.bytes
+		}
+	}
+	return buckets.map(x => ({
+		time: date_format(x.start * 1000, 'hh:mm:ss'),
+		packets: x.packets,
+		bytes: x.bytes
+	}))
+}
+
 function useMetrics(pollInterval: number) {
 	const [metricsReport, setMetricsReport] = useState<MetricsReport>({
 		total_packets: 0,
 		total_bytes: 0,
+		distinct_sources: 0,
+		evicted_sources: 0,
 		day: [],
 		dimension: {} as Record<DimensionKey, Statistics[]>
 	})
@@ -51,25 +78,6 @@ function useMetrics(pollInterval: number) {
 				bytes: today.total_bytes
 			})
 		}
-		setTrafficDeltas(prev => {
-			const newHistory = [
-				...prev,
-				{
-					time: date_format(now, 'hh:mm:ss'),
-					packets: deltaPackets,
-					bytes: deltaBytes
-				}
-			]
-			while (newHistory.length < 30) {
-				newHistory.unshift({
-					time: date_format(now.getTime() - (30 - newHistory.length) * 5000, 'hh:mm:ss'),
-					packets: 0,
-					bytes: 0
-				})
-			}
-			return newHistory.slice(-30)
-		})
-
 		report.day = Array.from({ length: 30 }, (_, i) => {
 			const date = new Date(now)
 			date.setDate(now.getDate() - i)
@@ -88,11 +96,17 @@ function useMetrics(pollInterval: number) {
 		}
 		const fetchData = async () => {
 			try {
-				const report = await api.getMetricsReport()
+				// 秒级历史保留 5 分钟，更长的刷新间隔使用分钟级历史
+				const span = HISTORY_POINTS * pollInterval
+				const resolution = span <= 300 ? 'second' : 'minute'
+				const [report, series] = await Promise.all([
+					api.getMetricsReport(),
+					api.getTimeSeries(resolution, resolution === 'second' ? span : Math.ceil(span / 60) + 1)
+				])
 				const now = new Date()
 				const time = date_format(now, 'yyyyMMdd')
-				const day = report.day.find(x => x.key === time)
 				calculateTrafficDelta(report, time)
+				setTrafficDeltas(bucketSeries(series, resolution === 'second' ? pollInterval : Math.max(60, pollInterval), now.getTime()))
 
 				setMetricsReport(report)
 			} catch (error) {
@@ -61,6 +61,10 @@ export enum DimensionKey {
 export interface MetricsReport {
 	total_packets: number
 	total_bytes: number
+	// 近似的不同来源数量
+	distinct_sources: number
+	// 有界模式下被淘汰的来源数量
+	evicted_sources: number
 	day: Statistics[]
 	dimension: Record<DimensionKey, Statistics[]>
 }
@@ -83,3 +87,27 @@ export interface DeltaMetrics {
 export interface IncrementMetrics extends DeltaMetrics {
 	time: string
 }
+
+export type SeriesResolution = 'second' | 'minute'
+
+// 时间序列中一个时间间隔的流量
+export interface SeriesPoint {
+	timestamp: number
+	packets: number
+	bytes: number
+	dropped: number
+	// 按匹配类型统计的数据包数量，下标为匹配类型，共 9 项（0 未匹配 至 8 国家/自治系统）
+	matches: number[]
+	protocols: {
+		tcp: number
+		udp: number
+		icmp: number
+		other: number
+	}
+}
+
+export interface TimeSeries {
+	resolution: SeriesResolution
+	step: number
+	points: SeriesPoint[]
+}